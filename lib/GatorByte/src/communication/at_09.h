@@ -169,7 +169,7 @@ GB_AT_09& GB_AT_09::_initialize() {
         }
 
         if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("-..").wait(250).play("-..");
-        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(2).wait(250).revert(); 
+        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->flash(2, 250); 
 
         _gb->arrow().log("Name: " + name, false);
         _gb->log(", PIN: " + pin);
@@ -180,7 +180,7 @@ GB_AT_09& GB_AT_09::_initialize() {
         _gb->globals.INIT_REPORT += this->device.id;
 
         if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("-..").wait(250).play("-..").wait(250).play("---");
-        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(2).wait(250).revert(); 
+        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->flash(2, 250); 
     }
 
     this->off("comm");
@@ -277,6 +277,7 @@ GB_AT_09& GB_AT_09::on(String type) {
 GB_AT_09& GB_AT_09::on() {
     this->on("comm");
     this->on("power");
+    GB_ENERGY::meter().on(GB_ENERGY::BL);
     return *this;
 }
 
@@ -300,6 +301,7 @@ GB_AT_09& GB_AT_09::off(String type) {
 GB_AT_09& GB_AT_09::off() {
     this->off("comm");
     this->off("power");
+    GB_ENERGY::meter().off(GB_ENERGY::BL);
     return *this;
 }
 
@@ -27,6 +27,24 @@
     #include "Stream.h"
 #endif
 
+// Maximum number of QoS1 messages that can be awaiting a PUBACK
+#ifndef MQTT_INFLIGHT_MAX
+    #define MQTT_INFLIGHT_MAX 8
+#endif
+
+// Every this many milliseconds of round-trip time opens one more slot in the window
+#ifndef MQTT_WINDOW_RTT_STEP
+    #define MQTT_WINDOW_RTT_STEP 150
+#endif
+
+// Lower bound of the PUBACK timeout and the maximum number of retransmissions of a message
+#ifndef MQTT_ACK_TIMEOUT_MIN
+    #define MQTT_ACK_TIMEOUT_MIN 2000
+#endif
+#ifndef MQTT_MAX_RETRANSMITS
+    #define MQTT_MAX_RETRANSMITS 3
+#endif
+
 class GB_MQTT : public GB_DEVICE {
     public:
         GB_MQTT(GB &gb);
@@ -34,6 +52,7 @@ class GB_MQTT : public GB_DEVICE {
         // Type definitions
         typedef void (*callback_t_on_message)(String, String);
         typedef void (*callback_t_on_connect)();
+        typedef void (*callback_t_on_ack)(String, uint32_t);
 
         DEVICE device = {
             "mqtt",
@@ -49,6 +68,10 @@ class GB_MQTT : public GB_DEVICE {
         int SUBQOS = 1;
         bool ACK_RECEIVED = false;
 
+        // Pipelined publishing; smoothed round-trip time (ms) and the current window size
+        unsigned long RTT = 0;
+        int WINDOW = 1;
+
         GB_MQTT& configure(callback_t_on_message, callback_t_on_connect);
         GB_MQTT& configure(String, int, String, callback_t_on_message, callback_t_on_connect);
         GB_MQTT& connect();
@@ -62,8 +85,20 @@ class GB_MQTT : public GB_DEVICE {
         bool waituntilresponse(String, unsigned long, bool);
         bool publish(String, String, String);
         bool publish(String, String);
+        int room(String topic);
         void subscribe(String);
 
+        GB_MQTT& onack(callback_t_on_ack);
+        GB_MQTT& onabandon(callback_t_on_ack);
+        bool send(String topic, String data, String tag);
+        bool send(String topic, String data, String tag, uint32_t sequence);
+        bool windowavailable();
+        bool waitwindow(unsigned long timeout_ms);
+        bool isinflight(String tag);
+        int inflight();
+        String inflighttags();
+        GB_MQTT& flush(unsigned long timeout_ms);
+
     private:
 
         GB *_gb;
@@ -77,6 +112,28 @@ class GB_MQTT : public GB_DEVICE {
         String _waiting_for_response_topic = "";
         bool _waiting_for_response_flag = false;
         String _ack_id = "";
+
+        // Messages awaiting a PUBACK. The payload is kept so that the message can be retransmitted as-is (with DUP set).
+        struct INFLIGHT {
+            bool active = false;
+            uint16_t id = 0;
+            String topic = "";
+            String payload = "";
+            String tag = "";
+            uint32_t sequence = 0;
+            unsigned long sentat = 0;
+            uint8_t retransmits = 0;
+        } _inflight[MQTT_INFLIGHT_MAX];
+
+        callback_t_on_ack _on_ack_handler = NULL;
+        callback_t_on_ack _on_abandon_handler = NULL;
+        int _window_cap = MQTT_INFLIGHT_MAX;
+
+        String _envelope(String data);
+        String _envelope(String data, uint32_t sequence);
+        void _process_acks();
+        void _retransmit(bool all);
+        void _resize_window();
 };
 
 GB_MQTT::GB_MQTT(GB &gb) {
@@ -306,6 +363,9 @@ GB_MQTT& GB_MQTT::update() {
             CONNECTED_TO_MQTT_BROKER = 1;
             this->_reconnection_attempt_count = 0;
             // _gb->color("green").log("Reconnected.", false);
+
+            //! Messages that were in flight at disconnect are resent with DUP set
+            this->_retransmit(true);
         }
         else {
             CONNECTED_TO_MQTT_BROKER = 0;
@@ -332,12 +392,22 @@ GB_MQTT& GB_MQTT::update() {
     }
     else {
         this->_mqttclient.loop();
+
+        // Retire acknowledged messages and resend the ones that timed out
+        this->_process_acks();
+        this->_retransmit(false);
     }
 
     return *this;
 }
 
 // Publish to a topic
+// Bytes of data a publish() to the topic can carry in PubSubClient's buffer (the topic and the envelope take the rest)
+int GB_MQTT::room(String topic) {
+    int overhead = MQTT_MAX_HEADER_SIZE + 2 + String("gb-server::" + topic).length() + this->_envelope("").length();
+    return max(0, (int) this->_mqttclient.getBufferSize() - overhead);
+}
+
 bool GB_MQTT::publish(String topic, String header, String data) { return this->publish(topic, header + "\n" + data); }
 bool GB_MQTT::publish(String topic, String data) {
 
@@ -378,7 +448,7 @@ bool GB_MQTT::publish(String topic, String data) {
         
         success = this->_mqttclient.publish(
             _gb->s2c("gb-server::" + topic),
-            _gb->s2c(_gb->globals.DEVICE_SN + "::" + "null" + "::" + _gb->uuid() + ":::" + data + ":::" + this->_wait_for_ack)
+            _gb->s2c(this->_envelope(data))
         );
 
         if (!success) {
@@ -469,6 +539,199 @@ GB_MQTT& GB_MQTT::noack() {
     return *this;
 }
 
+/*
+    Build the message envelope sent to the server
+    Sequenced records carry the record's sequence number as the message id; together with the
+    device SN it lets the server discard retransmitted duplicates. Other messages use a random id.
+*/
+String GB_MQTT::_envelope(String data) { return this->_envelope(data, 0); }
+String GB_MQTT::_envelope(String data, uint32_t sequence) {
+    String id = sequence > 0 ? "s" + String(sequence) : _gb->uuid();
+    return _gb->globals.DEVICE_SN + "::" + "null" + "::" + id + ":::" + data + ":::" + this->_wait_for_ack;
+}
+
+/*
+    ! Pipelined QoS1 publishing
+    Instead of publishing a message and waiting for it to go through before sending the next one, up to
+    WINDOW messages are kept in flight. Each message carries a tag (e.g. the queue file name) which is
+    handed to the onack() callback when the broker's PUBACK for that message arrives, so that the
+    caller can retire the corresponding record.
+
+    The window grows with the observed round-trip time (a longer round trip needs more messages in
+    flight to keep the link busy) and is halved when a PUBACK times out. Messages that are still
+    outstanding at disconnect are resent with the DUP flag set once the broker connection is restored.
+    A message still unacknowledged after MQTT_MAX_RETRANSMITS is given up on and handed to the
+    onabandon() callback, so that its record can go back in the queue.
+
+    Usage:
+        mqtt.onack([] (String queuefilename, uint32_t sequence) { sd.removequeuefile(queuefilename); });
+        mqtt.onabandon([] (String queuefilename, uint32_t sequence) { sd.requeuefile(queuefilename); });
+        while (... && mqtt.waitwindow(20000)) mqtt.send("data/set", data, queuefilename, sequence);
+        mqtt.flush(10000);
+*/
+GB_MQTT& GB_MQTT::onack(callback_t_on_ack on_ack_ptr) {
+    this->_on_ack_handler = on_ack_ptr;
+    return *this;
+}
+
+GB_MQTT& GB_MQTT::onabandon(callback_t_on_ack on_abandon_ptr) {
+    this->_on_abandon_handler = on_abandon_ptr;
+    return *this;
+}
+
+// Send a message without waiting for the broker's acknowledgement
+bool GB_MQTT::send(String topic, String data, String tag) { return this->send(topic, data, tag, 0); }
+bool GB_MQTT::send(String topic, String data, String tag, uint32_t sequence) {
+
+    if(!CONNECTED_TO_NETWORK || !CONNECTED_TO_INTERNET || !CONNECTED_TO_MQTT_BROKER) return false;
+    if (!this->windowavailable()) return false;
+
+    // Find a free slot
+    int slot = -1;
+    for (int i = 0; i < MQTT_INFLIGHT_MAX; i++) if (!this->_inflight[i].active) { slot = i; break; }
+    if (slot == -1) return false;
+
+    INFLIGHT &message = this->_inflight[slot];
+    message.id = this->_mqttclient.nextmessageid();
+    message.topic = "gb-server::" + topic;
+    message.payload = this->_envelope(data, sequence);
+    message.tag = tag;
+    message.sequence = sequence;
+    message.retransmits = 0;
+
+    bool success = this->_mqttclient.publish(
+        message.topic.c_str(),
+        (const uint8_t*) message.payload.c_str(), message.payload.length(),
+        false, message.id, false
+    );
+
+    if (!success) {
+        message.payload = "";
+        return false;
+    }
+
+    message.sentat = millis();
+    message.active = true;
+    return true;
+}
+
+// Check if another message can be put in flight
+bool GB_MQTT::windowavailable() {
+    return this->inflight() < this->WINDOW;
+}
+
+// Wait (at most timeout_ms) for a slot in the window; false if none opened or the broker went away
+bool GB_MQTT::waitwindow(unsigned long timeout_ms) {
+    unsigned long start = millis();
+    while (!this->windowavailable()) {
+        if (!CONNECTED_TO_MQTT_BROKER || millis() - start > timeout_ms) return false;
+        this->update();
+        delay(10);
+    }
+    return true;
+}
+
+// Get the number of messages awaiting a PUBACK
+int GB_MQTT::inflight() {
+    int count = 0;
+    for (int i = 0; i < MQTT_INFLIGHT_MAX; i++) if (this->_inflight[i].active) count++;
+    return count;
+}
+
+// Check if a message with the tag is awaiting a PUBACK
+bool GB_MQTT::isinflight(String tag) {
+    for (int i = 0; i < MQTT_INFLIGHT_MAX; i++) if (this->_inflight[i].active && this->_inflight[i].tag == tag) return true;
+    return false;
+}
+
+// Get a comma-separated list of the tags of the messages in flight
+String GB_MQTT::inflighttags() {
+    String tags = "";
+    for (int i = 0; i < MQTT_INFLIGHT_MAX; i++) if (this->_inflight[i].active) tags += this->_inflight[i].tag + ",";
+    return tags;
+}
+
+// Wait for the messages in flight to be acknowledged
+GB_MQTT& GB_MQTT::flush(unsigned long timeout_ms) {
+    unsigned long start = millis();
+    while (this->inflight() > 0 && millis() - start <= timeout_ms) {
+        this->update();
+        delay(10);
+    }
+    return *this;
+}
+
+// Retire the messages whose PUBACKs have been received
+void GB_MQTT::_process_acks() {
+    uint16_t id;
+    while (this->_mqttclient.popack(&id)) {
+        for (int i = 0; i < MQTT_INFLIGHT_MAX; i++) {
+            INFLIGHT &message = this->_inflight[i];
+            if (!message.active || message.id != id) continue;
+
+            // Sample the round-trip time (retransmitted messages are ambiguous and skipped)
+            if (message.retransmits == 0) {
+                unsigned long sample = millis() - message.sentat;
+                this->RTT = this->RTT == 0 ? sample : (7 * this->RTT + sample) / 8;
+            }
+
+            // Recover from an earlier timeout one slot at a time
+            if (this->_window_cap < MQTT_INFLIGHT_MAX) this->_window_cap++;
+            this->_resize_window();
+
+            message.active = false;
+            message.payload = "";
+            if (this->_on_ack_handler) this->_on_ack_handler(message.tag, message.sequence);
+            break;
+        }
+    }
+}
+
+// Resend the messages in flight; all of them (after a reconnection) or only the ones that timed out
+void GB_MQTT::_retransmit(bool all) {
+    unsigned long timeout = max((unsigned long) MQTT_ACK_TIMEOUT_MIN, 4 * this->RTT);
+    bool timedout = false;
+
+    for (int i = 0; i < MQTT_INFLIGHT_MAX; i++) {
+        INFLIGHT &message = this->_inflight[i];
+        if (!message.active) continue;
+        if (!all && millis() - message.sentat < timeout) continue;
+
+        // Give up on the message; its record stays in the queue (the callback may move it to the back)
+        if (message.retransmits >= MQTT_MAX_RETRANSMITS) {
+            _gb->log("No PUBACK for " + message.tag + " after " + String(MQTT_MAX_RETRANSMITS) + " retransmissions; abandoned");
+            message.active = false;
+            message.payload = "";
+            if (this->_on_abandon_handler) this->_on_abandon_handler(message.tag, message.sequence);
+            continue;
+        }
+
+        if (!all) timedout = true;
+
+        bool success = this->_mqttclient.publish(
+            message.topic.c_str(),
+            (const uint8_t*) message.payload.c_str(), message.payload.length(),
+            false, message.id, true
+        );
+        if (success) {
+            message.sentat = millis();
+            message.retransmits++;
+        }
+    }
+
+    // A lost PUBACK is taken as a sign of congestion
+    if (timedout) {
+        this->_window_cap = max(1, this->_window_cap / 2);
+        this->_resize_window();
+    }
+}
+
+// Size the window from the smoothed round-trip time
+void GB_MQTT::_resize_window() {
+    int window = 1 + this->RTT / MQTT_WINDOW_RTT_STEP;
+    this->WINDOW = constrain(min(window, this->_window_cap), 1, MQTT_INFLIGHT_MAX);
+}
+
 void mqtt_response_handler(GB gb, String topic, String payload) { }
 
 #endif
\ No newline at end of file
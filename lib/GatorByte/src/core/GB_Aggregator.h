@@ -0,0 +1,180 @@
+#ifndef GB_AGGREGATOR_h
+#define GB_AGGREGATOR_h
+
+#ifndef GB_h
+    #include "../GB.h"
+#endif
+
+/*
+    ! Windowed aggregation
+    Sits between a sensor read and the CSV/queue writes. Instead of writing every sample, the
+    samples are folded into running statistics (min, max, mean, standard deviation, last, count)
+    over a window and one aggregate record is written per window. The memory used doesn't depend on
+    the number of samples (Welford's algorithm is used for the mean and variance).
+
+    A sample that moves more than the change threshold away from the last raw sample kept is flagged
+    (changed() returns true) so that it can also be written as a raw record; this keeps sudden
+    events (e.g. a surge in water level) at full resolution.
+
+    Usage:
+        wlevagg.configure(60 * 60 * 1000, 0.05);
+        wlevagg.add(eadc.getdepth(0));             // or wlevagg.add(gb.getdevice("ph")) for readsensor()
+        if (wlevagg.changed()) { ...; wlevagg.appendlast(csv); }       // raw record in the same layout
+        if (wlevagg.ready()) { csv.setheader(wlevagg.header("WLEV")); wlevagg.appendto(csv); wlevagg.reset(); }
+*/
+class GB_AGGREGATOR {
+    public:
+        GB_AGGREGATOR(GB &gb);
+
+        DEVICE device = {
+            "aggregator",
+            "GatorByte Aggregator"
+        };
+
+        GB_AGGREGATOR& configure(unsigned long window_ms, float threshold);
+        GB_AGGREGATOR& add(float value);
+        GB_AGGREGATOR& add(GB_DEVICE *device);
+        GB_AGGREGATOR& reset();
+
+        bool ready();
+        bool changed();
+
+        float minimum();
+        float maximum();
+        float mean();
+        float stddev();
+        float last();
+        unsigned long count();
+
+        String header(String prefix);
+        GB_AGGREGATOR& appendto(CSVary &csv);
+        GB_AGGREGATOR& appendlast(CSVary &csv);
+
+    private:
+        GB *_gb;
+        unsigned long _window_ms = 60 * 60 * 1000UL;
+        float _threshold = 0;
+
+        unsigned long _window_start = 0;
+        unsigned long _count = 0;
+        float _min = 0;
+        float _max = 0;
+        float _last = 0;
+        double _mean = 0;
+        double _m2 = 0;
+
+        bool _changed = false;
+        bool _has_reference = false;
+        float _reference = 0;
+};
+
+GB_AGGREGATOR::GB_AGGREGATOR(GB &gb) {
+    _gb = &gb;
+}
+
+/*
+    Set the window length (milliseconds) and the change-detection threshold
+    A threshold of 0 disables the change detection
+*/
+GB_AGGREGATOR& GB_AGGREGATOR::configure(unsigned long window_ms, float threshold) {
+    this->_window_ms = window_ms;
+    this->_threshold = threshold;
+    return *this;
+}
+
+// Fold a sample into the window
+GB_AGGREGATOR& GB_AGGREGATOR::add(float value) {
+    if (this->_count == 0) {
+        this->_window_start = millis();
+        this->_min = value;
+        this->_max = value;
+    }
+
+    this->_count++;
+    this->_last = value;
+    if (value < this->_min) this->_min = value;
+    if (value > this->_max) this->_max = value;
+
+    // Running mean and sum of squared deviations
+    double delta = value - this->_mean;
+    this->_mean += delta / this->_count;
+    this->_m2 += delta * (value - this->_mean);
+
+    // Change detection against the last raw sample kept
+    this->_changed = false;
+    if (this->_threshold > 0) {
+        if (!this->_has_reference || fabs(value - this->_reference) >= this->_threshold) {
+            this->_changed = this->_has_reference;
+            this->_reference = value;
+            this->_has_reference = true;
+        }
+    }
+
+    return *this;
+}
+
+// Fold a reading from a sensor (readsensor()) into the window
+GB_AGGREGATOR& GB_AGGREGATOR::add(GB_DEVICE *device) {
+    return this->add(device->readsensor());
+}
+
+// Start a new window; the change-detection reference is kept across windows
+GB_AGGREGATOR& GB_AGGREGATOR::reset() {
+    this->_count = 0;
+    this->_mean = 0;
+    this->_m2 = 0;
+    this->_changed = false;
+    return *this;
+}
+
+// Check if the window has elapsed
+bool GB_AGGREGATOR::ready() {
+    return this->_count > 0 && millis() - this->_window_start >= this->_window_ms;
+}
+
+// Check if the last sample crossed the change threshold
+bool GB_AGGREGATOR::changed() {
+    return this->_changed;
+}
+
+float GB_AGGREGATOR::minimum() { return this->_min; }
+float GB_AGGREGATOR::maximum() { return this->_max; }
+float GB_AGGREGATOR::mean() { return this->_mean; }
+float GB_AGGREGATOR::last() { return this->_last; }
+unsigned long GB_AGGREGATOR::count() { return this->_count; }
+
+// Sample standard deviation
+float GB_AGGREGATOR::stddev() {
+    return this->_count > 1 ? sqrt(this->_m2 / (this->_count - 1)) : 0;
+}
+
+// CSV header for the aggregate record (e.g. WLEVMIN,WLEVMAX,WLEVMEAN,WLEVSD,WLEVLAST,WLEVN)
+String GB_AGGREGATOR::header(String prefix) {
+    return prefix + "MIN," + prefix + "MAX," + prefix + "MEAN," + prefix + "SD," + prefix + "LAST," + prefix + "N";
+}
+
+// Append the aggregate values to a CSV row
+GB_AGGREGATOR& GB_AGGREGATOR::appendto(CSVary &csv) {
+    csv
+        .set(this->minimum())
+        .set(this->maximum())
+        .set(this->mean())
+        .set(this->stddev())
+        .set(this->last())
+        .set((int) this->count());
+    return *this;
+}
+
+// Append the last sample as a single-sample record (same layout as appendto())
+GB_AGGREGATOR& GB_AGGREGATOR::appendlast(CSVary &csv) {
+    csv
+        .set(this->last())
+        .set(this->last())
+        .set(this->last())
+        .set(0)
+        .set(this->last())
+        .set(1);
+    return *this;
+}
+
+#endif
@@ -513,7 +513,13 @@ void GB_CONSOLE::process(String command) {
                 _gb->getdevice("sd")->sderase();
             }
             else if (command.indexOf(".test") > -1) {
-                _gb->getdevice("sd")->rwtest();
+                _gb->log("SD verification: " + _gb->getdevice("sd")->sdverify());
+            }
+
+            // Storage benchmark in faults mode (sd.bench <records>)
+            else if (command.indexOf(".bench") > -1) {
+                int records = command.substring(command.indexOf(".bench") + 6).toInt();
+                _gb->log("SD benchmark: " + _gb->getdevice("sd")->bench(records > 0 ? records : 100));
             }
         }
 
@@ -0,0 +1,285 @@
+#ifndef GB_CONVERGENCE_h
+#define GB_CONVERGENCE_h
+
+#ifndef GB_h
+    #include "../GB.h"
+#endif
+
+#define CONVERGENCE_WINDOW_LENGTH 16
+#define CONVERGENCE_MIN_READINGS 3
+
+/*
+    ! Reading convergence
+    Shared by the Atlas Scientific drivers to decide when a probe's readings have settled. The last few
+    readings (a sliding window) are kept with their running mean and variance (Welford's algorithm,
+    with removal of the oldest reading) and the least-squares slope (units/second).
+
+    The readings have converged when the window has at least 3 readings, the 95% confidence
+    interval of the mean (half-width, Student's t) is within the interval criterion, and the slope is
+    within the slope criterion. The value returned is the window's mean.
+
+    There is no fixed warm-up delay. While the probe is warming up, its readings drift and fail the
+    slope criterion; they fall out of the window as new readings come in.
+
+    Control variables (control/variables.ini), e.g. for the pH driver (prefix "PH").
+    Missing or non-positive values keep the driver's defaults.
+        PH_CI                   Half-width of the 95% confidence interval
+        PH_SLOPE                Slope (units/second)
+        PH_WINDOW               Number of readings in the window (3 - 16)
+        PH_ATTEMPTS             Readings after which the read gives up
+
+    Usage:
+        ph.convergence.configure(gb.controls, "PH");
+        float value = ph.readsensor();
+        if (!ph.convergence.result().converged) ...
+*/
+class GB_CONVERGENCE {
+    public:
+        GB_CONVERGENCE();
+
+        DEVICE device = {
+            "convergence",
+            "GatorByte Convergence Engine"
+        };
+
+        struct RESULT {
+            float value = -1;
+            int n = 0;
+            float stddev = 0;
+            float slope = 0;
+            float minimum = 0;
+            float maximum = 0;
+            bool converged = false;
+            int attempts = 0;
+            unsigned long elapsed = 0;
+        };
+
+        GB_CONVERGENCE& attach(GB &gb);
+        GB_CONVERGENCE& configure(float interval, float slope, uint8_t window, int attempts);
+        GB_CONVERGENCE& configure(JSONary controls, String prefix);
+        GB_CONVERGENCE& reset();
+        bool add(float value);
+        bool converged();
+        bool done();
+        RESULT result();
+
+        template <typename READER> RESULT read(READER reader);
+        template <typename READER> RESULT read(READER reader, int count);
+
+    private:
+        GB *_gb = NULL;
+
+
+
+        float _interval = 0.025;
+        float _slope = 0.01;
+        uint8_t _window = 10;
+        int _attempts = 40;
+
+        float _values[CONVERGENCE_WINDOW_LENGTH];
+        unsigned long _times[CONVERGENCE_WINDOW_LENGTH];
+        uint8_t _head = 0;
+        uint8_t _count = 0;
+        double _mean = 0;
+        double _m2 = 0;
+
+        RESULT _result;
+        unsigned long _started_at = 0;
+
+        float _stddev();
+        float _halfwidth();
+        float _regression();
+        void _feedback(bool settled);
+};
+
+GB_CONVERGENCE::GB_CONVERGENCE() {}
+
+GB_CONVERGENCE& GB_CONVERGENCE::attach(GB &gb) {
+    _gb = &gb;
+    return *this;
+}
+
+/*
+    Set the criteria
+    interval: half-width of the 95% confidence interval of the mean
+    slope: units/second
+    window: number of readings in the sliding window
+    attempts: readings after which the read gives up
+*/
+GB_CONVERGENCE& GB_CONVERGENCE::configure(float interval, float slope, uint8_t window, int attempts) {
+    this->_interval = interval;
+    this->_slope = slope;
+    this->_window = constrain(window, CONVERGENCE_MIN_READINGS, CONVERGENCE_WINDOW_LENGTH);
+    this->_attempts = attempts;
+    return this->reset();
+}
+
+// Read the criteria from the control variables (<PREFIX>_CI, <PREFIX>_SLOPE, <PREFIX>_WINDOW, <PREFIX>_ATTEMPTS)
+GB_CONVERGENCE& GB_CONVERGENCE::configure(JSONary controls, String prefix) {
+    float interval = controls.getfloat(prefix + "_CI") > 0 ? controls.getfloat(prefix + "_CI") : this->_interval;
+    float slope = controls.getfloat(prefix + "_SLOPE") > 0 ? controls.getfloat(prefix + "_SLOPE") : this->_slope;
+    uint8_t window = controls.getint(prefix + "_WINDOW") > 0 ? controls.getint(prefix + "_WINDOW") : this->_window;
+    int attempts = controls.getint(prefix + "_ATTEMPTS") > 0 ? controls.getint(prefix + "_ATTEMPTS") : this->_attempts;
+    return this->configure(interval, slope, window, attempts);
+}
+
+// Clear the window and the last result
+GB_CONVERGENCE& GB_CONVERGENCE::reset() {
+    this->_head = 0;
+    this->_count = 0;
+    this->_mean = 0;
+    this->_m2 = 0;
+    this->_result = RESULT();
+    this->_started_at = millis();
+    return *this;
+}
+
+/*
+    Add a reading to the window
+    Returns true once the readings have converged
+*/
+bool GB_CONVERGENCE::add(float value) {
+    unsigned long now = millis();
+
+    // Drop the oldest reading once the window is full
+    if (this->_count == this->_window) {
+        float oldest = this->_values[this->_head];
+        double delta = oldest - this->_mean;
+        this->_mean -= delta / (this->_count - 1);
+        this->_m2 -= delta * (oldest - this->_mean);
+        if (this->_m2 < 0) this->_m2 = 0;
+        this->_count--;
+    }
+
+    this->_values[this->_head] = value;
+    this->_times[this->_head] = now;
+    this->_head = (this->_head + 1) % this->_window;
+    this->_count++;
+
+    double delta = value - this->_mean;
+    this->_mean += delta / this->_count;
+    this->_m2 += delta * (value - this->_mean);
+
+    // Result so far
+    RESULT &result = this->_result;
+    if (result.attempts == 0 || value < result.minimum) result.minimum = value;
+    if (result.attempts == 0 || value > result.maximum) result.maximum = value;
+    result.attempts++;
+    result.value = this->_mean;
+    result.n = this->_count;
+    result.stddev = this->_stddev();
+    result.slope = this->_regression();
+    result.elapsed = now - this->_started_at;
+    result.converged = this->_count >= CONVERGENCE_MIN_READINGS && this->_halfwidth() <= this->_interval && fabs(result.slope) <= this->_slope;
+
+    return result.converged;
+}
+
+bool GB_CONVERGENCE::converged() {
+    return this->_result.converged;
+}
+
+// Check if the readings have converged or the attempts have run out
+bool GB_CONVERGENCE::done() {
+    return this->_result.converged || this->_result.attempts >= this->_attempts;
+}
+
+// Value and quality of the last read
+GB_CONVERGENCE::RESULT GB_CONVERGENCE::result() {
+    return this->_result;
+}
+
+/*
+    Read until the readings converge or the attempts run out
+    reader: returns the next reading; -1 (no new reading) isn't added to the window
+*/
+template <typename READER> GB_CONVERGENCE::RESULT GB_CONVERGENCE::read(READER reader) {
+    this->reset();
+
+    for (int attempt = 0; attempt < this->_attempts; attempt++) {
+        float value = reader();
+        if (value == -1) continue;
+
+        bool settled = this->add(value);
+        this->_feedback(settled);
+        if (settled) break;
+    }
+
+    if (!this->_result.converged && _gb != NULL) _gb->arrow().color("yellow").log("Stability not acheived", false);
+    return this->_result;
+}
+
+/*
+    Take a fixed number of readings once the probe has warmed up (slope criterion met or attempts run out)
+    The result's value is the mean of those readings (the last 16 at most).
+*/
+template <typename READER> GB_CONVERGENCE::RESULT GB_CONVERGENCE::read(READER reader, int count) {
+    this->reset();
+
+    // Warm-up
+    for (int attempt = 0; attempt < this->_attempts; attempt++) {
+        float value = reader();
+        if (value == -1) continue;
+
+        this->add(value);
+        if (this->_count >= CONVERGENCE_MIN_READINGS && fabs(this->_result.slope) <= this->_slope) break;
+    }
+
+    // Readings; the window is widened to hold all of them
+    uint8_t window = this->_window;
+    this->_window = constrain(count, CONVERGENCE_MIN_READINGS, CONVERGENCE_WINDOW_LENGTH);
+    unsigned long started_at = this->_started_at;
+    this->reset();
+    this->_started_at = started_at;
+
+    for (int i = 0; i < count; i++) {
+        float value = reader();
+        if (value != -1) this->add(value);
+    }
+
+    this->_window = window;
+    return this->_result;
+}
+
+// Sample standard deviation of the window
+float GB_CONVERGENCE::_stddev() {
+    return this->_count > 1 ? sqrt(this->_m2 / (this->_count - 1)) : 0;
+}
+
+// Half-width of the 95% confidence interval of the mean
+float GB_CONVERGENCE::_halfwidth() {
+    if (this->_count < 2) return INFINITY;
+
+    // Student's t (two-sided, 95%) for 1 to 15 degrees of freedom
+    const float t[] = { 12.71, 4.30, 3.18, 2.78, 2.57, 2.45, 2.36, 2.31, 2.26, 2.23, 2.20, 2.18, 2.16, 2.14, 2.13 };
+    float factor = this->_count - 1 <= 15 ? t[this->_count - 2] : 1.96;
+    return factor * this->_stddev() / sqrt(this->_count);
+}
+
+// Least-squares slope of the window (units/second)
+float GB_CONVERGENCE::_regression() {
+    if (this->_count < 2) return 0;
+
+    uint8_t first = (this->_head + this->_window - this->_count) % this->_window;
+    unsigned long origin = this->_times[first];
+
+    double st = 0, sv = 0, stt = 0, stv = 0;
+    for (uint8_t i = 0; i < this->_count; i++) {
+        uint8_t index = (first + i) % this->_window;
+        double t = (this->_times[index] - origin) / 1000.0;
+        double v = this->_values[index];
+        st += t; sv += v; stt += t * t; stv += t * v;
+    }
+
+    double denominator = this->_count * stt - st * st;
+    return denominator > 0 ? (this->_count * stv - st * sv) / denominator : 0;
+}
+
+// Let someone on site know if the readings are settling
+void GB_CONVERGENCE::_feedback(bool settled) {
+    if (_gb == NULL) return;
+    if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(5).flash(settled ? 2 : 6, 250);
+    if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play(settled ? "." : "-");
+}
+
+#endif
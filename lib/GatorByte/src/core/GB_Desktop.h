@@ -469,30 +469,62 @@ void GB_DESKTOP::process(string command) {
 
                 String filename = command.substring(command.indexOf(":") + 1, command.indexOf(","));
                 
-                File file = _gb->getdevice("sd")->openFile("read", filename);
-                if (!file) {
+                if (!_gb->getdevice("sd")->exists(filename)) {
                     #if LOGCONTROL
                         _gb->log("Error opening file!");
                     #endif
                     return;
                 }
 
-                const int bufferSize = 40;
-                char buffer[bufferSize];
+                // Stream the file in 40-byte chunks
+                char buffer[41];
+                _gb->getdevice("sd")->readchunks(filename, 0, buffer, sizeof(buffer), [] (const char *chunk, int length, void *context) {
+                    ((GB_DESKTOP *) context)->sendfile("gdc-dfl", "fdl:" + String(chunk)); delay(25);
+                    return true;
+                }, this);
 
-                while (file.available()) {
-                    int bytesRead = file.read(buffer, bufferSize);
+                #if LOGCONTROL
+                _gb->log("File upload completed: " + filename);
+                #endif
+                this->sendfile("gdc-dfl", "fdl:#DLEOF#"); delay(10);
+            }
 
-                    // Process the data in the buffer
-                    String chunk = "";
-                    for (int i = 0; i < bytesRead; i++) {
-                        chunk += String(buffer[i]);
-                    }
-                    this->sendfile("gdc-dfl", "fdl:" + String(chunk)); delay(25);
+            // Download an archive (dla:<file>); the compressed bytes are sent as hex
+            if (command.contains("dla:")) {
+
+                String filename = "/archive/" + command.substring(command.indexOf("dla:") + 4, command.length());
+                if (!_gb->getdevice("sd")->exists(filename)) {
+                    this->send("gdc-dfl", "error:nofile");
+                    return;
                 }
 
+                char buffer[21];
+                _gb->getdevice("sd")->readchunks(filename, 0, buffer, sizeof(buffer), [] (const char *chunk, int length, void *context) {
+                    char hex[41] = "";
+                    for (int i = 0; i < length; i++) sprintf(hex + 2 * i, "%02X", (uint8_t) chunk[i]);
+                    ((GB_DESKTOP *) context)->sendfile("gdc-dfl", "fdl:" + String(hex)); delay(25);
+                    return true;
+                }, this);
+                this->sendfile("gdc-dfl", "fdl:#DLEOF#"); delay(10);
+            }
+
+            // Download the rows of a readings file within a time range (qry:<file>,<from>,<to>)
+            if (command.contains("qry:")) {
+
+                String arguments = command.substring(command.indexOf("qry:") + 4, command.length());
+                String filename = arguments.substring(0, arguments.indexOf(","));
+                arguments = arguments.substring(arguments.indexOf(",") + 1, arguments.length());
+                uint32_t from = strtoul(arguments.c_str(), NULL, 10);
+                uint32_t to = strtoul(arguments.substring(arguments.indexOf(",") + 1, arguments.length()).c_str(), NULL, 10);
+
+                char buffer[256];
+                uint32_t rows = _gb->getdevice("sd")->query(filename, from, to, buffer, sizeof(buffer), [] (char *line, int length, void *context) {
+                    ((GB_DESKTOP *) context)->sendfile("gdc-dfl", "fdl:" + String(line) + "\n"); delay(25);
+                    return true;
+                }, this);
+
                 #if LOGCONTROL
-                _gb->log("File upload completed: " + filename);
+                _gb->log("Query completed: " + String(rows) + " rows from " + filename);
                 #endif
                 this->sendfile("gdc-dfl", "fdl:#DLEOF#"); delay(10);
             }
@@ -975,17 +1007,18 @@ void GB_DESKTOP::process(string command) {
                 // String data = _gb->getdevice("sd")->readLinesFromSD(filename, charsatatime, initialcharindex);
                 // this->sendfile("gdc-cv", "fdl:" + data);
 
-                String data = _gb->getdevice("sd")->readfile(filename);
-                for (int i = 0; i < data.length(); i += 30) {
-                    // Extract a chunk of 30 characters
-                    String chunk = data.substring(i, i + 30);
-
+                // Write the text view from the control store, then stream it in 30-character chunks
+                _gb->getdevice("sd")->exportcontrol();
+                char buffer[31];
+                _gb->getdevice("sd")->readchunks(filename, 0, buffer, sizeof(buffer), [] (const char *chunk, int length, void *context) {
+                    
                     // Send the chunk over Serial
-                    this->sendfile("gdc-cv", "fdl:" + chunk);
+                    ((GB_DESKTOP *) context)->sendfile("gdc-cv", "fdl:" + String(chunk));
 
                     // Add a delay if needed to prevent data loss
                     delay(10);
-                }
+                    return true;
+                }, this);
                 this->sendfile("gdc-cv", "fdl:#EOF#"); delay(10);
             }
             
@@ -1025,6 +1058,9 @@ void GB_DESKTOP::process(string command) {
 
                 // Reset global variable
                 _gb->controls.reset();
+
+                // Rebuild the control store from the uploaded file
+                _gb->getdevice("sd")->importcontrol();
             
                 // Update config in the memory
                 _gb->getdevice("sd")->readconfig();
@@ -1034,6 +1070,7 @@ void GB_DESKTOP::process(string command) {
             //! Get hash from stored file
             if (command.contains("cv:hash")) {
 
+                _gb->getdevice("sd")->exportcontrol();
                 String cvdata = _gb->getdevice("sd")->readfile(CVPATH);
                 int hash = _gb->s2hash(cvdata);
 
@@ -1229,6 +1266,31 @@ void GB_DESKTOP::process(string command) {
                 this->send("gdc-dgn", "lipo:" + String(success ? "true" : "false") + ":..:" + _gb->getmcu()->batterystatus());
             }
             
+            if (command.contains("energy")) {
+
+                // Today's and the previous day's on-time and charge per subsystem
+                this->send("gdc-dgn", "energy=" + GB_ENERGY::meter().summary());
+                this->send("gdc-dgn", "energy-prev=" + GB_ENERGY::meter().previous());
+            }
+
+            if (command.contains("i2c")) {
+
+                // Mux writes, transactions and bus time since boot
+                this->send("gdc-dgn", "i2c=" + GB_I2C::bus().status());
+            }
+
+            if (command.contains("trace")) {
+
+                // Lines, reads and modeled latency of the traced sensors
+                this->send("gdc-dgn", "trace=" + GB_TRACE::replay().status());
+            }
+
+            if (command.contains("sdverify")) {
+
+                // Checks the CRC of every record in the readings and queue files
+                this->send("gdc-dgn", "sdverify=" + _gb->getdevice("sd")->sdverify());
+            }
+            
             if (command.contains("comm:all")) {
                 NBModem _nbModem;
 
@@ -11,6 +11,32 @@
 #include "CSVary.h"
 #include "JSONary.h"
 
+//! Energy accounting (used by the devices' power transitions)
+#include "./GB_Energy.h"
+
+//! I2C bus manager (mux channel cache, per-device clock, recovery; used by the I2C devices)
+#include "./GB_I2C.h"
+
+//! Trace replay (sensors backed by recorded traces in trace mode)
+#include "./GB_Trace.h"
+
+//! Streaming filters (median, Hampel, EMA, rate limiter; templates)
+#include "./GB_Filters.h"
+
+//! LZW coder (readings archives)
+#include "./GB_LZW.h"
+
+//! SPI block transfers (SAMD21 DMAC; SdFat's SPI driver, flash pages)
+#include "./GB_SPI.h"
+
+//! Storage fault injection (power cuts, stalls, read errors, bit flips in faults mode; used by the SD)
+#include "./GB_Faults.h"
+
+//! Indicator engine (background LED/buzzer patterns; used by the RGB LED and the buzzer)
+#if not defined (LOW_MEMORY_MODE) || defined (INCLUDE_INDICATOR) || defined (INCLUDE_RGB) || defined (INCLUDE_BUZZER)
+    #include "./GB_Indicator.h"
+#endif
+
 //! Microcontrollers
 #if not defined (LOW_MEMORY_MODE) || defined (INCLUDE_NB1500)
     #include "../microcontrollers/nb1500.h"
@@ -158,6 +184,18 @@
 #if not defined (LOW_MEMORY_MODE) || defined (INCLUDE_PIPER) 
     #include "./GB_PIPER.h"
 #endif
+#if not defined (LOW_MEMORY_MODE) || defined (INCLUDE_POLICY) 
+    #include "./GB_Policy.h"
+#endif
+#if not defined (LOW_MEMORY_MODE) || defined (INCLUDE_AGGREGATOR) 
+    #include "./GB_Aggregator.h"
+#endif
+#if not defined (LOW_MEMORY_MODE) || defined (INCLUDE_SAMPLER) 
+    #include "./GB_Sampler.h"
+#endif
+#if not defined (LOW_MEMORY_MODE) || defined (INCLUDE_GRAPH) 
+    #include "./GB_Graph.h"
+#endif
 
 // __AVR__ for any board with AVR architecture.
 // ARDUINO_AVR_PRO for the Arduino Pro or Pro Mini
@@ -0,0 +1,366 @@
+#ifndef GB_ENERGY_h
+#define GB_ENERGY_h
+
+#ifndef GB_h
+    #include "../GB.h"
+#endif
+
+/*
+    ! Energy accounting
+    Records how long each subsystem is powered and how long the device spends in each loop phase, and
+    converts the on-time to charge (mAh) using the subsystems' current draws.
+
+    The devices report their power transitions (on()/off()); the microcontroller reports the modem's
+    connect/shutdown and the sleep transitions. The counters are fixed-size arrays indexed by the
+    SUBSYSTEM and PHASE enums, so the hooks don't allocate.
+
+    While the microcontroller sleeps, millis() stops. The sleep duration is added to the MCU's sleep
+    time and to every subsystem that stays powered.
+
+    The day's totals are saved to the EEPROM (see the AT24 memory map) on day rollover and every
+    ENERGY_SAVE_INTERVAL seconds, so they survive resets. The previous day's totals are kept too.
+
+    Current draws (control/variables.ini; mA). Missing or non-positive values keep the defaults.
+        PWR_<NAME>_MA           e.g. PWR_MODEM_MA, PWR_SD_MA, PWR_SLEEP_MA (MCU asleep)
+        PWR_SAVE_INTERVAL       Seconds between saves
+
+    Usage:
+        GB_ENERGY::meter().configure(gb.controls);
+        GB_ENERGY::meter().phase(GB_ENERGY::UPLOAD);
+        GB_ENERGY::meter().report(state);                       // Adds MAH and MAH_<NAME> keys
+*/
+class GB_ENERGY {
+    public:
+        GB_ENERGY();
+
+        DEVICE device = {
+            "energy",
+            "GatorByte Energy Meter"
+        };
+
+        enum SUBSYSTEM { MCU, MODEM, SD, MEM, GPS, BL, EADC, USS, BOOSTER, AHT, PH, EC, DOX, RTD, SUBSYSTEMS };
+        enum PHASE { SETUP, SENSE, STORE, UPLOAD, IDLE, PHASES };
+
+        static GB_ENERGY& meter();
+
+        GB_ENERGY& attach(GB &gb);
+        GB_ENERGY& configure(JSONary controls);
+        GB_ENERGY& current(uint8_t subsystem, float milliamps);
+
+        GB_ENERGY& on(uint8_t subsystem);
+        GB_ENERGY& off(uint8_t subsystem);
+        GB_ENERGY& phase(uint8_t phase);
+        GB_ENERGY& sleep(unsigned long milliseconds);
+        GB_ENERGY& wake();
+
+        uint32_t ontime(uint8_t subsystem);
+        uint32_t phasetime(uint8_t phase);
+        float charge(uint8_t subsystem);
+        float charge();
+
+        GB_ENERGY& save();
+        GB_ENERGY& report(JSONary &data);
+        String summary();
+        String previous();
+
+    private:
+        GB *_gb = NULL;
+
+        static const uint32_t CHECK = 0x5A5AC3C3;
+        uint16_t _today_address = 8448;
+        uint16_t _previous_address = 8576;
+
+        // Daily totals (milliseconds); laid out as stored in the EEPROM
+        struct TOTALS {
+            uint32_t day;
+            uint32_t on[SUBSYSTEMS];
+            uint32_t phases[PHASES];
+            uint32_t sleep;
+            uint32_t check;
+        };
+        TOTALS _today;
+
+        float _milliamps[SUBSYSTEMS] = { 15, 100, 30, 3, 45, 10, 1, 15, 20, 1, 15, 15, 15, 15 };
+        float _sleep_milliamps = 0.5;
+        unsigned long _save_interval = 3600;
+
+        uint32_t _on_mask = 1;
+        unsigned long _since[SUBSYSTEMS];
+        uint8_t _phase = SETUP;
+        unsigned long _phase_since = 0;
+        long _saved_at = 0;
+        bool _loaded = false;
+
+        const char* _name(uint8_t subsystem);
+        uint32_t _day();
+        long _now();
+        uint32_t _checksum(TOTALS &totals);
+        void _clear(TOTALS &totals, uint32_t day);
+        void _load();
+        void _rollover();
+        float _mah(uint32_t milliseconds, float milliamps);
+        String _summary(TOTALS &totals);
+};
+
+GB_ENERGY::GB_ENERGY() {
+    this->_clear(this->_today, 0);
+    for (uint8_t i = 0; i < SUBSYSTEMS; i++) this->_since[i] = 0;
+}
+
+// The meter is shared by all the devices
+GB_ENERGY& GB_ENERGY::meter() {
+    static GB_ENERGY instance;
+    return instance;
+}
+
+GB_ENERGY& GB_ENERGY::attach(GB &gb) {
+    _gb = &gb;
+    return *this;
+}
+
+// Read the current draws from the control variables
+GB_ENERGY& GB_ENERGY::configure(JSONary controls) {
+    for (uint8_t i = 0; i < SUBSYSTEMS; i++) {
+        float milliamps = controls.getfloat("PWR_" + String(this->_name(i)) + "_MA");
+        if (milliamps > 0) this->_milliamps[i] = milliamps;
+    }
+    if (controls.getfloat("PWR_SLEEP_MA") > 0) this->_sleep_milliamps = controls.getfloat("PWR_SLEEP_MA");
+    if (controls.getint("PWR_SAVE_INTERVAL") > 0) this->_save_interval = controls.getint("PWR_SAVE_INTERVAL");
+    return *this;
+}
+
+// Set a subsystem's current draw (e.g. from a power meter reading)
+GB_ENERGY& GB_ENERGY::current(uint8_t subsystem, float milliamps) {
+    if (subsystem < SUBSYSTEMS && milliamps >= 0) this->_milliamps[subsystem] = milliamps;
+    return *this;
+}
+
+// A subsystem was powered on
+GB_ENERGY& GB_ENERGY::on(uint8_t subsystem) {
+    if (subsystem >= SUBSYSTEMS || (this->_on_mask & (1UL << subsystem))) return *this;
+    this->_on_mask |= 1UL << subsystem;
+    this->_since[subsystem] = millis();
+    return *this;
+}
+
+// A subsystem was powered off
+GB_ENERGY& GB_ENERGY::off(uint8_t subsystem) {
+    if (subsystem >= SUBSYSTEMS || !(this->_on_mask & (1UL << subsystem))) return *this;
+    this->_on_mask &= ~(1UL << subsystem);
+    this->_today.on[subsystem] += millis() - this->_since[subsystem];
+    return *this;
+}
+
+// Switch the loop phase; the time since the last switch is added to the previous phase
+GB_ENERGY& GB_ENERGY::phase(uint8_t phase) {
+    if (phase >= PHASES) return *this;
+    unsigned long now = millis();
+    this->_today.phases[this->_phase] += now - this->_phase_since;
+    this->_phase = phase;
+    this->_phase_since = now;
+    return *this;
+}
+
+/*
+    The microcontroller is about to sleep for the given duration
+    millis() doesn't advance during sleep, so the duration is added here
+*/
+GB_ENERGY& GB_ENERGY::sleep(unsigned long milliseconds) {
+    this->off(MCU);
+    this->phase(IDLE);
+
+    this->_today.sleep += milliseconds;
+    for (uint8_t i = 0; i < SUBSYSTEMS; i++) {
+        if (this->_on_mask & (1UL << i)) this->_today.on[i] += milliseconds;
+    }
+    return *this;
+}
+
+// The microcontroller woke up
+GB_ENERGY& GB_ENERGY::wake() {
+    this->on(MCU);
+    this->phase(IDLE);
+    return *this;
+}
+
+// Today's on-time of a subsystem (milliseconds); includes the running interval
+uint32_t GB_ENERGY::ontime(uint8_t subsystem) {
+    if (subsystem >= SUBSYSTEMS) return 0;
+    uint32_t total = this->_today.on[subsystem];
+    if (this->_on_mask & (1UL << subsystem)) total += millis() - this->_since[subsystem];
+    return total;
+}
+
+// Today's time spent in a loop phase (milliseconds)
+uint32_t GB_ENERGY::phasetime(uint8_t phase) {
+    if (phase >= PHASES) return 0;
+    uint32_t total = this->_today.phases[phase];
+    if (phase == this->_phase) total += millis() - this->_phase_since;
+    return total;
+}
+
+// Today's charge drawn by a subsystem (mAh)
+float GB_ENERGY::charge(uint8_t subsystem) {
+    if (subsystem >= SUBSYSTEMS) return 0;
+    float mah = this->_mah(this->ontime(subsystem), this->_milliamps[subsystem]);
+    if (subsystem == MCU) mah += this->_mah(this->_today.sleep, this->_sleep_milliamps);
+    return mah;
+}
+
+// Today's total charge (mAh)
+float GB_ENERGY::charge() {
+    float mah = 0;
+    for (uint8_t i = 0; i < SUBSYSTEMS; i++) mah += this->charge(i);
+    return mah;
+}
+
+/*
+    Save today's totals to the EEPROM
+    Writes only on day rollover or once the save interval has elapsed
+*/
+GB_ENERGY& GB_ENERGY::save() {
+    if (_gb == NULL || !_gb->hasdevice("mem")) return *this;
+    this->_load();
+    this->_rollover();
+
+    long now = this->_now();
+    if (this->_saved_at > 0 && now - this->_saved_at < (long) this->_save_interval) return *this;
+    this->_saved_at = now;
+
+    // Snapshot with the running intervals folded in
+    TOTALS snapshot = this->_today;
+    for (uint8_t i = 0; i < SUBSYSTEMS; i++) snapshot.on[i] = this->ontime(i);
+    for (uint8_t i = 0; i < PHASES; i++) snapshot.phases[i] = this->phasetime(i);
+    snapshot.check = this->_checksum(snapshot);
+
+    _gb->getdevice("mem")->writeblock(this->_today_address, (uint8_t *) &snapshot, sizeof(TOTALS));
+    return *this;
+}
+
+// Add today's charge (total and per powered subsystem) to a JSON object (e.g. state/report)
+GB_ENERGY& GB_ENERGY::report(JSONary &data) {
+    this->_rollover();
+    data.set("MAH", this->charge());
+    for (uint8_t i = 0; i < SUBSYSTEMS; i++) {
+        if (this->ontime(i) > 0) data.set("MAH_" + String(this->_name(i)), this->charge(i));
+    }
+    return *this;
+}
+
+// Today's breakdown (used by the GDC diagnostics)
+String GB_ENERGY::summary() {
+    this->_rollover();
+    TOTALS snapshot = this->_today;
+    for (uint8_t i = 0; i < SUBSYSTEMS; i++) snapshot.on[i] = this->ontime(i);
+    for (uint8_t i = 0; i < PHASES; i++) snapshot.phases[i] = this->phasetime(i);
+    return this->_summary(snapshot);
+}
+
+// The previous day's breakdown, from the EEPROM
+String GB_ENERGY::previous() {
+    if (_gb == NULL || !_gb->hasdevice("mem")) return "";
+    TOTALS totals;
+    if (!_gb->getdevice("mem")->readblock(this->_previous_address, (uint8_t *) &totals, sizeof(TOTALS)) || totals.check != this->_checksum(totals)) return "";
+    return this->_summary(totals);
+}
+
+/*
+    Format: <name>=<seconds>s/<mAh>mAh,...;<phase>=<seconds>s,...;sleep=<seconds>s
+    Subsystems that weren't powered are skipped.
+*/
+String GB_ENERGY::_summary(TOTALS &totals) {
+    const char* phases[PHASES] = { "setup", "sense", "store", "upload", "idle" };
+
+    String result = "";
+    for (uint8_t i = 0; i < SUBSYSTEMS; i++) {
+        if (totals.on[i] == 0) continue;
+        float mah = this->_mah(totals.on[i], this->_milliamps[i]);
+        if (i == MCU) mah += this->_mah(totals.sleep, this->_sleep_milliamps);
+        result += String(result.length() > 0 ? "," : "") + this->_name(i) + "=" + String(totals.on[i] / 1000) + "s/" + String(mah, 2) + "mAh";
+    }
+    result += ";";
+    for (uint8_t i = 0; i < PHASES; i++) result += String(i > 0 ? "," : "") + phases[i] + "=" + String(totals.phases[i] / 1000) + "s";
+    result += ";sleep=" + String(totals.sleep / 1000) + "s";
+    return result;
+}
+
+const char* GB_ENERGY::_name(uint8_t subsystem) {
+    static const char* names[SUBSYSTEMS] = { "MCU", "MODEM", "SD", "MEM", "GPS", "BL", "EADC", "USS", "BOOSTER", "AHT", "PH", "EC", "DOX", "RTD" };
+    return subsystem < SUBSYSTEMS ? names[subsystem] : "";
+}
+
+// Days since epoch (0 if there is no RTC)
+uint32_t GB_ENERGY::_day() {
+    if (_gb == NULL || !_gb->hasdevice("rtc")) return 0;
+    return _gb->getdevice("rtc")->timestamp().toInt() / 86400;
+}
+
+// Seconds; RTC time if available
+long GB_ENERGY::_now() {
+    if (_gb != NULL && _gb->hasdevice("rtc")) return _gb->getdevice("rtc")->timestamp().toInt();
+    return millis() / 1000;
+}
+
+uint32_t GB_ENERGY::_checksum(TOTALS &totals) {
+    uint32_t sum = CHECK ^ totals.day;
+    for (uint8_t i = 0; i < SUBSYSTEMS; i++) sum = (sum << 1 | sum >> 31) ^ totals.on[i];
+    for (uint8_t i = 0; i < PHASES; i++) sum = (sum << 1 | sum >> 31) ^ totals.phases[i];
+    return sum ^ totals.sleep;
+}
+
+void GB_ENERGY::_clear(TOTALS &totals, uint32_t day) {
+    memset(&totals, 0, sizeof(TOTALS));
+    totals.day = day;
+}
+
+// Resume today's totals after a reset
+void GB_ENERGY::_load() {
+    if (this->_loaded) return;
+    this->_loaded = true;
+
+    TOTALS stored;
+    if (!_gb->getdevice("mem")->readblock(this->_today_address, (uint8_t *) &stored, sizeof(TOTALS))) return;
+    if (stored.check != this->_checksum(stored)) return;
+
+    uint32_t today = this->_day();
+    if (stored.day == today) {
+        for (uint8_t i = 0; i < SUBSYSTEMS; i++) this->_today.on[i] += stored.on[i];
+        for (uint8_t i = 0; i < PHASES; i++) this->_today.phases[i] += stored.phases[i];
+        this->_today.sleep += stored.sleep;
+    }
+
+    // The stored day is over; keep it as the previous day
+    else _gb->getdevice("mem")->writeblock(this->_previous_address, (uint8_t *) &stored, sizeof(TOTALS));
+    this->_today.day = today;
+}
+
+// Start a new day; the finished day is kept as the previous day
+void GB_ENERGY::_rollover() {
+    uint32_t today = this->_day();
+    if (today == 0 || today == this->_today.day) return;
+
+    // The first day is only known once the RTC is available
+    if (this->_today.day == 0) {
+        this->_today.day = today;
+        return;
+    }
+
+    TOTALS finished = this->_today;
+    for (uint8_t i = 0; i < SUBSYSTEMS; i++) finished.on[i] = this->ontime(i);
+    for (uint8_t i = 0; i < PHASES; i++) finished.phases[i] = this->phasetime(i);
+    finished.check = this->_checksum(finished);
+    if (_gb->hasdevice("mem")) _gb->getdevice("mem")->writeblock(this->_previous_address, (uint8_t *) &finished, sizeof(TOTALS));
+
+    // Restart the running intervals at the day boundary
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < SUBSYSTEMS; i++) this->_since[i] = now;
+    this->_phase_since = now;
+    this->_clear(this->_today, today);
+    this->_saved_at = 0;
+}
+
+float GB_ENERGY::_mah(uint32_t milliseconds, float milliamps) {
+    return milliseconds / 3600000.0 * milliamps;
+}
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef GB_FAULTS_h
+#define GB_FAULTS_h
+
+#ifndef GB_h
+    #include "../GB.h"
+#endif
+
+#define FAULT_BUCKETS 16
+
+/*
+    ! Storage fault injection
+    Runs the SD storage under the faults seen in the field, so that the framing, recovery and queue
+    code can be exercised on a real card. Enabled with "mode = faults" in the config; otherwise the
+    hooks do nothing.
+
+    Faults (control/variables.ini). All of them come from one seeded generator, so the same seed and
+    the same sequence of operations give the same faults.
+        FLT_SEED                Seed (non-zero)
+        FLT_CUT_AFTER           Power cut at the N-th write since boot: a random part of the record
+                                is written and the MCU is reset without closing the file (0 = off)
+        FLT_STALL_PERMILLE      Chance (per 1000 file opens) of a card stall ...
+        FLT_STALL_MS            ... of this many ms
+        FLT_READ_PERMILLE       Chance (per 1000 opens for reading) of a read error
+        FLT_FLIP_PERMILLE       Chance (per 1000 writes) of a flipped bit in the written record
+
+    While enabled, the readings, queue and control writes are measured: the latency distribution
+    (power-of-two buckets, so the percentiles are bucket bounds) and the write amplification, as
+    the 512-byte sectors written (data, directory entry and FAT; an estimate from the offsets) per
+    byte of data. GB_SD::bench() runs a fixed workload and reports them.
+
+    Usage (GB_SD):
+        String record = GB_FAULTS::injector().flip(record);
+        uint32_t length = GB_FAULTS::injector().tear(record.length());
+        file.write(record.c_str(), length);
+        if (length < record.length()) GB_FAULTS::injector().cut();
+*/
+class GB_FAULTS {
+    public:
+        DEVICE device = {
+            "faults",
+            "GatorByte Storage Fault Injection"
+        };
+
+        enum OPERATION { READINGS, QUEUE, CONTROL, OPERATIONS };
+
+        static GB_FAULTS& injector();
+
+        GB_FAULTS& attach(GB &gb);
+        GB_FAULTS& configure(JSONary controls);
+        bool enabled();
+        uint32_t seed();
+
+        GB_FAULTS& stall();
+        bool readerror();
+        String flip(String data);
+        uint32_t tear(uint32_t length);
+        void cut();
+
+        static uint32_t sectors(uint32_t offset, uint32_t length, uint32_t cluster);
+        GB_FAULTS& record(uint8_t operation, unsigned long milliseconds, uint32_t bytes, uint32_t sectors);
+        GB_FAULTS& clear();
+        String status();
+
+    private:
+        GB *_gb = NULL;
+
+        uint32_t _seed = 1;
+        uint32_t _state = 1;
+        uint32_t _cut_after = 0;
+        uint16_t _stall_permille = 0;
+        uint16_t _stall_ms = 0;
+        uint16_t _read_permille = 0;
+        uint16_t _flip_permille = 0;
+
+        uint32_t _writes = 0;
+        uint32_t _stalls = 0;
+        uint32_t _read_errors = 0;
+        uint32_t _flips = 0;
+
+        uint32_t _histogram[OPERATIONS][FAULT_BUCKETS];
+        uint32_t _operations[OPERATIONS];
+        uint32_t _bytes[OPERATIONS];
+        uint32_t _sectors[OPERATIONS];
+
+        uint32_t _random();
+        bool _chance(uint16_t permille);
+        uint32_t _percentile(uint8_t operation, uint8_t percent);
+};
+
+// The injector is shared by all the storage code
+GB_FAULTS& GB_FAULTS::injector() {
+    static GB_FAULTS instance;
+    return instance;
+}
+
+GB_FAULTS& GB_FAULTS::attach(GB &gb) {
+    _gb = &gb;
+    return this->clear();
+}
+
+// Read the faults from the control variables (restarts the generator)
+GB_FAULTS& GB_FAULTS::configure(JSONary controls) {
+    if (controls.getint("FLT_SEED") > 0) this->_seed = controls.getint("FLT_SEED");
+    this->_state = this->_seed;
+    this->_cut_after = max(0, controls.getint("FLT_CUT_AFTER"));
+    this->_stall_permille = constrain(controls.getint("FLT_STALL_PERMILLE"), 0, 1000);
+    this->_stall_ms = max(0, controls.getint("FLT_STALL_MS"));
+    this->_read_permille = constrain(controls.getint("FLT_READ_PERMILLE"), 0, 1000);
+    this->_flip_permille = constrain(controls.getint("FLT_FLIP_PERMILLE"), 0, 1000);
+    return *this;
+}
+
+bool GB_FAULTS::enabled() {
+    return _gb != NULL && _gb->globals.MODE == "faults";
+}
+
+uint32_t GB_FAULTS::seed() {
+    return this->_seed;
+}
+
+// A file is opened: the card may stall
+GB_FAULTS& GB_FAULTS::stall() {
+    if (!this->enabled() || !this->_chance(this->_stall_permille)) return *this;
+    this->_stalls++;
+    delay(this->_stall_ms);
+    return *this;
+}
+
+// A file is opened for reading: whether the read fails
+bool GB_FAULTS::readerror() {
+    if (!this->enabled() || !this->_chance(this->_read_permille)) return false;
+    this->_read_errors++;
+    return true;
+}
+
+// A record is about to be written: maybe flip one of its bits
+String GB_FAULTS::flip(String data) {
+    if (!this->enabled() || data.length() == 0 || !this->_chance(this->_flip_permille)) return data;
+    uint32_t bit = this->_random() % (data.length() * 8);
+    data.setCharAt(bit / 8, data[bit / 8] ^ (1 << (bit % 8)));
+    this->_flips++;
+    return data;
+}
+
+// A record is about to be written: the number of its bytes that make it to the card before the power cut
+uint32_t GB_FAULTS::tear(uint32_t length) {
+    if (!this->enabled() || this->_cut_after == 0 || length == 0) return length;
+    return ++this->_writes == this->_cut_after ? this->_random() % length : length;
+}
+
+// Power cut: reset without closing the file, so what SdFat hasn't flushed is lost
+void GB_FAULTS::cut() {
+    _gb->log("Fault injection: power cut at write " + String(this->_writes));
+    NVIC_SystemReset();
+}
+
+/*
+    Sectors written by a write of 'length' bytes at 'offset': the data sectors it spans, the directory
+    entry and, for a growing file ('cluster' bytes per cluster; 0 = written in place), a FAT sector per
+    cluster it starts
+*/
+uint32_t GB_FAULTS::sectors(uint32_t offset, uint32_t length, uint32_t cluster) {
+    uint32_t count = length > 0 ? (offset + length - 1) / 512 - offset / 512 + 1 : 0;
+    if (cluster > 0 && length > 0) count += (offset + length + cluster - 1) / cluster - (offset + cluster - 1) / cluster;
+    return count + 1;
+}
+
+// A measured write: its latency, the data bytes and the sectors written
+GB_FAULTS& GB_FAULTS::record(uint8_t operation, unsigned long milliseconds, uint32_t bytes, uint32_t sectors) {
+    if (!this->enabled() || operation >= OPERATIONS) return *this;
+
+    uint8_t bucket = 0;
+    while (bucket < FAULT_BUCKETS - 1 && milliseconds >= (1UL << bucket)) bucket++;
+    this->_histogram[operation][bucket]++;
+    this->_operations[operation]++;
+    this->_bytes[operation] += bytes;
+    this->_sectors[operation] += sectors;
+    return *this;
+}
+
+// Clear the measurements and the fault counts
+GB_FAULTS& GB_FAULTS::clear() {
+    memset(this->_histogram, 0, sizeof(this->_histogram));
+    memset(this->_operations, 0, sizeof(this->_operations));
+    memset(this->_bytes, 0, sizeof(this->_bytes));
+    memset(this->_sectors, 0, sizeof(this->_sectors));
+    this->_stalls = this->_read_errors = this->_flips = 0;
+    return *this;
+}
+
+// Injected faults, and the latency percentiles (ms) and write amplification per operation
+String GB_FAULTS::status() {
+    const char *names[OPERATIONS] = { "readings", "queue", "control" };
+
+    String status = String(this->_stalls) + " stalls, " + String(this->_read_errors) + " read errors, " + String(this->_flips) + " bit flips";
+    for (uint8_t i = 0; i < OPERATIONS; i++) {
+        if (this->_operations[i] == 0) continue;
+        status += "; " + String(names[i]) + ": " + String(this->_operations[i]) + " writes, p50 " + String(this->_percentile(i, 50)) + " ms, p90 " + String(this->_percentile(i, 90)) + " ms, p99 " + String(this->_percentile(i, 99)) + " ms";
+        if (this->_bytes[i] > 0) status += ", amplification " + String(this->_sectors[i] * 512.0 / this->_bytes[i], 1);
+    }
+    return status;
+}
+
+// xorshift32
+uint32_t GB_FAULTS::_random() {
+    this->_state ^= this->_state << 13;
+    this->_state ^= this->_state >> 17;
+    this->_state ^= this->_state << 5;
+    return this->_state;
+}
+
+bool GB_FAULTS::_chance(uint16_t permille) {
+    return permille > 0 && this->_random() % 1000 < permille;
+}
+
+// Upper bound of the bucket holding the percentile
+uint32_t GB_FAULTS::_percentile(uint8_t operation, uint8_t percent) {
+    uint32_t target = (this->_operations[operation] * percent + 99) / 100, seen = 0;
+    for (uint8_t bucket = 0; bucket < FAULT_BUCKETS; bucket++) {
+        seen += this->_histogram[operation][bucket];
+        if (seen >= target) return 1UL << bucket;
+    }
+    return 1UL << (FAULT_BUCKETS - 1);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,300 @@
+#ifndef GB_FILTERS_h
+#define GB_FILTERS_h
+
+#ifndef GB_h
+    #include "../GB.h"
+#endif
+
+/*
+    ! Streaming filters
+    Constant-memory filters for a sensor's sample stream. Each filter takes a sample (add()) and returns
+    the filtered sample. The window sizes are template parameters, so the state is a fixed array in the
+    object (no heap); nothing is compiled unless a filter is instantiated.
+
+        GB_MEDIAN<T, N>         Running median of the last N samples (two heaps around the median;
+                                O(log N) per sample)
+        GB_HAMPEL<T, N>         Hampel identifier; a sample further than 'threshold' scaled MADs from the
+                                median of the last N samples is replaced by that median (the scale has
+                                an optional floor, for quantized samples)
+        GB_EMA<T>               Exponential moving average
+        GB_RATELIMIT<T>         Limits the change between consecutive outputs to a maximum step
+
+    Filters chain with >> (the chain is a filter too, so chains compose):
+        GB_HAMPEL<float, 7> spikes(3);
+        GB_EMA<float> smooth(0.3);
+        auto filter = spikes >> smooth;
+        float value = filter.add(reading);
+*/
+
+// Base of the filters (static dispatch; no virtual calls)
+template <typename DERIVED, typename T>
+class GB_FILTER {
+    public:
+        typedef T type;
+
+        T add(T sample) { return static_cast<DERIVED*>(this)->add(sample); }
+        void reset() { static_cast<DERIVED*>(this)->reset(); }
+};
+
+template <typename A, typename B> class GB_FILTER_PAIR;
+
+// A chain refers to its filters; a nested chain (a temporary in a >> b >> c) is kept by value
+template <typename F> struct GB_FILTER_LINK { typedef F& type; };
+template <typename A, typename B> struct GB_FILTER_LINK<GB_FILTER_PAIR<A, B> > { typedef GB_FILTER_PAIR<A, B> type; };
+
+// Two filters in series
+template <typename A, typename B>
+class GB_FILTER_PAIR : public GB_FILTER<GB_FILTER_PAIR<A, B>, typename A::type> {
+    public:
+        typedef typename A::type T;
+
+        GB_FILTER_PAIR(A &first, B &second) : _first(first), _second(second) {}
+
+        T add(T sample) { return _second.add(_first.add(sample)); }
+        void reset() { _first.reset(); _second.reset(); }
+
+    private:
+        typename GB_FILTER_LINK<A>::type _first;
+        typename GB_FILTER_LINK<B>::type _second;
+};
+
+template <typename A, typename B, typename T>
+GB_FILTER_PAIR<A, B> operator>>(GB_FILTER<A, T> &first, GB_FILTER<B, T> &second) {
+    return GB_FILTER_PAIR<A, B>(static_cast<A&>(first), static_cast<B&>(second));
+}
+
+template <typename A, typename B, typename T>
+GB_FILTER_PAIR<A, B> operator>>(GB_FILTER<A, T> &&first, GB_FILTER<B, T> &second) {
+    return GB_FILTER_PAIR<A, B>(static_cast<A&>(first), static_cast<B&>(second));
+}
+
+/*
+    Running median
+    The window is kept in a ring; the heap array holds the max-heap of the lower half at negative
+    indices, the median at 0 and the min-heap of the upper half at positive indices (stored from N / 2). Replacing the
+    oldest sample moves it up or down its heap, so each sample costs O(log N) comparisons.
+*/
+template <typename T, uint8_t N>
+class GB_MEDIAN : public GB_FILTER<GB_MEDIAN<T, N>, T> {
+    public:
+        GB_MEDIAN() { this->reset(); }
+
+        T add(T sample);
+        void reset();
+
+        T median();
+        uint8_t count() { return _count; }
+        const T* window() { return _data; }
+
+    private:
+        T _data[N];
+        int8_t _pos[N];
+        uint8_t _store[N];
+        uint8_t _index = 0;
+        uint8_t _count = 0;
+
+        uint8_t& _heap(int i) { return _store[N / 2 + i]; }
+        int _mincount() { return (_count - 1) / 2; }
+        int _maxcount() { return _count / 2; }
+        bool _less(int i, int j) { return _data[_heap(i)] < _data[_heap(j)]; }
+        bool _exchange(int i, int j);
+        bool _swapless(int i, int j) { return this->_less(i, j) && this->_exchange(i, j); }
+        void _minsortdown(int i);
+        void _maxsortdown(int i);
+        bool _minsortup(int i);
+        bool _maxsortup(int i);
+};
+
+template <typename T, uint8_t N>
+void GB_MEDIAN<T, N>::reset() {
+    _index = 0;
+    _count = 0;
+
+    // Fill pattern: median, max, min, max, ...
+    for (int i = N - 1; i >= 0; i--) {
+        _pos[i] = ((i + 1) / 2) * ((i & 1) ? -1 : 1);
+        _heap(_pos[i]) = i;
+    }
+}
+
+template <typename T, uint8_t N>
+T GB_MEDIAN<T, N>::add(T sample) {
+    bool filling = _count < N;
+    int p = _pos[_index];
+    T old = _data[_index];
+    _data[_index] = sample;
+    _index = (_index + 1) % N;
+    if (filling) _count++;
+
+    // The new sample is in the min-heap
+    if (p > 0) {
+        if (!filling && old < sample) this->_minsortdown(p * 2);
+        else if (this->_minsortup(p)) this->_maxsortdown(-1);
+    }
+
+    // The new sample is in the max-heap
+    else if (p < 0) {
+        if (!filling && sample < old) this->_maxsortdown(p * 2);
+        else if (this->_maxsortup(p) && _count) this->_minsortdown(1);
+    }
+
+    // The new sample is the median
+    else {
+        if (this->_maxcount()) this->_maxsortdown(-1);
+        if (this->_mincount()) this->_minsortdown(1);
+    }
+
+    return this->median();
+}
+
+// Median of the window (the mean of the two middle samples if the count is even)
+template <typename T, uint8_t N>
+T GB_MEDIAN<T, N>::median() {
+    if (_count == 0) return 0;
+    T value = _data[_heap(0)];
+    if ((_count & 1) == 0) value = (value + _data[_heap(-1)]) / 2;
+    return value;
+}
+
+template <typename T, uint8_t N>
+bool GB_MEDIAN<T, N>::_exchange(int i, int j) {
+    uint8_t t = _heap(i);
+    _heap(i) = _heap(j);
+    _heap(j) = t;
+    _pos[_heap(i)] = i;
+    _pos[_heap(j)] = j;
+    return true;
+}
+
+template <typename T, uint8_t N>
+void GB_MEDIAN<T, N>::_minsortdown(int i) {
+    for (; i <= this->_mincount(); i *= 2) {
+        if (i > 1 && i < this->_mincount() && this->_less(i + 1, i)) ++i;
+        if (!this->_swapless(i, i / 2)) break;
+    }
+}
+
+template <typename T, uint8_t N>
+void GB_MEDIAN<T, N>::_maxsortdown(int i) {
+    for (; i >= -this->_maxcount(); i *= 2) {
+        if (i < -1 && i > -this->_maxcount() && this->_less(i, i - 1)) --i;
+        if (!this->_swapless(i / 2, i)) break;
+    }
+}
+
+template <typename T, uint8_t N>
+bool GB_MEDIAN<T, N>::_minsortup(int i) {
+    while (i > 0 && this->_swapless(i, i / 2)) i /= 2;
+    return i == 0;
+}
+
+template <typename T, uint8_t N>
+bool GB_MEDIAN<T, N>::_maxsortup(int i) {
+    while (i < 0 && this->_swapless(i / 2, i)) i /= 2;
+    return i == 0;
+}
+
+/*
+    Hampel identifier
+    The scale is the median absolute deviation (MAD) of the window x 1.4826 (the standard deviation for
+    normally distributed samples). Until the window holds 3 samples, the samples pass through.
+    'floor' is the smallest scale used. Quantized samples (e.g. whole millimeters) that mostly repeat
+    have a MAD of 0, which would make any change an outlier; the floor sets the change (divided by the
+    threshold) that passes regardless.
+*/
+template <typename T, uint8_t N>
+class GB_HAMPEL : public GB_FILTER<GB_HAMPEL<T, N>, T> {
+    public:
+        GB_HAMPEL(float threshold = 3, float floor = 0) : _threshold(threshold), _floor(floor) {}
+
+        T add(T sample);
+        void reset() { _median.reset(); _outliers = 0; }
+
+        bool outlier() { return _outlier; }
+        uint32_t outliers() { return _outliers; }
+
+    private:
+        GB_MEDIAN<T, N> _median;
+        float _threshold;
+        float _floor;
+        bool _outlier = false;
+        uint32_t _outliers = 0;
+
+        float _mad(T median);
+};
+
+template <typename T, uint8_t N>
+T GB_HAMPEL<T, N>::add(T sample) {
+    T median = _median.add(sample);
+    _outlier = false;
+    if (_median.count() < 3) return sample;
+
+    float deviation = fabs((float) sample - (float) median);
+    float scale = 1.4826 * this->_mad(median);
+    if (scale < _floor) scale = _floor;
+    if (deviation > _threshold * scale) {
+        _outlier = true;
+        _outliers++;
+        return median;
+    }
+    return sample;
+}
+
+// Median of the absolute deviations from the median (insertion sort of a copy; the windows are short)
+template <typename T, uint8_t N>
+float GB_HAMPEL<T, N>::_mad(T median) {
+    float deviations[N];
+    uint8_t count = _median.count();
+    const T *window = _median.window();
+    for (uint8_t i = 0; i < count; i++) {
+        float deviation = fabs((float) window[i] - (float) median);
+        uint8_t j = i;
+        for (; j > 0 && deviations[j - 1] > deviation; j--) deviations[j] = deviations[j - 1];
+        deviations[j] = deviation;
+    }
+    return count & 1 ? deviations[count / 2] : (deviations[count / 2 - 1] + deviations[count / 2]) / 2;
+}
+
+// Exponential moving average; alpha is the weight of the new sample
+template <typename T>
+class GB_EMA : public GB_FILTER<GB_EMA<T>, T> {
+    public:
+        GB_EMA(float alpha = 0.3) : _alpha(alpha) {}
+
+        T add(T sample) {
+            _value = _primed ? (T) (_value + _alpha * (sample - _value)) : sample;
+            _primed = true;
+            return _value;
+        }
+        void reset() { _primed = false; }
+
+    private:
+        float _alpha;
+        T _value = 0;
+        bool _primed = false;
+};
+
+// Limits the change between consecutive outputs to 'step'
+template <typename T>
+class GB_RATELIMIT : public GB_FILTER<GB_RATELIMIT<T>, T> {
+    public:
+        GB_RATELIMIT(T step) : _step(step) {}
+
+        T add(T sample) {
+            if (_primed) {
+                if (sample > _value + _step) sample = _value + _step;
+                else if (sample < _value - _step) sample = _value - _step;
+            }
+            _value = sample;
+            _primed = true;
+            return _value;
+        }
+        void reset() { _primed = false; }
+
+    private:
+        T _step;
+        T _value = 0;
+        bool _primed = false;
+};
+
+#endif
\ No newline at end of file
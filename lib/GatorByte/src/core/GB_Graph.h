@@ -0,0 +1,240 @@
+#ifndef GB_GRAPH_h
+#define GB_GRAPH_h
+
+#ifndef GB_h
+    #include "../GB.h"
+#endif
+
+#define GRAPH_NODES 8
+#define GRAPH_POLL_INTERVAL 100
+
+/*
+    ! Sensor graph
+    Reads a set of sensors once per cycle in dependency order. A sensor can depend on another
+    sensor's reading (its source); e.g. the pH, EC and DO modules are compensated with the RTD's
+    temperature. Each reading is cached with the time it was taken.
+
+    acquire() reads the sensors without a source (or whose source has been read) first, one at a
+    time. Then the dependent sensors get their source's reading (compensate()) and are read together:
+    each one is started and then polled in turn until all of them have converged (see the Atlas
+    drivers' startread()/pollread()/finishread()), so their reads overlap instead of adding up.
+    A source that failed (-1) leaves the dependent sensors' last compensation in place.
+
+    The overlapped reads follow the "stability" sensor mode. In the other sensor modes, in dummy mode
+    and in the development environment, the dependent sensors are read one at a time with readsensor().
+
+    Sensors that can't share the water with the others while they read are marked exclusive() and read
+    on their own after the overlapped reads, once the other modules are off. An EC module without a
+    galvanic isolator is one: its excitation current disturbs the pH and DO probes' readings.
+
+    Usage:
+        sensors.add(&rtd).add(&ph, &rtd).add(&ec, &rtd).add(&dox, &rtd).exclusive(&ec);
+        sensors.acquire();
+        float ph_value = sensors.value(&ph);
+*/
+class GB_GRAPH {
+    public:
+        GB_GRAPH(GB &gb);
+
+        DEVICE device = {
+            "graph",
+            "GatorByte Sensor Graph"
+        };
+
+        GB_GRAPH& add(GB_DEVICE *device);
+        GB_GRAPH& add(GB_DEVICE *device, GB_DEVICE *source);
+        GB_GRAPH& exclusive(GB_DEVICE *device);
+        GB_GRAPH& timeout(unsigned long milliseconds);
+        GB_GRAPH& acquire();
+
+        float value(GB_DEVICE *device);
+        unsigned long timestamp(GB_DEVICE *device);
+        String status();
+
+    private:
+        GB *_gb;
+
+        struct NODE {
+            GB_DEVICE *device;
+            int8_t source;
+            float value;
+            unsigned long timestamp;
+            bool read;
+            bool exclusive;
+        };
+        NODE _nodes[GRAPH_NODES];
+        uint8_t _count = 0;
+
+        unsigned long _timeout = 60000;
+        unsigned long _elapsed = 0;
+        uint32_t _transactions = 0;
+
+        int8_t _index(GB_DEVICE *device);
+        void _readsources(bool *batch);
+        void _readdependents(bool *batch);
+};
+
+GB_GRAPH::GB_GRAPH(GB &gb) {
+    _gb = &gb;
+}
+
+// Add a sensor that doesn't depend on another sensor
+GB_GRAPH& GB_GRAPH::add(GB_DEVICE *device) {
+    if (this->_index(device) >= 0 || this->_count == GRAPH_NODES) return *this;
+    this->_nodes[this->_count++] = { device, -1, -1, 0, false, false };
+    return *this;
+}
+
+// Add a sensor that is compensated with the source's reading (the source is added if needed)
+GB_GRAPH& GB_GRAPH::add(GB_DEVICE *device, GB_DEVICE *source) {
+    this->add(source).add(device);
+    int8_t index = this->_index(device);
+    if (index >= 0) this->_nodes[index].source = this->_index(source);
+    return *this;
+}
+
+// Read the sensor on its own, after the overlapped reads
+GB_GRAPH& GB_GRAPH::exclusive(GB_DEVICE *device) {
+    int8_t index = this->_index(device);
+    if (index >= 0) this->_nodes[index].exclusive = true;
+    return *this;
+}
+
+// Time (milliseconds) after which the overlapped reads are stopped
+GB_GRAPH& GB_GRAPH::timeout(unsigned long milliseconds) {
+    this->_timeout = milliseconds;
+    return *this;
+}
+
+/*
+    ! Acquire
+    Reads all the sensors once, in dependency order
+*/
+GB_GRAPH& GB_GRAPH::acquire() {
+    unsigned long started = millis();
+    uint32_t transactions = GB_I2C::bus().transactions();
+
+    for (uint8_t i = 0; i < this->_count; i++) this->_nodes[i].read = false;
+
+    uint8_t remaining = this->_count;
+    while (remaining > 0) {
+
+        // Sensors whose source has been read
+        bool batch[GRAPH_NODES];
+        uint8_t ready = 0;
+        for (uint8_t i = 0; i < this->_count; i++) {
+            NODE &node = this->_nodes[i];
+            batch[i] = !node.read && (node.source < 0 || this->_nodes[node.source].read);
+            if (batch[i]) ready++;
+        }
+
+        // A dependency cycle; read the rest without compensation
+        if (ready == 0) {
+            _gb->log("Sensor graph has a dependency cycle");
+            for (uint8_t i = 0; i < this->_count; i++) {
+                batch[i] = !this->_nodes[i].read;
+                if (batch[i]) this->_nodes[i].source = -1;
+            }
+            ready = remaining;
+        }
+
+        this->_readsources(batch);
+        this->_readdependents(batch);
+        remaining -= ready;
+    }
+
+    this->_elapsed = millis() - started;
+    this->_transactions = GB_I2C::bus().transactions() - transactions;
+    _gb->log("Sensor graph: " + this->status());
+
+    return *this;
+}
+
+// Last reading of a sensor (-1 if it isn't in the graph)
+float GB_GRAPH::value(GB_DEVICE *device) {
+    int8_t index = this->_index(device);
+    return index >= 0 ? this->_nodes[index].value : -1;
+}
+
+// Time (millis()) the last reading of a sensor was taken
+unsigned long GB_GRAPH::timestamp(GB_DEVICE *device) {
+    int8_t index = this->_index(device);
+    return index >= 0 ? this->_nodes[index].timestamp : 0;
+}
+
+// Time and I2C transactions of the last acquisition
+String GB_GRAPH::status() {
+    return String(this->_elapsed / 1000.0) + " seconds, " + String(this->_transactions) + " I2C transactions";
+}
+
+int8_t GB_GRAPH::_index(GB_DEVICE *device) {
+    for (uint8_t i = 0; i < this->_count; i++) if (this->_nodes[i].device == device) return i;
+    return -1;
+}
+
+// Sensors without a source are read one at a time
+void GB_GRAPH::_readsources(bool *batch) {
+    for (uint8_t i = 0; i < this->_count; i++) {
+        NODE &node = this->_nodes[i];
+        if (!batch[i] || node.source >= 0) continue;
+
+        node.value = node.device->readsensor();
+        node.timestamp = millis();
+        node.read = true;
+    }
+}
+
+// Dependent sensors are compensated, then read together; the exclusive ones are read one at a time afterwards
+void GB_GRAPH::_readdependents(bool *batch) {
+    bool overlap = _gb->globals.SENSOR_MODE == "stability" && _gb->globals.MODE != "dummy" && _gb->env() != "development";
+
+    bool overlapped[GRAPH_NODES];
+    bool pending[GRAPH_NODES];
+    uint8_t count = 0;
+
+    for (uint8_t i = 0; i < this->_count; i++) {
+        NODE &node = this->_nodes[i];
+        overlapped[i] = pending[i] = false;
+        if (!batch[i] || node.source < 0) continue;
+
+        float source = this->_nodes[node.source].value;
+        if (source == -1) _gb->log("Sensor graph: source reading failed, keeping the last compensation");
+        else node.device->compensate(source);
+
+        if (!overlap || node.exclusive) continue;
+        node.device->startread();
+        overlapped[i] = pending[i] = true;
+        count++;
+    }
+
+    unsigned long started = millis();
+    while (count > 0 && millis() - started < this->_timeout) {
+        delay(GRAPH_POLL_INTERVAL);
+        for (uint8_t i = 0; i < this->_count; i++) {
+            if (pending[i] && this->_nodes[i].device->pollread()) {
+                pending[i] = false;
+                count--;
+            }
+        }
+    }
+
+    for (uint8_t i = 0; i < this->_count; i++) {
+        NODE &node = this->_nodes[i];
+        if (!overlapped[i]) continue;
+
+        node.value = node.device->finishread();
+        node.timestamp = millis();
+        node.read = true;
+    }
+
+    for (uint8_t i = 0; i < this->_count; i++) {
+        NODE &node = this->_nodes[i];
+        if (!batch[i] || node.source < 0 || overlapped[i]) continue;
+
+        node.value = node.device->readsensor();
+        node.timestamp = millis();
+        node.read = true;
+    }
+}
+
+#endif
\ No newline at end of file
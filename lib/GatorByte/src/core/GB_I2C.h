@@ -0,0 +1,335 @@
+#ifndef GB_I2C_h
+#define GB_I2C_h
+
+#ifndef GB_h
+    #include "../GB.h"
+#endif
+
+#define I2C_MUX_ADDRESS 0x70
+#define I2C_SPEED_SLOTS 8
+#define I2C_QUEUE_LENGTH 12
+#define I2C_QUEUE_BYTES 6
+
+/*
+    ! I2C bus manager
+    Owns the Wire bus and the TCA9548A multiplexer's channel selection. The drivers submit their
+    transactions with the mux channel the device sits behind (or -1 for a device on the main bus).
+
+    The selected channel is cached, so the mux is written only when the channel changes (and not
+    before every transaction). The bus clock is set per device (clock()); devices that aren't
+    registered use 100 kHz. Writes can be queued and flushed together, grouped by channel.
+
+    A transaction that fails is retried once after a bus recovery: SCL is toggled (up to 9 clocks)
+    until the slave holding SDA lets go, a STOP is sent and Wire is restarted. If the mux doesn't
+    respond after that, it's reset through its reset pin. A transaction that succeeds but takes
+    longer than the timeout is only counted as slow; it isn't retried since the device has already
+    acted on it and a write may not be safe to repeat.
+
+    Usage:
+        GB_I2C::bus().clock(0x65, 400000);
+        GB_I2C::bus().write(2, 0x65, data, 2);
+        GB_I2C::bus().read(2, 0x65, 0x16, buffer, 4);
+        GB_I2C::bus().status();                                 // Mux writes, transactions, bus time, slow transactions
+*/
+class GB_I2C {
+    public:
+        GB_I2C();
+
+        DEVICE device = {
+            "i2c",
+            "GatorByte I2C Bus"
+        };
+
+        static GB_I2C& bus();
+
+        GB_I2C& attach(GB &gb);
+        GB_I2C& clock(uint8_t address, uint32_t hz);
+        GB_I2C& timeout(unsigned long milliseconds);
+
+        bool select(int8_t channel);
+        GB_I2C& selected(uint8_t control);
+        GB_I2C& invalidate();
+
+        bool write(int8_t channel, uint8_t address, const uint8_t *data, uint8_t length);
+        uint8_t request(int8_t channel, uint8_t address, uint8_t *data, uint8_t length);
+        uint8_t read(int8_t channel, uint8_t address, uint8_t reg, uint8_t *data, uint8_t length);
+
+        GB_I2C& queue(int8_t channel, uint8_t address, const uint8_t *data, uint8_t length);
+        uint8_t flush();
+
+        bool recover();
+        uint32_t transactions();
+        String status();
+
+    private:
+        GB *_gb = NULL;
+
+        // Cached mux control byte; -1 when unknown
+        int16_t _control = -1;
+
+        uint32_t _clock = 100000;
+        struct SPEED {
+            uint8_t address;
+            uint32_t hz;
+        } _speeds[I2C_SPEED_SLOTS];
+        uint8_t _speed_count = 0;
+
+        struct PENDING {
+            int8_t channel;
+            uint8_t address;
+            uint8_t length;
+            uint8_t data[I2C_QUEUE_BYTES];
+        } _pending[I2C_QUEUE_LENGTH];
+        uint8_t _pending_count = 0;
+
+        unsigned long _timeout = 25;
+
+        // Counters
+        uint32_t _mux_writes = 0;
+        uint32_t _transactions = 0;
+        uint32_t _failures = 0;
+        uint32_t _slow = 0;
+        uint32_t _recoveries = 0;
+        uint32_t _busy_us = 0;
+
+        bool _prepare(int8_t channel, uint8_t address);
+        bool _write(uint8_t address, const uint8_t *data, uint8_t length);
+        uint8_t _request(uint8_t address, uint8_t *data, uint8_t length);
+        bool _account(unsigned long started, bool success);
+};
+
+GB_I2C::GB_I2C() {}
+
+// The bus is shared by all the devices
+GB_I2C& GB_I2C::bus() {
+    static GB_I2C instance;
+    return instance;
+}
+
+GB_I2C& GB_I2C::attach(GB &gb) {
+    _gb = &gb;
+    return *this;
+}
+
+// Set a device's bus clock (e.g. 400000 for fast mode)
+GB_I2C& GB_I2C::clock(uint8_t address, uint32_t hz) {
+    for (uint8_t i = 0; i < this->_speed_count; i++) {
+        if (this->_speeds[i].address == address) {
+            this->_speeds[i].hz = hz;
+            return *this;
+        }
+    }
+    if (this->_speed_count < I2C_SPEED_SLOTS) this->_speeds[this->_speed_count++] = { address, hz };
+    return *this;
+}
+
+// Time (milliseconds) after which a successful transaction is counted as slow
+GB_I2C& GB_I2C::timeout(unsigned long milliseconds) {
+    this->_timeout = milliseconds;
+    return *this;
+}
+
+/*
+    ! Select a mux channel
+    Selects a channel (0 - 7) exclusively. The mux is only written if the channel isn't already selected.
+    A channel of -1 leaves the mux as it is.
+*/
+bool GB_I2C::select(int8_t channel) {
+    if (channel < 0) return true;
+    if (channel > 7) return false;
+
+    uint8_t control = 1 << channel;
+    if (this->_control == control) return true;
+
+    bool success = false; int counter = 3;
+    while (!success && counter-- > 0) {
+        Wire.beginTransmission(I2C_MUX_ADDRESS);
+        Wire.write(control);
+        success = Wire.endTransmission() == 0;
+        this->_mux_writes++;
+    }
+
+    this->_control = success ? control : -1;
+    return success;
+}
+
+// The mux was written outside the bus manager
+GB_I2C& GB_I2C::selected(uint8_t control) {
+    this->_control = control;
+    return *this;
+}
+
+// The mux's state is unknown (e.g. after a reset)
+GB_I2C& GB_I2C::invalidate() {
+    this->_control = -1;
+    return *this;
+}
+
+// Write bytes to a device
+bool GB_I2C::write(int8_t channel, uint8_t address, const uint8_t *data, uint8_t length) {
+    for (uint8_t attempt = 0; attempt < 2; attempt++) {
+        if (!this->_prepare(channel, address)) continue;
+        if (this->_write(address, data, length)) return true;
+    }
+    return false;
+}
+
+// Read bytes from a device; returns the number of bytes read
+uint8_t GB_I2C::request(int8_t channel, uint8_t address, uint8_t *data, uint8_t length) {
+    uint8_t count = 0;
+    for (uint8_t attempt = 0; attempt < 2 && count < length; attempt++) {
+        if (!this->_prepare(channel, address)) continue;
+        count = this->_request(address, data, length);
+    }
+    return count;
+}
+
+// Read a device's register(s); returns the number of bytes read
+uint8_t GB_I2C::read(int8_t channel, uint8_t address, uint8_t reg, uint8_t *data, uint8_t length) {
+    uint8_t count = 0;
+    for (uint8_t attempt = 0; attempt < 2 && count < length; attempt++) {
+        if (!this->_prepare(channel, address)) continue;
+        if (this->_write(address, &reg, 1)) count = this->_request(address, data, length);
+    }
+    return count;
+}
+
+/*
+    Queue a write (up to I2C_QUEUE_BYTES bytes)
+    The queue is flushed when it's full
+*/
+GB_I2C& GB_I2C::queue(int8_t channel, uint8_t address, const uint8_t *data, uint8_t length) {
+    if (length > I2C_QUEUE_BYTES) {
+        this->write(channel, address, data, length);
+        return *this;
+    }
+    if (this->_pending_count == I2C_QUEUE_LENGTH) this->flush();
+
+    PENDING &pending = this->_pending[this->_pending_count++];
+    pending.channel = channel;
+    pending.address = address;
+    pending.length = length;
+    memcpy(pending.data, data, length);
+    return *this;
+}
+
+/*
+    Send the queued writes, grouped by channel (the order is kept within a channel)
+    Returns the number of failed writes
+*/
+uint8_t GB_I2C::flush() {
+    uint8_t failed = 0;
+    bool sent[I2C_QUEUE_LENGTH] = { false };
+
+    for (uint8_t i = 0; i < this->_pending_count; i++) {
+        if (sent[i]) continue;
+        int8_t channel = this->_pending[i].channel;
+
+        for (uint8_t j = i; j < this->_pending_count; j++) {
+            if (sent[j] || this->_pending[j].channel != channel) continue;
+            if (!this->write(channel, this->_pending[j].address, this->_pending[j].data, this->_pending[j].length)) failed++;
+            sent[j] = true;
+        }
+    }
+
+    this->_pending_count = 0;
+    return failed;
+}
+
+/*
+    ! Bus recovery
+    Clocks out a slave that is holding SDA low (up to 9 SCL pulses), sends a STOP and restarts Wire.
+    The mux channel has to be selected again afterwards.
+*/
+bool GB_I2C::recover() {
+    this->_recoveries++;
+
+    #if defined (PIN_WIRE_SDA) && defined (PIN_WIRE_SCL)
+        Wire.end();
+
+        pinMode(PIN_WIRE_SDA, INPUT_PULLUP);
+        pinMode(PIN_WIRE_SCL, OUTPUT);
+        for (uint8_t i = 0; i < 9 && digitalRead(PIN_WIRE_SDA) == LOW; i++) {
+            digitalWrite(PIN_WIRE_SCL, LOW); delayMicroseconds(5);
+            digitalWrite(PIN_WIRE_SCL, HIGH); delayMicroseconds(5);
+        }
+
+        // STOP: SDA goes high while SCL is high
+        pinMode(PIN_WIRE_SDA, OUTPUT);
+        digitalWrite(PIN_WIRE_SDA, LOW); delayMicroseconds(5);
+        digitalWrite(PIN_WIRE_SCL, HIGH); delayMicroseconds(5);
+        digitalWrite(PIN_WIRE_SDA, HIGH); delayMicroseconds(5);
+        pinMode(PIN_WIRE_SDA, INPUT);
+        pinMode(PIN_WIRE_SCL, INPUT);
+
+        Wire.begin();
+        Wire.setClock(this->_clock);
+    #endif
+
+    // Reset the mux if it doesn't respond
+    this->_control = -1;
+    Wire.beginTransmission(I2C_MUX_ADDRESS);
+    bool responding = Wire.endTransmission() == 0;
+    if (!responding && _gb != NULL && _gb->hasdevice("tca")) _gb->getdevice("tca")->resetmux();
+
+    return responding;
+}
+
+// Number of transactions since boot
+uint32_t GB_I2C::transactions() {
+    return this->_transactions;
+}
+
+String GB_I2C::status() {
+    return "mux writes: " + String(this->_mux_writes) + ", transactions: " + String(this->_transactions) + ", bus time: " + String(this->_busy_us / 1000) + " ms, slow: " + String(this->_slow) + ", failures: " + String(this->_failures) + ", recoveries: " + String(this->_recoveries);
+}
+
+// Select the device's channel and clock
+bool GB_I2C::_prepare(int8_t channel, uint8_t address) {
+    uint32_t hz = 100000;
+    for (uint8_t i = 0; i < this->_speed_count; i++) if (this->_speeds[i].address == address) hz = this->_speeds[i].hz;
+
+    if (!this->select(channel)) {
+        this->_failures++;
+        this->recover();
+        return false;
+    }
+
+    if (hz != this->_clock) {
+        Wire.setClock(hz);
+        this->_clock = hz;
+    }
+    return true;
+}
+
+bool GB_I2C::_write(uint8_t address, const uint8_t *data, uint8_t length) {
+    unsigned long started = micros();
+    Wire.beginTransmission(address);
+    Wire.write(data, length);
+    return this->_account(started, Wire.endTransmission() == 0);
+}
+
+uint8_t GB_I2C::_request(uint8_t address, uint8_t *data, uint8_t length) {
+    unsigned long started = micros();
+    uint8_t count = Wire.requestFrom(address, length);
+    for (uint8_t i = 0; i < count && Wire.available(); i++) data[i] = Wire.read();
+    return this->_account(started, count == length) ? count : 0;
+}
+
+// Add the transaction to the counters; recover the bus on a failure (a slow success is only counted)
+bool GB_I2C::_account(unsigned long started, bool success) {
+    unsigned long elapsed = micros() - started;
+    this->_transactions++;
+    this->_busy_us += elapsed;
+
+    if (success) {
+        if (elapsed > this->_timeout * 1000) this->_slow++;
+        return true;
+    }
+
+    this->_failures++;
+    this->recover();
+    return false;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,401 @@
+#ifndef GB_INDICATOR_h
+#define GB_INDICATOR_h
+
+#ifndef GB_h
+    #include "../GB.h"
+#endif
+
+#if defined (ARDUINO_ARCH_SAMD)
+    //! TC4/TC5 are left to the core (Servo/tone()); see the AG note in SAMDTimerInterrupt_Impl.h
+    #define SAMD_TIMERINTERRUPT_TC3_ONLY
+    #ifndef SAMD_TIMERINTERRUPT_H
+        #include "SAMDTimerInterrupt.h"
+    #endif
+#endif
+
+#define INDICATOR_TICK_MS 10
+#define INDICATOR_QUEUE_LENGTH 24
+
+/*
+    ! Indicator engine
+    Plays LED and buzzer patterns in the background. Instead of blocking on delay(), GB_RGB and
+    GB_BUZZER queue pattern steps (a color or a tone, and a duration) and return immediately. The
+    steps are played from the TC3 timer interrupt, one tick every INDICATOR_TICK_MS milliseconds.
+    The timer only runs while there are steps to play.
+
+    The interrupt only works out the outputs; analogWrite() and tone() aren't safe to call from it,
+    so update() applies them from the main program. On the SAMD boards the core calls it through
+    yield(), i.e. on every delay(), so a pattern plays while the sketch waits.
+
+    There is one queue per channel (LED, sound); the channels play independently. A channel's queue
+    can be repeated (e.g. the rainbow) until a deadline or until it is cancelled.
+
+    Policy (INDICATOR_POLICY in control/variables.ini)
+        on          Patterns are always played (default)
+        usb         Patterns are only played while someone is on site (USB or GDC connected)
+        off         Patterns are never played
+
+    Patterns that are suppressed are dropped, so the device doesn't stay awake for them. Colors set
+    directly (rgb.on(), rgb.off()) are not affected by the policy.
+
+    Usage:
+        GB_INDICATOR::engine().configure(gb.controls);
+        rgb.blink("green", 3, 300, 200); buzzer.play("..");        // Returns immediately
+        GB_INDICATOR::engine().drain(2000);                         // Wait (at most 2 seconds) for the patterns to finish
+        GB_INDICATOR::engine().cancel();                            // Stop everything (e.g. before sleep)
+*/
+class GB_INDICATOR {
+    public:
+        GB_INDICATOR();
+
+        DEVICE device = {
+            "indicator",
+            "GatorByte Indicator Engine"
+        };
+
+        enum CHANNEL { LED = 0, SOUND = 1 };
+
+        static GB_INDICATOR& engine();
+
+        GB_INDICATOR& attach(GB &gb);
+        GB_INDICATOR& led(int red, int green, int blue);
+        GB_INDICATOR& sound(int pin);
+        GB_INDICATOR& configure(String policy);
+        GB_INDICATOR& configure(JSONary controls);
+        bool enabled();
+
+        bool color(uint8_t red, uint8_t green, uint8_t blue, uint16_t milliseconds, bool fade);
+        bool note(uint16_t frequency, uint16_t milliseconds);
+        GB_INDICATOR& repeat(uint8_t channel, unsigned long milliseconds);
+
+        GB_INDICATOR& cancel();
+        GB_INDICATOR& cancel(uint8_t channel);
+        GB_INDICATOR& drain();
+        GB_INDICATOR& drain(unsigned long timeout_ms);
+        bool busy();
+        bool busy(uint8_t channel);
+
+        void tick();
+        void update();
+
+    private:
+        GB *_gb = NULL;
+        String _policy = "on";
+
+        int _pins[3] = {-1, -1, -1};
+        int _sound_pin = -1;
+
+        struct STEP {
+            uint8_t red;
+            uint8_t green;
+            uint8_t blue;
+            bool fade;
+            uint16_t frequency;
+            uint16_t ticks;
+        };
+
+        struct QUEUE {
+            STEP steps[INDICATOR_QUEUE_LENGTH];
+            volatile uint8_t head = 0;
+            volatile uint8_t count = 0;
+            volatile uint16_t elapsed = 0;
+            volatile bool started = false;
+            volatile bool repeat = false;
+            volatile uint32_t deadline = 0;
+        } _queues[2];
+
+        // LED output (and the start of the current fade)
+        uint8_t _output[3] = {0, 0, 0};
+        uint8_t _from[3] = {0, 0, 0};
+
+        // Outputs the interrupt has left for update()
+        volatile bool _led_pending = false;
+        volatile bool _sound_pending = false;
+        volatile uint16_t _frequency = 0;
+
+        volatile bool _running = false;
+
+        #if defined (ARDUINO_ARCH_SAMD)
+            SAMDTimer _timer = SAMDTimer(TIMER_TC3);
+            bool _attached = false;
+        #endif
+
+        static void _isr();
+        bool _push(uint8_t channel, STEP step);
+        void _start();
+        void _stop();
+        void _advance(uint8_t channel);
+        void _apply(uint8_t channel, STEP &step);
+        void _write(uint8_t red, uint8_t green, uint8_t blue);
+        void _tone(uint16_t frequency);
+};
+
+GB_INDICATOR::GB_INDICATOR() {}
+
+// The engine is shared by the RGB LED and the buzzer
+GB_INDICATOR& GB_INDICATOR::engine() {
+    static GB_INDICATOR instance;
+    return instance;
+}
+
+GB_INDICATOR& GB_INDICATOR::attach(GB &gb) {
+    _gb = &gb;
+    return *this;
+}
+
+GB_INDICATOR& GB_INDICATOR::led(int red, int green, int blue) {
+    this->_pins[0] = red;
+    this->_pins[1] = green;
+    this->_pins[2] = blue;
+    return *this;
+}
+
+GB_INDICATOR& GB_INDICATOR::sound(int pin) {
+    this->_sound_pin = pin;
+    return *this;
+}
+
+// Set the policy ("on", "usb" or "off"); other values keep the current policy
+GB_INDICATOR& GB_INDICATOR::configure(String policy) {
+    policy.toLowerCase();
+    if (policy == "on" || policy == "usb" || policy == "off") this->_policy = policy;
+    if (!this->enabled()) this->cancel();
+    return *this;
+}
+
+// Read the policy from the control variables
+GB_INDICATOR& GB_INDICATOR::configure(JSONary controls) {
+    return this->configure(controls.getstring("INDICATOR_POLICY"));
+}
+
+// Check if patterns are played under the current policy
+bool GB_INDICATOR::enabled() {
+    if (this->_policy == "off") return false;
+    if (this->_policy == "usb") return _gb != NULL && (_gb->USB_CONNECTED || _gb->globals.GDC_CONNECTED);
+    return true;
+}
+
+/*
+    Queue a color on the LED channel
+    A duration of 0 sets the color and moves on; fade ramps from the current color over the duration.
+    Returns false if the step was suppressed or the queue is full.
+*/
+bool GB_INDICATOR::color(uint8_t red, uint8_t green, uint8_t blue, uint16_t milliseconds, bool fade) {
+    if (this->_pins[0] < 0) return false;
+    return this->_push(LED, {red, green, blue, fade, 0, (uint16_t) ((milliseconds + INDICATOR_TICK_MS - 1) / INDICATOR_TICK_MS)});
+}
+
+/*
+    Queue a tone on the sound channel
+    A frequency of 0 is a silence.
+*/
+bool GB_INDICATOR::note(uint16_t frequency, uint16_t milliseconds) {
+    if (this->_sound_pin < 0) return false;
+    return this->_push(SOUND, {0, 0, 0, false, frequency, (uint16_t) ((milliseconds + INDICATOR_TICK_MS - 1) / INDICATOR_TICK_MS)});
+}
+
+/*
+    Repeat the steps queued on the channel
+    The channel is turned off after the given duration; 0 repeats until cancelled.
+*/
+GB_INDICATOR& GB_INDICATOR::repeat(uint8_t channel, unsigned long milliseconds) {
+    QUEUE &queue = this->_queues[channel];
+    noInterrupts();
+    if (queue.count > 0) {
+        queue.repeat = true;
+        queue.deadline = milliseconds / INDICATOR_TICK_MS;
+    }
+    interrupts();
+    return *this;
+}
+
+// Stop all the patterns
+GB_INDICATOR& GB_INDICATOR::cancel() {
+    this->cancel(LED);
+    this->cancel(SOUND);
+    return *this;
+}
+
+// Stop the patterns on a channel
+GB_INDICATOR& GB_INDICATOR::cancel(uint8_t channel) {
+    noInterrupts();
+    QUEUE &queue = this->_queues[channel];
+    bool playing = queue.count > 0;
+    queue.count = 0;
+    queue.started = false;
+    queue.repeat = false;
+    if (channel == LED) this->_led_pending = false;
+    else this->_sound_pending = false;
+    if (!this->busy()) this->_stop();
+    interrupts();
+
+    // An interrupted tone would keep playing
+    if (playing && channel == SOUND && this->_sound_pin >= 0) noTone(this->_sound_pin);
+    return *this;
+}
+
+// Wait for the queued patterns to finish
+GB_INDICATOR& GB_INDICATOR::drain() { return this->drain(0); }
+GB_INDICATOR& GB_INDICATOR::drain(unsigned long timeout_ms) {
+    unsigned long start = millis();
+    while (this->busy()) {
+        if (timeout_ms > 0 && millis() - start >= timeout_ms) break;
+
+        #if defined (ARDUINO_ARCH_SAMD)
+            delay(INDICATOR_TICK_MS);
+        #else
+            this->tick(); this->update(); delay(INDICATOR_TICK_MS);
+        #endif
+    }
+    this->update();
+    return *this;
+}
+
+bool GB_INDICATOR::busy() { return this->busy(LED) || this->busy(SOUND); }
+bool GB_INDICATOR::busy(uint8_t channel) { return this->_queues[channel].count > 0; }
+
+// Advance the queues by one tick (called from the timer interrupt)
+void GB_INDICATOR::tick() {
+    this->_advance(LED);
+    this->_advance(SOUND);
+    if (!this->busy()) this->_stop();
+}
+
+void GB_INDICATOR::_isr() {
+    GB_INDICATOR::engine().tick();
+}
+
+// Apply the outputs the interrupt has worked out (called from the main program)
+void GB_INDICATOR::update() {
+    if (!this->_led_pending && !this->_sound_pending) return;
+
+    noInterrupts();
+    bool led = this->_led_pending, sound = this->_sound_pending;
+    uint8_t rgb[3] = {this->_output[0], this->_output[1], this->_output[2]};
+    uint16_t frequency = this->_frequency;
+    this->_led_pending = false;
+    this->_sound_pending = false;
+    interrupts();
+
+    if (led) for (uint8_t i = 0; i < 3; i++) analogWrite(this->_pins[i], rgb[i]);
+    if (sound && frequency > 0) tone(this->_sound_pin, frequency);
+    else if (sound) noTone(this->_sound_pin);
+}
+
+bool GB_INDICATOR::_push(uint8_t channel, STEP step) {
+    if (!this->enabled()) return false;
+
+    QUEUE &queue = this->_queues[channel];
+    bool queued = false;
+
+    noInterrupts();
+    if (queue.count < INDICATOR_QUEUE_LENGTH) {
+        queue.steps[(queue.head + queue.count) % INDICATOR_QUEUE_LENGTH] = step;
+        queue.count++;
+        queued = true;
+    }
+    interrupts();
+
+    if (queued) this->_start();
+    return queued;
+}
+
+void GB_INDICATOR::_start() {
+    if (this->_running) return;
+    this->_running = true;
+
+    #if defined (ARDUINO_ARCH_SAMD)
+        if (!this->_attached) {
+            this->_attached = this->_timer.attachInterruptInterval_MS(INDICATOR_TICK_MS, GB_INDICATOR::_isr);
+        }
+        else this->_timer.enableTimer();
+    #else
+        // No timer; play the pattern in place
+        this->drain();
+    #endif
+}
+
+void GB_INDICATOR::_stop() {
+    if (!this->_running) return;
+    this->_running = false;
+
+    #if defined (ARDUINO_ARCH_SAMD)
+        this->_timer.disableTimer();
+    #endif
+}
+
+void GB_INDICATOR::_advance(uint8_t channel) {
+    QUEUE &queue = this->_queues[channel];
+    if (queue.count == 0) return;
+
+    // The repetition has run its course
+    if (queue.repeat && queue.deadline > 0 && --queue.deadline == 0) {
+        queue.count = 0;
+        queue.started = false;
+        queue.repeat = false;
+        if (channel == LED) this->_write(0, 0, 0);
+        else this->_tone(0);
+        return;
+    }
+
+    STEP &step = queue.steps[queue.head];
+    if (!queue.started) {
+        queue.started = true;
+        queue.elapsed = 0;
+        this->_apply(channel, step);
+    }
+
+    // Fade towards the step's color
+    if (channel == LED && step.fade && step.ticks > 0) {
+        uint8_t target[3] = {step.red, step.green, step.blue};
+        uint8_t rgb[3];
+        for (uint8_t i = 0; i < 3; i++) rgb[i] = this->_from[i] + ((int) target[i] - this->_from[i]) * (queue.elapsed + 1) / step.ticks;
+        this->_write(rgb[0], rgb[1], rgb[2]);
+    }
+
+    if (++queue.elapsed < step.ticks) return;
+
+    // Step complete; requeue it at the end when repeating
+    STEP done = step;
+    queue.head = (queue.head + 1) % INDICATOR_QUEUE_LENGTH;
+    queue.count--;
+    queue.started = false;
+    if (queue.repeat) {
+        queue.steps[(queue.head + queue.count) % INDICATOR_QUEUE_LENGTH] = done;
+        queue.count++;
+    }
+
+    // The LED keeps the last color; the buzzer is silenced between tones
+    if (channel == SOUND) this->_tone(0);
+}
+
+// Start a step
+void GB_INDICATOR::_apply(uint8_t channel, STEP &step) {
+    if (channel == LED) {
+        for (uint8_t i = 0; i < 3; i++) this->_from[i] = this->_output[i];
+        if (!step.fade || step.ticks == 0) this->_write(step.red, step.green, step.blue);
+    }
+    else this->_tone(step.frequency);
+}
+
+// Outputs for update() to apply (a frequency of 0 is a silence)
+void GB_INDICATOR::_write(uint8_t red, uint8_t green, uint8_t blue) {
+    this->_output[0] = red;
+    this->_output[1] = green;
+    this->_output[2] = blue;
+    this->_led_pending = true;
+}
+
+void GB_INDICATOR::_tone(uint16_t frequency) {
+    this->_frequency = frequency;
+    this->_sound_pending = true;
+}
+
+#if defined (ARDUINO_ARCH_SAMD)
+    // The core's delay() calls yield() while it waits (a weak, empty function otherwise)
+    void yield() {
+        GB_INDICATOR::engine().update();
+    }
+#endif
+
+#endif
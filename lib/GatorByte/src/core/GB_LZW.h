@@ -0,0 +1,165 @@
+#ifndef GB_LZW_h
+#define GB_LZW_h
+
+#ifndef GB_h
+    #include "../GB.h"
+#endif
+
+#define LZW_BITS 10
+#define LZW_CODES (1 << LZW_BITS)
+
+/*
+    ! LZW coder
+    A small streaming LZW coder for the readings archives (see GB_SD::archive()). The dictionary starts
+    with the 256 single bytes and gains one string per code until it holds LZW_CODES; it is never reset,
+    so a long input is coded in blocks, each one starting with begin().
+
+    Codes are packed LSB-first. A code is written with the width of the code about to be assigned
+    (9 bits, growing to LZW_BITS); the last byte of a block is padded with zeros.
+
+    The encoder keeps the dictionary as a trie (first child, next sibling); the decoder reuses the tables
+    as prefix links. About 5 KB; GB_SD::archive() keeps one static coder rather than allocating it per
+    call, since begin() clears the tables.
+
+    Usage:
+        static GB_LZW lzw;
+        lzw.begin();
+        length = lzw.compress(input, count, output);        // 'output' holds 2 * count bytes
+        length += lzw.finish(output + length);              // 4 bytes
+*/
+class GB_LZW {
+    public:
+        GB_LZW& begin();
+        uint16_t compress(const uint8_t *input, uint16_t length, uint8_t *output);
+        uint16_t finish(uint8_t *output);
+        uint32_t decompress(const uint8_t *input, uint32_t length, uint8_t *output, uint32_t size);
+
+    private:
+        uint16_t _link[LZW_CODES];
+        uint16_t _sibling[LZW_CODES];
+        uint8_t _suffix[LZW_CODES];
+        uint16_t _next = 256;
+        int16_t _current = -1;
+        uint32_t _bits = 0;
+        uint8_t _count = 0;
+
+        uint8_t _width(uint16_t code);
+        uint16_t _emit(uint16_t code, uint8_t *output);
+};
+
+// Start a block with a fresh dictionary
+GB_LZW& GB_LZW::begin() {
+    for (uint16_t i = 0; i < 256; i++) this->_link[i] = 0;
+    this->_next = 256;
+    this->_current = -1;
+    this->_bits = 0;
+    this->_count = 0;
+    return *this;
+}
+
+// Code a piece of the block; returns the number of bytes written to 'output'
+uint16_t GB_LZW::compress(const uint8_t *input, uint16_t length, uint8_t *output) {
+    uint16_t produced = 0;
+    for (uint16_t i = 0; i < length; i++) {
+        uint8_t character = input[i];
+        if (this->_current < 0) {
+            this->_current = character;
+            continue;
+        }
+
+        // Extend the current string if the dictionary has it
+        uint16_t child = this->_link[this->_current];
+        while (child != 0 && this->_suffix[child] != character) child = this->_sibling[child];
+        if (child != 0) {
+            this->_current = child;
+            continue;
+        }
+
+        produced += this->_emit(this->_current, output + produced);
+        if (this->_next < LZW_CODES) {
+            this->_suffix[this->_next] = character;
+            this->_link[this->_next] = 0;
+            this->_sibling[this->_next] = this->_link[this->_current];
+            this->_link[this->_current] = this->_next++;
+        }
+        this->_current = character;
+    }
+    return produced;
+}
+
+// End the block: the pending string and the padded last byte
+uint16_t GB_LZW::finish(uint8_t *output) {
+    uint16_t produced = this->_current >= 0 ? this->_emit(this->_current, output) : 0;
+    if (this->_count > 0) output[produced++] = this->_bits;
+    this->_current = -1;
+    this->_bits = 0;
+    this->_count = 0;
+    return produced;
+}
+
+// Decode a whole block; returns the number of bytes written to 'output' (stops early if it's full or the block is corrupt)
+uint32_t GB_LZW::decompress(const uint8_t *input, uint32_t length, uint8_t *output, uint32_t size) {
+    uint32_t bits = 0, position = 0, produced = 0;
+    uint8_t count = 0;
+    uint16_t next = 256;
+    int16_t previous = -1;
+
+    while (true) {
+
+        // The decoder assigns codes one step behind the encoder
+        uint8_t width = this->_width(previous < 0 ? next : next + 1);
+        while (count < width && position < length) {
+            bits |= (uint32_t) input[position++] << count;
+            count += 8;
+        }
+        if (count < width) break;
+
+        uint16_t code = bits & ((1UL << width) - 1);
+        bits >>= width;
+        count -= width;
+        if ((previous < 0 && code >= 256) || (previous >= 0 && code > next)) break;
+
+        // The code's string; a code not assigned yet is the previous string plus its first byte
+        uint16_t walk = code < next ? code : previous;
+        uint16_t depth = 1;
+        for (uint16_t w = walk; w >= 256; w = this->_link[w]) depth++;
+        uint16_t total = depth + (code < next ? 0 : 1);
+        if (produced + total > size) break;
+
+        for (uint16_t i = depth; i > 0; i--) {
+            output[produced + i - 1] = walk >= 256 ? this->_suffix[walk] : walk;
+            if (walk >= 256) walk = this->_link[walk];
+        }
+        if (code >= next) output[produced + depth] = output[produced];
+
+        if (previous >= 0 && next < LZW_CODES) {
+            this->_link[next] = previous;
+            this->_suffix[next] = output[produced];
+            next++;
+        }
+        produced += total;
+        previous = code;
+    }
+    return produced;
+}
+
+// Bits needed for a code (up to LZW_BITS)
+uint8_t GB_LZW::_width(uint16_t code) {
+    uint8_t width = 9;
+    while (width < LZW_BITS && code >= (1U << width)) width++;
+    return width;
+}
+
+uint16_t GB_LZW::_emit(uint16_t code, uint8_t *output) {
+    uint16_t produced = 0;
+    this->_bits |= (uint32_t) code << this->_count;
+    this->_count += this->_width(this->_next);
+    while (this->_count >= 8) {
+        output[produced++] = this->_bits;
+        this->_bits >>= 8;
+        this->_count -= 8;
+    }
+    return produced;
+}
+
+#endif
\ No newline at end of file
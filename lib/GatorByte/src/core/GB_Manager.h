@@ -45,6 +45,7 @@
             virtual String gettime() { return ""; };
             virtual String getsn() { return ""; };
             virtual int getrssi() { return 0; };
+            virtual int getrsrq() { return 255; };
             virtual String getoperator() { return ""; };
             virtual bool begin_modem() { return false; };
             virtual void watchdog(String) {};
@@ -107,6 +108,10 @@
             virtual GB_DEVICE& calibrate(int) { return *this; };
             virtual int calibrate(String, int) { return 0; };
             virtual float lastvalue() { return 0; };
+            virtual GB_DEVICE& compensate(float) { return *this; };
+            virtual GB_DEVICE& startread() { return *this; };
+            virtual bool pollread() { return true; };
+            virtual float finishread() { return -1; };
 
             //! RGB functions
             virtual GB_DEVICE& on(uint8_t) { return *this; };
@@ -115,9 +120,11 @@
             virtual GB_DEVICE& revert() { return *this; };
             virtual GB_DEVICE& blink(String, int, int, int) { return *this; };
             virtual GB_DEVICE& rainbow(int) { return *this; };
+            virtual GB_DEVICE& flash(uint8_t, int) { return *this; };
 
             //! MQTT functions
             virtual GB_DEVICE& update() { return *this; };
+            virtual String inflighttags() { return ""; };
 
             //! Buzzer functions
             virtual GB_DEVICE& play(String) { return *this; };
@@ -149,8 +156,16 @@
             virtual bool rwtest() { return false; };
             virtual bool exists(String) { return false; };
             virtual bool sdtest() { return false; };
+            virtual String sdverify() { return ""; };
+            virtual String bench(int records) { return ""; };
             virtual File openFile(String reason, String file_name) { File file; return file; }
             virtual String readLinesFromSD(String file_name, int lines_at_a_time, int starting_line) { return ""; }
+            typedef bool (*callback_t_on_chunk)(const char *chunk, int length, void *context);
+            typedef bool (*callback_t_on_line)(char *line, int length, void *context);
+            virtual int read(String path, uint32_t offset, char *buffer, int length) { return -1; }
+            virtual uint32_t readchunks(String path, uint32_t offset, char *buffer, int size, callback_t_on_chunk callback, void *context) { return 0; }
+            virtual uint32_t readlines(String path, char *buffer, int size, callback_t_on_line callback, void *context) { return 0; }
+            virtual uint32_t query(String filename, uint32_t from, uint32_t to, char *buffer, int size, callback_t_on_line callback, void *context) { return 0; }
             virtual String writeLinesToSD(String file_name, String data) { return ""; }
 
             virtual bool renamedir(String originalfolder, String newfolder) { return false;}
@@ -169,6 +184,8 @@
             virtual String readfile(String filename, String folder) { return ""; };
             virtual String readfile(String filename) { return ""; };
             virtual GB_DEVICE& readcontrol() { return *this; };
+            virtual uint32_t importcontrol() { return 0; };
+            virtual bool exportcontrol() { return false; };
             virtual GB_DEVICE& updatecontrolstring(String, String, callback_t_on_control) { return *this; };
             virtual GB_DEVICE& updatecontrolbool(String, bool, callback_t_on_control) { return *this; };
             virtual GB_DEVICE& updatecontrolint(String, int, callback_t_on_control) { return *this; };
@@ -190,6 +207,12 @@
             virtual GB_DEVICE& remove(int) { return *this; };
             virtual void debug(String message) { return; };
             virtual bool memtest() { return false; };
+            virtual uint32_t nextsequence() { return 0; };
+            virtual GB_DEVICE& setacked(uint32_t) { return *this; };
+            virtual GB_DEVICE& flushacked() { return *this; };
+            virtual bool isacked(uint32_t) { return false; };
+            virtual bool readblock(uint16_t, uint8_t*, uint16_t) { return false; };
+            virtual GB_DEVICE& writeblock(uint16_t, uint8_t*, uint16_t) { return *this; };
             
             //! GatorByte desktop client (GDC)
             virtual GB_DEVICE& detect() {  return *this; };
@@ -0,0 +1,164 @@
+#ifndef GB_POLICY_h
+#define GB_POLICY_h
+
+#ifndef GB_h
+    #include "../GB.h"
+#endif
+
+/*
+    ! Upload policy
+    Decides, each upload cycle, whether the queue should be uploaded now, deferred, or whether only
+    the high-priority (alerts) lane should be uploaded.
+
+    The decision is based on a simple cost model. The link quality (from RSSI and RSRQ) scales the
+    energy needed to attach/connect and to push each byte. That energy, spread over the records in the
+    backlog, is compared with a per-record budget that shrinks with the battery level.
+
+    The backlog's age and size are upper bounds; once either is exceeded the upload is forced,
+    whatever the signal and the battery. Queued alerts are always uploaded (alone when the cost is
+    too high). The signal is read only while the modem is connected (sample() again right after the
+    upload's connection attempt); with the modem down, the last reading is used. Until there is
+    one the cost is unknown and, short of the bounds and alerts, the upload is deferred.
+
+    Cost model variables (control/variables.ini). Missing or non-positive values keep the defaults.
+        UPL_SESSION_MJ          Energy to attach and connect at good signal (mJ)
+        UPL_BYTE_UJ             Energy per byte sent at good signal (uJ)
+        UPL_MAX_RECORD_MJ       Acceptable energy per delivered record at full battery (mJ)
+        UPL_RECORD_BYTES        Typical size of a queued record (bytes)
+        UPL_MIN_BATTERY         Battery level (%) below which only alerts are uploaded
+        UPL_MIN_RSSI            Signal strength (CSQ) below which uploads are deferred
+        UPL_MAX_BACKLOG_AGE     Seconds since the last upload after which an upload is forced
+        UPL_MAX_BACKLOG         Number of queued records after which an upload is forced
+
+    Usage:
+        String decision = policy.sample().decide(sd.getqueuecount(), sd.getqueuecount("alerts"));
+        if (decision != "defer") { ...connect...; policy.sample(); ...upload...; policy.uploaded(); }
+*/
+class GB_POLICY {
+    public:
+        GB_POLICY(GB &gb);
+
+        DEVICE device = {
+            "policy",
+            "GatorByte Upload Policy"
+        };
+
+        struct MODEL {
+            float SESSION_MJ = 6000;
+            float BYTE_UJ = 40;
+            float MAX_RECORD_MJ = 400;
+            int RECORD_BYTES = 300;
+            int MIN_BATTERY = 30;
+            int MIN_RSSI = 6;
+            long MAX_BACKLOG_AGE = 6L * 60 * 60;
+            int MAX_BACKLOG = 50;
+        } model;
+
+        // Last sample and decision; QUALITY is -1 while the signal is unknown
+        int RSSI = 99;
+        int RSRQ = 255;
+        float BATTERY = 100;
+        float QUALITY = -1;
+        float RECORD_MJ = 0;
+        String DECISION = "defer";
+
+        GB_POLICY& configure(JSONary controls);
+        GB_POLICY& sample();
+        String decide(int backlog, int priority);
+        GB_POLICY& uploaded();
+        String status();
+
+    private:
+        GB *_gb;
+        long _last_upload_at = 0;
+        long _now();
+};
+
+GB_POLICY::GB_POLICY(GB &gb) {
+    _gb = &gb;
+}
+
+// Read the cost model from the control variables
+GB_POLICY& GB_POLICY::configure(JSONary controls) {
+    if (controls.getfloat("UPL_SESSION_MJ") > 0) this->model.SESSION_MJ = controls.getfloat("UPL_SESSION_MJ");
+    if (controls.getfloat("UPL_BYTE_UJ") > 0) this->model.BYTE_UJ = controls.getfloat("UPL_BYTE_UJ");
+    if (controls.getfloat("UPL_MAX_RECORD_MJ") > 0) this->model.MAX_RECORD_MJ = controls.getfloat("UPL_MAX_RECORD_MJ");
+    if (controls.getint("UPL_RECORD_BYTES") > 0) this->model.RECORD_BYTES = controls.getint("UPL_RECORD_BYTES");
+    if (controls.getint("UPL_MIN_BATTERY") > 0) this->model.MIN_BATTERY = controls.getint("UPL_MIN_BATTERY");
+    if (controls.getint("UPL_MIN_RSSI") > 0) this->model.MIN_RSSI = controls.getint("UPL_MIN_RSSI");
+    if (controls.getint("UPL_MAX_BACKLOG_AGE") > 0) this->model.MAX_BACKLOG_AGE = controls.getint("UPL_MAX_BACKLOG_AGE");
+    if (controls.getint("UPL_MAX_BACKLOG") > 0) this->model.MAX_BACKLOG = controls.getint("UPL_MAX_BACKLOG");
+    return *this;
+}
+
+// Sample the link quality and the battery level
+GB_POLICY& GB_POLICY::sample() {
+    this->BATTERY = _gb->getmcu()->fuel("level");
+
+    // Without a connection the modem reports no signal (and getrssi() retries for seconds); keep the last reading
+    if (!_gb->getmcu()->connected()) return *this;
+
+    this->RSSI = _gb->getmcu()->getrssi();
+    this->RSRQ = _gb->getmcu()->getrsrq();
+
+    // Link quality (0 to 1) from the signal strength; a poor RSRQ (interference/load) halves it at most
+    float quality = 0;
+    if (this->RSSI != 0 && this->RSSI != 99 && this->RSSI >= this->model.MIN_RSSI) {
+        quality = constrain((float) (this->RSSI - this->model.MIN_RSSI + 1) / (31 - this->model.MIN_RSSI + 1), 0.05, 1.0);
+        if (this->RSRQ >= 0 && this->RSRQ <= 34) quality *= 0.5 + 0.5 * this->RSRQ / 34.0;
+    }
+    this->QUALITY = quality;
+
+    return *this;
+}
+
+/*
+    Decide what to upload
+    backlog: number of queued records (all lanes)
+    priority: number of queued high-priority records
+
+    Returns "upload", "priority" or "defer"
+*/
+String GB_POLICY::decide(int backlog, int priority) {
+    String decision = "defer";
+    this->RECORD_MJ = 0;
+
+    if (backlog > 0) {
+        bool forced = backlog >= this->model.MAX_BACKLOG || this->_now() - this->_last_upload_at >= this->model.MAX_BACKLOG_AGE;
+
+        // Energy per delivered record at the current link quality
+        bool affordable = false;
+        if (this->QUALITY > 0) {
+            this->RECORD_MJ = (this->model.SESSION_MJ / backlog + this->model.RECORD_BYTES * this->model.BYTE_UJ / 1000) / this->QUALITY;
+
+            // The budget shrinks with the battery level
+            float budget = this->model.MAX_RECORD_MJ * constrain(this->BATTERY, 0, 100) / 100;
+            affordable = this->BATTERY >= this->model.MIN_BATTERY && this->RECORD_MJ <= budget;
+        }
+
+        if (forced || affordable) decision = "upload";
+        else if (priority > 0) decision = "priority";
+    }
+
+    this->DECISION = decision;
+    _gb->log("Upload policy: " + this->status());
+    return decision;
+}
+
+// Mark the backlog as uploaded
+GB_POLICY& GB_POLICY::uploaded() {
+    this->_last_upload_at = this->_now();
+    return *this;
+}
+
+String GB_POLICY::status() {
+    return this->DECISION + " (RSSI: " + (this->QUALITY < 0 ? String("unknown") : String(this->RSSI)) + ", RSRQ: " + String(this->RSRQ) + ", battery: " + String(this->BATTERY) + ", cost: " + String(this->RECORD_MJ) + " mJ/record)";
+}
+
+// Seconds; RTC time if available
+long GB_POLICY::_now() {
+    if (_gb->hasdevice("rtc")) return _gb->getdevice("rtc")->timestamp().toInt();
+    return millis() / 1000;
+}
+
+#endif
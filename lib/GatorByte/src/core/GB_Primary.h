@@ -129,6 +129,7 @@ class GB {
 
             int TIMEOUT_CELLULAR_CONNECTION;
             int SLEEP_DURATION = 5 * 60 * 1000;
+            int ADAPTIVE_SLEEP_DURATION = 0;
             int BREATHE_INTERVAL = 60 * 1000;
             bool OFFLINE_MODE;
             int FAULTS_PRIMARY = 0;
@@ -0,0 +1,420 @@
+#ifndef GB_SPI_h
+#define GB_SPI_h
+
+#ifndef GB_h
+    #include "../GB.h"
+#endif
+
+#include "SPI.h"
+
+#ifndef SdFat_h
+    #include "SdFat.h"
+#endif
+
+// The SAMD21's DMAC moves the blocks; other boards fall back to polled transfers
+#if defined(ARDUINO_ARCH_SAMD) && !defined(__SAMD51__)
+    #define GB_SPI_DMA
+#endif
+
+// SERCOM behind the SPI header (SERCOM1 on the MKR boards) and its DMAC triggers
+#ifndef GB_SPI_SERCOM
+    #define GB_SPI_SERCOM SERCOM1
+    #define GB_SPI_TRIGGER_RX SERCOM1_DMAC_ID_RX
+    #define GB_SPI_TRIGGER_TX SERCOM1_DMAC_ID_TX
+#endif
+
+// DMAC channels (the descriptors are indexed by channel, so these are the first two)
+#define GB_SPI_RX 0
+#define GB_SPI_TX 1
+
+// Blocks shorter than this are polled (the DMA setup costs about as much as 32 bytes at 12 MHz)
+#define GB_SPI_DMA_MIN 32
+#define GB_SPI_TIMEOUT_US 100000UL
+
+#if defined(GB_SPI_DMA)
+    extern "C" void DMAC_Handler(void);
+#endif
+
+/*
+    ! SPI block transfers
+    Moves the SD card's 512-byte sectors and the flash's 256-byte pages over the SAMD21 DMAC. The
+    SERCOM's RX and TX triggers pace two channels, one beat (byte) per trigger; the transfer is
+    complete when the RX channel has stored the last byte. While a transfer is in flight the CPU
+    sleeps (WFI, idle mode) until the DMAC interrupt, instead of polling the SERCOM byte by byte.
+    Single bytes and short blocks (commands, tokens, CRCs) still go through SPI.transfer().
+
+    The SD uses it as SdFat's external SPI driver (SPI_DRIVER_SELECT = 3 in platformio.ini); all
+    the SdFat begin() calls must pass sdconfig() so the card gets this port. Writes through SdFat
+    are synchronous (SdFat sends the CRC and reads the card's data response right after the block).
+
+    post() is asynchronous: it returns as soon as the block is started, and the chip select is
+    raised when it completes. The caller formats the next block in a second buffer meanwhile; the
+    next post() (or any other transfer) waits for the one in flight first. The posted buffer must
+    not be changed until then.
+
+    The driver owns the DMAC (its descriptor base and interrupt). SPIMemory's ENABLEZERODMA must
+    stay off.
+
+    Usage:
+        _sd.begin(GB_SPI::sdconfig(pins.ss, SD_SCK_MHZ(12)));
+
+        SPI.beginTransaction(settings); digitalWrite(cs, LOW); SPI.transfer(0x02); ...
+        GB_SPI::bus().post(page, 256, cs);                      // Returns at once
+        // ... fill the other page buffer ...
+        GB_SPI::bus().wait();
+
+        GB_SPI::bus().status();                                 // Clock, MB/s, CPU asleep while transferring
+*/
+#if SPI_DRIVER_SELECT == 3
+class GB_SPI : public SdSpiBaseClass {
+#else
+class GB_SPI {
+#endif
+    public:
+        DEVICE device = {
+            "spi",
+            "GatorByte SPI Block Transfers"
+        };
+
+        static GB_SPI& bus();
+        static SdSpiConfig sdconfig(SdCsPin_t cs, uint32_t clock);
+
+        bool transfer(const uint8_t *tx, uint8_t *rx, size_t count);
+        GB_SPI& post(const uint8_t *data, size_t count, int cs);
+        bool busy();
+        bool wait();
+
+        GB_SPI& clear();
+        String status();
+
+        //! SdFat external driver
+        void begin(SdSpiConfig config);
+        void activate();
+        void deactivate();
+        void end();
+        uint8_t receive();
+        uint8_t receive(uint8_t *buffer, size_t count);
+        void send(uint8_t data);
+        void send(const uint8_t *buffer, size_t count);
+        void setSckSpeed(uint32_t clock);
+
+    private:
+        SPISettings _settings = SPISettings(SD_SCK_MHZ(4), MSBFIRST, SPI_MODE0);
+        uint32_t _clock = SD_SCK_MHZ(4);
+
+        // Transfer in flight (cleared by the DMAC interrupt) and not yet waited for
+        volatile bool _busy = false;
+        bool _pending = false;
+        volatile bool _error = false;
+        volatile unsigned long _finished = 0;
+        unsigned long _started = 0;
+        int _release = -1;
+
+        // Sources and sinks of the blocks that are only sent or only received
+        uint8_t _idle = 0xFF;
+        uint8_t _sink = 0;
+
+        uint32_t _transfers = 0;
+        uint32_t _bytes = 0;
+        uint32_t _polled = 0;
+        uint32_t _timeouts = 0;
+        uint32_t _errors = 0;
+        uint64_t _dma_us = 0;
+        uint64_t _waited_us = 0;
+        uint32_t _sd_ontime = 0;
+
+        bool _dmac = false;
+        void _dmacinit();
+        void _channel(uint8_t channel, uint8_t trigger, bool interrupt);
+        void _start(const uint8_t *tx, uint8_t *rx, size_t count);
+        void _stop();
+
+        #if defined(GB_SPI_DMA)
+            friend void ::DMAC_Handler(void);
+        #endif
+};
+
+#if defined(GB_SPI_DMA)
+    // Channel descriptors and their write-back area (the DMAC needs them 128-bit aligned in SRAM)
+    static DmacDescriptor _gb_spi_descriptors[2] __attribute__((aligned(16)));
+    static DmacDescriptor _gb_spi_writeback[2] __attribute__((aligned(16)));
+#endif
+
+// The SD and the flash share the bus, and so the driver
+GB_SPI& GB_SPI::bus() {
+    static GB_SPI instance;
+    return instance;
+}
+
+// SdFat configuration on this driver
+SdSpiConfig GB_SPI::sdconfig(SdCsPin_t cs, uint32_t clock) {
+    #if SPI_DRIVER_SELECT == 3
+        return SdSpiConfig(cs, SHARED_SPI, clock, &GB_SPI::bus());
+    #else
+        return SdSpiConfig(cs, SHARED_SPI, clock);
+    #endif
+}
+
+// Send 'tx' (0xFF when NULL) and store what comes back in 'rx' (dropped when NULL)
+bool GB_SPI::transfer(const uint8_t *tx, uint8_t *rx, size_t count) {
+    if (!this->wait()) return false;
+
+    #if defined(GB_SPI_DMA)
+        if (count >= GB_SPI_DMA_MIN) {
+            this->_start(tx, rx, count);
+            return this->wait();
+        }
+    #endif
+
+    for (size_t i = 0; i < count; i++) {
+        uint8_t data = SPI.transfer(tx ? tx[i] : 0xFF);
+        if (rx) rx[i] = data;
+    }
+    this->_polled += count;
+    return true;
+}
+
+// Start sending a block; 'cs' is raised (and the caller's SPI transaction ended) once it's out
+GB_SPI& GB_SPI::post(const uint8_t *data, size_t count, int cs) {
+    this->wait();
+
+    #if defined(GB_SPI_DMA)
+        this->_release = cs;
+        this->_start(data, NULL, count);
+    #else
+        this->transfer(data, NULL, count);
+        digitalWrite(cs, HIGH);
+        SPI.endTransaction();
+    #endif
+    return *this;
+}
+
+bool GB_SPI::busy() {
+    return this->_busy;
+}
+
+// Sleep until the block in flight is complete; false if it failed or timed out
+bool GB_SPI::wait() {
+    #if defined(GB_SPI_DMA)
+        if (!this->_pending) return true;
+
+        unsigned long start = micros();
+
+        // Idle mode, whatever the last sleep left in SCR (the SERCOM stops in standby)
+        uint32_t scr = SCB->SCR;
+        SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+
+        // The interrupt can come between the test and WFI; a pending interrupt still wakes the
+        // core with PRIMASK set, and SysTick bounds the wait to the timeout check
+        __disable_irq();
+        while (this->_busy && micros() - start < GB_SPI_TIMEOUT_US) {
+            __WFI();
+            __enable_irq();
+            __disable_irq();
+        }
+        __enable_irq();
+        SCB->SCR = scr;
+
+        if (this->_busy) {
+            this->_stop();
+            this->_busy = false;
+            this->_error = true;
+            this->_finished = micros();
+            this->_timeouts++;
+        }
+        this->_pending = false;
+        this->_waited_us += micros() - start;
+        this->_dma_us += this->_finished - this->_started;
+
+        if (this->_release >= 0) {
+            digitalWrite(this->_release, HIGH);
+            SPI.endTransaction();
+            this->_release = -1;
+        }
+
+        if (this->_error) {
+            this->_errors++;
+            this->_error = false;
+            return false;
+        }
+    #endif
+    return true;
+}
+
+GB_SPI& GB_SPI::clear() {
+    this->_transfers = 0;
+    this->_bytes = 0;
+    this->_polled = 0;
+    this->_timeouts = 0;
+    this->_errors = 0;
+    this->_dma_us = 0;
+    this->_waited_us = 0;
+    this->_sd_ontime = GB_ENERGY::meter().ontime(GB_ENERGY::SD);
+    return *this;
+}
+
+// Clock, DMA throughput and the share of the SD's on-time the CPU slept through
+String GB_SPI::status() {
+    String report = String(this->_clock / 1000000.0, 1) + " MHz";
+
+    #if defined(GB_SPI_DMA)
+        float rate = this->_dma_us > 0 ? (float) this->_bytes / this->_dma_us : 0;
+        uint32_t ontime = GB_ENERGY::meter().ontime(GB_ENERGY::SD) - this->_sd_ontime;
+        float asleep = ontime > 0 ? min(100.0, this->_waited_us / 10.0 / ontime) : 0;
+
+        report += ", DMA: " + String(this->_transfers) + " transfers, " + String(this->_bytes / 1024) + " KB at " + String(rate, 2) + " MB/s";
+        report += ", CPU asleep " + String(asleep, 0) + "% of the SD on-time";
+        if (this->_timeouts > 0 || this->_errors > 0) report += ", " + String(this->_errors) + " errors (" + String(this->_timeouts) + " timeouts)";
+    #endif
+
+    return report + ", polled: " + String(this->_polled) + " bytes";
+}
+
+/*
+    ! SdFat external driver
+    SdFat drives the chip select; activate() and deactivate() bracket each command.
+*/
+void GB_SPI::begin(SdSpiConfig config) {
+    SPI.begin();
+    this->setSckSpeed(config.maxSck);
+    #if defined(GB_SPI_DMA)
+        this->_dmacinit();
+    #endif
+}
+
+void GB_SPI::activate() {
+    this->wait();
+    SPI.beginTransaction(this->_settings);
+}
+
+void GB_SPI::deactivate() {
+    SPI.endTransaction();
+}
+
+void GB_SPI::end() {
+    this->wait();
+}
+
+uint8_t GB_SPI::receive() {
+    return SPI.transfer(0xFF);
+}
+
+uint8_t GB_SPI::receive(uint8_t *buffer, size_t count) {
+    return this->transfer(NULL, buffer, count) ? 0 : 1;
+}
+
+void GB_SPI::send(uint8_t data) {
+    SPI.transfer(data);
+}
+
+void GB_SPI::send(const uint8_t *buffer, size_t count) {
+    this->transfer(buffer, NULL, count);
+}
+
+// SdFat sets the slow clock for the card's initialization, then the configured one
+void GB_SPI::setSckSpeed(uint32_t clock) {
+    this->_clock = clock;
+    this->_settings = SPISettings(clock, MSBFIRST, SPI_MODE0);
+}
+
+#if defined(GB_SPI_DMA)
+
+// Clock the DMAC and set up the two channels (once)
+void GB_SPI::_dmacinit() {
+    if (this->_dmac) return;
+
+    PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+    PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+
+    DMAC->CTRL.reg &= ~DMAC_CTRL_DMAENABLE;
+    DMAC->CTRL.reg = DMAC_CTRL_SWRST;
+    while (DMAC->CTRL.reg & DMAC_CTRL_SWRST);
+    DMAC->BASEADDR.reg = (uint32_t) _gb_spi_descriptors;
+    DMAC->WRBADDR.reg = (uint32_t) _gb_spi_writeback;
+    DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xF);
+
+    this->_channel(GB_SPI_RX, GB_SPI_TRIGGER_RX, true);
+    this->_channel(GB_SPI_TX, GB_SPI_TRIGGER_TX, false);
+
+    NVIC_ClearPendingIRQ(DMAC_IRQn);
+    NVIC_EnableIRQ(DMAC_IRQn);
+    this->_dmac = true;
+}
+
+// One beat per trigger of the SERCOM
+void GB_SPI::_channel(uint8_t channel, uint8_t trigger, bool interrupt) {
+    DMAC->CHID.reg = DMAC_CHID_ID(channel);
+    DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+    while (DMAC->CHCTRLA.reg & DMAC_CHCTRLA_SWRST);
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(0) | DMAC_CHCTRLB_TRIGSRC(trigger) | DMAC_CHCTRLB_TRIGACT_BEAT;
+    if (interrupt) DMAC->CHINTENSET.reg = DMAC_CHINTENSET_TCMPL | DMAC_CHINTENSET_TERR;
+}
+
+// Point the descriptors at the buffers (end addresses where the address increments) and go
+void GB_SPI::_start(const uint8_t *tx, uint8_t *rx, size_t count) {
+    uint32_t data = (uint32_t) &GB_SPI_SERCOM->SPI.DATA.reg;
+
+    DmacDescriptor &receiver = _gb_spi_descriptors[GB_SPI_RX];
+    receiver.BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE | (rx ? DMAC_BTCTRL_DSTINC : 0);
+    receiver.BTCNT.reg = count;
+    receiver.SRCADDR.reg = data;
+    receiver.DSTADDR.reg = rx ? (uint32_t) (rx + count) : (uint32_t) &this->_sink;
+    receiver.DESCADDR.reg = 0;
+
+    DmacDescriptor &transmitter = _gb_spi_descriptors[GB_SPI_TX];
+    transmitter.BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE | (tx ? DMAC_BTCTRL_SRCINC : 0);
+    transmitter.BTCNT.reg = count;
+    transmitter.SRCADDR.reg = tx ? (uint32_t) (tx + count) : (uint32_t) &this->_idle;
+    transmitter.DSTADDR.reg = data;
+    transmitter.DESCADDR.reg = 0;
+
+    // Drop what the polled bytes left in the receiver
+    while (GB_SPI_SERCOM->SPI.INTFLAG.bit.RXC) (void) GB_SPI_SERCOM->SPI.DATA.reg;
+    GB_SPI_SERCOM->SPI.STATUS.reg = SERCOM_SPI_STATUS_BUFOVF;
+
+    this->_busy = true;
+    this->_pending = true;
+    this->_error = false;
+    this->_transfers++;
+    this->_bytes += count;
+    this->_started = micros();
+
+    // The receiver first, so it's armed for the first byte out
+    DMAC->CHID.reg = DMAC_CHID_ID(GB_SPI_RX);
+    DMAC->CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+    DMAC->CHID.reg = DMAC_CHID_ID(GB_SPI_TX);
+    DMAC->CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+}
+
+void GB_SPI::_stop() {
+    DMAC->CHID.reg = DMAC_CHID_ID(GB_SPI_TX);
+    DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+    DMAC->CHID.reg = DMAC_CHID_ID(GB_SPI_RX);
+    DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+}
+
+// Completion (or a bus error) of the receive channel
+extern "C" void DMAC_Handler(void) {
+    GB_SPI &spi = GB_SPI::bus();
+    uint8_t active = DMAC->CHID.reg;
+
+    DMAC->CHID.reg = DMAC_CHID_ID(GB_SPI_RX);
+    uint8_t flags = DMAC->CHINTFLAG.reg;
+    DMAC->CHINTFLAG.reg = flags;
+
+    if (flags & DMAC_CHINTFLAG_TERR) {
+        spi._stop();
+        spi._error = true;
+    }
+    if (flags & (DMAC_CHINTFLAG_TCMPL | DMAC_CHINTFLAG_TERR)) {
+        spi._finished = micros();
+        spi._busy = false;
+    }
+
+    DMAC->CHID.reg = active;
+}
+
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,192 @@
+#ifndef GB_SAMPLER_h
+#define GB_SAMPLER_h
+
+#ifndef GB_h
+    #include "../GB.h"
+#endif
+
+/*
+    ! Adaptive sampling
+    Watches the recent signal of the registered sensors (channels) and sets the sampling interval.
+    When a channel's rate of change or its (exponentially weighted) standard deviation crosses its
+    threshold, the interval drops to the minimum. It stays there for a few samples and then decays
+    back (multiplicatively) to the baseline.
+
+    The interval is published to gb.globals.ADAPTIVE_SLEEP_DURATION, which is used by the
+    microcontroller's sleep in place of SLEEP_DURATION. It can also be passed to a piper.
+
+    Control variables (control/variables.ini). Missing or non-positive values keep the defaults.
+        SMP_BASE_INTERVAL           Baseline interval (ms)
+        SMP_MIN_INTERVAL            Interval during an event (ms)
+        SMP_DECAY                   Factor by which the interval grows back per calm sample (> 1)
+        SMP_HOLD                    Number of calm samples before the interval starts decaying
+        <NAME>_RATE_THRESHOLD       Rate of change (units/second) that triggers an event
+        <NAME>_SD_THRESHOLD         Standard deviation that triggers an event
+
+    Usage:
+        sampler.watch("WLEV", 0.01, 0.2).watch("RAIN", 0.005, 0).configure(gb.controls);
+        sampler.add("WLEV", eadc.getdepth(0));
+        wlevpiper.pipe(sampler.interval(), ...);
+*/
+class GB_SAMPLER {
+    public:
+        GB_SAMPLER(GB &gb);
+
+        DEVICE device = {
+            "sampler",
+            "GatorByte Adaptive Sampler"
+        };
+
+        GB_SAMPLER& configure(unsigned long base_ms, unsigned long min_ms);
+        GB_SAMPLER& configure(JSONary controls);
+        GB_SAMPLER& watch(String name, float rate_threshold, float stddev_threshold);
+        GB_SAMPLER& add(String name, float value);
+        GB_SAMPLER& add(String name, GB_DEVICE *device);
+
+        unsigned long interval();
+        bool triggered();
+
+    private:
+        GB *_gb;
+
+        struct CHANNEL {
+            String name = "";
+            float rate_threshold = 0;
+            float stddev_threshold = 0;
+            bool primed = false;
+            float last = 0;
+            unsigned long lastat = 0;
+            float mean = 0;
+            float variance = 0;
+        };
+        static const uint8_t MAX_CHANNELS = 6;
+        CHANNEL _channels[MAX_CHANNELS];
+        uint8_t _channel_count = 0;
+
+        unsigned long _base_ms = 10 * 60 * 1000UL;
+        unsigned long _min_ms = 60 * 1000UL;
+        float _decay = 1.5;
+        int _hold = 3;
+
+        unsigned long _interval = 10 * 60 * 1000UL;
+        int _hold_left = 0;
+        bool _triggered = false;
+
+        CHANNEL* _channel(String name);
+        void _update(bool triggered);
+};
+
+GB_SAMPLER::GB_SAMPLER(GB &gb) {
+    _gb = &gb;
+}
+
+// Set the baseline and the event intervals (milliseconds)
+GB_SAMPLER& GB_SAMPLER::configure(unsigned long base_ms, unsigned long min_ms) {
+    this->_base_ms = base_ms;
+    this->_min_ms = min(min_ms, base_ms);
+    if (this->_hold_left == 0) this->_interval = this->_base_ms;
+    return *this;
+}
+
+// Read the limits and the thresholds from the control variables
+GB_SAMPLER& GB_SAMPLER::configure(JSONary controls) {
+    unsigned long base_ms = controls.getint("SMP_BASE_INTERVAL") > 0 ? controls.getint("SMP_BASE_INTERVAL") : this->_base_ms;
+    unsigned long min_ms = controls.getint("SMP_MIN_INTERVAL") > 0 ? controls.getint("SMP_MIN_INTERVAL") : this->_min_ms;
+    if (controls.getfloat("SMP_DECAY") > 1) this->_decay = controls.getfloat("SMP_DECAY");
+    if (controls.getint("SMP_HOLD") > 0) this->_hold = controls.getint("SMP_HOLD");
+
+    for (uint8_t i = 0; i < this->_channel_count; i++) {
+        CHANNEL &channel = this->_channels[i];
+        if (controls.getfloat(channel.name + "_RATE_THRESHOLD") > 0) channel.rate_threshold = controls.getfloat(channel.name + "_RATE_THRESHOLD");
+        if (controls.getfloat(channel.name + "_SD_THRESHOLD") > 0) channel.stddev_threshold = controls.getfloat(channel.name + "_SD_THRESHOLD");
+    }
+
+    return this->configure(base_ms, min_ms);
+}
+
+/*
+    Register a channel
+    A threshold of 0 disables that check
+*/
+GB_SAMPLER& GB_SAMPLER::watch(String name, float rate_threshold, float stddev_threshold) {
+    CHANNEL *channel = this->_channel(name);
+    if (channel == NULL) {
+        if (this->_channel_count == MAX_CHANNELS) return *this;
+        channel = &this->_channels[this->_channel_count++];
+        channel->name = name;
+    }
+    channel->rate_threshold = rate_threshold;
+    channel->stddev_threshold = stddev_threshold;
+    return *this;
+}
+
+// Feed a sample of a channel
+GB_SAMPLER& GB_SAMPLER::add(String name, float value) {
+    CHANNEL *channel = this->_channel(name);
+    if (channel == NULL) return *this;
+
+    unsigned long now = millis();
+    bool triggered = false;
+
+    if (channel->primed) {
+
+        // Rate of change (units/second)
+        float seconds = (now - channel->lastat) / 1000.0;
+        if (seconds > 0 && channel->rate_threshold > 0 && fabs(value - channel->last) / seconds >= channel->rate_threshold) triggered = true;
+
+        // Exponentially weighted mean and variance
+        float alpha = 0.3;
+        float delta = value - channel->mean;
+        channel->mean += alpha * delta;
+        channel->variance = (1 - alpha) * (channel->variance + alpha * delta * delta);
+        if (channel->stddev_threshold > 0 && sqrt(channel->variance) >= channel->stddev_threshold) triggered = true;
+    }
+    else {
+        channel->mean = value;
+        channel->variance = 0;
+        channel->primed = true;
+    }
+
+    channel->last = value;
+    channel->lastat = now;
+
+    this->_update(triggered);
+    return *this;
+}
+
+// Feed a reading from a sensor (readsensor())
+GB_SAMPLER& GB_SAMPLER::add(String name, GB_DEVICE *device) {
+    return this->add(name, device->readsensor());
+}
+
+// Current sampling interval (milliseconds)
+unsigned long GB_SAMPLER::interval() {
+    return this->_interval;
+}
+
+// Check if the last sample triggered an event
+bool GB_SAMPLER::triggered() {
+    return this->_triggered;
+}
+
+GB_SAMPLER::CHANNEL* GB_SAMPLER::_channel(String name) {
+    for (uint8_t i = 0; i < this->_channel_count; i++) if (this->_channels[i].name == name) return &this->_channels[i];
+    return NULL;
+}
+
+// Drop to the event interval on a trigger; otherwise hold, then decay back to the baseline
+void GB_SAMPLER::_update(bool triggered) {
+    this->_triggered = triggered;
+
+    if (triggered) {
+        if (this->_interval != this->_min_ms) _gb->log("Event detected. Sampling interval: " + String(this->_min_ms / 1000) + " seconds");
+        this->_interval = this->_min_ms;
+        this->_hold_left = this->_hold;
+    }
+    else if (this->_hold_left > 0) this->_hold_left--;
+    else this->_interval = min((unsigned long) (this->_interval * this->_decay), this->_base_ms);
+
+    _gb->globals.ADAPTIVE_SLEEP_DURATION = this->_interval;
+}
+
+#endif
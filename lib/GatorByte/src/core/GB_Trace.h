@@ -0,0 +1,255 @@
+#ifndef GB_TRACE_h
+#define GB_TRACE_h
+
+#ifndef GB_h
+    #include "../GB.h"
+#endif
+
+#define TRACE_CHANNELS 8
+#define TRACE_FOLDER "/traces/"
+
+/*
+    ! Trace replay
+    Backs sensors with traces recorded on the SD card instead of the hardware, so that a sketch can be
+    run end to end (warm-up and stability loops, power hooks, storage, upload) with reproducible data.
+    Enabled with "mode = trace" in the config. Sensors without a trace file use the hardware.
+
+    Trace files (TRACE_FOLDER):
+        <device id>.csv         One reading per line; multi-value sensors use one column per value
+                                (e.g. aht.csv: temperature,humidity)
+        gps.nmea                NMEA sentences as received from the module
+
+    Each read (begin()) takes the next line and wraps around at the end of the file, so the same trace
+    always produces the same readings. A comment line at the top of the file sets the model:
+        # latency=900, warmup=30000, offset=0.4
+
+        latency     Delay added to each sub-read (ms); the bus and conversion time of the real sensor
+        warmup      Warm-up time constant (ms); a sub-read t ms after begin() returns
+                    value + offset * e^(-t / warmup), which drives the drivers' convergence loops
+        offset      Warm-up starting offset (units of the first column)
+
+    The replay runs on the device, in real time: the latency is a delay() and the warm-up is measured
+    with millis(), so a traced run takes as long as it would with the hardware. The SD card is left
+    in the power state the replay found it in.
+
+    Usage (drivers):
+        if (GB_TRACE::replay().traced(this->device.id)) return GB_TRACE::replay().next(this->device.id);
+*/
+class GB_TRACE {
+    public:
+        DEVICE device = {
+            "trace",
+            "GatorByte Trace Replay"
+        };
+
+        static GB_TRACE& replay();
+
+        GB_TRACE& attach(GB &gb);
+        bool traced(String id);
+        GB_TRACE& begin(String id);
+        float next(String id);
+        float next(String id, uint8_t column);
+        String line(String id);
+        String status();
+
+    private:
+        GB *_gb = NULL;
+
+        struct CHANNEL {
+            String id = "";
+            String path = "";
+            bool available = false;
+            uint32_t position = 0;
+            String row = "";
+            unsigned long started = 0;
+            unsigned long latency = 0;
+            unsigned long warmup = 0;
+            float offset = 0;
+            uint32_t rows = 0;
+            uint32_t reads = 0;
+            uint32_t waited = 0;
+        };
+        CHANNEL _channels[TRACE_CHANNELS];
+        uint8_t _count = 0;
+
+        CHANNEL* _channel(String id);
+        void _open(CHANNEL &channel);
+        String _readline(CHANNEL &channel);
+        String _column(String row, uint8_t column);
+        String _setting(String header, String key);
+};
+
+// The replay is shared by all the devices
+GB_TRACE& GB_TRACE::replay() {
+    static GB_TRACE instance;
+    return instance;
+}
+
+GB_TRACE& GB_TRACE::attach(GB &gb) {
+    _gb = &gb;
+    return *this;
+}
+
+// Check if a device is backed by a trace (trace mode is on and the device has a trace file)
+bool GB_TRACE::traced(String id) {
+    if (_gb == NULL || _gb->globals.MODE != "trace") return false;
+
+    CHANNEL *channel = this->_channel(id);
+    return channel != NULL && channel->available;
+}
+
+// Start a read: take the next line of the trace and restart the warm-up
+GB_TRACE& GB_TRACE::begin(String id) {
+    if (!this->traced(id)) return *this;
+
+    CHANNEL *channel = this->_channel(id);
+    channel->row = this->_readline(*channel);
+    channel->started = millis();
+    channel->rows++;
+    return *this;
+}
+
+float GB_TRACE::next(String id) {
+    return this->next(id, 0);
+}
+
+// Take a sub-read of the current line (a column of a multi-value trace)
+float GB_TRACE::next(String id, uint8_t column) {
+    if (!this->traced(id)) return -1;
+
+    CHANNEL *channel = this->_channel(id);
+    if (channel->rows == 0) this->begin(id);
+
+    delay(channel->latency);
+    channel->waited += channel->latency;
+    channel->reads++;
+
+    String cell = this->_column(channel->row, column);
+    if (cell.length() == 0) return -1;
+
+    float value = cell.toFloat();
+    if (channel->warmup > 0 && column == 0) value += channel->offset * exp(-(float) (millis() - channel->started) / channel->warmup);
+    return value;
+}
+
+// Take the next raw line of the trace (e.g. an NMEA sentence)
+String GB_TRACE::line(String id) {
+    if (!this->traced(id)) return "";
+
+    this->begin(id);
+    CHANNEL *channel = this->_channel(id);
+    delay(channel->latency);
+    channel->waited += channel->latency;
+    channel->reads++;
+    return channel->row;
+}
+
+// Lines, sub-reads and the modeled latency per traced device
+String GB_TRACE::status() {
+    String status = "";
+    for (uint8_t i = 0; i < this->_count; i++) {
+        CHANNEL &channel = this->_channels[i];
+        if (!channel.available) continue;
+        status += (status.length() > 0 ? ", " : "") + channel.id + ": " + String(channel.rows) + " lines, " + String(channel.reads) + " reads, " + String(channel.waited / 1000.0) + " s";
+    }
+    return status.length() > 0 ? status : "none";
+}
+
+// Find a device's channel; the trace file is looked up the first time
+GB_TRACE::CHANNEL* GB_TRACE::_channel(String id) {
+    for (uint8_t i = 0; i < this->_count; i++) if (this->_channels[i].id == id) return &this->_channels[i];
+    if (this->_count == TRACE_CHANNELS) return NULL;
+
+    CHANNEL &channel = this->_channels[this->_count++];
+    channel.id = id;
+    this->_open(channel);
+    return &channel;
+}
+
+// Look up the trace file and read the model from its header
+void GB_TRACE::_open(CHANNEL &channel) {
+    if (!_gb->hasdevice("sd")) return;
+    bool powered = _gb->getdevice("sd")->ison();
+
+    String csv = TRACE_FOLDER + channel.id + ".csv";
+    String nmea = TRACE_FOLDER + channel.id + ".nmea";
+    if (_gb->getdevice("sd")->exists(csv)) channel.path = csv;
+    else if (_gb->getdevice("sd")->exists(nmea)) channel.path = nmea;
+
+    bool found = false;
+    String header = "";
+    if (channel.path.length() > 0) {
+        File file = _gb->getdevice("sd")->openFile("read", channel.path);
+        if (file) {
+            header = file.readStringUntil('\n');
+            file.close();
+            found = true;
+        }
+    }
+    if (!powered) _gb->getdevice("sd")->off();
+    if (!found) return;
+
+    if (header.startsWith("#")) {
+        if (this->_setting(header, "latency").length() > 0) channel.latency = this->_setting(header, "latency").toInt();
+        if (this->_setting(header, "warmup").length() > 0) channel.warmup = this->_setting(header, "warmup").toInt();
+        if (this->_setting(header, "offset").length() > 0) channel.offset = this->_setting(header, "offset").toFloat();
+    }
+
+    channel.available = true;
+    _gb->log("Replaying " + channel.id + " from " + channel.path + " (latency: " + String(channel.latency) + " ms, warm-up: " + String(channel.warmup) + " ms)");
+}
+
+// Read the line at the channel's position, skipping comments and blank lines; wraps around at the end
+String GB_TRACE::_readline(CHANNEL &channel) {
+    bool powered = _gb->getdevice("sd")->ison();
+    File file = _gb->getdevice("sd")->openFile("read", channel.path);
+    if (!file) {
+        if (!powered) _gb->getdevice("sd")->off();
+        return "";
+    }
+
+    String line = "";
+    bool wrapped = false;
+    file.seek(channel.position);
+    while (true) {
+        if (!file.available()) {
+            if (wrapped) break;
+            wrapped = true;
+            file.seek(0);
+        }
+        line = file.readStringUntil('\n');
+        line.trim();
+        if (line.length() > 0 && !line.startsWith("#")) break;
+        line = "";
+    }
+    channel.position = file.position();
+
+    file.close();
+    if (!powered) _gb->getdevice("sd")->off();
+    return line;
+}
+
+String GB_TRACE::_column(String row, uint8_t column) {
+    int start = 0;
+    for (uint8_t i = 0; i < column; i++) {
+        start = row.indexOf(',', start) + 1;
+        if (start == 0) return "";
+    }
+    int end = row.indexOf(',', start);
+    String cell = row.substring(start, end == -1 ? row.length() : end);
+    cell.trim();
+    return cell;
+}
+
+// Value of a "key=value" setting in a header line
+String GB_TRACE::_setting(String header, String key) {
+    int start = header.indexOf(key + "=");
+    if (start == -1) return "";
+    start += key.length() + 1;
+    int end = header.indexOf(',', start);
+    String value = header.substring(start, end == -1 ? header.length() : end);
+    value.trim();
+    return value;
+}
+
+#endif
\ No newline at end of file
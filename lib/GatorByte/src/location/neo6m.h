@@ -7,6 +7,10 @@
     #include "../GB.h"
 #endif
 
+#ifndef GB_TRACE_h
+    #include "../core/GB_Trace.h"
+#endif
+
 struct GPS_DATA {
     bool has_fix;
     bool valid;
@@ -210,6 +214,7 @@ GB_NEO_6M& GB_NEO_6M::on(String type) {
 GB_NEO_6M& GB_NEO_6M::on() {
     this->on("comm");
     this->on("power");
+    GB_ENERGY::meter().on(GB_ENERGY::GPS);
     return *this;
 }
 
@@ -233,6 +238,7 @@ GB_NEO_6M& GB_NEO_6M::off(String type) {
 GB_NEO_6M& GB_NEO_6M::off() {
     this->off("comm");
     this->off("power");
+    GB_ENERGY::meter().off(GB_ENERGY::GPS);
     return *this;
 }
 
@@ -259,7 +265,8 @@ GPS_DATA GB_NEO_6M::read(bool dummy) {
     _gb->log("Reading " + this->device.name, false);
 
     // Dummy data requested?
-    dummy = dummy || _gb->globals.MODE == "dummy" || _gb->env() == "development";
+    bool traced = GB_TRACE::replay().traced(this->device.id);
+    dummy = dummy || _gb->globals.MODE == "dummy" || (_gb->env() == "development" && !traced);
 
     if (dummy) {
         _gb->arrow().log("Dummy data");
@@ -269,8 +276,11 @@ GPS_DATA GB_NEO_6M::read(bool dummy) {
     }
     else {
 
+        // A traced GPS is always present
+        if (traced) this->device.detected = true;
+
         // Return if the devices file on SD does not contain gps
-        if (_gb->globals.DEVICES_LIST.indexOf("gps") == -1) {
+        if (!traced && _gb->globals.DEVICES_LIST.indexOf("gps") == -1) {
             _gb->arrow().log("Not found in config.");
             return this->data; 
         };
@@ -331,6 +341,17 @@ float GB_NEO_6M::speed() {
 // Read the GPS data
 void GB_NEO_6M::_read_nmea() {
 
+    // Replay the trace: feed sentences up to the end of the next fix (RMC)
+    if (GB_TRACE::replay().traced(this->device.id)) {
+        for (int i = 0; i < 20; i++) {
+            String sentence = GB_TRACE::replay().line(this->device.id);
+            for (unsigned int j = 0; j < sentence.length(); j++) _neo.encode(sentence[j]);
+            _neo.encode('\r'); _neo.encode('\n');
+            if (sentence.indexOf("RMC,") != -1) break;
+        }
+        return;
+    }
+
     // Clear the serial buffer
     for (unsigned long start = millis(); millis() - start < 500;) while (_gb->serial.hardware->available()) char c = _gb->serial.hardware->read();
 
@@ -398,7 +419,7 @@ bool GB_NEO_6M::_update() {
         )
     ) {
 
-        bool dummy = _gb->env() == "development";
+        bool dummy = _gb->env() == "development" && !GB_TRACE::replay().traced(this->device.id);
         if (dummy) {
             _gb->arrow().log("Dummy data");
             this->data = this->_dummydata;
@@ -43,6 +43,22 @@
     #include "../core/GB_Piper.h"
 #endif
 
+#ifndef GB_INDICATOR_h
+    #include "../core/GB_Indicator.h"
+#endif
+
+#ifndef GB_ENERGY_h
+    #include "../core/GB_Energy.h"
+#endif
+
+#ifndef GB_I2C_h
+    #include "../core/GB_I2C.h"
+#endif
+
+#ifndef GB_TRACE_h
+    #include "../core/GB_Trace.h"
+#endif
+
 #ifndef _MKRNB_H_INCLUDED
     #include "MKRNB.h"
 #endif
@@ -115,6 +131,7 @@ class GB_NB1500 : public GB_MCU {
         String gettime();
         String geticcid();
         int getrssi();
+        int getrsrq();
         bool getfplmn();
         bool clearfplmn();
         
@@ -187,6 +204,7 @@ class GB_NB1500 : public GB_MCU {
         uint8_t CELL_SIGNAL_LOWER_BOUND = 5;
         uint8_t REBOOTCOUNTER = 0;
         int RSSI = 0;
+        int RSRQ = 255;
         uint8_t CELL_FAILURE_COUNT_LIMIT = 3;
 
     private:
@@ -224,6 +242,7 @@ class GB_NB1500 : public GB_MCU {
         String _sara_at_command(String);
         void _sleep(String, int);
         void _sleep(int);
+        void _sleepcue(int);
         bool _register_network();
         bool _attach_gprs();
 
@@ -235,6 +254,10 @@ GB_NB1500::GB_NB1500(GB &gb) {
     this->_gb = &gb;
     // this->_gb->includelibrary(this->device.id, this->device.name);
     this->_gb->devices.mcu = this;
+    GB_ENERGY::meter().attach(gb);
+    GB_I2C::bus().attach(gb);
+    GB_TRACE::replay().attach(gb);
+    GB_FAULTS::injector().attach(gb);
     
     // Set Serial channels
     this->_gb->serial = {&Serial, &Serial1};
@@ -547,6 +570,22 @@ int GB_NB1500::getrssi() {
     return rssi;
 }
 
+/*
+    ! Signal quality (AT+CESQ)
+    Gets the reference signal received quality (RSRQ); the fifth field of the response.
+    0 to 34 map to -19.5 dB to -2.5 dB in 0.5 dB steps, 255 if not known.
+*/
+int GB_NB1500::getrsrq() {
+    String cesq = this->_sara_at_command("AT+CESQ");
+
+    int rsrq = 255;
+    for (int i = 0; i < 4 && cesq.indexOf(",") != -1; i++) cesq = cesq.substring(cesq.indexOf(",") + 1);
+    if (cesq.indexOf(",") != -1) rsrq = cesq.substring(0, cesq.indexOf(",")).toInt();
+    
+    this->RSRQ = rsrq;
+    return rsrq;
+}
+
 /*
     ! FPLMN list
     nbAccess.begin doesn't work if FPLMN is not empty. So, first let's make sure to see if the list
@@ -724,6 +763,7 @@ bool GB_NB1500::connect(bool diagnostics) {
     */
     if(_gb->globals.OFFLINE_MODE) {
         _nbAccess.shutdown();
+        GB_ENERGY::meter().off(GB_ENERGY::MODEM);
         MODEM_INITIALIZED = false;
         CONNECTED_TO_NETWORK = false;
         CONNECTED_TO_INTERNET = false;
@@ -745,6 +785,7 @@ bool GB_NB1500::connect(bool diagnostics) {
     /*
         ! Go through pre-connection checklist
     */
+    GB_ENERGY::meter().on(GB_ENERGY::MODEM);
     MODEM_INITIALIZED = this->checklist("iccid");
     
     /*
@@ -950,6 +991,7 @@ bool GB_NB1500::disconnect(String type) {
         _gb->log("Shutting down MODEM", false);
         if (MODEM_INITIALIZED) {
             bool success = _nbAccess.secureShutdown();
+            GB_ENERGY::meter().off(GB_ENERGY::MODEM);
             MODEM_INITIALIZED = false;
             CONNECTED_TO_NETWORK = false;
             CONNECTED_TO_INTERNET = false;
@@ -1082,7 +1124,9 @@ void GB_NB1500::_sleep(String level, int milliseconds) {
     // Deduce sleep duration from the last timestamp when readings were taken
     _gb->br().log("Seconds since last reading: " + String(_gb->globals.SECONDS_SINCE_LAST_READING) + " seconds");
     
-    milliseconds = _gb->globals.SLEEP_DURATION - _gb->globals.SECONDS_SINCE_LAST_READING * 1000;
+    // The adaptive sampler (if used) overrides the configured sleep duration
+    int duration = _gb->globals.ADAPTIVE_SLEEP_DURATION > 0 ? _gb->globals.ADAPTIVE_SLEEP_DURATION : _gb->globals.SLEEP_DURATION;
+    milliseconds = duration - _gb->globals.SECONDS_SINCE_LAST_READING * 1000;
 
     // Deduct setup from the sleep time
     milliseconds -= _gb->globals.SETUPDELAY * 1000;
@@ -1104,7 +1148,7 @@ void GB_NB1500::_sleep(String level, int milliseconds) {
     */
     if (milliseconds > 1000000000) {
         _gb->br().log("Sleep duration is too large. Setting sleep duration to as specified in the config file.");
-        milliseconds = _gb->globals.SLEEP_DURATION;
+        milliseconds = duration;
     }
 
     this->LAST_SLEEP_DURATION = milliseconds;
@@ -1148,7 +1192,10 @@ void GB_NB1500::_sleep(String level, int milliseconds) {
 
         _gb->log("Entering 'daydream' sleep mode.");
         
-        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->rainbow(milliseconds);
+        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->rainbow(0);
+        delay(milliseconds);
+        GB_INDICATOR::engine().cancel();
+        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->off();
         _gb->log("Exiting 'daydream' sleep mode.");
     }
     
@@ -1159,7 +1206,9 @@ void GB_NB1500::_sleep(String level, int milliseconds) {
     else if (level == "reset") {
 
         _gb->log("Entering 'fake' and reset sleep mode.");
-        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->rainbow(milliseconds);
+        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->rainbow(0);
+        delay(milliseconds);
+        GB_INDICATOR::engine().cancel();
         _gb->log("Exiting 'fake' and reset sleep mode."); delay(2000);
         _gb->getmcu()->reset("mcu");
     }
@@ -1184,12 +1233,14 @@ void GB_NB1500::_sleep(String level, int milliseconds) {
     */
     else if (level == "deep") {
 
-        //! RGB rainbow
-        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->rainbow(5000).off();
+        //! Sleep cue
+        this->_sleepcue(2000);
 
+        GB_ENERGY::meter().save().sleep(milliseconds);
         USBDevice.detach();
         LowPower.deepSleep(milliseconds);
         USBDevice.attach();
+        GB_ENERGY::meter().wake();
     }
     
     /*
@@ -1205,12 +1256,14 @@ void GB_NB1500::_sleep(String level, int milliseconds) {
     */
     else if (level == "shallow") {
 
-        //! RGB rainbow
-        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->rainbow(5000).off();
+        //! Sleep cue
+        this->_sleepcue(2000);
 
+        GB_ENERGY::meter().save().sleep(milliseconds);
         USBDevice.detach();
         LowPower.sleep(milliseconds);
         USBDevice.attach();
+        GB_ENERGY::meter().wake();
     }
     
     /*
@@ -1223,10 +1276,12 @@ void GB_NB1500::_sleep(String level, int milliseconds) {
     */
     else if (level == "idle") {
 
-        //! RGB rainbow
-        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->rainbow(3000).off();
+        //! Sleep cue
+        this->_sleepcue(3000);
 
+        GB_ENERGY::meter().save().sleep(milliseconds);
         LowPower.idle(milliseconds);
+        GB_ENERGY::meter().wake();
     }
     
     /*
@@ -1235,8 +1290,8 @@ void GB_NB1500::_sleep(String level, int milliseconds) {
     */
     else if (level == "delay") {
 
-        //! RGB rainbow
-        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->rainbow(1000).off();
+        //! Sleep cue
+        this->_sleepcue(1000);
 
         // this->_sara_at_command("AT+CSPSM");
         delay(milliseconds);
@@ -1244,6 +1299,18 @@ void GB_NB1500::_sleep(String level, int milliseconds) {
     }
 }
 
+/*
+    Show the rainbow before sleeping
+    The cue is only played when someone is on site (USB or GDC connected) and the indicator policy
+    allows it, so unattended devices go to sleep right away. The timer is stopped before sleeping.
+*/
+void GB_NB1500::_sleepcue(int milliseconds) {
+    if (!_gb->USB_CONNECTED && !_gb->globals.GDC_CONNECTED) milliseconds = 0;
+    if (milliseconds > 0 && _gb->hasdevice("rgb")) _gb->getdevice("rgb")->rainbow(milliseconds);
+    GB_INDICATOR::engine().drain(milliseconds + 500).cancel();
+    if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->off();
+}
+
 void GB_NB1500::watchdog(String action) { 
     if (action == "enable") this->watchdog(action, 16 * 1000);
     else if (action == "reset") this->watchdog(action, 16 * 1000);
@@ -7,6 +7,8 @@
     #include "../GB.h"
 #endif
 
+#define EADC_RING_LENGTH 64
+
 class GB_EADC : public GB_DEVICE {
     public:
         GB_EADC(GB &gb);
@@ -21,9 +23,15 @@ class GB_EADC : public GB_DEVICE {
             int enable;
         } pins;
 
+        enum FILTER { BOXCAR, CIC };
+
         GB_EADC& initialize();
         GB_EADC& configure(PINS);
+        GB_EADC& continuous(int alertpin, uint8_t datarate);
+        GB_EADC& oversample(uint8_t samples, uint8_t filter, bool median);
         uint16_t readchannel(uint8_t);
+        float readfiltered(uint8_t);
+        bool poll();
         uint16_t getreading(uint8_t);
         float getdepth(uint8_t);
 
@@ -49,8 +57,32 @@ class GB_EADC : public GB_DEVICE {
         int DENSITY_FLUID = 1;
         int PRINT_INTERVAL = 1000;
         float ADC_VDD_VALUE = 32767.0;
+
+        // Continuous-conversion path; the ALERT/RDY interrupt flags a conversion and poll() reads it
+        static GB_EADC *_active;
+        static void _onready();
+        volatile uint8_t _ready = 0;
+        volatile int16_t _ring[EADC_RING_LENGTH];
+        volatile uint8_t _ring_head = 0;
+        volatile uint8_t _ring_count = 0;
+        volatile bool _ring_skip = false;
+
+        int _alert_pin = -1;
+        uint8_t _datarate = ADS1115_DR_860_SPS;
+        uint8_t _pga = ADS1115_PGA_2_048;
+        uint8_t _samples = 16;
+        uint8_t _filter = BOXCAR;
+        bool _median = false;
+
+        uint16_t _config(uint8_t mux, uint8_t mode);
+        int _rate();
+        float _scale();
+        float _decimate(int32_t *samples, uint8_t count);
+        float _depth(float value);
 };
 
+GB_EADC* GB_EADC::_active = NULL;
+
 // Constructor 
 GB_EADC::GB_EADC(GB &gb) {
     this->_gb = &gb;
@@ -131,6 +163,7 @@ GB_EADC& GB_EADC::initialize() {
 GB_EADC&  GB_EADC::on() { 
     if(this->pins.mux) _gb->getdevice("ioe")->writepin(this->pins.enable, HIGH);
     else digitalWrite(this->pins.enable, HIGH);
+    GB_ENERGY::meter().on(GB_ENERGY::EADC);
     this->_ison = true;
     delay(100);
     return *this;
@@ -141,6 +174,7 @@ GB_EADC&  GB_EADC::off() {
     if (this->_persistent) return *this;
     if(this->pins.mux) _gb->getdevice("ioe")->writepin(this->pins.enable, LOW);
     else digitalWrite(this->pins.enable, LOW);
+    GB_ENERGY::meter().off(GB_ENERGY::EADC);
     this->_ison = false;
     return *this;
 }
@@ -194,6 +228,184 @@ uint16_t GB_EADC::readchannel(uint8_t input) {
     return value;
 }
 
+/*
+    ! Continuous conversion
+    Sets up the continuous-conversion path. The ADS1115's ALERT/RDY pin (open drain) is used as a
+    conversion-ready signal; the interrupt only flags the conversion and poll() reads it into a ring
+    buffer over I2C, outside the interrupt. readfiltered() and getdepth() then use oversampled,
+    filtered readings instead of single shots.
+
+    The data rate is one of the ADS1115_DR_* values (e.g. ADS1115_DR_860_SPS).
+*/
+GB_EADC& GB_EADC::continuous(int alertpin, uint8_t datarate) {
+    this->_alert_pin = alertpin;
+    this->_datarate = datarate;
+    pinMode(alertpin, INPUT_PULLUP);
+    return *this;
+}
+
+/*
+    Number of conversions per filtered reading (1 - 64) and the decimation filter
+    BOXCAR averages the conversions; CIC applies a third-order CIC (sinc^3) decimator, which
+    rejects noise above the output rate better at the same number of conversions.
+    median: a 3-point median runs over the conversions first to reject single-conversion spikes
+*/
+GB_EADC& GB_EADC::oversample(uint8_t samples, uint8_t filter, bool median) {
+    this->_samples = constrain(samples, 1, EADC_RING_LENGTH);
+    this->_filter = filter;
+    this->_median = median;
+    return *this;
+}
+
+/*
+    ! Read filtered channel
+    Reads an oversampled, filtered value from the provided channel (0 - 3), in the same units as
+    readchannel(). The ADS1115 converts continuously only while the conversions are being collected
+    and returns to single-shot (power-down) mode afterwards.
+
+    Falls back to readchannel() if the continuous path isn't set up or no ALERT/RDY interrupts arrive.
+*/
+float GB_EADC::readfiltered(uint8_t input) {
+
+    // Return if input channel number is out of range (0 - 3)
+    if (input > 3) return -1;
+    if (this->_alert_pin < 0) return this->readchannel(input);
+
+    if(this->pins.mux) _gb->getdevice("ioe")->writepin(this->pins.enable, HIGH);
+    else digitalWrite(this->pins.enable, HIGH);
+
+    // Conversion-ready mode: MSB of the high threshold set, MSB of the low threshold cleared
+    this->_eadc.setHighTreshold(0x8000);
+    this->_eadc.setLowTreshold(0x0000);
+
+    // The first conversion after the configuration change is dropped
+    this->_ring_head = 0;
+    this->_ring_count = 0;
+    this->_ring_skip = true;
+    this->_ready = 0;
+
+    GB_EADC::_active = this;
+    attachInterrupt(digitalPinToInterrupt(this->_alert_pin), GB_EADC::_onready, FALLING);
+    this->_eadc.writeRegister(ADS1115_CONFIG_REG_ADDR, this->_config(input + 4, ADS1115_MODE_CONTINOUS));
+
+    // Sleep between the conversions; twice the expected time before giving up
+    unsigned long timeout = (this->_samples + 1) * 2000UL / this->_rate() + 50;
+    unsigned long start = millis();
+    while (this->_ring_count < this->_samples && millis() - start < timeout) {
+        if (this->poll()) continue;
+        #if defined (ARDUINO_ARCH_SAMD)
+            __WFI();
+        #endif
+    }
+
+    detachInterrupt(digitalPinToInterrupt(this->_alert_pin));
+    GB_EADC::_active = NULL;
+    this->_eadc.writeRegister(ADS1115_CONFIG_REG_ADDR, this->_config(input + 4, ADS1115_MODE_SINGLE));
+
+    uint8_t count = this->_ring_count;
+    if (count == 0) {
+        _gb->log("No conversion-ready interrupts from " + this->device.name + ". Using single-shot readings.");
+        this->_alert_pin = -1;
+        return this->readchannel(input);
+    }
+
+    // Latest conversions, oldest first
+    int32_t samples[EADC_RING_LENGTH];
+    for (uint8_t i = 0; i < count; i++) samples[i] = this->_ring[(this->_ring_head + EADC_RING_LENGTH - count + i) % EADC_RING_LENGTH];
+
+    // 3-point median
+    if (this->_median && count >= 3) {
+        int32_t previous = samples[0];
+        for (uint8_t i = 1; i < count - 1; i++) {
+            int32_t current = samples[i];
+            samples[i] = max(min(previous, current), min(max(previous, current), samples[i + 1]));
+            previous = current;
+        }
+    }
+
+    return this->_decimate(samples, count) * this->_scale();
+}
+
+// Conversion-ready interrupt; no I2C here, the main code may be in the middle of a transaction
+void GB_EADC::_onready() {
+    GB_EADC *eadc = GB_EADC::_active;
+    if (eadc != NULL && eadc->_ready < 255) eadc->_ready++;
+}
+
+/*
+    Reads a flagged conversion into the ring buffer. Returns false if no conversion is pending.
+    The conversion register only holds the latest conversion, so several pending flags give one reading.
+*/
+bool GB_EADC::poll() {
+    if (this->_ready == 0) return false;
+
+    noInterrupts();
+    this->_ready = 0;
+    interrupts();
+
+    int16_t value = (int16_t) this->_eadc.readRawValue();
+    if (this->_ring_skip) {
+        this->_ring_skip = false;
+        return true;
+    }
+
+    this->_ring[this->_ring_head] = value;
+    this->_ring_head = (this->_ring_head + 1) % EADC_RING_LENGTH;
+    if (this->_ring_count < EADC_RING_LENGTH) this->_ring_count++;
+    return true;
+}
+
+// Configuration register; the comparator asserts ALERT/RDY after every conversion in continuous mode
+uint16_t GB_EADC::_config(uint8_t mux, uint8_t mode) {
+    uint8_t queue = mode == ADS1115_MODE_CONTINOUS ? ADS1115_COMP_QUE_ONE_CONV : ADS1115_COMP_QUE_DISABLE;
+    return (mux << ADS1115_MUX0_DAT_POS) | (this->_pga << ADS1115_PGA0_DAT_POS) | (mode << ADS1115_MODE_FLAG_POS) | (this->_datarate << ADS1115_DR0_DAT_POS) | queue;
+}
+
+// Samples per second of the configured data rate
+int GB_EADC::_rate() {
+    const int rates[] = { 8, 16, 32, 64, 128, 250, 475, 860 };
+    return rates[this->_datarate & 0b111];
+}
+
+// Same multiplier the driver's readConvertedValue() applies
+float GB_EADC::_scale() {
+    switch (this->_pga) {
+        case ADS1115_PGA_0_256: return ADS1115_PGA_0_256_MULT;
+        case ADS1115_PGA_0_512: return ADS1115_PGA_0_512_MULT;
+        case ADS1115_PGA_1_024: return ADS1115_PGA_1_024_MULT;
+        case ADS1115_PGA_2_048: return ADS1115_PGA_2_048_MULT;
+        case ADS1115_PGA_4_096: return ADS1115_PGA_4_096_MULT;
+        case ADS1115_PGA_6_144: return ADS1115_PGA_6_144_MULT;
+        default: return 1.0;
+    }
+}
+
+/*
+    Reduce the conversions to one value
+    CIC: three cascaded integrators (in place) and a comb with delay R, normalized by R^3. R is chosen
+    so that the filter's response (3R - 2 conversions) fits in the conversions collected. With at most
+    64 conversions of 15 bits, the integrators stay within 32 bits.
+*/
+float GB_EADC::_decimate(int32_t *samples, uint8_t count) {
+    if (this->_filter == CIC && count >= 4) {
+        int32_t r = (count + 2) / 3;
+        for (uint8_t stage = 0; stage < 3; stage++) {
+            for (uint8_t i = 1; i < count; i++) samples[i] += samples[i - 1];
+        }
+
+        int n = count - 1;
+        int32_t y = samples[n];
+        if (n - r >= 0) y -= 3 * samples[n - r];
+        if (n - 2 * r >= 0) y += 3 * samples[n - 2 * r];
+        if (n - 3 * r >= 0) y -= samples[n - 3 * r];
+        return (float) y / (r * r * r);
+    }
+
+    int32_t sum = 0;
+    for (uint8_t i = 0; i < count; i++) sum += samples[i];
+    return (float) sum / count;
+}
+
 uint16_t GB_EADC::getreading(uint8_t channel) {
 
     // Read ADC channel; channel is a integer {0, 1, 2, 3}
@@ -206,7 +418,13 @@ float GB_EADC::getdepth(uint8_t channel) {
     // _gb->log("Reading depth (" + String(channel) + ")", false);
 
     // Read ADC channel; channel is a integer {0, 1, 2, 3}
-    int16_t value = this->readchannel(channel);
+    float value = this->readfiltered(channel);
+
+    return this->_depth(value);
+}
+
+// Convert a channel reading to depth (inches)
+float GB_EADC::_depth(float value) {
 
     // Convert the ADC reading to voltage (mV)
     float voltage = (value / ADC_VDD_VALUE) * VREF;
@@ -222,8 +440,6 @@ float GB_EADC::getdepth(uint8_t channel) {
 
     // Ignore invalid readings
     if (depth < 0) depth = 0.0;
-    
-    // _gb->arrow().log("" + String(depth));
 
     return depth;
 }
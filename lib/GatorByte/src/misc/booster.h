@@ -54,12 +54,14 @@ GB_BOOSTER& GB_BOOSTER::configure(PINS pins) {
 GB_BOOSTER& GB_BOOSTER::on() {
     if(this->pins.mux) _gb->getdevice("ioe")->writepin(this->pins.enable, HIGH);
     else digitalWrite(this->pins.enable, HIGH);
+    GB_ENERGY::meter().on(GB_ENERGY::BOOSTER);
     return *this;
 }
 
 GB_BOOSTER& GB_BOOSTER::off() {
     if(this->pins.mux) _gb->getdevice("ioe")->writepin(this->pins.enable, LOW);
     else digitalWrite(this->pins.enable, LOW);
+    GB_ENERGY::meter().off(GB_ENERGY::BOOSTER);
     return *this;
 }
 
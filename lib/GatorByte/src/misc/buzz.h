@@ -5,8 +5,6 @@
     #include "../GB.h"
 #endif
 
-#include "buzzer.h"
-
 #define NOTE_B0  31
 #define NOTE_C1  33
 #define NOTE_CS1 35
@@ -120,7 +118,6 @@ class GB_BUZZER : public GB_DEVICE {
 
     private:
         GB *_gb;
-        Buzzer *_buzzer = new Buzzer();
         
         GB_BUZZER& _beep(int frequency, int on, int off);
 };
@@ -130,6 +127,7 @@ GB_BUZZER::GB_BUZZER(GB &gb) {
     _gb = &gb;
     _gb->includelibrary(this->device.id, this->device.name);
     _gb->devices.buzzer = this;
+    GB_INDICATOR::engine().attach(gb);
 }
 
 GB_BUZZER& GB_BUZZER::configure(PINS pins) {
@@ -149,8 +147,8 @@ GB_BUZZER& GB_BUZZER::initialize() {
     // Add the device to included devices list
     _gb->includedevice(this->device.id, this->device.name);
 
-    _buzzer = new Buzzer(this->pins.tone);
-    _buzzer->begin(10);
+    // Patterns are played by the indicator engine
+    GB_INDICATOR::engine().sound(this->pins.tone);
 
     this->device.detected = true;
     
@@ -172,19 +170,17 @@ String GB_BUZZER::status() {
     return this->device.detected ? "detected" : "not-detected" + String(":") + device.id;
 }
 
+// Queue a tone and the silence after it (returns immediately)
 GB_BUZZER& GB_BUZZER::_beep(int frequency, int on_duration, int off_duration) {
-    // analogWrite(this->pins.tone, frequency * 1.0 / 10000 * 255);
-    // delay(on_duration);
-    // analogWrite(this->pins.tone, frequency / 10000 * 0);
-    // delay(off_duration);
-
-    _buzzer->sound(frequency, on_duration);
-    _buzzer->end(off_duration);
-    
-
+    GB_INDICATOR::engine().note(frequency, on_duration);
+    if (off_duration > 0) GB_INDICATOR::engine().note(0, off_duration);
     return *this;
 }
 
+/*
+    Play a pattern (in the background)
+    '-' long, 'x' short with a long pause, '.' short, ',' very short
+*/
 GB_BUZZER& GB_BUZZER::play(String pattern) {
     pattern.toLowerCase();
     
@@ -210,8 +206,9 @@ GB_BUZZER& GB_BUZZER::play(String pattern) {
     return *this;
 }
 
+// Queue a silence between patterns
 GB_BUZZER& GB_BUZZER::wait(int milliseconds) {
-    delay(milliseconds);
+    GB_INDICATOR::engine().note(0, milliseconds);
     return *this;
 }
 
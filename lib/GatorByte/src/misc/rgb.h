@@ -35,8 +35,10 @@ class GB_RGB : public GB_DEVICE {
         bool testdevice();
         String status();
 
-        GB_RGB& blink(String, uint8_t, uint16_t, uint16_t);
-        GB_RGB& rainbow(uint32_t milliseconds);
+        GB_RGB& blink(String color, int count, int on_duration, int off_duration);
+        GB_RGB& rainbow(int milliseconds);
+        GB_RGB& rainbow(int milliseconds, bool wait);
+        GB_RGB& flash(uint8_t identifier, int milliseconds);
 
 
         struct colorinfo  {
@@ -65,6 +67,9 @@ class GB_RGB : public GB_DEVICE {
             float brightness;
         };
         GB_RGB& _set(STATE);
+        GB_RGB& _queue(STATE, int milliseconds, bool fade);
+        STATE _color(String color, float brightness);
+        String _name(uint8_t identifier);
 
         STATE _state = {0,0,0,0};
         STATE _prevstate = {0,0,0,0};
@@ -75,6 +80,7 @@ GB_RGB::GB_RGB(GB &gb) {
     _gb = &gb;
     _gb->includelibrary(this->device.id, this->device.name);
     _gb->devices.rgb = this;
+    GB_INDICATOR::engine().attach(gb);
 }
 
 GB_RGB& GB_RGB::configure(PINS pins) {
@@ -85,10 +91,17 @@ GB_RGB& GB_RGB::configure(PINS pins) {
     pinMode(this->pins.green, OUTPUT);
     pinMode(this->pins.blue, OUTPUT);
 
+    // Patterns are played by the indicator engine
+    GB_INDICATOR::engine().led(this->pins.red, this->pins.green, this->pins.blue);
+
     return *this;
 }
 
 GB_RGB& GB_RGB::_set(STATE state) {
+
+    // A color set directly replaces the pattern being played
+    GB_INDICATOR::engine().cancel(GB_INDICATOR::LED);
+
     analogWrite(this->pins.red, state.red * 255 * state.brightness);
     analogWrite(this->pins.green, state.green * 255 * state.brightness);
     analogWrite(this->pins.blue, state.blue * 255 * state.brightness);
@@ -97,6 +110,16 @@ GB_RGB& GB_RGB::_set(STATE state) {
     return *this;
 }
 
+/*
+    Queue a state on the indicator engine (returns immediately)
+    The state is recorded as the current one so that off() and revert() behave as if it was set directly.
+*/
+GB_RGB& GB_RGB::_queue(STATE state, int milliseconds, bool fade) {
+    GB_INDICATOR::engine().color(state.red * 255 * state.brightness, state.green * 255 * state.brightness, state.blue * 255 * state.brightness, milliseconds, fade);
+    this->_state = state;
+    return *this;
+}
+
 GB_RGB& GB_RGB::revert() {
     this->_set(this->_prevstate);
     return *this;
@@ -106,19 +129,23 @@ GB_RGB& GB_RGB::revert() {
     Set color using the colors' identifiers
 */
 GB_RGB& GB_RGB::on(uint8_t identifier) {
+    String name = this->_name(identifier);
+    if (name.length() > 0) this->on(name);
+    return *this;
+}
+
+String GB_RGB::_name(uint8_t identifier) {
     for (const auto& color : this->colormap) {
-        if (identifier == color.identifier) {
-            this->on(color.name);
-            break;
-        }
+        if (identifier == color.identifier) return color.name;
     }
-    return *this;
+    return "";
 }
 
 /*
     Set color using the individual RGB values (0-255)
 */
 GB_RGB& GB_RGB::on(uint8_t red, uint8_t green, uint8_t blue) {
+    GB_INDICATOR::engine().cancel(GB_INDICATOR::LED);
     analogWrite(this->pins.red, red);
     analogWrite(this->pins.green, green);
     analogWrite(this->pins.blue, blue);
@@ -138,14 +165,12 @@ GB_RGB& GB_RGB::initialize(float brightness) {
     if (brightness > 255) brightness = 255;
     if (brightness < 0) brightness = 0;
 
-    // Cycle through primary colors
-    this->on(1); delay(200);
-    this->on(2); delay(200);
-    this->on(3); delay(200);
-
-    // Blink white 2 times
-    this->on(8); delay(200);
-    this->off();
+    // Cycle through primary colors and white (in the background)
+    this->_queue(this->_color("red", 80), 200, false);
+    this->_queue(this->_color("green", 80), 200, false);
+    this->_queue(this->_color("blue", 80), 200, false);
+    this->_queue(this->_color("white", 80), 200, false);
+    this->_queue({this->_state.red, this->_state.green, this->_state.blue, 0}, 0, false);
 
     return *this;
 }
@@ -176,42 +201,35 @@ GB_RGB& GB_RGB::on(String color) { this->on(color, 80); return *this;}
 GB_RGB& GB_RGB::on(String color, float brightness) {
 
     this->_prevstate = this->_state;
+    this->_set(this->_color(color, brightness));
+    return *this;
+}
+
+/*
+    Resolve a color name and brightness (0-255) to a state
+    Unknown colors resolve to the current color turned off.
+*/
+GB_RGB::STATE GB_RGB::_color(String color, float brightness) {
 
     // Calculate brightness
     if (brightness > 255) brightness = 255;
     if (brightness < 0) brightness = 0;
     brightness = brightness / 255.0;
 
-    this->off();
-    if (color == "red") {
-        this->_set({1, 0, 0, brightness});
-    }
-    else if (color == "green") {
-        this->_set({0, 1, 0, brightness});
-    }
-    else if (color == "blue") {
-        this->_set({0, 0, 1, brightness});
-    }
-    else if (color == "white") {
-        this->_set({1, 1, 1, brightness});
-    }
+    if (color == "red") return {1, 0, 0, brightness};
+    else if (color == "green") return {0, 1, 0, brightness};
+    else if (color == "blue") return {0, 0, 1, brightness};
+    else if (color == "white") return {1, 1, 1, brightness};
 
     // The following colors are not available in low power mode
     #if not defined (LOW_MEMORY_MODE)
-        else if (color == "cyan") {
-            this->_set({0, 1, 1, brightness});
-        }
-        else if (color == "magenta") {
-            this->_set({1, 0, 1, brightness});
-        }
-        else if (color == "grass") {
-            this->_set({0, 1, 20/255, brightness});
-        }
-        else if (color == "yellow") {
-            this->_set({1, 1, 0, brightness});
-        }
+        else if (color == "cyan") return {0, 1, 1, brightness};
+        else if (color == "magenta") return {1, 0, 1, brightness};
+        else if (color == "grass") return {0, 1, 20/255, brightness};
+        else if (color == "yellow") return {1, 1, 0, brightness};
     #endif
-    return *this;
+
+    return {this->_state.red, this->_state.green, this->_state.blue, 0};
 }
 
 GB_RGB& GB_RGB::off() {
@@ -219,55 +237,46 @@ GB_RGB& GB_RGB::off() {
     return *this;
 }
 
-GB_RGB& GB_RGB::blink(String color, uint8_t count, uint16_t on_duration, uint16_t off_duration) {
+// Blink a color (in the background)
+GB_RGB& GB_RGB::blink(String color, int count, int on_duration, int off_duration) {
+    STATE state = this->_color(color, 80);
+    STATE dark = {state.red, state.green, state.blue, 0};
 
-    this->off(); delay(200);
-    for (uint8_t i = 0; i < count; i++) {
-        this->on(color); delay(on_duration);
-        if (i < count - 1) this->off(); 
-        delay(off_duration);
+    this->_queue(dark, 200, false);
+    for (int i = 0; i < count; i++) {
+        this->_queue(state, on_duration, false);
+        this->_queue(dark, off_duration, false);
     }
-    this->off(); delay(100);
     return *this;
 }
 
-GB_RGB& GB_RGB::rainbow(uint32_t milliseconds) {
+/*
+    Cross-fade red, green and blue (in the background)
+    milliseconds = 0 means infinite duration (until another color is set or the engine is cancelled)
+*/
+GB_RGB& GB_RGB::rainbow(int milliseconds) {
+    this->_queue({1, 0, 0, 1}, 1275, true);
+    this->_queue({0, 1, 0, 1}, 1275, true);
+    this->_queue({0, 0, 1, 1}, 1275, true);
+    GB_INDICATOR::engine().repeat(GB_INDICATOR::LED, milliseconds);
+
+    // The engine turns the LED off at the end
+    this->_state.brightness = 0;
+    return *this;
+}
 
-    uint32_t now = millis();
-    while (true) {
-        
-        // milliseconds = 0 means infinite duration
-        if (milliseconds > 0 && millis() - now >= milliseconds) break;
-        else {
-
-            // // Loop mqtt     
-            // if (this->_gb->hasdevice("mqtt")) this->_gb->getdevice("mqtt").update();
-        }
-
-        //! Fade RGB light
-        unsigned int rgbColour[3];
-
-        // Start off with red.
-        rgbColour[0] = 255;
-        rgbColour[1] = 0;
-        rgbColour[2] = 0;  
-
-        // Choose the colours to increment and decrement.
-        for (int decColour = 0; decColour < 3; decColour += 1) {
-            int incColour = decColour == 2 ? 0 : decColour + 1;
-
-            // cross-fade the two colours.
-            for(int i = 0; i < 255; i += 1) {
-                rgbColour[decColour] -= 1;
-                rgbColour[incColour] += 1;
-                
-                this->on(rgbColour[0], rgbColour[1], rgbColour[2]);
-                delay(5);
-            }
-        }
-    }
-    
-    this->off(); delay(100);
+// Cross-fade for the given duration before returning, for a cue the next color would cut short
+GB_RGB& GB_RGB::rainbow(int milliseconds, bool wait) {
+    this->rainbow(milliseconds);
+    if (wait && milliseconds > 0) GB_INDICATOR::engine().drain(milliseconds + 100);
+    return *this;
+}
+
+// Show a color briefly and go back to the current one (in the background)
+GB_RGB& GB_RGB::flash(uint8_t identifier, int milliseconds) {
+    STATE current = this->_state;
+    this->_queue(this->_color(this->_name(identifier), 80), milliseconds, false);
+    this->_queue(current, 0, false);
     return *this;
 }
 
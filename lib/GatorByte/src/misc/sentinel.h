@@ -604,23 +604,13 @@ uint16_t GB_SNTL::tell(int data, int attempts) {
 */
 uint16_t GB_SNTL::ask() { 
 
-    // Reset mux
-    if (this->pins.commux) _gb->getdevice("tca")->resetmux();
-    
-    // Select I2C mux channel
-    if (this->pins.commux) _gb->getdevice("tca")->selectexclusive(pins.muxchannel);
-
-    // Request first byte from Sentinel
-    Wire.requestFrom(this->_address, 1);
+    // I2C mux channel (the bus manager only writes the mux if the channel changed)
+    int8_t channel = this->pins.commux ? this->pins.muxchannel : -1;
 
-    // Read low byte
-    delay(50); byte low = Wire.read();
-    
-    // Request second byte from Sentinel
-    Wire.requestFrom(this->_address, 1);
-
-    // Read high byte
-    delay(50); byte high = Wire.read();
+    // Request the low byte, then the high byte, from Sentinel (0xFF if not received)
+    byte low = 0xFF, high = 0xFF;
+    GB_I2C::bus().request(channel, this->_address, &low, 1); delay(50);
+    GB_I2C::bus().request(channel, this->_address, &high, 1); delay(50);
 
     uint16_t response = (high << 8) | low;
 
@@ -769,11 +759,8 @@ uint16_t GB_SNTL::_tell(int data, int maxattempts, int currentattempt) {
         _gb->log(String(data) + ": " + String(numberofattempts <= 3 ? 250 : (numberofattempts <= 6 ? 250 : (numberofattempts <= 10 ? 500 : (numberofattempts <= 12 ? 1500 : 2000)))) + ": ", false);
     }
     
-    // Reset mux
-    if (this->pins.commux) _gb->getdevice("tca")->resetmux();
-    
-    // Select I2C mux channel
-    if (this->pins.commux) _gb->getdevice("tca")->selectexclusive(pins.muxchannel);
+    // I2C mux channel (the bus manager only writes the mux if the channel changed)
+    int8_t channel = this->pins.commux ? this->pins.muxchannel : -1;
     
     // If maximum number of attempts have been made, return.
     if (currentattempt < 0) return 1;
@@ -785,9 +772,7 @@ uint16_t GB_SNTL::_tell(int data, int maxattempts, int currentattempt) {
 
     // Try sending/resending the data
     delay(100);
-    Wire.beginTransmission(this->_address);
-    Wire.write(b);
-    Wire.endTransmission();
+    GB_I2C::bus().write(channel, this->_address, &b, 1);
     delay(10);
 
     if (!this->_no_ack) {
@@ -807,9 +792,7 @@ uint16_t GB_SNTL::_tell(int data, int maxattempts, int currentattempt) {
             delay(1000);
 
             // Send command again
-            Wire.beginTransmission(this->_address);
-            Wire.write(b);
-            Wire.endTransmission();
+            GB_I2C::bus().write(channel, this->_address, &b, 1);
             delay(10);
             uint16_t x = this->ask();
             return x;
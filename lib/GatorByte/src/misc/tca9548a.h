@@ -83,39 +83,14 @@ GB_TCA9548A& GB_TCA9548A::initialize() {
 /*
     ! Exclusive channel select
     Selects a channel exclusively in the multiplexer. Provide a channel number between 0 and 7.
+    The I2C bus manager keeps track of the selected channel; the mux is only written on a change.
 */
 void GB_TCA9548A::selectexclusive(int channel) {
 
-    bool log = false;
-
     // Return if invalid channel number was provided
     if (channel < 0 || channel > 7) return; 
 
-    if (log) _gb->log("Exclusively selecting channel: " + String(channel), false);
-
-    // Select single channel
-    bool success = false; int counter = 3;
-    while (!success && counter-- > 0) {
-        Wire.beginTransmission(this->_tca_address);
-        Wire.write(1 << channel);
-        success = Wire.endTransmission() == 0;
-    }
-
-    // Check if the channel was successfully selected
-    success = this->isselected(channel);
-
-    if (success) {
-
-        // Update control byte
-        this->_control_byte = 1 << channel;
-
-        if (log) _gb->arrow().log("Done (" + String(this->_control_byte) + ")");
-    }
-    else {
-        if (log) _gb->arrow().log("Failed");
-    }
-    
-    delay(25);
+    if (GB_I2C::bus().select(channel)) this->_control_byte = 1 << channel;
 
     return; 
 }
@@ -150,6 +125,7 @@ void GB_TCA9548A::select(int channel) {
 
         // Update control byte
         this->_control_byte |= 1 << channel;
+        GB_I2C::bus().selected(this->_control_byte);
 
         if (log) _gb->arrow().log("Done (" + String(this->_control_byte) + ")");
     }
@@ -188,14 +164,18 @@ void GB_TCA9548A::deselect() {
     while (!success && counter-- > 0) {
         Wire.beginTransmission(this->_tca_address);
         Wire.write(0);
-        success = Wire.endTransmission();
+        success = Wire.endTransmission() == 0;
 
         // Try resetting the TCA9548A
         if (!success) this->resetmux();
     }
 
-    // Update control byte
-    if (success) this->_control_byte = 0b0;
+    // Update control byte; the mux's state is unknown if the write didn't go through
+    if (success) {
+        this->_control_byte = 0b0;
+        GB_I2C::bus().selected(this->_control_byte);
+    }
+    else GB_I2C::bus().invalidate();
 
     delay(25);
 
@@ -216,6 +196,10 @@ void GB_TCA9548A::resetmux() {
     digitalWrite(this->pins.reset, HIGH);
     delay(25);
 
+    // All channels are deselected after a reset
+    this->_control_byte = 0b0;
+    GB_I2C::bus().selected(this->_control_byte);
+
     return; 
 }
 
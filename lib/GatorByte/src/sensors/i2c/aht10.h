@@ -9,6 +9,10 @@
     #include "../../lib/AHT10/src/AHT10.h"
 #endif
 
+#ifndef GB_TRACE_h
+    #include "../../core/GB_Trace.h"
+#endif
+
 class GB_AHT10 : public GB_DEVICE {
     public:
         GB_AHT10(GB&);
@@ -64,6 +68,7 @@ GB_AHT10& GB_AHT10::on() {
     delay(10);
     if(this->pins.mux) _gb->getdevice("ioe")->writepin(this->pins.enable, HIGH);
     else digitalWrite(this->pins.enable, HIGH);
+    GB_ENERGY::meter().on(GB_ENERGY::AHT);
     return *this;
 }
 
@@ -75,6 +80,7 @@ GB_AHT10& GB_AHT10::off() {
     delay(50);
     if(this->pins.mux) _gb->getdevice("ioe")->writepin(this->pins.enable, LOW);
     else digitalWrite(this->pins.enable, LOW);
+    GB_ENERGY::meter().off(GB_ENERGY::AHT);
     delay(10);
     return *this;
 }
@@ -137,7 +143,7 @@ GB_AHT10& GB_AHT10::_initialize(bool testdevice) {
             delay(2000); _gb->arrow().log(String(this->temperature()) + " Celcius and " + String(this->humidity()) + " % R.H."); 
             
             if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("---").wait(250).play("...");
-            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(2).wait(250).revert(); 
+            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->flash(2, 250); 
         }
         else {
             _gb->arrow().log("Not detected"); 
@@ -162,6 +168,14 @@ GB_AHT10& GB_AHT10::_initialize(bool testdevice) {
 
 float GB_AHT10::temperature() {
 
+    // Replay the trace instead of reading the sensor (first column; starts a new line)
+    if (GB_TRACE::replay().traced(this->device.id)) {
+        this->on();
+        float value = GB_TRACE::replay().begin(this->device.id).next(this->device.id, 0);
+        this->off();
+        return value;
+    }
+
     // If device wasn't initialized/detected
     if (!this->device.detected) this->_initialize(false);
 
@@ -188,6 +202,14 @@ float GB_AHT10::temperature() {
 
 float GB_AHT10::humidity() {
 
+    // Replay the trace instead of reading the sensor (second column of the current line)
+    if (GB_TRACE::replay().traced(this->device.id)) {
+        this->on();
+        float value = GB_TRACE::replay().next(this->device.id, 1);
+        this->off();
+        return value;
+    }
+
     // If device wasn't initialized/detected
     if (!this->device.detected) this->_initialize(false);
     
@@ -9,6 +9,14 @@
     #include "../../GB.h"
 #endif
 
+#ifndef GB_CONVERGENCE_h
+    #include "../../core/GB_Convergence.h"
+#endif
+
+#ifndef GB_TRACE_h
+    #include "../../core/GB_Trace.h"
+#endif
+
 class GB_AT_SCI_DO : public GB_DEVICE {
     public:
         GB_AT_SCI_DO(GB &gb);
@@ -36,10 +44,12 @@ class GB_AT_SCI_DO : public GB_DEVICE {
             int new_reading;
             int calibration_confirmation;
             int calibration_request;
+            int compensation_value;
+            int compensation_confirmation;
         };
 
         ADDRESSES addresses = {0x67};
-        REGISTERS registers = {0x22, 0x05, 0x06, 0x07, 0x09, 0x08};
+        REGISTERS registers = {0x22, 0x05, 0x06, 0x07, 0x09, 0x08, 0x12, 0x1E};
 
         GB_AT_SCI_DO& initialize();
         GB_AT_SCI_DO& initialize(bool testdevice);
@@ -59,6 +69,15 @@ class GB_AT_SCI_DO : public GB_DEVICE {
         float readsensor(String mode);
         float readsensor();
 
+        // Temperature compensation and reads that can run alongside other modules' (see GB_GRAPH)
+        GB_AT_SCI_DO& compensate(float temperature);
+        GB_AT_SCI_DO& startread();
+        bool pollread();
+        float finishread();
+
+        // Criteria for the "stability" and "iterations" modes; value and quality of the last read
+        GB_CONVERGENCE convergence;
+
     private:
         GB *_gb;
         GB_AT_SCI_DO& _initialize(bool testdevice);
@@ -67,6 +86,7 @@ class GB_AT_SCI_DO : public GB_DEVICE {
             long answ;
         } _acquired_data;
         bool _persistent = false;
+        float _temperature = NAN;
 
         float _sendCommand(String);
         void _write_byte(byte, byte);
@@ -76,11 +96,15 @@ class GB_AT_SCI_DO : public GB_DEVICE {
         void _led_control(String);
         int _calibrate(String, int value);
         float _read();
+        float _next();
+        void _compensate();
         bool _test_connection();
+        int8_t _channel();
 };
 
 GB_AT_SCI_DO::GB_AT_SCI_DO(GB &gb) {
     _gb = &gb;
+    this->convergence.attach(gb).configure(0.1, 0.05, 5, 20);
     _gb->includelibrary(this->device.id, this->device.name);
     _gb->devices.dox = this;
 }
@@ -126,7 +150,7 @@ GB_AT_SCI_DO& GB_AT_SCI_DO::_initialize (bool testdevice) {
             this->off();
             
             if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("..").wait(250).play("...");
-            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(2).wait(250).revert();
+            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->flash(2, 250);
         }
         else {
             _gb->arrow().log("Not detected");
@@ -146,6 +170,9 @@ GB_AT_SCI_DO& GB_AT_SCI_DO::configure(PINS pins, ADDRESSES addresses) {
     this->pins = pins;
     this->addresses = addresses;
 
+    // The OEM modules support fast mode (400 kHz)
+    GB_I2C::bus().clock(this->addresses.bus, 400000);
+
     // Set pin modes of the device
     if(!this->pins.pwrmux) pinMode(this->pins.enable, OUTPUT);
     
@@ -164,15 +191,13 @@ GB_AT_SCI_DO& GB_AT_SCI_DO::persistent() {
 GB_AT_SCI_DO& GB_AT_SCI_DO::on() {
     delay(2);
     
-    // Reset mux
-    _gb->getdevice("tca")->resetmux();
-
     // Power on the device
     if(this->pins.pwrmux) _gb->getdevice("ioe")->writepin(this->pins.enable, HIGH);
     else digitalWrite(this->pins.enable, HIGH);
+    GB_ENERGY::meter().on(GB_ENERGY::DOX);
 
-    // Select I2C mux channel
-    if(this->pins.commux) _gb->getdevice("tca")->selectexclusive(pins.muxchannel);;
+    // Select I2C mux channel (only written if the channel changed)
+    if(this->pins.commux) GB_I2C::bus().select(pins.muxchannel);
 
     delay(30);
 
@@ -185,6 +210,7 @@ GB_AT_SCI_DO& GB_AT_SCI_DO::off() {
     delay(30);
     if(this->pins.pwrmux) _gb->getdevice("ioe")->writepin(this->pins.enable, LOW);
     else digitalWrite(this->pins.enable, LOW);
+    GB_ENERGY::meter().off(GB_ENERGY::DOX);
     delay(2);
 
     return *this;
@@ -192,6 +218,7 @@ GB_AT_SCI_DO& GB_AT_SCI_DO::off() {
 
 // Activate the module
 GB_AT_SCI_DO& GB_AT_SCI_DO::activate() {
+    GB_TRACE::replay().begin(this->device.id);
     this->on();
     this->_write_byte(this->registers.hibernation, 0x01);
     this->_read_register(this->registers.hibernation, 0x01);
@@ -213,18 +240,93 @@ GB_AT_SCI_DO& GB_AT_SCI_DO::led(String state) {
     return *this;
 }
 
+/*
+    ! Temperature compensation
+    Sets the temperature (Celsius) the module compensates its readings for. It's pushed to the module at
+    the start of each read, since the compensation register isn't retained after a power off.
+    The RTD's failure value (-1) and temperatures outside -20 to 100 Celsius (e.g. a disconnected RTD)
+    are ignored; the module keeps the last valid temperature.
+*/
+GB_AT_SCI_DO& GB_AT_SCI_DO::compensate(float temperature) {
+    if (temperature == -1 || temperature < -20 || temperature > 100) return *this;
+    this->_temperature = max(temperature, (float) 0);
+    return *this;
+}
+
+/*
+    ! Overlapped reads
+    startread() powers up and activates the module; pollread() takes the module's new reading (if
+    there is one) without waiting and returns true once the readings have converged or the attempts
+    have run out; finishread() turns the module off and returns the value. GB_GRAPH uses these to read
+    several modules at the same time.
+*/
+GB_AT_SCI_DO& GB_AT_SCI_DO::startread() {
+
+    // If device wasn't initialized/detected
+    if (!this->device.detected) this->_initialize(false);
+
+    this->convergence.reset();
+    this->device.detected = this->_test_connection();
+    if (!this->device.detected) return *this;
+
+    this->on();
+    this->activate();
+    this->_compensate();
+    return *this;
+}
+
+bool GB_AT_SCI_DO::pollread() {
+    if (!this->device.detected) return true;
+
+    float value = this->_next();
+    if (value != -1 && this->convergence.add(value) && _gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(5).flash(2, 250);
+    return this->convergence.done();
+}
+
+float GB_AT_SCI_DO::finishread() {
+    if (!this->device.detected) {
+        _gb->log(this->device.name + " not detected");
+        return -1;
+    }
+
+    this->deactivate();
+    this->off();
+
+    GB_CONVERGENCE::RESULT result = this->convergence.result();
+    _gb->log(this->device.name + ": " + String(result.value) + " (n: " + String(result.n) + ", sd: " + String(result.stddev) + (result.converged ? ", converged" : "") + ", " + String(result.elapsed / 1000) + " seconds)");
+    return result.value;
+}
+
+// Push the compensation temperature to the module (value x 100) and check it
+void GB_AT_SCI_DO::_compensate() {
+    if (isnan(this->_temperature) || GB_TRACE::replay().traced(this->device.id)) return;
+
+    this->_write_long(this->registers.compensation_value, (unsigned long) (this->_temperature * 100 + 0.5));
+    this->_read_register(this->registers.compensation_confirmation, 0x04);
+    if (abs(_acquired_data.answ / 100.0 - this->_temperature) > 0.01) _gb->log("Temperature compensation failed (" + this->device.name + ")");
+}
+
 // Read the sensor
 float GB_AT_SCI_DO::_read() {
+    int DELAY_BETWEEN_SENSOR_READS = 420;
+
+    // Sensor's temporal resolution (from datasheet)
+    delay(DELAY_BETWEEN_SENSOR_READS);
+
+    return this->_next();
+}
+
+// Take the module's new reading if there is one (-1 otherwise)
+float GB_AT_SCI_DO::_next() {
+
+    // Replay the trace instead of reading the module
+    if (GB_TRACE::replay().traced(this->device.id)) return GB_TRACE::replay().next(this->device.id);
     
     // Enable watchdog
     _gb->getmcu()->watchdog("enable");
 
     float sensor_value = -1;
     float divident = 100;
-    int DELAY_BETWEEN_SENSOR_READS = 420;
-
-    // Sensor's temporal resolution (from datasheet)
-    delay(DELAY_BETWEEN_SENSOR_READS);
 
     this->_read_register(this->registers.new_reading, 0x01);
     bool new_data_available = _acquired_data.i2c_data[0];
@@ -291,7 +393,7 @@ float GB_AT_SCI_DO::readsensor() {
     _gb->log("Reading " + this->device.name + " (" + _gb->globals.SENSOR_MODE + ")", false);
     
     // Return a dummy value if "dummy" mode is on
-    bool dummy = _gb->env() == "development";
+    bool dummy = _gb->env() == "development" && !GB_TRACE::replay().traced(this->device.id);
     if (dummy || _gb->globals.MODE == "dummy") {
         float value = random(5, 29) + random(0, 100) / 100.00;
         _gb->arrow().log("Dummy value: " + String(value));
@@ -312,83 +414,41 @@ float GB_AT_SCI_DO::readsensor() {
     this->on();
     this->activate();
 
+    // Push the temperature compensation (the register isn't retained after a power off)
+    this->_compensate();
+
     // Variables
     String sensor_mode = _gb->globals.SENSOR_MODE;
     float sensor_value = -1;
-    float stability_delta = 0.1;
-    int min_stable_reading_count = 5;
-    float previous_reading = 0;
-    int stability_counter = 0;
-
-    // Determine number of times to read the sensor
     int NUMBER_OF_SENSOR_READS = 10;
-    int MAX_ATTEMPTS = 20;
-    int ATTEMPT_COUNT = 0;
-    
+
     // Get readings
     int timer = millis();
-    float min = 99, max = 0, avg = 0;
+    GB_CONVERGENCE::RESULT result;
 
     if (sensor_mode == "stability") {
-        
-        // Read sensors until readings are stable
-        while (stability_counter < min_stable_reading_count && ATTEMPT_COUNT++ < MAX_ATTEMPTS) {
-            
-            // Get updated sensor value
-            sensor_value = this->_read();
-
-            // Calculate statistics
-            if (sensor_value < min) min = sensor_value;
-            if (max < sensor_value) max = sensor_value;
-            avg = (avg * (ATTEMPT_COUNT - 1) + sensor_value) / ATTEMPT_COUNT;
-
-            // Check if the readings are stable
-            float difference = abs(sensor_value - previous_reading);
-            if (difference <= stability_delta) {
-                stability_counter++;
-                if (_gb->hasdevice("rgb")) { _gb->getdevice("rgb")->on(2); delay (250); _gb->getdevice("rgb")->on(5); }
-                if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play(".");
-            }
-            else {
-                stability_counter = 0;
-                if (_gb->hasdevice("rgb")) { _gb->getdevice("rgb")->on(6); delay (250); _gb->getdevice("rgb")->on(5); }
-                if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("-");
-            }
-            previous_reading = sensor_value;
-        }
-    }
 
+        // Read until the readings converge; a warming-up probe drifts and fails the slope criterion
+        result = this->convergence.read([this] () { return this->_read(); });
+    }
     else if (sensor_mode == "iterations") {
-        
-        // Read sensor a fixed number of times
-        for(int i = 0; i < NUMBER_OF_SENSOR_READS; i++, ATTEMPT_COUNT++) {
 
-            // Get sensor value
-            sensor_value = this->_read();
-
-            // Calculate statistics
-            if (sensor_value < min) min = sensor_value;
-            if (max < sensor_value) max = sensor_value;
-            avg = (avg * (ATTEMPT_COUNT - 1) + sensor_value) / ATTEMPT_COUNT;
-
-            // If max number of read attempts were made, exit
-            if (ATTEMPT_COUNT >= MAX_ATTEMPTS) {
-                i = NUMBER_OF_SENSOR_READS;
-            }
-        }
+        // Read a fixed number of times once the probe has warmed up
+        result = this->convergence.read([this] () { return this->_read(); }, NUMBER_OF_SENSOR_READS);
     }
 
     else if (sensor_mode == "single") {
             
         // Read sensor once
-        sensor_value = this->_read();
-        min = avg = max = sensor_value;
+        this->convergence.reset().add(this->_read());
+        result = this->convergence.result();
     }
 
     else _gb->arrow().color("red").log("Unknown mode.", false);
+    sensor_value = result.value;
     
     _gb->arrow().log("" + String(sensor_value) + (abs(sensor_value - 48) <= 1 ? " -> The sensor might not be connected." : "") + " (" + String((millis() - timer) / 1000) + " seconds)", false);
-    _gb->log(String(" -> ") + String(min) + " |--- " + String(avg) + " ---| " + String(max));
+    _gb->log(String(" -> ") + String(result.minimum) + " |--- " + String(result.value) + " ---| " + String(result.maximum) + " (n: " + String(result.n) + ", sd: " + String(result.stddev) + (result.converged ? ", converged" : "") + ")");
 
     // Deactivate and turn off
     this->deactivate();
@@ -414,17 +474,16 @@ int GB_AT_SCI_DO::calibrate(String action, int value) {
 
 // Write a byte to an OEM register
 void GB_AT_SCI_DO::_write_byte(byte reg, byte data) {
+    if (GB_TRACE::replay().traced(this->device.id)) return;
     this->on();
-    Wire.beginTransmission(this->addresses.bus);
-    Wire.write(reg);
-    Wire.write(data);
-    Wire.endTransmission();
+    byte bytes[2] = { reg, data };
+    GB_I2C::bus().write(this->_channel(), this->addresses.bus, bytes, 2);
     // this->off();
 }
 
 // Write a long to an OEM register
 void GB_AT_SCI_DO::_write_long(byte reg, unsigned long data) {
-    
+    if (GB_TRACE::replay().traced(this->device.id)) return;
     union local_sensor_mem_handler {
         byte bdata[4];
         long ldata;
@@ -432,34 +491,32 @@ void GB_AT_SCI_DO::_write_long(byte reg, unsigned long data) {
     _local_data.ldata = data;
     
     this->on();
-    Wire.beginTransmission(this->addresses.bus);
-    Wire.write(reg);
-    for (int i = 3; i >= 0; i--) Wire.write(_local_data.bdata[i]);
-    Wire.endTransmission();
+    byte bytes[5] = { reg, _local_data.bdata[3], _local_data.bdata[2], _local_data.bdata[1], _local_data.bdata[0] };
+    GB_I2C::bus().write(this->_channel(), this->addresses.bus, bytes, 5);
     // this->off();
 
 }
 
 // Read OEM device register
 void GB_AT_SCI_DO::_read_register(byte register_address, byte number_of_bytes_to_read) {
+    if (GB_TRACE::replay().traced(this->device.id)) return;
     this->on();
-    byte i;
-    Wire.beginTransmission(this->addresses.bus);
-    Wire.write(register_address);
-    Wire.endTransmission();
-
-    Wire.requestFrom(this->addresses.bus, (byte) number_of_bytes_to_read);
-    for (i = number_of_bytes_to_read; i > 0; i--){
-        // Byte 0 is LSB
-        byte data = Wire.read();
-        _acquired_data.i2c_data[i - 1] = data;
-    }
-    Wire.endTransmission();
+    byte bytes[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+    GB_I2C::bus().read(this->_channel(), this->addresses.bus, register_address, bytes, number_of_bytes_to_read);
+
+    // Byte 0 is LSB
+    for (byte i = number_of_bytes_to_read; i > 0; i--) _acquired_data.i2c_data[i - 1] = bytes[number_of_bytes_to_read - i];
     // this->off();
 }
 
+// I2C mux channel of the device (-1 if it isn't behind the mux)
+int8_t GB_AT_SCI_DO::_channel() {
+    return this->pins.commux ? this->pins.muxchannel : -1;
+}
+
 // Sensor info function
 bool GB_AT_SCI_DO::_test_connection() {
+    if (GB_TRACE::replay().traced(this->device.id)) return true;
     this->on();
     for (int i = 0; i < 3; i++) { delay(30); this->_read_register(this->registers.led, 0x01); }
     if (_acquired_data.i2c_data[0] <= 1) {
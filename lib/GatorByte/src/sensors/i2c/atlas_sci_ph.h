@@ -9,6 +9,14 @@
     #include "../../GB.h"
 #endif
 
+#ifndef GB_CONVERGENCE_h
+    #include "../../core/GB_Convergence.h"
+#endif
+
+#ifndef GB_TRACE_h
+    #include "../../core/GB_Trace.h"
+#endif
+
 class GB_AT_SCI_PH : public GB_DEVICE {
     public:
         GB_AT_SCI_PH(GB &gb);
@@ -62,8 +70,17 @@ class GB_AT_SCI_PH : public GB_DEVICE {
         float readsensor(String mode);
         float quickreadsensor(int times);
 
+        // Temperature compensation and reads that can run alongside other modules' (see GB_GRAPH)
+        GB_AT_SCI_PH& compensate(float temperature);
+        GB_AT_SCI_PH& startread();
+        bool pollread();
+        float finishread();
+
         bool stablereadings = false;
 
+        // Criteria for the "stability" and "iterations" modes; value and quality of the last read
+        GB_CONVERGENCE convergence;
+
     private:
         GB *_gb;
         GB_AT_SCI_PH& _initialize(bool testdevice);
@@ -73,6 +90,7 @@ class GB_AT_SCI_PH : public GB_DEVICE {
             float answf;
         } _acquired_data;
         bool _persistent = false;
+        float _temperature = NAN;
 
         void _write_byte(byte, byte);
         void _write_long(byte, unsigned long);
@@ -81,13 +99,16 @@ class GB_AT_SCI_PH : public GB_DEVICE {
         void _led_control(String);
         int _calibrate(String, int);
         float _read();
-        void _compensate(float value);
+        float _next();
+        void _compensate();
         bool _test_connection();
+        int8_t _channel();
 };
 
 
 GB_AT_SCI_PH::GB_AT_SCI_PH(GB &gb) {
     _gb = &gb;
+    this->convergence.attach(gb).configure(0.025, 0.01, 10, 40);
     _gb->includelibrary(this->device.id, this->device.name);
     _gb->devices.ph = this;
 }
@@ -133,7 +154,7 @@ GB_AT_SCI_PH& GB_AT_SCI_PH::_initialize (bool testdevice) {
             this->off();
             
             if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("..").wait(250).play("...");
-            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(2).wait(250).revert();
+            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->flash(2, 250);
         }
         else {
             _gb->arrow().log("Not detected");
@@ -153,6 +174,9 @@ GB_AT_SCI_PH& GB_AT_SCI_PH::configure(PINS pins, ADDRESSES addresses) {
     this->pins = pins;
     this->addresses = addresses;
 
+    // The OEM modules support fast mode (400 kHz)
+    GB_I2C::bus().clock(this->addresses.bus, 400000);
+
     // Set pin modes of the device
     if(!this->pins.pwrmux) pinMode(this->pins.enable, OUTPUT);
     
@@ -171,15 +195,13 @@ GB_AT_SCI_PH& GB_AT_SCI_PH::persistent() {
 GB_AT_SCI_PH& GB_AT_SCI_PH::on() {
     delay(2);
     
-    // Reset mux
-    _gb->getdevice("tca")->resetmux();
-
     // Power on the device
     if(this->pins.pwrmux) _gb->getdevice("ioe")->writepin(this->pins.enable, HIGH);
     else digitalWrite(this->pins.enable, HIGH);
+    GB_ENERGY::meter().on(GB_ENERGY::PH);
 
-    // Select I2C mux channel
-    if(this->pins.commux) _gb->getdevice("tca")->selectexclusive(pins.muxchannel);
+    // Select I2C mux channel (only written if the channel changed)
+    if(this->pins.commux) GB_I2C::bus().select(pins.muxchannel);
 
     delay(10);
 
@@ -193,12 +215,14 @@ GB_AT_SCI_PH& GB_AT_SCI_PH::off() {
     delay(10);
     if(this->pins.pwrmux) _gb->getdevice("ioe")->writepin(this->pins.enable, LOW);
     else digitalWrite(this->pins.enable, LOW);
+    GB_ENERGY::meter().off(GB_ENERGY::PH);
     delay(2);
     return *this;
 }
 
 // Activate the module
 GB_AT_SCI_PH& GB_AT_SCI_PH::activate() {
+    GB_TRACE::replay().begin(this->device.id);
     this->_write_byte(this->registers.hibernation, 0x01);
     this->_read_register(this->registers.hibernation, 0x01);
     delay(200);
@@ -218,50 +242,93 @@ GB_AT_SCI_PH& GB_AT_SCI_PH::led(String state) {
     return *this;
 }
 
-// Perform temperature compensation
 /*
-    TODO: Needs fixing
+    ! Temperature compensation
+    Sets the temperature (Celsius) the module compensates its readings for. It's pushed to the module at
+    the start of each read, since the compensation register isn't retained after a power off.
+    The RTD's failure value (-1) and temperatures outside -20 to 100 Celsius (e.g. a disconnected RTD)
+    are ignored; the module keeps the last valid temperature.
 */
-void GB_AT_SCI_PH::_compensate(float value) {
+GB_AT_SCI_PH& GB_AT_SCI_PH::compensate(float temperature) {
+    if (temperature == -1 || temperature < -20 || temperature > 100) return *this;
+    this->_temperature = max(temperature, (float) 0);
+    return *this;
+}
 
+/*
+    ! Overlapped reads
+    startread() powers up and activates the module; pollread() takes the module's new reading (if
+    there is one) without waiting and returns true once the readings have converged or the attempts
+    have run out; finishread() turns the module off and returns the value. GB_GRAPH uses these to read
+    several modules at the same time.
+*/
+GB_AT_SCI_PH& GB_AT_SCI_PH::startread() {
 
-    // The device must be active before compensation is applied
-    this->on();
+    // If device wasn't initialized/detected
+    if (!this->device.detected) this->_initialize(false);
 
-    // Set new compensation value
-    _acquired_data.answf = value;
-    // _gb->arrow().log("Temperature compensation: " + String(_acquired_data.answf), false);
-    this->_write_long(this->registers.compensation_value, _acquired_data.answ);
-    delay(200);
+    this->convergence.reset();
+    this->device.detected = this->_test_connection();
+    if (!this->device.detected) return *this;
 
+    this->on();
     this->activate();
-    
-    // Get compensation data from the OEM chip
-	float compensation;
-    this->_read_register(this->registers.compensation_confirmation, 0x04);
-    compensation = _acquired_data.answf;
-    _gb->arrow().log("" + String(compensation), false);
-    compensation /= 100;
-    _gb->arrow().log("" + String(compensation == value ? "Done" : "Failed"), false);
-
-    /* 
-        ! Do not turn off the device. The compensation register are NOT retained after a power off.
-    */
+    this->_compensate();
+    return *this;
+}
+
+bool GB_AT_SCI_PH::pollread() {
+    if (!this->device.detected) return true;
+
+    float value = this->_next();
+    if (value != -1 && this->convergence.add(value) && _gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(5).flash(2, 250);
+    return this->convergence.done();
+}
+
+float GB_AT_SCI_PH::finishread() {
+    if (!this->device.detected) {
+        _gb->log(this->device.name + " not detected");
+        return -1;
+    }
+
     this->deactivate();
+    this->off();
+
+    GB_CONVERGENCE::RESULT result = this->convergence.result();
+    _gb->log(this->device.name + ": " + String(result.value) + " (n: " + String(result.n) + ", sd: " + String(result.stddev) + (result.converged ? ", converged" : "") + ", " + String(result.elapsed / 1000) + " seconds)");
+    return result.value;
+}
+
+// Push the compensation temperature to the module (value x 100) and check it
+void GB_AT_SCI_PH::_compensate() {
+    if (isnan(this->_temperature) || GB_TRACE::replay().traced(this->device.id)) return;
+
+    this->_write_long(this->registers.compensation_value, (unsigned long) (this->_temperature * 100 + 0.5));
+    this->_read_register(this->registers.compensation_confirmation, 0x04);
+    if (abs(_acquired_data.answ / 100.0 - this->_temperature) > 0.01) _gb->log("Temperature compensation failed (" + this->device.name + ")");
 }
 
 // Read the sensor
 float GB_AT_SCI_PH::_read() {
+    int DELAY_BETWEEN_SENSOR_READS = 420;
+
+    // Sensor's temporal resolution (from datasheet)
+    delay(DELAY_BETWEEN_SENSOR_READS);
+
+    return this->_next();
+}
+
+// Take the module's new reading if there is one (-1 otherwise)
+float GB_AT_SCI_PH::_next() {
+
+    // Replay the trace instead of reading the module
+    if (GB_TRACE::replay().traced(this->device.id)) return GB_TRACE::replay().next(this->device.id);
     
     // Enable watchdog
     _gb->getmcu()->watchdog("enable");
 
     float sensor_value = -1;
     float divident = 1000;
-    int DELAY_BETWEEN_SENSOR_READS = 420;
-
-    // Sensor's temporal resolution (from datasheet)
-    delay(DELAY_BETWEEN_SENSOR_READS);
 
     this->_read_register(this->registers.new_reading, 0x01);
     bool new_data_available = _acquired_data.i2c_data[0];
@@ -381,7 +448,7 @@ float GB_AT_SCI_PH::readsensor() {
     _gb->log("Reading " + this->device.name + " (" + _gb->globals.SENSOR_MODE + ")", false);
 
     // Return a dummy value if "dummy" mode is on
-    bool dummy = _gb->env() == "development";
+    bool dummy = _gb->env() == "development" && !GB_TRACE::replay().traced(this->device.id);
     if (dummy || _gb->globals.MODE == "dummy") {
         float value = random(5, 29) + random(0, 100) / 100.00;
         _gb->arrow().log("Dummy value: " + String(value));
@@ -398,120 +465,46 @@ float GB_AT_SCI_PH::readsensor() {
         return -1;
     }
 
-    // _gb->log("Compensation temperature value: " + String(_gb->getdevice("rtd")->lastvalue()));
-    
-    // // Get temperature sensor value for compensation.
-    // this->_compensate(_gb->hasdevice("rtd") ? _gb->getdevice("rtd")->lastvalue() : 25) ;
-    
     // Turn on and activate
     this->on();
     this->activate();
 
+    // Push the temperature compensation (the register isn't retained after a power off)
+    this->_compensate();
+
     // Variables
     String sensor_mode = _gb->globals.SENSOR_MODE;
     float sensor_value = -1;
-    float stability_delta = 0.025;
-    int min_stable_reading_count = 10;
-    float previous_reading = 0;
-    int stability_counter = 0;
-    
-    // Variables
     int NUMBER_OF_SENSOR_READS = 20;
-    int MAX_ATTEMPTS = 40;
-    int ATTEMPT_COUNT = 0;
 
     // Get readings
     int timer = millis();
-    float min = 99, max = 0, avg = 0;
+    GB_CONVERGENCE::RESULT result;
 
     if (sensor_mode == "stability") {
-        
-        /*
-            If the mode is not 'persistent', pH module needs a 10 seconds warmup delay for accurate reading.
-        */
-        if (!this->_persistent) {
-            _gb->arrow().log("10 seconds warm-up delay", false);
-
-            int counter = 10;
-            while (counter-- >= 0) { 
-                delay(1000);
-            }
-        }
-
-        // Read sensors until readings are stable
-        while (stability_counter < min_stable_reading_count && ATTEMPT_COUNT++ < MAX_ATTEMPTS) {
-            
-            // Get updated sensor value
-            sensor_value = this->_read();
-
-            // Calculate statistics
-            if (sensor_value < min) min = sensor_value;
-            if (max < sensor_value) max = sensor_value;
-            avg = (avg * (ATTEMPT_COUNT - 1) + sensor_value) / ATTEMPT_COUNT;
-
-            // Check if the readings are stable
-            float difference = abs(sensor_value - previous_reading);
-            if (difference <= stability_delta) {
-                stability_counter++;
-                if (_gb->hasdevice("rgb")) { _gb->getdevice("rgb")->on(2); delay (250); _gb->getdevice("rgb")->on(5); }
-                if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play(".");
-            }
-            else {
-                stability_counter = 0;
-                if (_gb->hasdevice("rgb")) { _gb->getdevice("rgb")->on(6); delay (250); _gb->getdevice("rgb")->on(5); }
-                if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("-");
-            }
-            previous_reading = sensor_value;
-        }
-
-        if (ATTEMPT_COUNT == MAX_ATTEMPTS) {
-            _gb->arrow().color("yellow").log("Stability not acheived");
-            this->stablereadings = false;
-        }
-        else this->stablereadings = true;
 
+        // Read until the readings converge; a warming-up probe drifts and fails the slope criterion
+        result = this->convergence.read([this] () { return this->_read(); });
+        this->stablereadings = result.converged;
     }
     else if (sensor_mode == "iterations") {
-        
-        /*
-            If the mode is not 'persistent', pH module needs a 30 seconds warmup delay for accurate reading.
-        */
-        if (!this->_persistent) { _gb->arrow().log("30 seconds warm-up delay", false); delay(30 * 1000); }
-
-        // Read sensor a fixed number of times
-        for(int i = 0; i < NUMBER_OF_SENSOR_READS; i++, ATTEMPT_COUNT++) {
-
-            // // GB breathe
-            // _gb->breathe();
 
-            // Get sensor value
-            sensor_value = this->_read();
-
-            // _gb->log(sensor_value);
-            
-            // Calculate statistics
-            if (sensor_value < min) min = sensor_value;
-            if (max < sensor_value) max = sensor_value;
-            avg = (avg * (ATTEMPT_COUNT - 1) + sensor_value) / ATTEMPT_COUNT;
-
-            // If max number of read attempts were made, exit
-            if (ATTEMPT_COUNT >= MAX_ATTEMPTS) {
-                i = NUMBER_OF_SENSOR_READS;
-            }
-        }
+        // Read a fixed number of times once the probe has warmed up
+        result = this->convergence.read([this] () { return this->_read(); }, NUMBER_OF_SENSOR_READS);
     }
 
     else if (sensor_mode == "single") {
             
         // Read sensor once
-        sensor_value = this->_read();
-        min = avg = max = sensor_value;
+        this->convergence.reset().add(this->_read());
+        result = this->convergence.result();
     }
 
     else _gb->arrow().color("red").log("Unknown mode.", false);
+    sensor_value = result.value;
 
     _gb->arrow().log("" + String(sensor_value) + (sensor_value == 14 || sensor_value < 0 ? " -> The sensor might not be connected." : "") + " (" + String((millis() - timer) / 1000) + " seconds)", false);
-    _gb->log(String(" -> ") + String(min) + " |--- " + String(avg) + " ---| " + String(max));
+    _gb->log(String(" -> ") + String(result.minimum) + " |--- " + String(result.value) + " ---| " + String(result.maximum) + " (n: " + String(result.n) + ", sd: " + String(result.stddev) + (result.converged ? ", converged" : "") + ")");
     
     // Deactivate and turn off
     this->deactivate();
@@ -537,7 +530,7 @@ int GB_AT_SCI_PH::calibrate(String action, int value) {
 
 // Write a long to an OEM register
 void GB_AT_SCI_PH::_write_long(byte reg, unsigned long data) {
-    
+    if (GB_TRACE::replay().traced(this->device.id)) return;
     union local_sensor_mem_handler {
         byte bdata[4];
         long ldata;
@@ -545,44 +538,41 @@ void GB_AT_SCI_PH::_write_long(byte reg, unsigned long data) {
     _local_data.ldata = data;
     
     this->on();
-    Wire.beginTransmission(this->addresses.bus);
-    Wire.write(reg);
-    for (int i = 3; i >= 0; i--) Wire.write(_local_data.bdata[i]);
-    Wire.endTransmission();
+    byte bytes[5] = { reg, _local_data.bdata[3], _local_data.bdata[2], _local_data.bdata[1], _local_data.bdata[0] };
+    GB_I2C::bus().write(this->_channel(), this->addresses.bus, bytes, 5);
     // this->off();
 
 }
 
 // Write a byte to an OEM register
 void GB_AT_SCI_PH::_write_byte(byte reg, byte data) {
+    if (GB_TRACE::replay().traced(this->device.id)) return;
     this->on();
-    Wire.beginTransmission(this->addresses.bus);
-    Wire.write(reg);
-    Wire.write(data);
-    Wire.endTransmission();
+    byte bytes[2] = { reg, data };
+    GB_I2C::bus().write(this->_channel(), this->addresses.bus, bytes, 2);
     // this->off();
 }
 
 // Read OEM device register
 void GB_AT_SCI_PH::_read_register(byte register_address, byte number_of_bytes_to_read) {
+    if (GB_TRACE::replay().traced(this->device.id)) return;
     this->on();
-    byte i;
-    Wire.beginTransmission(this->addresses.bus);
-    Wire.write(register_address);
-    Wire.endTransmission();
-
-    Wire.requestFrom(this->addresses.bus, (byte) number_of_bytes_to_read);
-    for (i = number_of_bytes_to_read; i > 0; i--){
-        // Byte 0 is LSB
-        byte data = Wire.read();
-        _acquired_data.i2c_data[i - 1] = data;
-    }
-    Wire.endTransmission();
+    byte bytes[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+    GB_I2C::bus().read(this->_channel(), this->addresses.bus, register_address, bytes, number_of_bytes_to_read);
+
+    // Byte 0 is LSB
+    for (byte i = number_of_bytes_to_read; i > 0; i--) _acquired_data.i2c_data[i - 1] = bytes[number_of_bytes_to_read - i];
     // this->off();
 }
 
+// I2C mux channel of the device (-1 if it isn't behind the mux)
+int8_t GB_AT_SCI_PH::_channel() {
+    return this->pins.commux ? this->pins.muxchannel : -1;
+}
+
 // Sensor info function
 bool GB_AT_SCI_PH::_test_connection() {
+    if (GB_TRACE::replay().traced(this->device.id)) return true;
     this->on();
     for (int i = 0; i < 3; i++) { delay(30); this->_read_register(this->registers.led, 0x01); }
     if (_acquired_data.i2c_data[0] <= 1) {
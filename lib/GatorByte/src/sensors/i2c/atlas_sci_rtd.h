@@ -9,6 +9,14 @@
     #include "../../GB.h"
 #endif
 
+#ifndef GB_CONVERGENCE_h
+    #include "../../core/GB_Convergence.h"
+#endif
+
+#ifndef GB_TRACE_h
+    #include "../../core/GB_Trace.h"
+#endif
+
 /* Import I/O expander */
 #ifndef GB_74HC595_h
     #include "../misc/74hc595.h"
@@ -66,6 +74,9 @@ class GB_AT_SCI_RTD : public GB_DEVICE {
         float quickreadsensor(int times);
         float lastvalue();
 
+        // Criteria for the "stability" and "iterations" modes; value and quality of the last read
+        GB_CONVERGENCE convergence;
+
     private:
         GB *_gb;
         GB_AT_SCI_RTD& _initialize(bool testdevice);
@@ -84,11 +95,13 @@ class GB_AT_SCI_RTD : public GB_DEVICE {
         int _calibrate(String, int value);
         float _read();
         bool _test_connection();
+        int8_t _channel();
         
 };
 
 GB_AT_SCI_RTD::GB_AT_SCI_RTD(GB &gb) {
     _gb = &gb;
+    this->convergence.attach(gb).configure(0.5, 0.1, 5, 10);
     _gb->includelibrary(this->device.id, this->device.name);
     _gb->devices.rtd = this;
 }
@@ -134,7 +147,7 @@ GB_AT_SCI_RTD& GB_AT_SCI_RTD::_initialize (bool testdevice) {
             this->off();
             
             if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("..").wait(250).play("...");
-            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(2).wait(250).revert();
+            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->flash(2, 250);
         }
         else {
             _gb->arrow().log("Not detected");
@@ -154,6 +167,9 @@ GB_AT_SCI_RTD& GB_AT_SCI_RTD::configure(PINS pins, ADDRESSES addresses) {
     this->pins = pins;
     this->addresses = addresses;
 
+    // The OEM modules support fast mode (400 kHz)
+    GB_I2C::bus().clock(this->addresses.bus, 400000);
+
     // Set pin modes of the device
     if(!this->pins.pwrmux) pinMode(this->pins.enable, OUTPUT);
     
@@ -172,15 +188,13 @@ GB_AT_SCI_RTD& GB_AT_SCI_RTD::persistent() {
 GB_AT_SCI_RTD& GB_AT_SCI_RTD::on() {
     delay(2);
     
-    // Reset mux
-    _gb->getdevice("tca")->resetmux();
-    
     // Power on the device
     if(this->pins.pwrmux) _gb->getdevice("ioe")->writepin(this->pins.enable, HIGH);
     else digitalWrite(this->pins.enable, HIGH);
+    GB_ENERGY::meter().on(GB_ENERGY::RTD);
 
-    // Select I2C mux channel
-    if(this->pins.commux) _gb->getdevice("tca")->selectexclusive(pins.muxchannel);
+    // Select I2C mux channel (only written if the channel changed)
+    if(this->pins.commux) GB_I2C::bus().select(pins.muxchannel);
 
     delay(50);
     return *this;
@@ -192,12 +206,14 @@ GB_AT_SCI_RTD& GB_AT_SCI_RTD::off() {
     delay(10);
     if(this->pins.pwrmux) _gb->getdevice("ioe")->writepin(this->pins.enable, LOW);
     else digitalWrite(this->pins.enable, LOW);
+    GB_ENERGY::meter().off(GB_ENERGY::RTD);
     delay(2);
     return *this;
 }
 
 // Activate the module
 GB_AT_SCI_RTD& GB_AT_SCI_RTD::activate() {
+    GB_TRACE::replay().begin(this->device.id);
     this->on();
     this->_write_byte(this->registers.hibernation, 0x01);
     this->_read_register(this->registers.hibernation, 0x01);
@@ -222,6 +238,9 @@ GB_AT_SCI_RTD& GB_AT_SCI_RTD::led(String state) {
 // Read the sensor
 float GB_AT_SCI_RTD::_read() {
 
+    // Replay the trace instead of reading the module
+    if (GB_TRACE::replay().traced(this->device.id)) return GB_TRACE::replay().next(this->device.id);
+
     // Enable watchdog
     _gb->getmcu()->watchdog("enable");
 
@@ -357,7 +376,7 @@ float GB_AT_SCI_RTD::readsensor() {
     _gb->log("Reading " + this->device.name + " (" + _gb->globals.SENSOR_MODE + ")", false);
     
     // Return a dummy value if "dummy" mode is on
-    bool dummy = _gb->env() == "development";
+    bool dummy = _gb->env() == "development" && !GB_TRACE::replay().traced(this->device.id);
     if (dummy || _gb->globals.MODE == "dummy") {
         float value = random(5, 29) + random(0, 100) / 100.00;
         _gb->arrow().log("Dummy value: " + String(value));
@@ -382,83 +401,35 @@ float GB_AT_SCI_RTD::readsensor() {
     // Variables
     String sensor_mode = _gb->globals.SENSOR_MODE;
     float sensor_value = -1;
-    float stability_delta = 0.5;
-    int min_stable_reading_count = 5;
-    float previous_reading = 0;
-    int stability_counter = 0;
-
-    // Determine number of times to read the sensor
     int NUMBER_OF_SENSOR_READS = 10;
-    int MAX_ATTEMPTS = 10;
-    int ATTEMPT_COUNT = 0;
 
     // Get readings
     int timer = millis();
-    float min = 99, max = 0, avg = 0;
+    GB_CONVERGENCE::RESULT result;
 
     if (sensor_mode == "stability") {
-        
-        // Read sensors until readings are stable
-        while (stability_counter < min_stable_reading_count && ATTEMPT_COUNT++ < MAX_ATTEMPTS) {
-
-            // Get updated sensor value
-            sensor_value = this->_read();
-
-            // Calculate statistics
-            if (sensor_value < min) min = sensor_value;
-            if (max < sensor_value) max = sensor_value;
-            avg = (avg * (ATTEMPT_COUNT - 1) + sensor_value) / ATTEMPT_COUNT;
-
-            // Check if the readings are stable
-            float difference = abs(sensor_value - previous_reading);
-            if (difference <= stability_delta) {
-                stability_counter++;
-                if (_gb->hasdevice("rgb")) { _gb->getdevice("rgb")->on(2); delay (250); _gb->getdevice("rgb")->on(5); }
-                if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play(".");
-            }
-            else {
-                stability_counter = 0;
-                if (_gb->hasdevice("rgb")) { _gb->getdevice("rgb")->on(6); delay (250); _gb->getdevice("rgb")->on(5); }
-                if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("-");
-            }
-            previous_reading = sensor_value;
-        }
-    }
 
+        // Read until the readings converge; a warming-up probe drifts and fails the slope criterion
+        result = this->convergence.read([this] () { return this->_read(); });
+    }
     else if (sensor_mode == "iterations") {
-            
-        // Read sensor a fixed number of times
-        for(int i = 0; i < NUMBER_OF_SENSOR_READS; i++, ATTEMPT_COUNT++) {
 
-            // // GB breathe
-            // _gb->breathe();
-
-            // Get sensor value
-            sensor_value = this->_read();
-            
-            // Calculate statistics
-            if (sensor_value < min) min = sensor_value;
-            if (max < sensor_value) max = sensor_value;
-            avg = (avg * (ATTEMPT_COUNT - 1) + sensor_value) / ATTEMPT_COUNT;
-
-            // If max number of read attempts were made, exit
-            if (ATTEMPT_COUNT >= MAX_ATTEMPTS) {
-                i = NUMBER_OF_SENSOR_READS;
-            }
-        }
+        // Read a fixed number of times once the probe has warmed up
+        result = this->convergence.read([this] () { return this->_read(); }, NUMBER_OF_SENSOR_READS);
     }
 
     else if (sensor_mode == "single") {
             
         // Read sensor once
-        sensor_value = this->_read();
-        min = avg = max = sensor_value;
+        this->convergence.reset().add(this->_read());
+        result = this->convergence.result();
     }
 
     else _gb->arrow().color("red").log("Unknown mode.", false);
+    sensor_value = result.value;
     
     _gb->arrow().log(String(sensor_value) + (sensor_value == -1023.00 ? " -> The sensor might not be connected." : "") + " (" + String((millis() - timer) / 1000) + " seconds)", false);
-    _gb->log(String(" -> ") + String(min) + " |--- " + String(avg) + " ---| " + String(max));
+    _gb->log(String(" -> ") + String(result.minimum) + " |--- " + String(result.value) + " ---| " + String(result.maximum) + " (n: " + String(result.n) + ", sd: " + String(result.stddev) + (result.converged ? ", converged" : "") + ")");
 
     // Deactivate and turn off
     this->deactivate();
@@ -526,18 +497,17 @@ int GB_AT_SCI_RTD::_calibrate(String cmd, int value) {
 
 // Write a byte to an OEM register
 void GB_AT_SCI_RTD::_write_byte(byte reg, byte data) {
+    if (GB_TRACE::replay().traced(this->device.id)) return;
     this->on();
     delay(10);
-    Wire.beginTransmission(this->addresses.bus);
-    Wire.write(reg);
-    Wire.write(data);
-    Wire.endTransmission();
+    byte bytes[2] = { reg, data };
+    GB_I2C::bus().write(this->_channel(), this->addresses.bus, bytes, 2);
     // this->off();
 }
 
 // Write a long to an OEM register
 void GB_AT_SCI_RTD::_write_long(byte reg, unsigned long data) {
-    
+    if (GB_TRACE::replay().traced(this->device.id)) return;
     union local_sensor_mem_handler {
         byte bdata[4];
         long ldata;
@@ -545,33 +515,31 @@ void GB_AT_SCI_RTD::_write_long(byte reg, unsigned long data) {
     _local_data.ldata = data;
     
     this->on();
-    Wire.beginTransmission(this->addresses.bus);
-    Wire.write(reg);
-    for (int i = 3; i >= 0; i--) Wire.write(_local_data.bdata[i]);
-    Wire.endTransmission();
+    byte bytes[5] = { reg, _local_data.bdata[3], _local_data.bdata[2], _local_data.bdata[1], _local_data.bdata[0] };
+    GB_I2C::bus().write(this->_channel(), this->addresses.bus, bytes, 5);
     // this->off();
 }
 
 // Read OEM device register
 void GB_AT_SCI_RTD::_read_register(byte register_address, byte number_of_bytes_to_read) {
+    if (GB_TRACE::replay().traced(this->device.id)) return;
     this->on();
-    byte i;
-    Wire.beginTransmission(this->addresses.bus);
-    Wire.write(register_address);
-    Wire.endTransmission();
-
-    Wire.requestFrom(this->addresses.bus, (byte) number_of_bytes_to_read);
-    for (i = number_of_bytes_to_read; i > 0; i--){
-        // Byte 0 is LSB
-        byte data = Wire.read();
-        _acquired_data.i2c_data[i - 1] = data;
-    }
-    Wire.endTransmission();
+    byte bytes[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+    GB_I2C::bus().read(this->_channel(), this->addresses.bus, register_address, bytes, number_of_bytes_to_read);
+
+    // Byte 0 is LSB
+    for (byte i = number_of_bytes_to_read; i > 0; i--) _acquired_data.i2c_data[i - 1] = bytes[number_of_bytes_to_read - i];
     // this->off();
 }
 
+// I2C mux channel of the device (-1 if it isn't behind the mux)
+int8_t GB_AT_SCI_RTD::_channel() {
+    return this->pins.commux ? this->pins.muxchannel : -1;
+}
+
 // Sensor info function
 bool GB_AT_SCI_RTD::_test_connection() {
+    if (GB_TRACE::replay().traced(this->device.id)) return true;
     this->on();
     // delay(2000);
     for (int i = 0; i < 3; i++) { delay(30); this->_read_register(this->registers.led, 0x01); }
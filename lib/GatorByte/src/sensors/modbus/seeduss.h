@@ -9,8 +9,12 @@
 //     #include "RS485.h"
 // #endif
 
-#ifndef CRC16_H
-    #include "CRC16.h"
+#ifndef MODBUSRTU_h
+    #include "ModbusRTU.h"
+#endif
+
+#ifndef GB_FILTERS_h
+    #include "../../core/GB_Filters.h"
 #endif
 
 class GB_USS : GB_DEVICE {
@@ -28,15 +32,22 @@ class GB_USS : GB_DEVICE {
             int control;
         } pins;
         
+        // Register map (distances in mm)
         struct REGISTERS {
-            word ultrasonic = 0x01;
-            word calculated = 0x0100;
-            word realtime = 0x0101;
-            word addressconfig = 0x0200;
-            word buadrateconfig = 0x0201;
+            uint8_t slave = 0x01;
+            ModbusRTU::FIELD calculated = {0x0100, ModbusRTU::U16, 1};
+            ModbusRTU::FIELD realtime = {0x0101, ModbusRTU::U16, 1};
+            ModbusRTU::FIELD addressconfig = {0x0200, ModbusRTU::U16, 1};
+            ModbusRTU::FIELD buadrateconfig = {0x0201, ModbusRTU::U16, 1};
         } registers;
 
+        ModbusRTU modbus;
+
+        // Rejects spikes in the distance readings (across reads); changes within 3 x 10 mm always pass
+        GB_HAMPEL<float, 7> spikes = GB_HAMPEL<float, 7>(3, 10);
+
         GB_USS& configure(PINS);
+        GB_USS& configure(PINS, unsigned long baudrate);
         GB_USS& initialize();
         GB_USS& on();
         GB_USS& off();
@@ -47,6 +58,7 @@ class GB_USS : GB_DEVICE {
         String status();
 
         uint32_t read();
+        uint32_t realtime();
         
         // Type definitions
         typedef void (*callback_t)();
@@ -54,11 +66,10 @@ class GB_USS : GB_DEVICE {
 
     private:
         GB *_gb;
-        CRC16 CRC;
         bool _persistent = false;
+        unsigned long _baudrate = 9600;
+        long _realtime = -1;
         long _fetch();
-        void _request(byte Address, unsigned short Register);
-        void _write(byte Address, unsigned short Register, byte value);
 };
 
 GB_USS::GB_USS(GB &gb) {
@@ -76,6 +87,12 @@ GB_USS& GB_USS::configure(PINS pins) {
     return *this;
 }
 
+// Baud rate of the sensor (sets the Modbus frame timing); must match the MCU's hardware serial
+GB_USS& GB_USS::configure(PINS pins, unsigned long baudrate) {
+    this->_baudrate = baudrate;
+    return this->configure(pins);
+}
+
 GB_USS& GB_USS::initialize() {
     _gb->init();
 
@@ -91,8 +108,7 @@ GB_USS& GB_USS::initialize() {
     this->on();
     if (!this->_persistent) delay(3000);
     
-    pinMode(this->pins.control, OUTPUT);
-    digitalWrite(this->pins.control, LOW);
+    this->modbus.init(*this->_gb->serial.hardware, this->pins.control, this->_baudrate);
 
     // Read value
     long distance = -1;
@@ -127,6 +143,7 @@ String GB_USS::status() {
 GB_USS& GB_USS::on() { 
     if(this->pins.mux) _gb->getdevice("ioe")->writepin(this->pins.enable, HIGH);
     else digitalWrite(this->pins.enable, HIGH);
+    GB_ENERGY::meter().on(GB_ENERGY::USS);
     delay(20);
     return *this;
 }
@@ -135,6 +152,7 @@ GB_USS& GB_USS::off() {
     if (this->_persistent) return *this;
     if(this->pins.mux) _gb->getdevice("ioe")->writepin(this->pins.enable, LOW);
     else digitalWrite(this->pins.enable, LOW);
+    GB_ENERGY::meter().off(GB_ENERGY::USS);
     return *this;
 }
 
@@ -153,89 +171,39 @@ GB_USS& GB_USS::persistent(bool state) {
 
 /*
     Reads distance in mm
+    The processed and the real-time distances are read in one request
 */
 uint32_t GB_USS::read() {
     this->on();
 
     if (!this->_persistent) delay(2000);
 
-    long distance = 0;
+    long distance = -1;
     int counter = 5;
-    do {
-        uint32_t sum = 0;
-        for(uint32_t i = 0; i < 3; i++) { 
-            this->_request(registers.ultrasonic, registers.calculated);
-            distance = this->_fetch();
-            if (distance == -1) break;
-            sum += distance;
-            uint32_t average = sum / (i + 1);
-
-            // if (abs(distance - average) > 75) _gb->log("USS reading outlier detected: " + String(distance));
-            delay(500);
-        }
-        if (distance <= 0) this->_request(registers.ultrasonic, registers.calculated);
-    } while (distance <= 0 && counter-- > 0);
+    while ((distance = this->_fetch()) <= 0 && counter-- > 0) delay(100);
     
+    if (distance > 0) {
+        long raw = distance;
+        distance = this->spikes.add(raw);
+        if (this->spikes.outlier()) _gb->log("USS reading outlier detected: " + String(raw) + " mm (replaced with " + String(distance) + " mm, real-time: " + String(this->_realtime) + " mm)");
+    }
+
     this->off();
     return distance;
 }
 
-void GB_USS::_request(byte Address, unsigned short Register) {
-    this->on();
-
-    byte data[] = {Address, 0x03, highByte(Register), lowByte(Register), (byte)0, 0x01};
-    unsigned short checksum = CRC.Modbus(data, 0, 6);
-    digitalWrite(this->pins.control, HIGH);
-    this->_gb->serial.hardware->write(data[0]);
-    this->_gb->serial.hardware->write(data[1]);
-    this->_gb->serial.hardware->write(data[2]);
-    this->_gb->serial.hardware->write(data[3]);
-    this->_gb->serial.hardware->write(data[4]);
-    this->_gb->serial.hardware->write(data[5]);
-    
-    //CRC-16/MODBUS
-    this->_gb->serial.hardware->write(lowByte(checksum));
-    this->_gb->serial.hardware->write(highByte(checksum));
-
-    //wait until transmission ends
-    this->_gb->serial.hardware->flush();
-    digitalWrite(this->pins.control, LOW);
-}
-
-void GB_USS::_write(byte Address, unsigned short Register, byte value) {
-    this->on();
-
-    byte data[] = {Address, 0x06, highByte(Register), lowByte(Register), (byte)0, value};
-    unsigned short checksum = CRC.Modbus(data, 0, 6);
-    digitalWrite(this->pins.control, HIGH);
-    this->_gb->serial.hardware->write(data[0]);
-    this->_gb->serial.hardware->write(data[1]);
-    this->_gb->serial.hardware->write(data[2]);
-    this->_gb->serial.hardware->write(data[3]);
-    this->_gb->serial.hardware->write(data[4]);
-    this->_gb->serial.hardware->write(data[5]);
-    //CRC-16/MODBUS
-    this->_gb->serial.hardware->write(lowByte(checksum));
-    this->_gb->serial.hardware->write(highByte(checksum));
-    //wait until transmission ends
-    this->_gb->serial.hardware->flush();
-    digitalWrite(this->pins.control, LOW);
+// Real-time (unfiltered) distance in mm from the last read()
+uint32_t GB_USS::realtime() {
+    return this->_realtime;
 }
 
 long GB_USS::_fetch() {
-    this->on();
-    char buff[11];
-    long dist = 0;
+    uint16_t values[2];
+    uint8_t status = this->modbus.readholding(registers.slave, registers.calculated.address, 2, values);
+    if (status != ModbusRTU::OK) return -1;
 
-    if (this->_gb->serial.hardware->available() < 7) {
-        return -1;
-    }
-    for (int i = 0; i < sizeof(buff); i++) {
-        buff[i] = this->_gb->serial.hardware->read();
-        delayMicroseconds(10);
-    }
-    dist = (buff[3] << 8) | buff[4];
-    return dist;
+    this->_realtime = ModbusRTU::value(registers.realtime, registers.calculated.address, values);
+    return ModbusRTU::value(registers.calculated, registers.calculated.address, values);
 }
 
 #endif
\ No newline at end of file
@@ -79,6 +79,30 @@
 
 */
 
+/*
+    ! Message sequence numbers
+    Each queued record gets a 32-bit sequence number which, along with the device SN, identifies the
+    record on the server (so that retransmitted records can be deduplicated).
+
+    ----------------------------------------------------------------
+        Byte address    +   Description
+    ----------------------------------------------------------------
+        8192 - 8319     |  Sequence reservation ring. 16 slots of 8 bytes.
+                        |  Each slot holds a reserved sequence ceiling and a check word.
+                        |  A new block of SEQUENCE_BLOCK numbers is reserved by writing the next
+                        |  slot, so each slot is written once every 16 * SEQUENCE_BLOCK records.
+                        |  On boot, numbering resumes above the highest valid ceiling.
+    ----------------------------------------------------------------
+        8320 - 8447     |  Acknowledged sequence table. 16 slots of 8 bytes.
+                        |  An acknowledged sequence is written to slot (sequence % 16), so the
+                        |  most recent 16 acknowledgements are always available.
+    ----------------------------------------------------------------
+        8448 - 8575     |  Energy accounting; today's totals (see GB_ENERGY)
+    ----------------------------------------------------------------
+        8576 - 8703     |  Energy accounting; the previous day's totals
+    ----------------------------------------------------------------
+*/
+
 #include "Eeprom_at24c256.h"
 
 #ifndef GB_h
@@ -126,6 +150,14 @@ class GB_AT24 : public GB_DEVICE {
         GB_AT24& writecontrolvariables(String);
         String getcontrolvariables();
 
+        uint32_t nextsequence();
+        GB_AT24& setacked(uint32_t sequence);
+        GB_AT24& flushacked();
+        bool isacked(uint32_t sequence);
+
+        bool readblock(uint16_t address, uint8_t *data, uint16_t length);
+        GB_AT24& writeblock(uint16_t address, uint8_t *data, uint16_t length);
+
     private:
         GB *_gb;
         uint8_t _address = 0x50;
@@ -146,6 +178,22 @@ class GB_AT24 : public GB_DEVICE {
         uint16_t _max_value_size = 112;
 
         uint8_t MEMLOC_BOOT_COUNTER = 41;
+
+        // Sequence number store
+        static const uint8_t SEQUENCE_SLOTS = 16;
+        static const uint32_t SEQUENCE_BLOCK = 32;
+        static const uint32_t SEQUENCE_CHECK = 0xA5A5A5A5;
+        uint16_t _sequence_ring_address = 8192;
+        uint16_t _acked_table_address = 8320;
+        bool _sequence_loaded = false;
+        uint32_t _sequence = 0;
+        uint32_t _sequence_ceiling = 0;
+        uint32_t _acked[SEQUENCE_SLOTS];
+        uint16_t _acked_dirty = 0;
+
+        void _load_sequences();
+        bool _read_sequence_slot(uint16_t address, uint32_t &value);
+        void _write_sequence_slot(uint16_t address, uint32_t value);
 };
 
 /*
@@ -254,7 +302,7 @@ GB_AT24& GB_AT24::initialize(bool test) {
         if (this->get(0) == "formatted") {
             
             if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("--").wait(250).play("...");
-            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(2).wait(250).revert(); 
+            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->flash(2, 250); 
 
             _gb->log("Fetching SN", false);
             String savedsn = this->get(2);
@@ -346,6 +394,7 @@ GB_AT24& GB_AT24::format() {
 
 // Turn on the module
 GB_AT24&  GB_AT24::on() { 
+    GB_ENERGY::meter().on(GB_ENERGY::MEM);
     if(this->pins.mux) _gb->getdevice("ioe")->writepin(this->pins.enable, HIGH);
     else digitalWrite(this->pins.enable, HIGH);
     delay(1000);
@@ -358,6 +407,7 @@ GB_AT24&  GB_AT24::off() {
     if (this->_persistent) return *this;
     if(this->pins.mux) _gb->getdevice("ioe")->writepin(this->pins.enable, LOW);
     else digitalWrite(this->pins.enable, LOW);
+    GB_ENERGY::meter().off(GB_ENERGY::MEM);
     return *this;
 }
 
@@ -672,4 +722,132 @@ void GB_AT24::debug(String message) {
     // _gb->arrow().log("Done");
 }
 
-#endif
\ No newline at end of file
+/*
+    Read an 8-byte sequence slot (value, value ^ check).
+    Returns false for blank or corrupted slots.
+*/
+bool GB_AT24::_read_sequence_slot(uint16_t address, uint32_t &value) {
+    uint32_t slot[2];
+    _eeprom.read(address, (char *) slot, sizeof(slot));
+    value = slot[0];
+    return (slot[0] ^ SEQUENCE_CHECK) == slot[1];
+}
+
+// Write an 8-byte sequence slot
+void GB_AT24::_write_sequence_slot(uint16_t address, uint32_t value) {
+    uint32_t slot[2] = { value, value ^ SEQUENCE_CHECK };
+    _eeprom.write(address, (char *) slot, sizeof(slot));
+    delay(5);
+}
+
+// Load the sequence ceiling and the acknowledged table from the EEPROM
+void GB_AT24::_load_sequences() {
+    if (this->_sequence_loaded) return;
+    this->on();
+
+    uint32_t value;
+    for (uint8_t i = 0; i < SEQUENCE_SLOTS; i++) {
+        if (this->_read_sequence_slot(this->_sequence_ring_address + i * 8, value) && value > this->_sequence_ceiling) this->_sequence_ceiling = value;
+        this->_acked[i] = this->_read_sequence_slot(this->_acked_table_address + i * 8, value) ? value : 0;
+    }
+
+    // Numbers up to the ceiling may have been used before the reboot
+    this->_sequence = this->_sequence_ceiling;
+    this->_sequence_loaded = true;
+
+    this->off();
+}
+
+/*
+    Get the next message sequence number
+    Returns 0 if the EEPROM is not available
+*/
+uint32_t GB_AT24::nextsequence() {
+    if (!this->device.detected) return 0;
+    this->_load_sequences();
+
+    this->_sequence++;
+
+    // Reserve the next block
+    if (this->_sequence > this->_sequence_ceiling) {
+        this->_sequence_ceiling = this->_sequence + SEQUENCE_BLOCK - 1;
+
+        this->on();
+        this->_write_sequence_slot(this->_sequence_ring_address + ((this->_sequence_ceiling / SEQUENCE_BLOCK) % SEQUENCE_SLOTS) * 8, this->_sequence_ceiling);
+        this->off();
+    }
+
+    return this->_sequence;
+}
+
+/*
+    Record that the server has acknowledged a sequence number
+    Only in RAM (this is called from the PUBACK callback); flushacked() writes the changed slots.
+    An acknowledgement lost to a reboot before the flush only matters if its queue file wasn't
+    removed either, and then the file is sent again.
+*/
+GB_AT24& GB_AT24::setacked(uint32_t sequence) {
+    if (!this->device.detected || sequence == 0) return *this;
+    this->_load_sequences();
+
+    uint8_t slot = sequence % SEQUENCE_SLOTS;
+    if (this->_acked[slot] == sequence) return *this;
+    this->_acked[slot] = sequence;
+    this->_acked_dirty |= 1 << slot;
+    return *this;
+}
+
+// Persist the acknowledgements recorded since the last flush (one power cycle of the EEPROM)
+GB_AT24& GB_AT24::flushacked() {
+    if (!this->device.detected || this->_acked_dirty == 0) return *this;
+
+    this->on();
+    for (uint8_t slot = 0; slot < SEQUENCE_SLOTS; slot++) {
+        if (this->_acked_dirty & (1 << slot)) this->_write_sequence_slot(this->_acked_table_address + slot * 8, this->_acked[slot]);
+    }
+    this->off();
+
+    this->_acked_dirty = 0;
+    return *this;
+}
+
+// Check if a sequence number has been acknowledged recently
+bool GB_AT24::isacked(uint32_t sequence) {
+    if (!this->device.detected || sequence == 0) return false;
+    this->_load_sequences();
+
+    return this->_acked[sequence % SEQUENCE_SLOTS] == sequence;
+}
+
+// Read raw bytes
+bool GB_AT24::readblock(uint16_t address, uint8_t *data, uint16_t length) {
+    if (!this->device.detected) return false;
+
+    this->on();
+    for (uint16_t offset = 0; offset < length; offset += this->_chunksize) {
+        _eeprom.read(address + offset, (char *) data + offset, min((uint16_t) (length - offset), (uint16_t) this->_chunksize));
+    }
+    this->off();
+    return true;
+}
+
+/*
+    Write raw bytes
+    The writes are split so that they don't cross the EEPROM's 64-byte pages.
+*/
+GB_AT24& GB_AT24::writeblock(uint16_t address, uint8_t *data, uint16_t length) {
+    if (!this->device.detected) return *this;
+
+    this->on();
+    uint16_t offset = 0;
+    while (offset < length) {
+        uint16_t chunk = min((uint16_t) (length - offset), (uint16_t) (this->_chunksize - (address + offset) % this->_chunksize));
+        _eeprom.write(address + offset, (char *) data + offset, chunk);
+        delay(5);
+        offset += chunk;
+    }
+    this->off();
+    return *this;
+}
+
+#endif
@@ -51,6 +51,16 @@ class GB_FRAM : public GB_DEVICE {
         bool write(uint32_t address, String data);
         
         String read(uint32_t address);
+
+        /*
+            Page writes over DMA (see GB_SPI)
+            writepage() starts programming a page and returns while the data is still being sent, so
+            the next page can be formatted in a second buffer meanwhile. The buffer must not change
+            until the next writepage() or flush(), which wait for the transfer and the chip's program
+            cycle.
+        */
+        bool writepage(uint32_t address, const uint8_t *data, uint16_t length);
+        bool flush();
         
         bool rwtest();
         
@@ -60,13 +70,15 @@ class GB_FRAM : public GB_DEVICE {
         SPIFlash *_flash;
         bool _fram_present = false;
         GB *_gb;
-        int _sck_speed = SPI_HALF_SPEED;
+        uint32_t _sck_speed = SPI_HALF_SPEED;
+        bool _negotiate();
         bool _initialized = false;
         
         typedef void (*callback_t_on_control)(JSONary data);
         callback_t_on_control _on_control_update;
 
-        uint8_t _page_buffer[256];
+        // Two pages: write() formats one while writepage() sends the other
+        uint8_t _page_buffer[2][256];
         uint32_t addr;
         uint8_t dataByte;
         uint16_t dataInt;
@@ -130,19 +142,107 @@ bool GB_FRAM::rwtest() {
     return false;
 }
 
-// Write string
+// Write string (as SPIMemory's writeStr lays it out, so readStr() reads it back: the length with the
+// terminator, 4 bytes LSB first, then the characters and the terminator), one page at a time; each
+// page is formatted while the previous one is still going out
 bool GB_FRAM::write(uint32_t address, String data) {
-    return _flash->writeStr(address, data);
+    if (!_fram_present) return false;
+
+    uint32_t size = data.length() + 1;
+    uint32_t total = sizeof(size) + size, done = 0;
+    uint8_t buffer = 0;
+    bool success = true;
+
+    while (success && done < total) {
+        uint16_t length = min((uint32_t) (256 - (address + done) % 256), total - done);
+        uint8_t *page = this->_page_buffer[buffer];
+        for (uint16_t i = 0; i < length; i++) {
+            uint32_t at = done + i;
+            if (at < sizeof(size)) page[i] = size >> (8 * at);
+            else page[i] = at - sizeof(size) < data.length() ? data[at - sizeof(size)] : 0;
+        }
+
+        success = this->writepage(address + done, page, length);
+        done += length;
+        buffer ^= 1;
+    }
+
+    return this->flush() && success;
 }
 
 // Read string
 String GB_FRAM::read(uint32_t address) {
+    this->flush();
     String readstring = "";
     _flash->readStr(address, readstring, true);
 
     return readstring;
 }
 
+// Program a page (up to 256 bytes, within one page); the chip select is raised by the driver
+bool GB_FRAM::writepage(uint32_t address, const uint8_t *data, uint16_t length) {
+    if (length == 0 || (address % 256) + length > 256) return false;
+
+    // The previous page first
+    if (!this->flush()) return false;
+
+    SPI.beginTransaction(SPISettings(this->_sck_speed, MSBFIRST, SPI_MODE0));
+    digitalWrite(this->pins.ss, LOW);
+    SPI.transfer(0x06);                                     // Write enable
+    digitalWrite(this->pins.ss, HIGH);
+
+    digitalWrite(this->pins.ss, LOW);
+    SPI.transfer(0x02);                                     // Page program
+    SPI.transfer(address >> 16);
+    SPI.transfer(address >> 8);
+    SPI.transfer(address);
+    GB_SPI::bus().post(data, length, this->pins.ss);
+
+    return true;
+}
+
+// Wait for the page in flight, then for the chip's program cycle (a few ms)
+bool GB_FRAM::flush() {
+    bool sent = GB_SPI::bus().wait();
+
+    uint8_t status;
+    unsigned long start = millis();
+    do {
+        SPI.beginTransaction(SPISettings(this->_sck_speed, MSBFIRST, SPI_MODE0));
+        digitalWrite(this->pins.ss, LOW);
+        SPI.transfer(0x05);                                 // Status register 1
+        status = SPI.transfer(0xFF);
+        digitalWrite(this->pins.ss, HIGH);
+        SPI.endTransaction();
+    } while ((status & 0x01) && millis() - start < 10);
+
+    return sent && !(status & 0x01);
+}
+
+// Highest clock at which the chip identifies itself and reads back the same page three times (down
+// to 1 MHz, as the card)
+bool GB_FRAM::_negotiate() {
+    static const uint8_t clocks[] = { 12, 8, 6, 4, 2, 1 };
+    for (uint8_t i = 0; i < sizeof(clocks); i++) {
+        this->_sck_speed = clocks[i] * 1000000UL;
+        _flash->setClock(this->_sck_speed);
+
+        bool stable = true;
+        uint32_t expected = 0;
+        for (uint8_t pass = 0; pass < 3 && stable; pass++) {
+            stable = _flash->begin() && _flash->readByteArray(0, this->_page_buffer[0], sizeof(this->_page_buffer[0]));
+
+            // FNV-1a over the JEDEC ID and the page
+            uint32_t hash = 2166136261UL ^ _flash->getJEDECID();
+            for (uint16_t j = 0; j < sizeof(this->_page_buffer[0]); j++) hash = (hash ^ this->_page_buffer[0][j]) * 16777619UL;
+            stable = stable && (pass == 0 || hash == expected);
+            expected = hash;
+        }
+        if (stable) return true;
+    }
+    return false;
+}
+
 GB_FRAM& GB_FRAM::configure(PINS pins) {
     this->pins = pins;
 
@@ -176,8 +276,8 @@ GB_FRAM& GB_FRAM::off() {
     return *this;
 }
 
-// Initialize SD card
-GB_FRAM& GB_FRAM::initialize() { this->initialize("quarter"); }
+// Initialize SD card (at the negotiated clock)
+GB_FRAM& GB_FRAM::initialize() { return this->initialize("auto"); }
 GB_FRAM& GB_FRAM::initialize(String speed) { 
     this->on();
     
@@ -204,7 +304,8 @@ GB_FRAM& GB_FRAM::initialize(String speed) {
     _gb->log("Initializing " + this->device.name, false);
     if(_gb->globals.WRITE_DATA_TO_SD){
 
-        bool success = this->_flash->begin();
+        // Try the clocks from the fastest down
+        bool success = speed.indexOf("auto") > -1 ? this->_negotiate() : this->_flash->begin();
 
         if(!success) {
             _gb->arrow().log("Not detected", true);
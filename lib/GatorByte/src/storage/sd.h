@@ -18,7 +18,17 @@
     #include "sdios.h"
 #endif
 
-#define O_RDONLY 0
+#ifndef O_RDONLY
+    #define O_RDONLY 0
+#endif
+
+// Directory cache: folders and entries per folder (see GB_SD::cache())
+#ifndef DIR_CACHE_FOLDERS
+    #define DIR_CACHE_FOLDERS 6
+#endif
+#ifndef DIR_CACHE_ENTRIES
+    #define DIR_CACHE_ENTRIES 8
+#endif
 
 class GB_SD : public GB_DEVICE {
     public:
@@ -45,6 +55,27 @@ class GB_SD : public GB_DEVICE {
         bool initialized();
         GB_SD& on();
         GB_SD& off();
+        bool ison();
+
+        /*
+            Sessions
+            Usage:
+                sd.session([] { sd.writeCSV(csv); sd.writequeuefile(filename, csv); });
+                GB_SD::SESSION session(sd);         // Held until the end of the scope
+        */
+        typedef void (*callback_t_on_session)();
+        GB_SD& session(callback_t_on_session callback);
+        GB_SD& hold();
+        GB_SD& release();
+        String powerstatus();
+
+        class SESSION {
+            public:
+                SESSION(GB_SD &sd) : _sd(&sd) { _sd->hold(); }
+                ~SESSION() { _sd->release(); }
+            private:
+                GB_SD *_sd;
+        };
         
         bool testdevice();
         String status();
@@ -54,7 +85,11 @@ class GB_SD : public GB_DEVICE {
         bool gbformat();
         // bool sdformat();
         // bool sderase();
+        bool recover();
         bool rwtest();
+        String sdverify();
+        String health();
+        String bench(int records);
         bool sddetected();
 
         // Set state
@@ -69,16 +104,62 @@ class GB_SD : public GB_DEVICE {
         int count(String contains);
         String getfilelist(String root);
 
+        /*
+            Directory cache
+            The listings of the hot folders are kept in RAM, so the queue and file lookups don't scan the
+            card on every call. A folder is read once (on first use after initialize()) and then kept up to
+            date by GB_SD's own writes, removals and renames. Changes made behind GB_SD's back aren't seen.
+
+            Per folder: the number of files whose name contains 'pattern', the last such file, the highest
+            number in their names (queue_<n>.csv) and the first DIR_CACHE_ENTRIES entries (names, sizes).
+            New files are added at the end, in creation order. A folder with more entries keeps only that
+            window; lookups beyond it read the card, and an emptied window is read again.
+
+            By default, the queue lanes (pattern "queue"), /readings and /control are cached.
+        */
+        GB_SD& cache(String folder, String pattern);
+        String cachestatus();
+
         // Queuing functions
         int getqueuecount();
         bool isqueueempty();
         String getfirstqueuefilename();
+        String getfirstqueuefilename(String exclude);
         String getlastqueuefilename();
         String getavailablequeuefilename();
+        String getavailablequeuefilename(String folder);
         void removequeuefile(String);
+        bool requeuefile(String filename);
         String readqueuefile(String file_name);
+        String readqueuefile(String file_name, uint32_t &sequence);
+        String readqueuefile(String file_name, uint32_t &sequence, String &topic);
         void writequeuefile(String filename, String data);
         void writequeuefile(String filename, CSVary csv);
+        void writequeuefile(String filename, CSVary csv, uint32_t sequence);
+
+        /*
+            Queue lanes
+            Alerts are always drained first. Readings and logs share the rest by weight.
+            A lane holding 'cap' files drops its oldest file on enqueue (0 = no cap).
+        */
+        struct QUEUE_LANE {
+            String name;
+            String folder;
+            int weight;
+            int cap;
+            int credit;
+        };
+        QUEUE_LANE lanes[3] = {
+            {"alerts", "/queue/alerts", 0, 100, 0},
+            {"readings", "/queue", 4, 0, 0},
+            {"logs", "/queue/logs", 1, 200, 0}
+        };
+        int getqueuecount(String lane);
+        bool enqueue(String lane, String topic, String data);
+        bool enqueue(String lane, String topic, String data, uint32_t sequence);
+        bool enqueue(String lane, String topic, CSVary csv, uint32_t sequence);
+        String nextqueuefile(String exclude);
+        String nextqueuefile(String exclude, bool priorityonly);
 
         // Write functions
         void writefile(String filename, String data);
@@ -88,6 +169,78 @@ class GB_SD : public GB_DEVICE {
         void writeCSV(String filename, String data, String header);
         void writeJSON(String filename, String data);
 
+        /*
+            Record frames
+            Every record written to a /readings/ or /queue/ file is followed by a trailer line,
+            "#CRC:<length>:<crc32>", giving the length and CRC32 of the record text before it. The first
+            record of a file includes the header lines (the CSV header, #SEQ, #TOPIC). At boot,
+            recover() checks the end of each readings file: a record torn by a power loss (no complete
+            trailer) is truncated and a record whose CRC doesn't match is counted. A queue file is
+            never uploaded unless every record in it checks out: recover() and readqueuefile() move
+            any other to /quarantine. sdverify() checks every frame of the readings and queue files.
+            The counts are reported by health().
+        */
+
+        /*
+            Ring-buffer readings files
+            With ring mode on, writeCSV() to a /readings/ file writes to a preallocated, contiguous
+            <name>.ring file instead of appending to <name>.csv. The records are written as a circular
+            log; once the file is full, the oldest records are overwritten. The file's clusters and
+            size never change, so a steady-state write touches only data sectors (no FAT or directory
+            updates).
+
+            Layout: two 512-byte header slots (written alternately; the valid slot with the higher
+            generation wins, so a power loss during a header write keeps the previous one), then the
+            data region. A record is a 2-byte length followed by the row(s); a record that doesn't fit
+            before the end of the region starts at the beginning after a 0xFFFF marker.
+        */
+        struct RING_HEADER {
+            uint32_t magic;
+            uint32_t generation;
+            uint32_t capacity;
+            uint32_t head;
+            uint32_t tail;
+            uint32_t used;
+            uint32_t records;
+            uint32_t dropped;
+            char columns[256];
+            uint32_t check;
+        };
+        GB_SD& ring(uint32_t bytes);
+        bool writering(String filename, String data, String header);
+        String readring(String filename, uint32_t skip, uint32_t count);
+        String ringstatus(String filename);
+
+        /*
+            Timestamp index for the readings files
+            writeCSV() to a /readings/ file keeps a sidecar <name>.idx: a (timestamp, byte offset)
+            entry for every N-th record, taken from the TIMESTAMP column. query() binary-searches it
+            and reads only from the last indexed record before 'from', passing the header line and then
+            each row with from <= TIMESTAMP <= to to the callback. The rows are assumed to be in time
+            order; the buffer has to hold a full row. Ring files (see above) aren't indexed.
+        */
+        GB_SD& index(uint16_t records);
+        uint32_t query(String filename, uint32_t from, uint32_t to, char *buffer, int size, callback_t_on_line callback, void *context);
+        String readingsfile();
+
+        /*
+            Rotation and archives
+            With rotation on, writeCSV() to a /readings/ file first moves the file to /readings/rotated/
+            <name>_<first timestamp>.csv once it has reached the size limit, or (daily) once the new row
+            is from another UTC day than the file's first row. The next write starts a new file.
+
+            archive() compresses the oldest rotated file into /archive/<name>.lzw, one 8 KB block per
+            call, so it can run in the idle slots of the loop. When a file is done, a row is added to
+            /archive/manifest.csv (FILE,FROM,TO,BYTES,ARCHIVEBYTES,CRC32; the CRC is of the original
+            file) and the rotated file is removed. A file interrupted by a reboot is compressed again.
+
+            Archive layout: "GBLZ", the LZW code width and 3 reserved bytes, then blocks of a 2-byte
+            original length, a 2-byte compressed length and the codes (see GB_LZW). Each block starts
+            a new dictionary. Archived rows aren't covered by query().
+        */
+        GB_SD& rotate(uint32_t bytes, bool daily);
+        bool archive();
+
         // // Write messages for debugging
         // bool debug(String action, String category);
         // bool debug(String action, String category, String message);
@@ -109,6 +262,15 @@ class GB_SD : public GB_DEVICE {
         String writeLinesToSD(String file_name, String data);
         String readfile(String file_name);
 
+        /*
+            Streaming reads
+            The file is read straight into the caller's buffer from the requested offset; nothing is
+            held in RAM beyond it. The chunk and line callbacks return false to stop early.
+        */
+        int read(String path, uint32_t offset, char *buffer, int length);
+        uint32_t readchunks(String path, uint32_t offset, char *buffer, int size, callback_t_on_chunk callback, void *context);
+        uint32_t readlines(String path, char *buffer, int size, callback_t_on_line callback, void *context);
+
         
         String readconfig();
         String readconfig(String type);
@@ -131,6 +293,24 @@ class GB_SD : public GB_DEVICE {
         GB_SD& updatecontrolfloat(String key, double value, callback_t_on_control callback);
         GB_SD& updatecontrolfloat(String key, double value);
 
+        /*
+            Control variable store
+            The control variables live in /control/variables.kv: a file of 64-byte slots (24-byte key,
+            32-byte value, generation and checksum), two copies per variable in separate halves of the
+            file. An update rewrites only the older copy of one variable, so a power loss mid-write
+            leaves the previous value in the other copy. The card writes whole 512-byte sectors though:
+            a torn sector can also take the copies of the 7 variables sharing it, which then fall back
+            to their previous values in the other half.
+
+            The store is sized for twice the variables it's imported with (at least 64 slots). When it
+            fills up, it's copied to a store with twice the slots. A variable that still can't be saved
+            is logged in red and counted in controlstatus(). variables.ini is only a text view for the
+            GDC: exportcontrol() writes it from the store, importcontrol() rebuilds the store from it.
+        */
+        uint32_t importcontrol();
+        bool exportcontrol();
+        String controlstatus();
+
     private:
         bool _use_mux = false;
         String _split_string(String data, char separator, int index);
@@ -142,8 +322,15 @@ class GB_SD : public GB_DEVICE {
         bool _sd_card_present = false;
         GB *_gb;
         bool _rebegin_on_restart = false;
+        bool _powered = false;
+        uint8_t _sessions = 0;
+        uint32_t _cycles = 0;
         int _run_counter = 0;
-        int _sck_speed = SPI_HALF_SPEED;
+        bool _written = false;
+        uint32_t _sck_speed = SPI_HALF_SPEED;
+        bool _begin(uint32_t clock);
+        bool _negotiate();
+        bool _stable();
         bool _initialized = false;
         bool SKIP_CHIP_DETECT = false;
         callback_t_on_control _on_control_update;
@@ -156,12 +343,115 @@ class GB_SD : public GB_DEVICE {
 
         bool _write(String filename, String data);
 
+        struct DIR_ENTRY {
+            char name[25];
+            bool dir;
+            uint32_t size;
+        };
+        struct DIR_CACHE {
+            String folder;
+            String pattern;
+            bool built;
+            bool complete;
+            uint16_t matches;
+            uint32_t sequence;
+            char last[25];
+            uint8_t count;
+            DIR_ENTRY entries[DIR_CACHE_ENTRIES];
+        };
+        DIR_CACHE _dirs[DIR_CACHE_FOLDERS];
+        uint8_t _dir_folders = 0;
+        uint32_t _dir_hits = 0;
+        uint32_t _dir_scans = 0;
+        uint32_t _dir_reads = 0;
+        DIR_CACHE* _dircache(String folder);
+        bool _dirbuild(DIR_CACHE *cache);
+        void _diradd(DIR_CACHE *cache, const char *name, bool dir, uint32_t size);
+        bool _dirsplit(String path, DIR_CACHE *&cache, String &name);
+        void _dirupdate(String path, uint32_t size);
+        void _dirremove(String path);
+        void _dirflush();
+
+        QUEUE_LANE* _lane(String name);
+        String _first_queue_file(QUEUE_LANE *lane, String exclude);
+
+        static const uint32_t RING_MAGIC = 0x47425247;
+        static const uint16_t RING_WRAP = 0xFFFF;
+        uint32_t _ring_bytes = 0;
+        String _ringpath(String filename);
+        bool _ringopen(String path, File &file, RING_HEADER &header, bool create);
+        bool _ringsave(File &file, RING_HEADER &header);
+        bool _ringdrop(File &file, RING_HEADER &header);
+        uint32_t _ringcheck(RING_HEADER &header);
+
+        static const uint32_t INDEX_MAGIC = 0x47424958;
+        struct INDEX_ENTRY {
+            uint32_t timestamp;
+            uint32_t offset;
+        };
+        uint16_t _index_every = 32;
+        String _indexpath(String filename);
+        uint32_t _indexappend(String filename, String header, String data, uint32_t offset);
+        uint32_t _indexseek(String filename, uint32_t from);
+        int _column(const char *header, const char *name);
+        uint32_t _field(const char *row, int column);
+
+        static const uint16_t ARCHIVE_BLOCK = 8192;
+        uint32_t _rotate_bytes = 0;
+        bool _rotate_daily = false;
+        String _archive_source = "";
+        uint32_t _archive_offset = 0;
+        uint32_t _archive_crc = 0;
+        bool _rotationdue(String filename, String header, String data);
+        bool _rotate(String filename, String header);
+        uint32_t _stamp(File &file, int column, bool last);
+        bool _archivedone(File &input, String path, String archive, uint32_t bytes);
+
+        uint32_t _corrupt_records = 0;
+        uint32_t _torn_records = 0;
+        static uint32_t _crc32(const char *data, uint32_t length, uint32_t crc);
+        String _frame(String data);
+        bool _checkframe(File &file, uint32_t trailer, const char *line);
+        bool _recoverfile(String path);
+        bool _recoverlane(String folder);
+        bool _readall(File &file, String &content);
+        bool _unframe(String &content);
+        bool _quarantine(String path);
+        void _verifyfolder(String folder, uint32_t &files, uint32_t &frames, uint32_t &corrupt);
+
+        struct CONTROL_SLOT {
+            char key[24];
+            char value[32];
+            uint32_t generation;
+            uint32_t check;
+        };
+        static const uint16_t CONTROL_SLOTS = 64;
+        static const uint8_t CONTROL_BLOCK = 8;             // Slots in a sector
+        const char *_control_store = "/control/variables.kv";
+        const char *_control_grown = "/control/grown.kv";
+        uint16_t _control_slots = CONTROL_SLOTS;
+        uint32_t _control_failures = 0;
+        bool _kvopen(File &file);
+        bool _kvopen(File &file, uint16_t variables);
+        int8_t _kvread(File &file, uint16_t index, CONTROL_SLOT &slot, CONTROL_SLOT *block);
+        bool _kvblock(File &file, uint16_t first, CONTROL_SLOT *block);
+        bool _kvwrite(File &file, String key, String value);
+        bool _kvwrite(String key, String value);
+        bool _kvgrow(File &file);
+        uint32_t _kvload();
+        uint32_t _kvcheck(CONTROL_SLOT &slot);
+        void _setcontrol(String key, String value);
+
 };
 
 GB_SD::GB_SD(GB &gb) {
     this->_gb = &gb;
     this->_gb->includelibrary(this->device.id, this->device.name);     
     this->_gb->devices.sd = this;
+
+    // Hot folders
+    for (int i = 0; i < 3; i++) this->cache(this->lanes[i].folder, "queue");
+    this->cache("/readings", "").cache("/control", "");
 }
 
 /*
@@ -175,7 +465,7 @@ bool GB_SD::gbformat() {
     String folders[] = {"readings", "queue", "config", "calibration", "logs", "control", "debug"};
     
     // Check and create folders if needed
-    for (int i = 0; i < sizeof(folders)/sizeof(folders[0]); i++) {
+    for (size_t i = 0; i < sizeof(folders)/sizeof(folders[0]); i++) {
         String folder = folders[i].substring(0, folders[i].indexOf("."));
         String subfolder = folders[i].substring(folders[i].indexOf(".") + 1, folders[i].length());
         
@@ -307,29 +597,76 @@ GB_SD& GB_SD::configure(PINS pins) {
 
 GB_SD& GB_SD::on() {
 
+    // Already powered and initialized. A read that failed is ended here: SdFat leaves the card in it,
+    // and reading that sector again would time out until the next power cycle
+    if (this->_powered) {
+        if (_sd.card()) _sd.card()->syncDevice();
+        return *this;
+    }
+
     if(this->pins.mux) _gb->getdevice("ioe")->writepin(this->pins.enable, HIGH);
     else digitalWrite(this->pins.enable, HIGH);
+    GB_ENERGY::meter().on(GB_ENERGY::SD);
+    this->_powered = true;
+    this->_cycles++;
 
-    // Initialize the connection
+    // Initialize the connection (once more if a read error stops the mount; the card would be
+    // unusable until the next power cycle otherwise)
     if (this->_rebegin_on_restart) {
-        _sd.begin(this->pins.ss, this->_sck_speed);
+        if (!this->_begin(this->_sck_speed)) this->_begin(this->_sck_speed);
+        this->_rebegin_on_restart = false;
     }
 
     return *this;
 }
 
 GB_SD& GB_SD::off() {
+
+    // Already off, or deferred to the end of the session
+    if (!this->_powered || this->_sessions > 0) return *this;
     
     // Safety delay
     delay(250);
 
     if(this->pins.mux) _gb->getdevice("ioe")->writepin(this->pins.enable, LOW);
     else digitalWrite(this->pins.enable, LOW);
+    GB_ENERGY::meter().off(GB_ENERGY::SD);
     this->_rebegin_on_restart = true;
+    this->_powered = false;
+
+    return *this;
+}
+
+bool GB_SD::ison() {
+    return this->_powered;
+}
+
+/*
+    ! Sessions
+    Keeps the card powered and initialized across several operations; the on()/off() calls inside a
+    session are cheap and the card is turned off once, when the outermost session ends. Sessions nest.
+*/
+GB_SD& GB_SD::hold() {
+    if (this->_sessions++ == 0) this->on();
+    return *this;
+}
 
+GB_SD& GB_SD::release() {
+    if (this->_sessions > 0 && --this->_sessions == 0) this->off();
     return *this;
 }
 
+GB_SD& GB_SD::session(callback_t_on_session callback) {
+    this->hold();
+    callback();
+    return this->release();
+}
+
+// Power-ups since boot and the SD on-time today
+String GB_SD::powerstatus() {
+    return String(this->_cycles) + " power cycles, " + String(GB_ENERGY::meter().ontime(GB_ENERGY::SD) / 1000.0) + " seconds on today";
+}
+
 GB_SD& GB_SD::state(String name, bool value) {
     if(name.compareTo("SKIP_CHIP_DETECT") == 0) this->SKIP_CHIP_DETECT = value;
     return *this;
@@ -347,22 +684,54 @@ bool GB_SD::sddetected() {
 
 // Test the device
 bool GB_SD::testdevice() { 
-    if (!this->device.detected) this->device.detected = _sd.begin(this->pins.ss, this->_sck_speed) && this->rwtest();
+    if (!this->device.detected) this->device.detected = this->_begin(this->_sck_speed);
     return this->device.detected;
 }
 String GB_SD::status() {
     String size = "-";
     
     if (this->device.detected) {
-        SdSpiConfig SD_CONFIG = SdSpiConfig(this->pins.ss, DEDICATED_SPI);
+        SdSpiConfig SD_CONFIG = GB_SPI::sdconfig(this->pins.ss, this->_sck_speed);
         m_card = _cardFactory.newCard(SD_CONFIG);
         size = String(m_card->sectorCount() * 5.12e-7) + " GB";
     }
     return this->device.detected ? size : (String("not-detected") + String(":") + device.id);
 }
 
-// Initialize SD card
-GB_SD& GB_SD::initialize() { this->initialize("quarter"); }
+// Start SdFat on the DMA driver (see GB_SPI)
+bool GB_SD::_begin(uint32_t clock) {
+    return _sd.begin(GB_SPI::sdconfig(this->pins.ss, clock));
+}
+
+// Highest clock at which the card starts and reads back the same data (12 MHz is the SAMD21
+// SPI's ceiling, 1 MHz the old quarter-speed fallback for a slow card or long wires); sets the clock
+bool GB_SD::_negotiate() {
+    static const uint8_t clocks[] = { 12, 8, 6, 4, 2, 1 };
+    for (uint8_t i = 0; i < sizeof(clocks); i++) {
+        this->_sck_speed = SD_SCK_MHZ(clocks[i]);
+        if (this->_begin(this->_sck_speed) && this->_stable()) return true;
+    }
+    return false;
+}
+
+// The CID and the first sectors (read over DMA) give the same CRC three times over
+bool GB_SD::_stable() {
+    uint32_t expected = 0;
+    for (uint8_t pass = 0; pass < 3; pass++) {
+        if (!_sd.card()->readCID(&this->_cid)) return false;
+        uint32_t crc = this->_crc32((const char *) &this->_cid, sizeof(this->_cid), 0);
+        for (uint32_t sector = 0; sector < 4; sector++) {
+            if (!_sd.card()->readSector(sector, this->_sectorBuffer)) return false;
+            crc = this->_crc32((const char *) this->_sectorBuffer, sizeof(this->_sectorBuffer), crc);
+        }
+        if (pass > 0 && crc != expected) return false;
+        expected = crc;
+    }
+    return true;
+}
+
+// Initialize SD card (at the negotiated clock)
+GB_SD& GB_SD::initialize() { return this->initialize("auto"); }
 GB_SD& GB_SD::initialize(String speed) { 
     _gb->init();
     
@@ -387,6 +756,9 @@ GB_SD& GB_SD::initialize(String speed) {
     // Default speed value
     else this->_sck_speed = SPI_HALF_SPEED;
 
+    // Try the clocks from the fastest down
+    bool negotiate = speed.indexOf("auto") > -1;
+
     _gb->log("Initializing " + this->device.name, false);
     if(_gb->globals.WRITE_DATA_TO_SD){
 
@@ -406,7 +778,7 @@ GB_SD& GB_SD::initialize(String speed) {
             if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(1).wait(100).on("red").wait(100).revert();
 
         }
-        else if(!_sd.begin(this->pins.ss, this->_sck_speed)) {
+        else if(!(negotiate ? this->_negotiate() : this->_begin(this->_sck_speed))) {
             _gb->arrow().log("Not detected", true);
             this->device.detected = false;
             _gb->globals.INIT_REPORT += this->device.id + "i";
@@ -426,9 +798,10 @@ GB_SD& GB_SD::initialize(String speed) {
             _root.open("/");
             _sd_card_present = true;
 
-            // Perform R/W test
-            bool result = this->rwtest();
-            _gb->arrow().log(result ? "Done" : "R/W test failed", true);
+            // Repair the records torn by a power loss (the directory cache is read afresh afterwards)
+            bool result = this->recover();
+            this->_dirflush();
+            _gb->arrow().log(result ? "Done" : "Recovery scan failed", true);
             this->_initialized = result;
             this->device.detected = result;
 
@@ -469,6 +842,14 @@ File GB_SD::openFile(String reason, String file_name) {
     if(!this->SKIP_CHIP_DETECT && digitalRead(this->pins.cd) == LOW) _sd_card_present = false;
     else if(!this->SKIP_CHIP_DETECT && digitalRead(this->pins.cd) == HIGH) _sd_card_present = true;
     else if (this->SKIP_CHIP_DETECT) _sd_card_present = true;
+    if (!_sd_card_present) this->_dirflush();
+
+    // Faults mode: the card may stall, and reads may fail
+    GB_FAULTS::injector().stall();
+    if (strcmp(_gb->s2c(reason), "read") == 0 && GB_FAULTS::injector().readerror()) {
+        File failed;
+        return failed;
+    }
 
     File file;
     if(strcmp(_gb->s2c(reason), "write") == 0) {
@@ -480,6 +861,7 @@ File GB_SD::openFile(String reason, String file_name) {
         else {
             // File opened successfully
             // _gb->log("Done opening file");
+            this->_dirupdate(file_name, file.fileSize());
         }
     }
     else if(strcmp(_gb->s2c(reason), "read") == 0) {
@@ -532,7 +914,22 @@ String GB_SD::getfirstfilenamecontaining(String contains){
 String GB_SD::getfirstfilenamecontaining(String contains, String folder){
     if (!this->sddetected() || !this->device.detected)  return "";
 
+    DIR_CACHE *cache = this->_dircache(folder);
+    if (cache != NULL) {
+        for (uint8_t i = 0; i < cache->count; i++) {
+            if (!cache->entries[i].dir && strstr(cache->entries[i].name, contains.c_str()) != NULL) {
+                this->_dir_hits++;
+                return String(cache->entries[i].name);
+            }
+        }
+        if (cache->complete) {
+            this->_dir_hits++;
+            return "";
+        }
+    }
+
     this->on();
+    this->_dir_scans++;
 
     FsFile file;
     
@@ -542,6 +939,7 @@ String GB_SD::getfirstfilenamecontaining(String contains, String folder){
 
     // Lookup in root folder
     while (file.openNext(&root, O_RDONLY)) {
+        this->_dir_reads++;
         char name[25];
         file.getName(name, 25);
 
@@ -564,7 +962,19 @@ String GB_SD::getlastfilenamecontaining(String contains){
 String GB_SD::getlastfilenamecontaining(String contains, String folder){
     if (!this->sddetected() || !this->device.detected)  return "";
 
+    DIR_CACHE *cache = this->_dircache(folder);
+    if (cache != NULL && contains == cache->pattern) {
+        this->_dir_hits++;
+        return String(cache->last);
+    }
+    if (cache != NULL && cache->complete) {
+        this->_dir_hits++;
+        for (int i = cache->count - 1; i >= 0; i--) if (!cache->entries[i].dir && strstr(cache->entries[i].name, contains.c_str()) != NULL) return String(cache->entries[i].name);
+        return "";
+    }
+
     this->on();
+    this->_dir_scans++;
 
     FsFile file;
     
@@ -575,6 +985,7 @@ String GB_SD::getlastfilenamecontaining(String contains, String folder){
     // Lookup in root folder
     String filename = "";
     while (file.openNext(&root, O_RDONLY)) {
+        this->_dir_reads++;
         char name[25];
         file.getName(name, 25);
 
@@ -655,16 +1066,24 @@ bool GB_SD::initialized() {
 
 // Write to a CSV file
 void GB_SD::writeCSV(CSVary csv) {
-    String filename = "/readings/" + (_gb->globals.DEVICE_NAME.length() > 0 ? _gb->globals.DEVICE_NAME + "_" : "") + "readings.csv";
-    this->writeCSV(filename, csv); 
+    this->writeCSV(this->readingsfile(), csv); 
+}
+
+// Default readings file
+String GB_SD::readingsfile() {
+    return "/readings/" + (_gb->globals.DEVICE_NAME.length() > 0 ? _gb->globals.DEVICE_NAME + "_" : "") + "readings.csv";
 }
 void GB_SD::writeCSV(String filename, CSVary csv) { 
     this->writeCSV(filename, csv.getrows(), csv.getheader()); 
     }
 void GB_SD::writeCSV(String filename, String data, String header) {
     
+    this->_written = false;
     if (!this->sddetected() || !this->device.detected) return;
     if(!_gb->globals.WRITE_DATA_TO_SD) return;
+
+    // Ring mode: readings go to the preallocated ring file (falls back to appending if it can't be created)
+    if (this->_ring_bytes > 0 && filename.startsWith("/readings/") && this->writering(filename, data, header)) return;
     
     // Enable watchdog
     _gb->getmcu()->watchdog("enable");
@@ -672,27 +1091,30 @@ void GB_SD::writeCSV(String filename, String data, String header) {
     this->on();
     this->_run_counter++;
 
+    // Rotation: a full readings file moves to /readings/rotated/ and this row starts a new one
+    if (filename.startsWith("/readings/") && this->_rotationdue(filename, header, data)) this->_rotate(filename, header);
+
     unsigned long start = millis();
 
     // // Write to a different file in dummy mode
     // if (this->_gb->globals.MODE == "dummy") filename = "dummy-" + filename;
     
     _gb->log("Writing data to: " + filename, false);
-    bool erroroccured = false && !this->rwtest();
+    bool framed = filename.startsWith("/readings/") || filename.startsWith("/queue/");
 
-    // If error occured during the R/W test
-    if (erroroccured) {
-        _gb->arrow().log("Skipped due to error in R/W test");
-        if (this->_gb->hasdevice("rgb")) this->_gb->getdevice("rgb")->on(1);
-    }
-    else {
+    {
         _gb->arrow().log("File" + String(this->exists(filename) ? " " : " not ") + "found", false);
 
-        // Check if file doesn't exists, write header
-        if(header.length() > 0 && !this->exists(filename)) {
+        // Check if file doesn't exists, write header (a stale index of an earlier file goes with it). A
+        // framed file gets its header in the first record instead, under the same CRC
+        uint32_t sectors = 0;
+        bool created = header.length() > 0 && !this->exists(filename);
+        if (created && this->exists(this->_indexpath(filename))) this->rm(this->_indexpath(filename));
+        if(created && !framed) {
             File new_file = this->openFile("write", _gb->s2c(filename));
             if(new_file) {
                 new_file.print(String(header));
+                sectors += GB_FAULTS::sectors(0, header.length(), this->_sd.bytesPerCluster());
                 this->closeFile(new_file);
                 delay(15);
             }
@@ -701,15 +1123,29 @@ void GB_SD::writeCSV(String filename, String data, String header) {
         File file = this->openFile("write", filename);
         if(file) {
 
-            file.print((header.length() > 0 ? "\n" : "") + data);
+            // The record as written (the first frame of a file covers its header lines, so a torn or altered
+            // header is caught like a row); in faults mode a bit of it may flip, or the power may go part-way
+            bool first = file.fileSize() == 0;
+            String lead = framed ? (first ? "" : "\n") : (header.length() > 0 ? "\n" : "");
+            String body = framed && first && header.length() > 0 ? header + "\n" + data : data;
+            String record = GB_FAULTS::injector().flip(lead + (framed ? this->_frame(body) : body));
+            uint32_t length = GB_FAULTS::injector().tear(record.length());
+            uint32_t offset = file.fileSize() + lead.length() + body.length() - data.length();
+            sectors += GB_FAULTS::sectors(file.fileSize(), length, this->_sd.bytesPerCluster());
+            this->_written = file.write(record.c_str(), length) == record.length();
+            if (length < record.length()) GB_FAULTS::injector().cut();
+            this->_dirupdate(filename, file.fileSize());
             
             // // Force failure
             // if (this->_run_counter % 5 == 0) this->off();
-            file.close();
+            if (!file.close()) this->_written = false;
 
             delay(15);
 
+            if (filename.startsWith("/readings/")) sectors += this->_indexappend(filename, header, data, offset);
+
             int end = millis();
+            if (framed) GB_FAULTS::injector().record(filename.startsWith("/queue/") ? GB_FAULTS::QUEUE : GB_FAULTS::READINGS, end - start, data.length(), sectors);
             _gb->arrow().log("Write complete", false).arrow().log(String((end - start)) + " milliseconds");
         }
         else{
@@ -725,220 +1161,836 @@ void GB_SD::writeCSV(String filename, String data, String header) {
     _gb->getmcu()->watchdog("disable");
 }
 
-// Write to a JSON file
-void GB_SD::writeJSON(String filename, String data) {
-    if (!this->device.detected) return;
-    if(!_gb->globals.WRITE_DATA_TO_SD) return;
+/*
+    Turn ring mode on for the readings files; bytes is the size of the data region (0 turns it off)
+    An existing ring file keeps the size it was created with
+*/
+GB_SD& GB_SD::ring(uint32_t bytes) {
+    this->_ring_bytes = bytes;
+    return *this;
+}
 
-    this->on();
+// Append a record to the ring file of a readings file
+bool GB_SD::writering(String filename, String data, String header) {
+    if (data.length() == 0) return true;
     
-    _gb->log("Writing data to: " + filename, false);
-    bool erroroccured = false && !this->rwtest();
+    // Enable watchdog
+    _gb->getmcu()->watchdog("enable");
+
+    unsigned long start = millis();
+    String path = this->_ringpath(filename);
+    _gb->log("Writing data to: " + path, false);
 
-    // If error occured during the R/W test
-    if (erroroccured) {
-        _gb->arrow().log("Skipped due to error in R/W test");
+    File file;
+    RING_HEADER ring;
+    if (!this->_ringopen(path, file, ring, true)) {
+        _gb->arrow().log("Ring file unavailable; appending instead");
+        this->off();
+        return false;
     }
-    else {
 
-        // Check if file doesn't exists, write an empty array
-        if(!exists(filename)) {
-            File new_file = this->openFile("write", filename);
-            if(new_file) {
-                // new_file.print("");
-                this->closeFile(new_file);
+    bool success = true;
+    uint32_t need = 2 + data.length();
+    if (need > ring.capacity / 2) {
+        _gb->arrow().log("Record too large for the ring file");
+        success = false;
+    }
+    else {
+        if (ring.records == 0) ring.head = ring.tail = ring.used = 0;
+
+        // Not enough room before the end of the region: mark the rest as padding and wrap around
+        if (ring.head + need > ring.capacity) {
+            uint32_t padding = ring.capacity - ring.head;
+            while (ring.capacity - ring.used < padding && this->_ringdrop(file, ring));
+            if (padding >= 2) {
+                uint16_t marker = RING_WRAP;
+                file.seekSet(1024 + ring.head);
+                file.write(&marker, 2);
             }
+            ring.used += padding;
+            ring.head = 0;
         }
 
-        File file = this->openFile("write", filename);
-        if(file) {
-            file.print(data);
-            this->closeFile(file);
-            
-            _gb->arrow().log("Write complete");
-        }
-        else{
-            _gb->arrow().log("Write failed");
+        // Overwrite the oldest records until the record fits
+        while (ring.capacity - ring.used < need && this->_ringdrop(file, ring));
+
+        uint16_t length = data.length();
+        file.seekSet(1024 + ring.head);
+        success = file.write(&length, 2) == 2 && file.write(data.c_str(), length) == length;
+
+        if (success) {
+            ring.head += need;
+            ring.used += need;
+            ring.records++;
+            if (header.length() > 0) strncpy(ring.columns, header.c_str(), sizeof(ring.columns) - 1);
+
+            // The data is on the card before the header points to it
+            success = file.sync() && this->_ringsave(file, ring);
         }
     }
+
+    file.close();
     this->off();
-}
+    
+    _gb->arrow().log(success ? "Write complete" : "Write failed; appending instead", false).arrow().log(String(millis() - start) + " milliseconds");
+    if (!success && this->_gb->hasdevice("rgb")) this->_gb->getdevice("rgb")->on(1);
 
-// Read content from SD card
-String GB_SD::readfile(String filename) {
+    // Disable watchdog
+    _gb->getmcu()->watchdog("disable");
+    return success;
+}
 
-    // Enable watchdog
-    _gb->getmcu()->watchdog("enable");
+// Read records from a ring file as CSV (the header, then up to 'count' records after skipping 'skip' of the oldest)
+String GB_SD::readring(String filename, uint32_t skip, uint32_t count) {
+    File file;
+    RING_HEADER ring;
+    if (!this->_ringopen(this->_ringpath(filename), file, ring, false)) {
+        this->off();
+        return "";
+    }
 
-    this->on();
+    // The walk never covers more than the used bytes, so a corrupt length can't loop or run away
+    String result = String(ring.columns);
+    uint32_t position = ring.tail, index = 0, walked = 0;
+    for (uint32_t i = 0; i < ring.records && index < skip + count;) {
+        uint16_t length = RING_WRAP;
+        if (position + 2 <= ring.capacity) {
+            file.seekSet(1024 + position);
+            if (file.read(&length, 2) != 2) break;
+        }
 
-    if(this->exists(filename)){
-        File file = this->openFile("read", filename);
-        delay(100);
-        if(file){
-            char char_code;
-            String result = "";
-            while (file.available()) {
-                char_code = file.read();
-                if(char_code == 44) result += ",";
-                else result += String(char_code);
+        // Padding before the wrap
+        if (length == RING_WRAP) {
+            walked += ring.capacity - position;
+            if (position == 0 || walked > ring.used) {
+                _gb->log("Ring file " + filename + " corrupted; stopped after " + String(i) + " records");
+                break;
             }
-            this->closeFile(file);
-            
-            // Disable watchdog
-            _gb->getmcu()->watchdog("disable");
-            
-            this->off();
-            return result;
+            position = 0;
+            continue;
         }
-        else{
-            this->off();
-            
-            // Disable watchdog
-            _gb->getmcu()->watchdog("disable");
-    
-            return "";
+
+        // Empty records aren't written
+        walked += 2 + length;
+        if (length == 0 || walked > ring.used) {
+            _gb->log("Ring file " + filename + " corrupted; stopped after " + String(i) + " records");
+            break;
         }
-    }
-    else {
-        this->off();
-            
-        // Disable watchdog
-        _gb->getmcu()->watchdog("disable");
 
-        return "";
+        if (index++ >= skip) {
+            char buffer[65];
+            for (uint16_t read = 0; read < length;) {
+                int chunk = file.read(buffer, min(64, length - read));
+                if (chunk <= 0) break;
+                buffer[chunk] = 0;
+                result += (read == 0 && result.length() > 0 ? "\n" : "") + String(buffer);
+                read += chunk;
+            }
+        }
+        position += 2 + length;
+        if (position >= ring.capacity) position = 0;
+        i++;
     }
-}
 
-bool GB_SD::_write(String filename, String data) {
-    
-    this->on();
-    File file = this->openFile("write", filename);
-    if(file) {
-        file.print(data);
-        file.close();
-        delay(15);
-        return true;
-    }
-    else{
-        if (this->_gb->hasdevice("rgb")) this->_gb->getdevice("rgb")->on(1);
-        return false;
-    }
+    file.close();
     this->off();
+    return result;
 }
 
-/*
-    Read config file and set device and survey variables
-*/
-String GB_SD::readconfig() {
-
-    _gb->log("Reading config from SD", false);
-
-    if (!this->_initialized || !this->device.detected) {
+String GB_SD::ringstatus(String filename) {
+    File file;
+    RING_HEADER ring;
+    bool found = this->_ringopen(this->_ringpath(filename), file, ring, false);
+    if (found) file.close();
+    this->off();
+    if (!found) return "no ring file";
 
-        _gb->arrow().log("Skipped");
-        _gb->getdevice("sntl")->disable();
-        _gb->br().color("red").log("Configuration can't be read.").br();
+    return String(ring.records) + " records, " + String(ring.used) + "/" + String(ring.capacity) + " bytes, " + String(ring.dropped) + " overwritten, generation " + String(ring.generation);
+}
 
-        uint8_t now = millis();
-        while (!(this->device.detected = _sd.begin(this->pins.ss, this->_sck_speed))) {
-            _gb->getdevice("gdc")->detect(true);
-            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(((millis() - now) / 1000) % 2 ? "red" : "blue");
-            if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("-");
-            this->off();delay(500);
-            this->on(); delay(50);
-        }
-        if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("....");
-        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->off();
-        
-        // Reinitialize
-        this->initialize();
-        return "";
-    }
+// Ring file of a readings file (<name>.csv -> <name>.ring)
+String GB_SD::_ringpath(String filename) {
+    return (filename.endsWith(".csv") ? filename.substring(0, filename.length() - 4) : filename) + ".ring";
+}
 
+// Open a ring file and load its header; a new file is preallocated as one contiguous extent
+bool GB_SD::_ringopen(String path, File &file, RING_HEADER &header, bool create) {
     this->on();
+    if (!create && !this->exists(path)) return false;
+    if (!file.open(path.c_str(), O_RDWR | O_CREAT)) return false;
+    this->_dirupdate(path, file.fileSize());
 
-    // Create config folder if it does not exist
-    if (!this->exists("/config")) this->mkdir("/config");
+    if (file.fileSize() == 0) {
+        if (!create) { file.close(); return false; }
 
-    const char* filename = "/config/config.ini";
-    
-    // If requested config file exists
-    if(!this->exists(filename)) {
-        _gb->arrow().log("File not found.");
-        
-        _gb->getdevice("sntl")->disable();
-        _gb->br().color("red").log("Configuration absent.");
-        _gb->color("white").log("Use desktop client to proceed.");
-        uint8_t now = millis();
-        while (!_gb->globals.GDC_CONNECTED) {
-            _gb->getdevice("gdc")->detect(true);
-            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(((millis() - now) / 1000) % 2 ? "red" : "green");
-            if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("-");
-            delay(500);
+        if (!file.preAllocate(1024 + this->_ring_bytes) || !file.isContiguous()) {
+            _gb->arrow().log("Couldn't preallocate " + String(this->_ring_bytes) + " contiguous bytes", false);
+            file.close();
+            this->rm(path);
+            return false;
         }
-        return "";
+
+        memset(&header, 0, sizeof(header));
+        header.magic = RING_MAGIC;
+        header.capacity = this->_ring_bytes;
+        bool success = this->_ringsave(file, header) && this->_ringsave(file, header);
+        if (success) _gb->arrow().log("Created " + path + " (" + String(this->_ring_bytes) + " bytes)", false);
+        return success;
     }
-    else {
 
-        // Read data
-        String configdata = this->readfile(filename);
-        _gb->arrow().log("Done");
+    // Take the valid header slot with the higher generation
+    RING_HEADER slot;
+    bool found = false;
+    for (uint8_t i = 0; i < 2; i++) {
+        file.seekSet(i * 512);
+        if (file.read(&slot, sizeof(slot)) != sizeof(slot)) continue;
+        if (slot.magic != RING_MAGIC || slot.check != this->_ringcheck(slot)) continue;
+        if (!found || slot.generation > header.generation) header = slot;
+        found = true;
+    }
 
-        this->off();
-        return configdata;
+    if (!found) {
+        _gb->arrow().log("Ring file header corrupted", false);
+        file.close();
     }
+    return found;
 }
 
-// Read config file and return a line by type
-String GB_SD::readconfig(String type) { return this->readconfig("/config/config.ini", type); }
-String GB_SD::readconfig(String filename, String type) { 
-    
-    // Detect GDC without lock
-    if (_gb->hasdevice("gdc")) _gb->getdevice("gdc")->detect(false);
+// Write the header to the slot after the current one
+bool GB_SD::_ringsave(File &file, RING_HEADER &header) {
+    header.generation++;
+    header.columns[sizeof(header.columns) - 1] = 0;
+    header.check = this->_ringcheck(header);
+    file.seekSet((header.generation % 2) * 512);
+    return file.write(&header, sizeof(header)) == sizeof(header) && file.sync();
+}
 
-    // Enable watchdog
-    _gb->getmcu()->watchdog("enable");
-    this->on();
+// Drop the oldest record (or the padding before the wrap)
+bool GB_SD::_ringdrop(File &file, RING_HEADER &header) {
+    if (header.used == 0) return false;
 
-    // If requested config file exists
-    if(!this->exists(filename)){
-        _gb->log("config file not found.");
-        delay(100);
+    uint16_t length = RING_WRAP;
+    if (header.tail + 2 <= header.capacity) {
+        file.seekSet(1024 + header.tail);
+        if (file.read(&length, 2) != 2) return false;
     }
-        
-    File file = this->openFile("read", filename);
-    delay(100);
-
-    // If the file opened successfully
-    if(file){
-        char char_code;
-        String line = "";
-        while (file.available()) {
-            char_code = file.read();
-            if(char_code == '\n') {
-                
-                // Check if the current read line is the type requested
-                if (line.indexOf(type + "=") == 0) break;
-                else line = "";
-            }
-            else line += String(char_code);
-        }
-        
-        this->closeFile(file);
-        this->off();
-        return line;
+
+    // Inconsistent length or wrap marker; start over rather than walk garbage
+    bool wrap = length == RING_WRAP;
+    if (wrap ? header.tail == 0 || header.capacity - header.tail > header.used : length == 0 || 2U + length > header.used) {
+        header.head = header.tail = header.used = header.records = 0;
+        return false;
     }
-    
-    // If requested file could not be opened
-    else{
+
+    if (wrap) {
+        header.used -= header.capacity - header.tail;
+        header.tail = 0;
+        return true;
+    }
+
+    header.used -= 2 + length;
+    header.tail += 2 + length;
+    if (header.tail >= header.capacity) header.tail = 0;
+    header.records--;
+    header.dropped++;
+    return true;
+}
+
+uint32_t GB_SD::_ringcheck(RING_HEADER &header) {
+    uint32_t check = 2166136261UL;
+    uint8_t *bytes = (uint8_t *) &header;
+    for (size_t i = 0; i < offsetof(RING_HEADER, check); i++) check = (check ^ bytes[i]) * 16777619UL;
+    return check;
+}
+
+// Index entries every 'records' records (0 turns indexing off)
+GB_SD& GB_SD::index(uint16_t records) {
+    this->_index_every = records;
+    return *this;
+}
+
+/*
+    ! Query a readings file by time
+    Returns the number of matching rows
+*/
+uint32_t GB_SD::query(String filename, uint32_t from, uint32_t to, char *buffer, int size, callback_t_on_line callback, void *context) {
+    uint32_t offset = this->_indexseek(filename, from);
+
+    File file = this->openFile("read", filename);
+    if (!file) {
+        this->off();
+        return 0;
+    }
+
+    // The header line tells the timestamp column
+    int length = file.fgets(buffer, size);
+    if (length > 0 && buffer[length - 1] == '\n') buffer[--length] = 0;
+    int column = length > 0 ? this->_column(buffer, "TIMESTAMP") : -1;
+    if (column < 0 || !callback(buffer, length, context)) {
+        file.close();
+        this->off();
+        return 0;
+    }
+
+    // Start at the last indexed record before 'from'
+    if (offset > file.curPosition() && offset < file.fileSize()) file.seekSet(offset);
+
+    uint32_t matches = 0;
+    while ((length = file.fgets(buffer, size)) > 0) {
+        if (buffer[length - 1] == '\n') buffer[--length] = 0;
+        if (length == 0 || buffer[0] == '#') continue;
+
+        uint32_t timestamp = this->_field(buffer, column);
+        if (timestamp > to) break;
+        if (timestamp < from) continue;
+
+        matches++;
+        if (!callback(buffer, length, context)) break;
+    }
+
+    file.close();
+    this->off();
+    return matches;
+}
+
+// Index file of a readings file (<name>.csv -> <name>.idx)
+String GB_SD::_indexpath(String filename) {
+    return (filename.endsWith(".csv") ? filename.substring(0, filename.length() - 4) : filename) + ".idx";
+}
+
+/*
+    Count the rows just written at 'offset' and add an index entry if an N-th record is among them
+    Layout: the magic and the record count, then 8-byte entries. Returns the sectors written (see GB_FAULTS)
+*/
+uint32_t GB_SD::_indexappend(String filename, String header, String data, uint32_t offset) {
+    if (this->_index_every == 0 || data.length() == 0) return 0;
+
+    int column = this->_column(header.c_str(), "TIMESTAMP");
+    if (column < 0) return 0;
+
+    File file;
+    if (!file.open(this->_indexpath(filename).c_str(), O_RDWR | O_CREAT)) return 0;
+    this->_dirupdate(this->_indexpath(filename), file.fileSize());
+
+    uint32_t meta[2] = { INDEX_MAGIC, 0 };
+    if (file.fileSize() > 0 && (file.read(meta, sizeof(meta)) != sizeof(meta) || meta[0] != INDEX_MAGIC)) {
+        _gb->arrow().log("Index corrupted; starting over", false);
+        file.truncate(0);
+        meta[0] = INDEX_MAGIC; meta[1] = 0;
+    }
+    if (file.fileSize() == 0) file.write(meta, sizeof(meta));
+
+    uint32_t rows = 1;
+    for (unsigned int i = 0; i + 1 < data.length(); i++) if (data[i] == '\n') rows++;
+
+    uint32_t sectors = 0;
+    uint32_t position = meta[1] % this->_index_every;
+    if (position == 0 || position + rows > this->_index_every) {
+        INDEX_ENTRY entry = { this->_field(data.c_str(), column), offset };
+        sectors += GB_FAULTS::sectors(file.fileSize(), sizeof(entry), this->_sd.bytesPerCluster()) - 1;
+        file.seekSet(file.fileSize());
+        file.write(&entry, sizeof(entry));
+    }
+
+    meta[1] += rows;
+    file.seekSet(0);
+    file.write(meta, sizeof(meta));
+    file.close();
+    return sectors + GB_FAULTS::sectors(0, sizeof(meta), 0);
+}
+
+// Offset of the last indexed record before 'from' (0 if there is none)
+uint32_t GB_SD::_indexseek(String filename, uint32_t from) {
+    String path = this->_indexpath(filename);
+    this->on();
+    if (!this->exists(path)) return 0;
+
+    File file;
+    if (!file.open(path.c_str(), O_RDONLY)) return 0;
+
+    uint32_t meta[2];
+    if (file.read(meta, sizeof(meta)) != sizeof(meta) || meta[0] != INDEX_MAGIC) {
+        file.close();
+        return 0;
+    }
+
+    INDEX_ENTRY entry;
+    uint32_t offset = 0, low = 0, high = (file.fileSize() - sizeof(meta)) / sizeof(INDEX_ENTRY);
+    while (low < high) {
+        uint32_t middle = (low + high) / 2;
+        file.seekSet(sizeof(meta) + middle * sizeof(INDEX_ENTRY));
+        if (file.read(&entry, sizeof(entry)) != sizeof(entry)) break;
+        if (entry.timestamp < from) {
+            offset = entry.offset;
+            low = middle + 1;
+        }
+        else high = middle;
+    }
+    file.close();
+    return offset;
+}
+
+// Position of a column in a CSV header (-1 if absent)
+int GB_SD::_column(const char *header, const char *name) {
+    int column = 0, length = strlen(name);
+    for (const char *field = header; *field; column++) {
+        if (strncmp(field, name, length) == 0 && (field[length] == ',' || field[length] == 0 || field[length] == '\r' || field[length] == '\n')) return column;
+        field = strchr(field, ',');
+        if (!field) break;
+        field++;
+    }
+    return -1;
+}
+
+// Numeric value of a column in a CSV row
+uint32_t GB_SD::_field(const char *row, int column) {
+    for (; column > 0 && row; column--) {
+        row = strchr(row, ',');
+        if (row) row++;
+    }
+    return row ? strtoul(row, NULL, 10) : 0;
+}
+
+// Rotate the readings files at 'bytes' (0: no size limit) and/or when the UTC day changes
+GB_SD& GB_SD::rotate(uint32_t bytes, bool daily) {
+    this->_rotate_bytes = bytes;
+    this->_rotate_daily = daily;
+    return *this;
+}
+
+// Whether a readings file has to be rotated before 'data' is appended
+bool GB_SD::_rotationdue(String filename, String header, String data) {
+    if (this->_rotate_bytes == 0 && !this->_rotate_daily) return false;
+
+    File file;
+    if (!this->exists(filename) || !file.open(filename.c_str(), O_RDONLY)) return false;
+
+    bool due = this->_rotate_bytes > 0 && file.fileSize() >= this->_rotate_bytes;
+    int column = this->_column(header.c_str(), "TIMESTAMP");
+    if (!due && this->_rotate_daily && column >= 0) {
+        uint32_t first = this->_stamp(file, column, false);
+        due = first > 0 && first / 86400 != this->_field(data.c_str(), column) / 86400;
+    }
+    file.close();
+    return due;
+}
+
+// Move a readings file to /readings/rotated/ (its index goes)
+bool GB_SD::_rotate(String filename, String header) {
+    File file;
+    if (!file.open(filename.c_str(), O_RDONLY)) return false;
+    int column = this->_column(header.c_str(), "TIMESTAMP");
+    String stamp = String(column >= 0 ? this->_stamp(file, column, false) : 0);
+    file.close();
+
+    String name = filename.substring(filename.lastIndexOf("/") + 1);
+    if (name.endsWith(".csv")) name = name.substring(0, name.length() - 4);
+    String path = "/readings/rotated/" + name + "_" + stamp + ".csv";
+    for (int i = 1; this->exists(path); i++) path = "/readings/rotated/" + name + "_" + stamp + "-" + String(i) + ".csv";
+
+    if (!this->exists("/readings/rotated")) this->mkdir("/readings/rotated");
+    if (!this->_sd.rename(filename.c_str(), path.c_str())) {
+        _gb->log("Couldn't rotate " + filename);
+        return false;
+    }
+    this->_dirremove(filename);
+    if (this->exists(this->_indexpath(filename)) && this->_sd.remove(this->_indexpath(filename).c_str())) this->_dirremove(this->_indexpath(filename));
+
+    _gb->log("Rotated " + filename + " to " + path);
+    return true;
+}
+
+// Timestamp of the first or the last row of a readings file (0 if there is none)
+uint32_t GB_SD::_stamp(File &file, int column, bool last) {
+    char buffer[257];
+
+    // First: the first row after the header that isn't a trailer
+    if (!last) {
+        bool linestart = true, header = true;
+        int length;
+        file.seekSet(0);
+        while ((length = file.fgets(buffer, sizeof(buffer))) > 0) {
+            bool row = linestart;
+            linestart = buffer[length - 1] == '\n';
+            if (!row) continue;
+            if (header) { header = false; continue; }
+            if (buffer[0] != '#' && buffer[0] != '\n') return this->_field(buffer, column);
+        }
+        return 0;
+    }
+
+    // Last: the last complete row in the last 256 bytes
+    uint32_t size = file.fileSize(), start = size > 256 ? size - 256 : 0;
+    file.seekSet(start);
+    int count = file.read(buffer, size - start);
+    if (count <= 0) return 0;
+    for (int end = count; end > 0;) {
+        int begin = end;
+        while (begin > 0 && buffer[begin - 1] != '\n') begin--;
+        if (begin == 0) break;
+        if (end > begin && buffer[begin] != '#' && buffer[begin] != '\r') {
+            buffer[end] = 0;
+            return this->_field(buffer + begin, column);
+        }
+        end = begin - 1;
+    }
+    return 0;
+}
+
+/*
+    ! Archive the rotated readings files
+    Compresses the next block of the oldest rotated file; returns false when there's nothing to do
+*/
+bool GB_SD::archive() {
+    if (!this->sddetected() || !this->device.detected) return false;
+
+    // The oldest rotated file (by the timestamp in its name)
+    String source = "";
+    uint32_t oldest = 0;
+    File root, file;
+    if (this->exists("/readings/rotated") && root.open("/readings/rotated")) {
+        char name[64];
+        while (file.openNext(&root, O_RDONLY)) {
+            file.getName(name, sizeof(name));
+            String candidate = String(name);
+            uint32_t stamp = strtoul(candidate.substring(candidate.lastIndexOf("_") + 1).c_str(), NULL, 10);
+            if (!file.isDir() && candidate.endsWith(".csv") && (source.length() == 0 || stamp < oldest)) {
+                source = candidate;
+                oldest = stamp;
+            }
+            file.close();
+        }
+        root.close();
+    }
+    if (source.length() == 0) {
+        this->off();
+        return false;
+    }
+
+    String path = "/readings/rotated/" + source;
+    String archive = "/archive/" + source.substring(0, source.length() - 4) + ".lzw";
+    
+    // Enable watchdog
+    _gb->getmcu()->watchdog("enable");
+
+    _gb->log("Archiving " + path, false);
+    
+    File input, output;
+    if (!this->exists("/archive")) this->mkdir("/archive");
+    if (!input.open(path.c_str(), O_RDONLY) || !output.open(archive.c_str(), O_RDWR | O_CREAT)) {
+        _gb->arrow().log("Couldn't open the files");
+        input.close();
         this->off();
-        
-        // Disable watchdog
         _gb->getmcu()->watchdog("disable");
+        return false;
+    }
+
+    // A new file (or one interrupted by a reboot) starts over
+    if (path != this->_archive_source) {
+        uint8_t header[8] = { 'G', 'B', 'L', 'Z', LZW_BITS, 0, 0, 0 };
+        output.truncate(0);
+        output.write(header, sizeof(header));
+        this->_archive_source = path;
+        this->_archive_offset = 0;
+        this->_archive_crc = 0;
+    }
+
+    // Next block: the lengths are written once it's done
+    bool success = true;
+    uint16_t block[2] = { 0, 0 };
+    uint32_t start = output.fileSize();
+    if (this->_archive_offset < input.fileSize()) {
+        // One coder for every call (its tables are about 5 KB; begin() clears them)
+        static GB_LZW lzw;
+        uint8_t raw[256], packed[2 * sizeof(raw) + 4];
+
+        lzw.begin();
+        input.seekSet(this->_archive_offset);
+        output.seekSet(start);
+        success = output.write(block, sizeof(block)) == sizeof(block);
+        while (success && block[0] < ARCHIVE_BLOCK) {
+            int count = input.read(raw, min((int) sizeof(raw), (int) (ARCHIVE_BLOCK - block[0])));
+            if (count <= 0) break;
+            this->_archive_crc = this->_crc32((const char *) raw, count, this->_archive_crc);
+            uint16_t length = lzw.compress(raw, count, packed);
+            success = output.write(packed, length) == length;
+            block[0] += count;
+            block[1] += length;
+        }
+        uint16_t length = lzw.finish(packed);
+        success = success && output.write(packed, length) == length;
+        block[1] += length;
+
+        output.seekSet(start);
+        success = success && output.write(block, sizeof(block)) == sizeof(block);
+        this->_archive_offset += block[0];
+    }
+    uint32_t bytes = output.fileSize();
+    output.close();
+
+    if (!success) {
+        _gb->arrow().log("Write failed; starting over");
+        this->_archive_source = "";
+        input.close();
+    }
+    else if (this->_archive_offset < input.fileSize()) {
+        _gb->arrow().log(String(this->_archive_offset) + " of " + String(input.fileSize()) + " bytes");
+        input.close();
+    }
+    else {
+        _gb->arrow().log("Done", false).arrow().log(String(input.fileSize()) + " to " + String(bytes) + " bytes");
+        if (!this->_archivedone(input, path, archive, bytes)) _gb->log("Couldn't update the archive manifest");
+        this->_archive_source = "";
+    }
+
+    this->off();
+    
+    // Disable watchdog
+    _gb->getmcu()->watchdog("disable");
+    return true;
+}
+
+// Add a finished archive to the manifest and remove the rotated file
+bool GB_SD::_archivedone(File &input, String path, String archive, uint32_t bytes) {
+    char buffer[257];
+    input.seekSet(0);
+    int length = input.fgets(buffer, sizeof(buffer));
+    int column = length > 0 ? this->_column(buffer, "TIMESTAMP") : -1;
+    uint32_t from = column >= 0 ? this->_stamp(input, column, false) : 0;
+    uint32_t to = column >= 0 ? this->_stamp(input, column, true) : 0;
+    snprintf(buffer, sizeof(buffer), "\n%s,%lu,%lu,%lu,%lu,%08lX", archive.substring(archive.lastIndexOf("/") + 1).c_str(), (unsigned long) from, (unsigned long) to, (unsigned long) input.fileSize(), (unsigned long) bytes, (unsigned long) this->_archive_crc);
+    input.close();
+
+    File manifest;
+    if (!manifest.open("/archive/manifest.csv", O_RDWR | O_CREAT)) return false;
+    if (manifest.fileSize() == 0) manifest.print("FILE,FROM,TO,BYTES,ARCHIVEBYTES,CRC32");
+    manifest.seekSet(manifest.fileSize());
+    bool success = manifest.print(buffer) > 0;
+    manifest.close();
+
+    // The rotated file goes only once its row is in the manifest
+    return success && this->_sd.remove(path.c_str());
+}
+
+// Write to a JSON file
+void GB_SD::writeJSON(String filename, String data) {
+    if (!this->device.detected) return;
+    if(!_gb->globals.WRITE_DATA_TO_SD) return;
+
+    this->on();
+    
+    _gb->log("Writing data to: " + filename, false);
+
+    {
+
+        // Check if file doesn't exists, write an empty array
+        if(!exists(filename)) {
+            File new_file = this->openFile("write", filename);
+            if(new_file) {
+                // new_file.print("");
+                this->closeFile(new_file);
+            }
+        }
+
+        File file = this->openFile("write", filename);
+        if(file) {
+            file.print(data);
+            this->closeFile(file);
+            
+            _gb->arrow().log("Write complete");
+        }
+        else{
+            _gb->arrow().log("Write failed");
+        }
+    }
+    this->off();
+}
+
+// Read content from SD card
+String GB_SD::readfile(String filename) {
+
+    // Enable watchdog
+    _gb->getmcu()->watchdog("enable");
+
+    String result = "";
+    char buffer[65];
+    this->readchunks(filename, 0, buffer, sizeof(buffer), [] (const char *chunk, int, void *context) {
+        *((String *) context) += chunk;
+        return true;
+    }, &result);
+
+    // Disable watchdog
+    _gb->getmcu()->watchdog("disable");
+    return result;
+}
 
+// Read up to 'length' bytes from 'offset' into 'buffer'; returns the number of bytes read (-1 if the file can't be opened)
+int GB_SD::read(String path, uint32_t offset, char *buffer, int length) {
+    File file = this->openFile("read", path);
+    if (!file) {
+        this->off();
+        return -1;
+    }
+
+    int count = file.seekSet(offset) ? file.read(buffer, length) : 0;
+    file.close();
+    this->off();
+    return count;
+}
+
+/*
+    Read a file from 'offset' in chunks of up to size - 1 bytes; each chunk is NUL-terminated in 'buffer'
+    Returns the number of bytes read
+*/
+uint32_t GB_SD::readchunks(String path, uint32_t offset, char *buffer, int size, callback_t_on_chunk callback, void *context) {
+    uint32_t total = 0;
+    File file = this->openFile("read", path);
+    if (file && file.seekSet(offset)) {
+        int count;
+        while ((count = file.read(buffer, size - 1)) > 0) {
+            buffer[count] = 0;
+            total += count;
+            if (!callback(buffer, count, context)) break;
+        }
+    }
+    if (file) file.close();
+    this->off();
+    return total;
+}
+
+/*
+    Read a file line by line into 'buffer' (without the line ending)
+    A line longer than size - 1 bytes is passed on in pieces. Returns the number of lines read
+*/
+uint32_t GB_SD::readlines(String path, char *buffer, int size, callback_t_on_line callback, void *context) {
+    uint32_t lines = 0;
+    File file = this->openFile("read", path);
+    if (file) {
+        int length;
+        while ((length = file.fgets(buffer, size)) > 0) {
+            if (buffer[length - 1] == '\n') buffer[--length] = 0;
+            lines++;
+            if (!callback(buffer, length, context)) break;
+        }
+        file.close();
+    }
+    this->off();
+    return lines;
+}
+
+bool GB_SD::_write(String filename, String data) {
+    
+    this->on();
+    File file = this->openFile("write", filename);
+    if(file) {
+        file.print(data);
+        this->_dirupdate(filename, file.fileSize());
+        file.close();
+        delay(15);
+        return true;
+    }
+    else{
+        if (this->_gb->hasdevice("rgb")) this->_gb->getdevice("rgb")->on(1);
+        return false;
+    }
+    this->off();
+}
+
+/*
+    Read config file and set device and survey variables
+*/
+String GB_SD::readconfig() {
+
+    _gb->log("Reading config from SD", false);
+
+    if (!this->_initialized || !this->device.detected) {
+
+        _gb->arrow().log("Skipped");
+        _gb->getdevice("sntl")->disable();
+        _gb->br().color("red").log("Configuration can't be read.").br();
+
+        uint8_t now = millis();
+        while (!(this->device.detected = this->_begin(this->_sck_speed))) {
+            _gb->getdevice("gdc")->detect(true);
+            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(((millis() - now) / 1000) % 2 ? "red" : "blue");
+            if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("-");
+            this->off();delay(500);
+            this->on(); delay(50);
+        }
+        if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("....");
+        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->off();
+        
+        // Reinitialize
+        this->initialize();
+        return "";
+    }
+
+    this->on();
+
+    // Create config folder if it does not exist
+    if (!this->exists("/config")) this->mkdir("/config");
+
+    const char* filename = "/config/config.ini";
+    
+    // If requested config file exists
+    if(!this->exists(filename)) {
+        _gb->arrow().log("File not found.");
+        
+        _gb->getdevice("sntl")->disable();
+        _gb->br().color("red").log("Configuration absent.");
+        _gb->color("white").log("Use desktop client to proceed.");
+        uint8_t now = millis();
+        while (!_gb->globals.GDC_CONNECTED) {
+            _gb->getdevice("gdc")->detect(true);
+            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(((millis() - now) / 1000) % 2 ? "red" : "green");
+            if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("-");
+            delay(500);
+        }
+        return "";
+    }
+    else {
+
+        // Read data
+        String configdata = this->readfile(filename);
+        _gb->arrow().log("Done");
+
+        this->off();
+        return configdata;
+    }
+}
+
+// Read config file and return a line by type
+String GB_SD::readconfig(String type) { return this->readconfig("/config/config.ini", type); }
+String GB_SD::readconfig(String filename, String type) { 
+    
+    // Detect GDC without lock
+    if (_gb->hasdevice("gdc")) _gb->getdevice("gdc")->detect(false);
+
+    // Enable watchdog
+    _gb->getmcu()->watchdog("enable");
+    this->on();
+
+    // If requested config file exists
+    if(!this->exists(filename)){
+        _gb->log("config file not found.");
+        this->off();
+        _gb->getmcu()->watchdog("disable");
         return "";
     }
+
+    // Stop at the line of the requested type
+    struct SEARCH { String prefix; String line; } search = { type + "=", "" };
+    char buffer[128];
+    this->readlines(filename, buffer, sizeof(buffer), [] (char *line, int, void *context) {
+        SEARCH *search = (SEARCH *) context;
+        if (strncmp(line, search->prefix.c_str(), search->prefix.length()) != 0) return true;
+        search->line = line;
+        return false;
+    }, &search);
+
+    // Disable watchdog
+    _gb->getmcu()->watchdog("disable");
+    return search.line;
 }
 
 // Update config file by type
@@ -1019,7 +2071,20 @@ void GB_SD::updateconfig(String filename, String type, String data) {
 String GB_SD::getfilelist(String root) {
     if (!this->device.detected) return "SD device not initialized.";
 
+    DIR_CACHE *cache = this->_dircache(root);
+    if (cache != NULL && cache->complete) {
+        this->_dir_hits++;
+        String list = "";
+        for (uint8_t i = 0; i < cache->count; i++) {
+            if (strstr(cache->entries[i].name, "FOUND.") != NULL) continue;
+            list += String(cache->entries[i].name) + String(cache->entries[i].dir ? "/" : "") + ":" + String(cache->entries[i].size) + ",";
+        }
+        if (list.length() > 0) list = list.substring(0, list.length() - 1);
+        return String(cache->count) + "::" + list;
+    }
+
     this->on();
+    this->_dir_scans++;
 
     String list = "";
     int filecount = 0;
@@ -1028,6 +2093,7 @@ String GB_SD::getfilelist(String root) {
     while (true) {
         File file = dir.openNextFile();
         if (!file) break;
+        this->_dir_reads++;
 
         int max_characters = 25;
         char f_name[max_characters];
@@ -1067,7 +2133,18 @@ String GB_SD::getfilelist(String root) {
     ! Count files that contain the specified string in the filename.
 */
 int GB_SD::count(String contains, String folder) {
+    DIR_CACHE *cache = this->_dircache(folder);
+    if (cache != NULL && (contains == cache->pattern || cache->complete)) {
+        this->_dir_hits++;
+        if (contains == cache->pattern) return cache->matches;
+
+        int count = 0;
+        for (uint8_t i = 0; i < cache->count; i++) if (!cache->entries[i].dir && strstr(cache->entries[i].name, contains.c_str()) != NULL) count++;
+        return count;
+    }
+
     this->on();
+    this->_dir_scans++;
 
     int count = 0;
     FsFile file;
@@ -1078,6 +2155,7 @@ int GB_SD::count(String contains, String folder) {
 
     // Iterate over all files in the folder
     while (file.openNext(&root, O_RDONLY)) {
+        this->_dir_reads++;
         char name[25];
         file.getName(name, 25);
         if (!file.isDir()) {
@@ -1098,6 +2176,161 @@ int GB_SD::count(String contains){
     return this->count(contains, "/");
 }
 
+// Cache the listing of a folder; the files whose names contain 'pattern' are counted and numbered
+GB_SD& GB_SD::cache(String folder, String pattern) {
+    if (this->_dir_folders >= DIR_CACHE_FOLDERS) return *this;
+
+    DIR_CACHE *cache = &this->_dirs[this->_dir_folders++];
+    cache->folder = folder;
+    cache->pattern = pattern;
+    cache->built = false;
+    return *this;
+}
+
+// Lookups answered from the cache, and directory scans (and the entries they read) since boot
+String GB_SD::cachestatus() {
+    return String(this->_dir_hits) + " hits, " + String(this->_dir_scans) + " scans (" + String(this->_dir_reads) + " entries read)";
+}
+
+// The cache of a folder, read from the card if needed (NULL if the folder isn't cached or can't be read)
+GB_SD::DIR_CACHE* GB_SD::_dircache(String folder) {
+    for (uint8_t i = 0; i < this->_dir_folders; i++) {
+        DIR_CACHE *cache = &this->_dirs[i];
+        if (cache->folder != folder) continue;
+
+        // A window that has run out of files is read again
+        bool files = cache->complete || cache->matches == 0;
+        for (uint8_t j = 0; !files && j < cache->count; j++) files = !cache->entries[j].dir;
+
+        if ((!cache->built || !files) && !this->_dirbuild(cache)) return NULL;
+        return cache;
+    }
+    return NULL;
+}
+
+// Read a folder's listing
+bool GB_SD::_dirbuild(DIR_CACHE *cache) {
+    bool powered = this->_powered;
+    this->on();
+
+    File root, file;
+    cache->built = root.open(cache->folder.c_str());
+    if (cache->built) {
+        this->_dir_scans++;
+        cache->complete = true;
+        cache->matches = 0;
+        cache->sequence = 0;
+        cache->last[0] = 0;
+        cache->count = 0;
+
+        char name[64];
+        while (file.openNext(&root, O_RDONLY)) {
+            this->_dir_reads++;
+            file.getName(name, sizeof(name));
+            this->_diradd(cache, name, file.isDir(), file.fileSize());
+            file.close();
+        }
+
+        // A read error ends the listing early too; it isn't kept (exists() would miss the rest)
+        if (root.getError()) cache->built = false;
+        root.close();
+    }
+
+    if (!powered) this->off();
+    return cache->built;
+}
+
+// Add an entry at the end of a folder's listing
+void GB_SD::_diradd(DIR_CACHE *cache, const char *name, bool dir, uint32_t size) {
+    if (!dir && strstr(name, cache->pattern.c_str()) != NULL) {
+        cache->matches++;
+        strncpy(cache->last, name, sizeof(cache->last) - 1);
+        cache->last[sizeof(cache->last) - 1] = 0;
+
+        const char *number = strrchr(name, '_');
+        uint32_t sequence = number != NULL ? strtoul(number + 1, NULL, 10) : 0;
+        if (sequence > cache->sequence) cache->sequence = sequence;
+    }
+
+    // The window stays the first part of the listing; an entry past it makes the listing partial
+    if (cache->complete && cache->count < DIR_CACHE_ENTRIES && strlen(name) < sizeof(cache->entries[0].name)) {
+        DIR_ENTRY *entry = &cache->entries[cache->count++];
+        strcpy(entry->name, name);
+        entry->dir = dir;
+        entry->size = size;
+    }
+    else cache->complete = false;
+}
+
+// The (read) cache of a path's folder and the path's name
+bool GB_SD::_dirsplit(String path, DIR_CACHE *&cache, String &name) {
+    if (!path.startsWith("/")) path = "/" + path;
+    int slash = path.lastIndexOf("/");
+    String folder = slash > 0 ? path.substring(0, slash) : "/";
+    name = path.substring(slash + 1);
+    if (name.length() == 0) return false;
+
+    for (uint8_t i = 0; i < this->_dir_folders; i++) {
+        if (this->_dirs[i].built && this->_dirs[i].folder == folder) {
+            cache = &this->_dirs[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    A file was opened for writing: update its size, or add it if it's new
+    In a partial listing, only an empty file outside the window is taken as new
+*/
+void GB_SD::_dirupdate(String path, uint32_t size) {
+    DIR_CACHE *cache;
+    String name;
+    if (!this->_dirsplit(path, cache, name)) return;
+
+    for (uint8_t i = 0; i < cache->count; i++) {
+        if (name.equalsIgnoreCase(cache->entries[i].name)) {
+            cache->entries[i].size = size;
+            return;
+        }
+    }
+    if (cache->complete || size == 0) this->_diradd(cache, name.c_str(), false, size);
+}
+
+// A file was removed
+void GB_SD::_dirremove(String path) {
+    DIR_CACHE *cache;
+    String name;
+    if (!this->_dirsplit(path, cache, name)) return;
+
+    for (uint8_t i = 0; i < cache->count; i++) {
+        if (name.equalsIgnoreCase(cache->entries[i].name)) {
+            for (uint8_t j = i; j + 1 < cache->count; j++) cache->entries[j] = cache->entries[j + 1];
+            cache->count--;
+            break;
+        }
+    }
+
+    if (strstr(name.c_str(), cache->pattern.c_str()) == NULL) return;
+    if (cache->matches > 0) cache->matches--;
+    if (!name.equalsIgnoreCase(cache->last)) return;
+
+    // A new last file: from the window if it's the whole listing, else by reading the folder again
+    if (!cache->complete) {
+        cache->built = false;
+        return;
+    }
+    cache->last[0] = 0;
+    for (int i = cache->count - 1; i >= 0 && cache->last[0] == 0; i--) {
+        if (!cache->entries[i].dir && strstr(cache->entries[i].name, cache->pattern.c_str()) != NULL) strcpy(cache->last, cache->entries[i].name);
+    }
+}
+
+// Drop every listing (they are read again on use)
+void GB_SD::_dirflush() {
+    for (uint8_t i = 0; i < this->_dir_folders; i++) this->_dirs[i].built = false;
+}
+
 // Get queue count
 int GB_SD::getqueuecount() {
     if (!this->device.detected) return 0;
@@ -1106,7 +2339,18 @@ int GB_SD::getqueuecount() {
     if (!this->exists("/queue")) this->mkdir("/queue");
     if (!this->exists("/queue/sent")) this->mkdir("/queue/sent");
 
-    return this->count("queue", "/queue");
+    int count = 0;
+    for (int i = 0; i < 3; i++) count += this->getqueuecount(this->lanes[i].name);
+    return count;
+}
+
+// Get the number of files in a queue lane
+int GB_SD::getqueuecount(String name) {
+    if (!this->device.detected) return 0;
+
+    QUEUE_LANE *lane = this->_lane(name);
+    if (lane == NULL || !this->exists(lane->folder)) return 0;
+    return this->count("queue", lane->folder);
 }
 
 // Check if queue is empty
@@ -1126,22 +2370,162 @@ String GB_SD::getfirstqueuefilename() {
     return this->getfirstfilenamecontaining("queue", "/queue");
 }
 
+/*
+    Get the first queue file that is not in the comma-separated exclusion list
+    (e.g. the queue files that are already in flight with the MQTT broker)
+*/
+String GB_SD::getfirstqueuefilename(String exclude) {
+    if (!this->sddetected() || !this->device.detected)  return "";
+    return this->_first_queue_file(this->_lane("readings"), exclude);
+}
+
+/*
+    Get the first file in a queue lane that is not in the exclusion list.
+    The name is returned relative to /queue (e.g. alerts/queue_3.csv).
+*/
+String GB_SD::_first_queue_file(QUEUE_LANE *lane, String exclude) {
+    if (lane == NULL) return "";
+
+    String prefix = lane->folder.substring(String("/queue/").length());
+    if (prefix.length() > 0) prefix += "/";
+    exclude = "," + exclude;
+
+    DIR_CACHE *cache = this->_dircache(lane->folder);
+    if (cache != NULL) {
+        for (uint8_t i = 0; i < cache->count; i++) {
+            String filename = prefix + cache->entries[i].name;
+            if (!cache->entries[i].dir && filename.indexOf("queue") != -1 && exclude.indexOf("," + filename + ",") == -1) {
+                this->_dir_hits++;
+                return filename;
+            }
+        }
+        if (cache->complete) {
+            this->_dir_hits++;
+            return "";
+        }
+    }
+
+    this->on();
+    this->_dir_scans++;
+
+    FsFile file;
+    File root;
+    root.open(_gb->s2c(lane->folder));
+
+    String result = "";
+    while (result.length() == 0 && file.openNext(&root, O_RDONLY)) {
+        this->_dir_reads++;
+        char name[25];
+        file.getName(name, 25);
+
+        String filename = prefix + _gb->ca2s(name);
+        if (!file.isDir() && filename.indexOf("queue") != -1 && exclude.indexOf("," + filename + ",") == -1) {
+            result = filename;
+        }
+        file.close();
+    }
+    root.close();
+
+    this->off();
+    return result;
+}
+
+// Find a queue lane by name
+GB_SD::QUEUE_LANE* GB_SD::_lane(String name) {
+    for (int i = 0; i < 3; i++) if (this->lanes[i].name == name) return &this->lanes[i];
+    return NULL;
+}
+
+/*
+    Get the next queue file to upload (relative to /queue)
+    Alerts have strict priority. Readings and logs are drained in proportion to their weights
+    so that a backlog in one lane doesn't starve the other.
+*/
+String GB_SD::nextqueuefile(String exclude) { return this->nextqueuefile(exclude, false); }
+String GB_SD::nextqueuefile(String exclude, bool priorityonly) {
+    if (!this->sddetected() || !this->device.detected)  return "";
+
+    // Strict priority for alerts
+    String filename = this->_first_queue_file(this->_lane("alerts"), exclude);
+    if (filename.length() > 0 || priorityonly) return filename;
+
+    // Weighted round robin; the credits are refilled once spent (or when the lanes that have credits are empty)
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < 3; i++) {
+            QUEUE_LANE *lane = &this->lanes[i];
+            if (lane->weight == 0 || lane->credit <= 0) continue;
+
+            filename = this->_first_queue_file(lane, exclude);
+            if (filename.length() > 0) {
+                lane->credit--;
+                return filename;
+            }
+        }
+        for (int i = 0; i < 3; i++) this->lanes[i].credit = this->lanes[i].weight;
+    }
+    return "";
+}
+
+/*
+    Write a record to a queue lane
+    The topic is saved with the record (#TOPIC:<topic>). If the lane is at its cap, its oldest
+    file is dropped first. Returns false if the record couldn't be written (the caller may then
+    publish it directly).
+*/
+bool GB_SD::enqueue(String name, String topic, String data) { return this->enqueue(name, topic, data, 0); }
+bool GB_SD::enqueue(String name, String topic, CSVary csv, uint32_t sequence) { return this->enqueue(name, topic, csv.getheader() + "\n" + csv.getrows(), sequence); }
+bool GB_SD::enqueue(String name, String topic, String data, uint32_t sequence) {
+    if (!this->sddetected() || !this->device.detected) return false;
+
+    QUEUE_LANE *lane = this->_lane(name);
+    if (lane == NULL) return false;
+
+    if (!this->exists("/queue")) this->mkdir("/queue");
+    if (!this->exists(lane->folder)) this->mkdir(lane->folder);
+
+    // Enforce the retention cap. A file awaiting its PUBACK is skipped: its acknowledgement removes it
+    // anyway, and if it's abandoned it goes back in the lane (see GB_MQTT::onabandon())
+    if (lane->cap > 0 && this->count("queue", lane->folder) >= lane->cap) {
+        String inflight = _gb->hasdevice("mqtt") ? _gb->getdevice("mqtt")->inflighttags() : "";
+        String oldest = this->_first_queue_file(lane, inflight);
+        if (oldest.length() > 0) {
+            _gb->log("Queue lane " + lane->name + " full. Dropping " + oldest);
+            this->removequeuefile(oldest);
+        }
+    }
+
+    String metadata = "#TOPIC:" + topic;
+    if (sequence > 0) metadata = "#SEQ:" + _gb->globals.DEVICE_SN + ":" + String(sequence) + "\n" + metadata;
+
+    String path = lane->folder + "/" + this->getavailablequeuefilename(lane->folder);
+    this->writeCSV(path, data, metadata);
+    return this->_written;
+}
+
 String GB_SD::getlastqueuefilename() {
     if (!this->sddetected() || !this->device.detected) return "";
     return this->getlastfilenamecontaining("queue", "/queue");
 }
 
-String GB_SD::getavailablequeuefilename() {
+String GB_SD::getavailablequeuefilename() { return this->getavailablequeuefilename("/queue"); }
+String GB_SD::getavailablequeuefilename(String folder) {
     if (!this->sddetected() || !this->device.detected) return "";
 
-    String lastfilename = this->getlastfilenamecontaining("queue", "/queue");
+    // A cached folder knows the highest queue number
+    DIR_CACHE *cache = this->_dircache(folder);
+    if (cache != NULL && cache->pattern == "queue") {
+        this->_dir_hits++;
+        return "queue_" + String(cache->sequence + 1) + ".csv";
+    }
+
+    String lastfilename = this->getlastfilenamecontaining("queue", folder);
     String availablefilename = "queue_" + 
                                 String(
                                     (lastfilename.substring(lastfilename.indexOf("queue_") + 6, lastfilename.indexOf("queue_") + 8)).toInt() + 1
                                 ) + 
                                 ".csv";
     int count = 0;
-    while (this->getfirstfilenamecontaining(availablefilename, "/queue").length() > 0) {
+    while (this->getfirstfilenamecontaining(availablefilename, folder).length() > 0) {
         availablefilename = "queue_" + 
                             String(
                                 (lastfilename.substring(lastfilename.indexOf("queue_") + 6, lastfilename.indexOf("queue_") + 8)).toInt() + 1 + ++count
@@ -1157,6 +2541,35 @@ void GB_SD::removequeuefile(String filename) {
     this->rm("/queue/" + filename);
 }
 
+/*
+    Move a queue file to the back of its lane (e.g. one the broker never acknowledged), so the files
+    behind it go first; the name is relative to /queue. The file keeps its records and sequence.
+*/
+bool GB_SD::requeuefile(String filename) {
+    if (!this->sddetected() || !this->device.detected) return false;
+
+    String path = "/queue/" + filename;
+    String folder = path.substring(0, path.lastIndexOf("/"));
+    if (!this->exists(path)) return false;
+    String target = folder + "/" + this->getavailablequeuefilename(folder);
+
+    this->on();
+    bool success = this->_sd.rename(path.c_str(), target.c_str());
+    if (success) {
+        this->_dirremove(path);
+        this->_dirupdate(target, 0);
+
+        File file;
+        if (file.open(target.c_str(), O_RDONLY)) {
+            this->_dirupdate(target, file.fileSize());
+            file.close();
+        }
+    }
+    else _gb->log("Couldn't requeue " + path);
+    this->off();
+    return success;
+}
+
 // Write a string to a queue file (i.e. a CSV without a header)
 void GB_SD::writequeuefile(String filename, String data) {
     this->writeCSV("/queue/" + filename, data, "");
@@ -1166,24 +2579,80 @@ void GB_SD::writequeuefile(String filename, CSVary csv) {
     this->writeCSV("/queue/" + filename, csv); 
 }
 
+/*
+    Write CSV to queue file along with the record's sequence number
+    The sequence line (#SEQ:<device SN>:<sequence>) precedes the CSV header.
+*/
+void GB_SD::writequeuefile(String filename, CSVary csv, uint32_t sequence) {
+    if (sequence == 0) return this->writequeuefile(filename, csv);
+    this->writeCSV("/queue/" + filename, csv.getrows(), "#SEQ:" + _gb->globals.DEVICE_SN + ":" + String(sequence) + "\n" + csv.getheader());
+}
+
 // Read content from a queue file
 String GB_SD::readqueuefile(String filename) {
-    return this->readfile("/queue/" + filename);
+    uint32_t sequence;
+    return this->readqueuefile(filename, sequence);
+}
+
+// Read content from a queue file and its sequence number (0 if the record has none)
+String GB_SD::readqueuefile(String filename, uint32_t &sequence) {
+    String topic;
+    return this->readqueuefile(filename, sequence, topic);
+}
+
+// Read content from a queue file along with its sequence number and topic (data/set if the record has none)
+// "" if the file can't be read, or if it was quarantined: a record in it is torn or doesn't match its CRC
+String GB_SD::readqueuefile(String filename, uint32_t &sequence, String &topic) {
+    String path = "/queue/" + filename, content = "";
+    sequence = 0;
+    topic = "data/set";
+
+    // The whole file; a read error is tried once more (on() ends the failed read) and then left for later
+    bool read = false;
+    for (uint8_t attempt = 0; attempt < 2 && !read; attempt++) {
+        this->on();
+        File file = this->openFile("read", path);
+        read = file && this->_readall(file, content);
+        if (file) file.close();
+    }
+    this->off();
+    if (!read) return "";
+
+    // Check each record against its trailer and strip the trailers (a file appended to more than once holds several)
+    if (!this->_unframe(content)) {
+        _gb->log("Torn or corrupt record in queue file " + filename + "; quarantined");
+        this->_corrupt_records++;
+        this->_quarantine(path);
+        return "";
+    }
+
+    // Strip the metadata lines in place
+    while (content.startsWith("#")) {
+        int end = content.indexOf("\n");
+        if (end == -1) end = content.length();
+
+        const char *line = content.c_str();
+        if (strncmp(line, "#SEQ:", 5) == 0) sequence = strtoul(line + content.lastIndexOf(":", end) + 1, NULL, 10);
+        else if (strncmp(line, "#TOPIC:", 7) == 0) topic = content.substring(7, end);
+        content.remove(0, end + 1);
+    }
+    return content;
 }
 
 // Read content from SD card and encode for transfer over Serial USB
 // TODO: Test/redo/deprecate
 String GB_SD::download(String file_name){
-    File file = this->openFile("read", file_name);
-    int char_code;
-
     String result = "";
-    while ((char_code = file.read()) >= 0){
-        if(char_code == 44) result += ",";
-        else result += "!" + String(char_code);
-    }
+    char buffer[65];
+    this->readchunks(file_name, 0, buffer, sizeof(buffer), [] (const char *chunk, int length, void *context) {
+        String &result = *((String *) context);
+        for (int i = 0; i < length; i++) {
+            if (chunk[i] == 44) result += ",";
+            else result += "!" + String((int) chunk[i]);
+        }
+        return true;
+    }, &result);
     _gb->log("###" + String(result), true);
-    this->closeFile(file);
     return result;
 }
 
@@ -1191,24 +2660,22 @@ String GB_SD::download(String file_name){
     Read "chars_at_a_time" number of characters starting from "starting_char_index"
 */
 String GB_SD::readLinesFromSD(String file_name, int chars_at_a_time, int starting_char_index) {
-    File file = this->openFile("read", file_name);
-    this->on();
     String result = "";
-    int charnumber = 0;
-
-    bool log = file_name.indexOf("readings") != -1;
-
-    // Read lines one at a time
-    while(file.available()) {
-        // Read characters
-        char c = file.read();
-        charnumber++;
-        if (starting_char_index <= charnumber && charnumber < starting_char_index + chars_at_a_time) result += String(c);
-        // delay(1);
-    }
-    
-    this->closeFile(file);
-    this->off();
+    if (chars_at_a_time <= 0) return result;
+
+    // Character indices are 1-based; seek straight to the requested range
+    uint32_t offset = starting_char_index > 1 ? starting_char_index - 1 : 0;
+    if (starting_char_index < 1) chars_at_a_time += starting_char_index - 1;
+
+    struct RANGE { String *result; int remaining; } range = { &result, chars_at_a_time };
+    char buffer[65];
+    this->readchunks(file_name, offset, buffer, sizeof(buffer), [] (const char *chunk, int length, void *context) {
+        RANGE *range = (RANGE *) context;
+        if (length <= range->remaining) *range->result += chunk;
+        else for (int i = 0; i < range->remaining; i++) *range->result += chunk[i];
+        range->remaining -= length;
+        return range->remaining > 0;
+    }, &range);
     return result;
 }
 
@@ -1258,8 +2725,8 @@ bool GB_SD::rmdir(String folderpath){
     // Check if folder exists, and delete it if it does
     if (this->exists(folderpath)) {
 
-        // Traverse to parent folder
-        _sd.chdir(parentpath);
+        // Traverse to parent folder (from the root; an earlier rmdir() leaves the working folder elsewhere)
+        _sd.chdir("/" + parentpath);
 
         // If the delete action was unsuccessful
         if (!_sd.rmdir(foldername)) {
@@ -1268,6 +2735,8 @@ bool GB_SD::rmdir(String folderpath){
                 
         // Deleted successfully
         else erroroccured = false;
+
+        this->_dirflush();
     }
 
     // The the file does not exist
@@ -1296,7 +2765,10 @@ bool GB_SD::rm(String filename){
         }
                 
         // Deleted successfully
-        else erroroccured = false;
+        else {
+            erroroccured = false;
+            this->_dirremove(filename);
+        }
     }
 
     // The the file does not exist
@@ -1313,18 +2785,51 @@ bool GB_SD::rm(String filename){
 bool GB_SD::exists(String path) {
 
     this->on();
+
+    // Cached folders, and the entries of the cached folders
+    DIR_CACHE *cache = this->_dircache(path);
+    String name;
+    if (cache != NULL) {
+        this->_dir_hits++;
+        return true;
+    }
+    if (this->_dirsplit(path, cache, name)) {
+        for (uint8_t i = 0; i < cache->count; i++) {
+            if (name.equalsIgnoreCase(cache->entries[i].name)) {
+                this->_dir_hits++;
+                return true;
+            }
+        }
+        if (cache->complete) {
+            this->_dir_hits++;
+            return false;
+        }
+    }
+
     bool exists = _sd.exists(path);
     
     return exists;
 }
 
 bool GB_SD::mkdir(String path) {
+
+    // A mkdir cut short by a read error can leave the folder's entry as an empty file, which exists()
+    // then takes for the folder; it goes before the folder is made again
+    File stray;
+    if (stray.open(_gb->s2c(path)) && !stray.isDir() && stray.fileSize() == 0) {
+        stray.close();
+        if (_sd.remove(_gb->s2c(path))) this->_dirremove(path);
+    }
+    stray.close();
+
     bool success = _sd.mkdir(_gb->s2c(path), true);
+    if (success) this->_dirflush();
     return success;
 }
 
 
 bool GB_SD::renamedir(String originalFolder, String newFolder) {
+    this->_dirflush();
 
     // Create a new folder with the new name
     if (!_sd.mkdir(newFolder)) {
@@ -1405,54 +2910,326 @@ String GB_SD::_split_string(String data, char separator, int index) {
     return found > index ? data.substring(strIndex[0], strIndex[1]) : "";
 }
 
+/*
+    ! Boot recovery
+    Checks the end of each readings file; returns false if the card can't be read or a file couldn't be repaired
+*/
+bool GB_SD::recover() {
+    this->on();
+
+    // The queue lanes: a file an enqueue left torn is quarantined rather than uploaded
+    bool success = true;
+    for (int i = 0; i < 3; i++) if (!this->_recoverlane(this->lanes[i].folder)) success = false;
+    if (!this->exists("/readings")) return success;
+
+    File root, file;
+    if (!root.open("/readings")) return false;
+
+    // Collect the names first; the files are modified while checked
+    String names = "";
+    while (file.openNext(&root, O_RDONLY)) {
+        char name[64];
+        file.getName(name, sizeof(name));
+        if (!file.isDir() && String(name).endsWith(".csv")) names += String(name) + "\n";
+        file.close();
+    }
+    root.close();
+
+    for (int start = 0, end; start < (int) names.length(); start = end + 1) {
+        end = names.indexOf("\n", start);
+        if (!this->_recoverfile("/readings/" + names.substring(start, end))) success = false;
+    }
+    return success;
+}
+
+/*
+    ! R/W check
+    The sketches' card check, on the boot recovery path: the card answers, and the records at the end
+    of its files are intact or were repaired. False if the card isn't there or can't be read
+*/
 bool GB_SD::rwtest() {
+    if (!this->sddetected() || !this->device.detected) return false;
 
-    // // Skip R/W test
-    // return true;
+    bool success = this->recover();
+    this->off();
+    return success;
+}
 
-    _gb->arrow().log("SD R/W test", false);
-    bool _erroroccurred = false;
+/*
+    ! Full verification
+    Checks every frame of the readings and queue files
+*/
+String GB_SD::sdverify() {
+    unsigned long start = millis();
+    uint32_t files = 0, frames = 0, corrupt = 0;
 
-    if(this->exists("test")) {
-        _gb->arrow().log("Stale test file found.", false);
+    this->on();
+    this->_verifyfolder("/readings", files, frames, corrupt);
+    for (int i = 0; i < 3; i++) this->_verifyfolder(this->lanes[i].folder, files, frames, corrupt);
+    this->off();
 
-        // Delete the file
-        this->rm("test");
+    return String(files) + " files, " + String(frames) + " records, " + String(corrupt) + " corrupt, " + String((millis() - start) / 1000.0) + " seconds; since boot: " + this->health();
+}
 
-        _erroroccurred = true;
+/*
+    ! Storage benchmark (faults mode)
+    Writes 'records' readings rows, queue files and control updates, reports their latencies and write
+    amplification (see GB_FAULTS) and verifies the frames. The control updates go to a store of their
+    own, so the device's variables are left alone. The benchmark files are removed afterwards.
+*/
+String GB_SD::bench(int records) {
+    if (!GB_FAULTS::injector().enabled()) return "Faults mode is off";
+
+    String header = "TIMESTAMP,WLEV,RAIN,BATTERY";
+    if (!this->exists("/queue/bench")) this->mkdir("/queue/bench");
+
+    const char *store = this->_control_store, *grown = this->_control_grown;
+    uint16_t slots = this->_control_slots;
+    this->_control_store = "/control/bench.kv";
+    this->_control_grown = "/control/benchgrown.kv";
+
+    GB_FAULTS::injector().clear();
+    GB_SPI::bus().clear();
+    for (int i = 0; i < records; i++) {
+        String row = String(1700000000UL + i * 300UL) + "," + String((i % 500) / 100.0) + "," + String(i % 20) + "," + String(70 + i % 30);
+        this->writeCSV("/readings/bench.csv", row, header);
+        this->writeCSV("/queue/bench/queue_" + String(i + 1) + ".csv", row, "#TOPIC:bench");
+        this->_kvwrite("BENCH", String(i));
     }
-    
-    String prompt = "teststring";
-    File file = this->openFile("write", "test");
-    if (file) {
+    String report = GB_FAULTS::injector().status() + "; SPI: " + GB_SPI::bus().status();
 
-        // Write to the file
-        file.print(prompt);
-        file.close();
-        delay(15);
+    this->rm(this->_control_store);
+    this->_control_store = store;
+    this->_control_grown = grown;
+    this->_control_slots = slots;
+
+    for (int i = 0; i < records; i++) this->rm("/queue/bench/queue_" + String(i + 1) + ".csv");
+    this->rmdir("/queue/bench");
+    this->rm(this->_indexpath("/readings/bench.csv"));
+    this->rm("/readings/bench.csv");
 
-        // Read the file
-        String response = this->readfile("test");
+    return report + "; verification: " + this->sdverify();
+}
+
+// CRC failures and torn records since boot
+String GB_SD::health() {
+    if (this->_corrupt_records == 0 && this->_torn_records == 0) return "ok";
+    return String(this->_corrupt_records) + " corrupt records, " + String(this->_torn_records) + " torn records truncated";
+}
+
+// CRC-32 (IEEE); pass the previous result to continue over several chunks
+uint32_t GB_SD::_crc32(const char *data, uint32_t length, uint32_t crc) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    crc = ~crc;
+    for (uint32_t i = 0; i < length; i++) {
+        uint8_t value = data[i];
+        crc = table[(crc ^ value) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (value >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+// A record followed by its trailer
+String GB_SD::_frame(String data) {
+    char trailer[28];
+    snprintf(trailer, sizeof(trailer), "\n#CRC:%lu:%08lX", (unsigned long) data.length(), (unsigned long) this->_crc32(data.c_str(), data.length(), 0));
+    return data + trailer;
+}
 
-        // Delete the file
-        this->rm("test");
+// Check the record before the trailer at 'trailer' (the file position moves)
+bool GB_SD::_checkframe(File &file, uint32_t trailer, const char *line) {
+    char *end;
+    uint32_t length = strtoul(line + 5, &end, 10);
+    if (strncmp(line, "#CRC:", 5) != 0 || *end != ':' || strlen(end + 1) < 8 || length + 1 > trailer) return false;
+    uint32_t expected = strtoul(end + 1, NULL, 16);
+
+    char buffer[64];
+    uint32_t crc = 0;
+    file.seekSet(trailer - 1 - length);
+    for (uint32_t remaining = length; remaining > 0;) {
+        int count = file.read(buffer, min(remaining, (uint32_t) sizeof(buffer)));
+        if (count <= 0) return false;
+        crc = this->_crc32(buffer, count, crc);
+        remaining -= count;
+    }
+    return crc == expected;
+}
 
-        if (response == prompt) {
-            _erroroccurred = false;
+// Truncate a torn record at the end of a file and check the last record; returns false if the file couldn't be repaired
+bool GB_SD::_recoverfile(String path) {
+    File file;
+    if (!file.open(path.c_str(), O_RDWR)) return false;
+
+    bool success = true;
+    char buffer[257];
+    for (uint8_t attempt = 0; attempt < 3; attempt++) {
+        uint32_t size = file.fileSize();
+
+        // Find the last trailer in the last 2 KB (none: a file without frames is left as is)
+        int64_t trailer = -1;
+        for (uint32_t end = size; trailer < 0 && end > 0 && size - end < 2048;) {
+            uint32_t start = end > 256 ? end - 256 : 0;
+            file.seekSet(start);
+            int count = file.read(buffer, end - start);
+            for (int i = count - 6; i >= 0 && trailer < 0; i--) if (memcmp(buffer + i, "\n#CRC:", 6) == 0) trailer = start + i + 1;
+            if (start == 0) break;
+            end = start + 6;
         }
-        else {
-            _gb->arrow().log("R/W code mismatch", false);
-            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(1);
-            _erroroccurred = true;
+        if (trailer < 0) break;
+
+        file.seekSet(trailer);
+        int length = file.fgets(buffer, 32);
+        if (length > 0 && buffer[length - 1] == '\n') buffer[--length] = 0;
+        
+        // A torn trailer: drop it and look again (the record before it is then the torn tail)
+        char *end;
+        strtoul(buffer + 5, &end, 10);
+        if (*end != ':' || strlen(end + 1) != 8) {
+            success = file.truncate(trailer - 1);
+            if (!success) break;
+            continue;
+        }
+
+        // Anything after the trailer is a record without one
+        if (trailer + length < size) {
+            _gb->arrow().log("Truncated a torn record in " + path, false);
+            success = file.truncate(trailer + length);
+            if (success) this->_torn_records++;
         }
+
+        if (!this->_checkframe(file, trailer, buffer)) {
+            _gb->arrow().log("Corrupt record at the end of " + path, false);
+            this->_corrupt_records++;
+        }
+        break;
     }
-    else {
-        _gb->arrow().log("Failed (code 1)", false);
-        if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(1);
-        _erroroccurred = true;
+    file.close();
+    return success;
+}
+
+// Quarantine the queue files of a lane whose records don't all check out; false if the lane can't be listed
+bool GB_SD::_recoverlane(String folder) {
+    if (!this->exists(folder)) return true;
+
+    File root, file;
+    if (!root.open(folder.c_str())) return false;
+
+    // Collect the names first; the files are moved once the listing is done (one that can't be read is
+    // left for readqueuefile())
+    String names = "", content;
+    while (file.openNext(&root, O_RDONLY)) {
+        char name[64];
+        file.getName(name, sizeof(name));
+        if (!file.isDir() && strstr(name, "queue") != NULL && this->_readall(file, content) && !this->_unframe(content)) names += String(name) + "\n";
+        file.close();
+    }
+    bool success = !root.getError();
+    root.close();
+
+    for (int start = 0, end; start < (int) names.length(); start = end + 1) {
+        end = names.indexOf("\n", start);
+        String name = names.substring(start, end);
+        _gb->arrow().log("Quarantined the torn queue file " + folder + "/" + name, false);
+        this->_torn_records++;
+        if (!this->_quarantine(folder + "/" + name)) success = false;
+    }
+    return success;
+}
+
+// The rest of an open file; false if it couldn't be read to its end (a NUL in it ends the text there, so
+// its CRC won't match)
+bool GB_SD::_readall(File &file, String &content) {
+    char buffer[65];
+    uint32_t total = 0;
+    int count;
+    content = "";
+    while ((count = file.read(buffer, sizeof(buffer) - 1)) > 0) {
+        buffer[count] = 0;
+        content += buffer;
+        total += count;
     }
+    return count == 0 && total == file.fileSize();
+}
+
+// Strip the trailers from a queue file's text; false if a record has no trailer, if the text before a
+// trailer isn't all its record (header lines included), or if it doesn't match the CRC
+bool GB_SD::_unframe(String &content) {
+    String records = "";
+    int from = 0;
+    for (int trailer; (trailer = content.indexOf("\n#CRC:", from)) >= 0;) {
+
+        // A record starts after the newline that ends the previous trailer
+        int start = from == 0 ? 0 : from + 1;
+        int next = content.indexOf("\n", trailer + 1);
+        int stop = next < 0 ? content.length() : next;
+
+        char *end;
+        uint32_t length = strtoul(content.c_str() + trailer + 6, &end, 10);
+        if (*end != ':' || content.c_str() + stop - end != 9 || length != (uint32_t) (trailer - start)) return false;
+        if (strtoul(end + 1, NULL, 16) != this->_crc32(content.c_str() + start, length, 0)) return false;
+
+        // The newline ending the trailer starts the next record
+        records += content.substring(from, trailer);
+        from = stop;
+    }
+
+    // Text after the last trailer (or a file without one) is a record the power cut short
+    if (from == 0 || from < (int) content.length()) return false;
+    content = records;
+    return true;
+}
+
+// Move a queue file out of the lanes, to /quarantine (kept for inspection, never uploaded)
+bool GB_SD::_quarantine(String path) {
+    String name = path.substring(1);
+    name.replace("/", "_");
+    String target = "/quarantine/" + name;
+    for (int i = 1; this->exists(target); i++) target = "/quarantine/" + String(i) + "_" + name;
+
+    if (!this->exists("/quarantine")) this->mkdir("/quarantine");
+    bool success = this->_sd.rename(path.c_str(), target.c_str());
+    if (success) this->_dirremove(path);
+    else _gb->log("Couldn't quarantine " + path);
+    this->off();
+    return success;
+}
 
-    return !_erroroccurred;
+// Check every frame of the files in a folder
+void GB_SD::_verifyfolder(String folder, uint32_t &files, uint32_t &frames, uint32_t &corrupt) {
+    File root, file;
+    if (!this->exists(folder) || !root.open(folder.c_str())) return;
+
+    char buffer[64];
+    while (file.openNext(&root, O_RDONLY)) {
+        if (file.isDir()) { file.close(); continue; }
+        files++;
+
+        bool linestart = true;
+        uint32_t position = 0;
+        int length;
+        while ((position = file.curPosition(), length = file.fgets(buffer, sizeof(buffer))) > 0) {
+            bool trailer = linestart && strncmp(buffer, "#CRC:", 5) == 0;
+            linestart = buffer[length - 1] == '\n';
+            if (trailer) {
+                if (linestart) buffer[length - 1] = 0;
+                frames++;
+                if (!this->_checkframe(file, position, buffer)) {
+                    char name[64];
+                    file.getName(name, sizeof(name));
+                    _gb->log("Corrupt record in " + folder + "/" + String(name) + " at " + String(position));
+                    corrupt++;
+                }
+                file.seekSet(position);
+                file.fgets(buffer, sizeof(buffer));
+            }
+        }
+        file.close();
+    }
+    root.close();
+    this->_corrupt_records = max(this->_corrupt_records, corrupt);
 }
 
 /*
@@ -1460,7 +3237,7 @@ bool GB_SD::rwtest() {
     The following function parses key-value file into a json object
 */
 GB_SD& GB_SD::readcontrol() {
-    callback_t_on_control func = [](JSONary data){};
+    callback_t_on_control func = [](JSONary){};
     return this->readcontrol(func);
 }
 GB_SD& GB_SD::readcontrol(callback_t_on_control callback) {
@@ -1489,94 +3266,22 @@ GB_SD& GB_SD::readcontrol(callback_t_on_control callback) {
     // Create control folder if not exists
     if (!this->exists("/control")) this->mkdir("/control");
 
-    // Control file path
-    const char* filename = "/control/variables.ini";
-    
-    // If requested config file exists
-    if(!this->exists(filename)){
-        _gb->color("white").arrow().log("Control file not found. Creating file.").color();
-        this->writeCSV(filename, "", "");
-        delay(100);
+    // First run with the store: take the variables from the text file
+    uint32_t counter;
+    if (!this->exists(this->_control_store)) {
+        _gb->color("white").arrow().log("Importing control file", false).color();
+        counter = this->importcontrol();
     }
-    
-    File file = this->openFile("read", filename);
-    delay(100);
-
-    /*
-        ! Sample control.ini file
-
-        REBOOT_FLAG:false
-        RESET_VARIABLES_FLAG:false
-        QUEUE_UPLOAD_INTERVAL:60000
-        WLEV_SAMPLING_INTERVAL:30000
-    */
-
-    // If the file opened successfully
-    if(file) {
-        char char_code;
-        String line = "";
-        int counter = 0;
-        String category;
-        while (file.available()) {
-            char_code = file.read();
-            delay(5);
-            if(char_code != '\n' || !file.available()) {
-                line += String(char_code);
-                // _gb->log(line);
-            }
-
-            if(char_code == '\n' || !file.available()) {
-                
-                counter++;
-                line.trim();
-                String key = line.substring(0, line.indexOf(":"));
-                String value = line.substring(line.indexOf(":") + 1, line.length());
-                key.trim(); value.trim();
-
-                // Check the variable type of 'value'
-                bool isinteger = false;
-                bool isboolean = false;
-                bool isstring = false;
-                bool isfloat = false;
-
-                if (value == "true" || value == "false") isboolean = true;
-                else if (value.indexOf(".") > -1) {
-                    String predecimal = value.substring(0, value.indexOf("."));
-                    String postdecimal = value.substring(value.indexOf(".") + 1, value.length());
-                    if (_gb->isnumber(predecimal) && _gb->isnumber(postdecimal)) isfloat = true;
-                }
-                else if (_gb->isnumber(value)) isinteger = true;
-                else isstring = true;
-                
-                if (isboolean) _gb->controls.set(key, value);
-                else if (isfloat) _gb->controls.set(key, value.toFloat());
-                else if (isinteger) _gb->controls.set(key, value);
-                else _gb->controls.set(key, value);
-
-                line = "";
-            }
-        }
+    else counter = this->_kvload();
 
-        this->closeFile(file);
-        this->off();
-        if (counter > 0) _gb->arrow().color("green").log("Read " + String(counter) + " control variables.");
-        else {
-            _gb->arrow().color("red").log("No control variables found.");
-        }
-
-        // Callback
-        if (this->initialized() && _gb->controls.get() != "{}") callback(_gb->controls);
-
-        return *this;
-    }
-    
-    // If requested file could not be opened
-    else{
-        this->off();
-        _gb->arrow().color("red").log("File not found.");
-        return *this;
+    if (counter > 0) _gb->arrow().color("green").log("Read " + String(counter) + " control variables.");
+    else {
+        _gb->arrow().color("red").log("No control variables found.");
     }
 
+    // Callback
+    if (this->initialized() && _gb->controls.get() != "{}") callback(_gb->controls);
+
     return *this; 
 }
 
@@ -1691,31 +3396,19 @@ GB_SD& GB_SD::updateallcontrol(String keyvalues, callback_t_on_control callback)
 
     _gb->arrow().color("green").log("Done");
 
-    // Get control data from SD
-    this->readcontrol();
-
-    // Update values in the gb.controls object
+    // Update values in the gb.controls object and their slots on SD
+    File file;
+    bool opened = this->_kvopen(file);
     for (int i = 0; i < MAX_KEYS; i++) {
         String key = keys[i];
         
         if (key != "") {
             _gb->controls.set(key, values[i]);
+            if (opened) this->_kvwrite(file, key, values[i]);
         }
     }
-
-    // Update the controls file on SD
-    String filename = "/control/variables.ini";
-    
-    // Delete previous control file
-    this->rm(filename);
-
-    // Replace '=' with ':'
-    keyvalues.replace("=", ":");
-    keyvalues.replace(",", "\n");
-    keyvalues = keyvalues.substring(0, keyvalues.length());
-    
-    // Re-write the control file
-    this->_write(filename, keyvalues);
+    if (opened) file.close();
+    this->off();
 
     // Update variables in runtime memory
     callback(_gb->controls);
@@ -1735,22 +3428,11 @@ GB_SD& GB_SD::updatecontrolstring(String key, String value, callback_t_on_contro
 }
 GB_SD& GB_SD::updatecontrolstring(String key, String value) {
 
-    // Get control data from SD
-    this->readcontrol();
-
     // Update/add key-value pair to the control object
     _gb->controls.set(key, value);
 
-    // Convert JSON to key-value
-    String keyvalue = _gb->controls.toKeyValue();
-
-    String filename = "/control/variables.ini";
-    
-    // Delete previous control file
-    this->rm(filename);
-
-    // Re-write the control file
-    this->_write(filename, keyvalue);
+    // Rewrite the variable's slot
+    if (!this->_kvwrite(key, value)) _gb->log("Couldn't update control variable " + key);
 
     return *this;
 }
@@ -1793,6 +3475,337 @@ GB_SD& GB_SD::updatecontrolfloat(String key, double value) {
     return this->updatecontrolstring(key, String(value));
 }
 
+/*
+    ! Rebuild the control store from variables.ini
+    Replaces the variables in memory as well; returns the number of variables read
+
+    ! Sample control.ini file
+
+    REBOOT_FLAG:false
+    RESET_VARIABLES_FLAG:false
+    QUEUE_UPLOAD_INTERVAL:60000
+    WLEV_SAMPLING_INTERVAL:30000
+*/
+uint32_t GB_SD::importcontrol() {
+    const char* filename = "/control/variables.ini";
+    
+    this->on();
+    if (!this->exists(filename)) {
+        _gb->color("white").arrow().log("Control file not found. Creating file.").color();
+        this->writeCSV(filename, "", "");
+        delay(100);
+    }
+
+    // Read the text view into memory
+    _gb->controls.reset();
+    char buffer[128];
+    uint32_t counter = this->readlines(filename, buffer, sizeof(buffer), [] (char *line, int, void *context) {
+        String entry = line;
+        entry.trim();
+        if (entry.length() > 0) ((GB_SD *) context)->_setcontrol(entry.substring(0, entry.indexOf(":")), entry.substring(entry.indexOf(":") + 1, entry.length()));
+        return true;
+    }, this);
+
+    // Write a fresh store from memory
+    this->on();
+    if (this->exists(this->_control_store)) this->rm(this->_control_store);
+
+    File file;
+    if (this->_kvopen(file, counter)) {
+        String keyvalues = _gb->controls.toKeyValue();
+        for (int start = 0, end; start < (int) keyvalues.length(); start = end + 1) {
+            end = keyvalues.indexOf("\n", start);
+            if (end < 0) end = keyvalues.length();
+
+            String entry = keyvalues.substring(start, end);
+            if (entry.indexOf(":") > 0) this->_kvwrite(file, entry.substring(0, entry.indexOf(":")), entry.substring(entry.indexOf(":") + 1));
+        }
+        file.close();
+    }
+    this->off();
+    return counter;
+}
+
+// Write variables.ini from the control store (for the GDC)
+bool GB_SD::exportcontrol() {
+    File file;
+    if (!this->_kvopen(file)) {
+        this->off();
+        return false;
+    }
+
+    String keyvalues = "";
+    CONTROL_SLOT slot, block[2 * CONTROL_BLOCK];
+    for (uint16_t i = 0; i < this->_control_slots; i++) {
+        if (this->_kvread(file, i, slot, block) < 0) continue;
+        keyvalues += (keyvalues.length() > 0 ? "\n" : "") + String(slot.key) + ":" + String(slot.value);
+    }
+    file.close();
+
+    String filename = "/control/variables.ini";
+    this->rm(filename);
+    bool success = this->_write(filename, keyvalues);
+    this->off();
+    return success;
+}
+
+// Add a variable to gb.controls with the type its value reads as
+void GB_SD::_setcontrol(String key, String value) {
+    key.trim(); value.trim();
+
+    // Check the variable type of 'value'
+    bool isinteger = false;
+    bool isboolean = false;
+    bool isfloat = false;
+
+    if (value == "true" || value == "false") isboolean = true;
+    else if (value.indexOf(".") > -1) {
+        String predecimal = value.substring(0, value.indexOf("."));
+        String postdecimal = value.substring(value.indexOf(".") + 1, value.length());
+        if (_gb->isnumber(predecimal) && _gb->isnumber(postdecimal)) isfloat = true;
+    }
+    else if (_gb->isnumber(value)) isinteger = true;
+    
+    if (isboolean) _gb->controls.set(key, value);
+    else if (isfloat) _gb->controls.set(key, value.toFloat());
+    else if (isinteger) _gb->controls.set(key, value);
+    else _gb->controls.set(key, value);
+}
+
+// Variables in the control store, its slots and the variables that couldn't be saved
+String GB_SD::controlstatus() {
+    File file;
+    uint32_t variables = 0;
+    CONTROL_SLOT slot, block[2 * CONTROL_BLOCK];
+    if (this->_kvopen(file)) {
+        for (uint16_t i = 0; i < this->_control_slots; i++) if (this->_kvread(file, i, slot, block) >= 0) variables++;
+        file.close();
+    }
+    this->off();
+    return String(variables) + "/" + String(this->_control_slots) + " slots, " + String(this->_control_failures) + " not saved";
+}
+
+bool GB_SD::_kvopen(File &file) {
+    return this->_kvopen(file, 0);
+}
+
+/*
+    Open the control store; a new store is written out as empty slots so its clusters don't change until it grows
+    The slots per copy follow from the file's size; they're a multiple of 8, so each copy starts on a sector.
+*/
+bool GB_SD::_kvopen(File &file, uint16_t variables) {
+    this->on();
+
+    // A replacement cut short: finish it if the old store is gone, drop it otherwise
+    if (this->exists(this->_control_grown)) {
+        if (this->exists(this->_control_store)) {
+            if (this->_sd.remove(this->_control_grown)) this->_dirremove(this->_control_grown);
+        }
+        else if (this->_sd.rename(this->_control_grown, this->_control_store)) this->_dirremove(this->_control_grown);
+    }
+
+    // The folder may be missing, or half made (see mkdir())
+    if (!file.open(this->_control_store, O_RDWR | O_CREAT)) {
+        this->mkdir("/control");
+        if (!file.open(this->_control_store, O_RDWR | O_CREAT)) return false;
+    }
+    this->_dirupdate(this->_control_store, file.fileSize());
+
+    uint32_t copy = file.fileSize() / 2;
+    if (file.fileSize() > 0 && file.fileSize() % 2 == 0 && copy % 512 == 0) {
+        this->_control_slots = copy / sizeof(CONTROL_SLOT);
+        return true;
+    }
+
+    uint16_t slots = 2 * variables > CONTROL_SLOTS ? 2 * variables : CONTROL_SLOTS;
+    this->_control_slots = (slots + 7) / 8 * 8;
+
+    CONTROL_SLOT empty;
+    memset(&empty, 0, sizeof(empty));
+    file.truncate(0);
+    for (uint16_t i = 0; i < 2 * this->_control_slots; i++) file.write(&empty, sizeof(empty));
+    return file.sync();
+}
+
+/*
+    Newest valid copy of a variable's slot (returns the copy, -1 if neither is valid, -2 if the slot
+    couldn't be read: it may hold a variable, so it isn't free)
+    The slots are searched in RAM: 'block' holds both copies of the sector 'index' is in, read when
+    'index' starts a sector, so callers go through the slots in order.
+*/
+int8_t GB_SD::_kvread(File &file, uint16_t index, CONTROL_SLOT &slot, CONTROL_SLOT *block) {
+    if (index % CONTROL_BLOCK == 0 && !this->_kvblock(file, index, block)) return -2;
+
+    int8_t newest = -1;
+    for (uint8_t i = 0; i < 2; i++) {
+        CONTROL_SLOT &copy = block[i * CONTROL_BLOCK + index % CONTROL_BLOCK];
+        if (copy.key[0] == 0 || copy.check != this->_kvcheck(copy)) continue;
+        if (newest < 0 || copy.generation > slot.generation) {
+            slot = copy;
+            newest = i;
+        }
+    }
+    return newest;
+}
+
+// Both copies of the sector from slot 'first' into 'block'. A failed read is tried once more after
+// on() has ended it on the card; one bad read shouldn't cost the update.
+bool GB_SD::_kvblock(File &file, uint16_t first, CONTROL_SLOT *block) {
+    int bytes = CONTROL_BLOCK * sizeof(CONTROL_SLOT);
+    for (uint8_t attempt = 0; attempt < 2; attempt++) {
+        if (attempt > 0) this->on();
+
+        bool read = true;
+        for (uint8_t i = 0; i < 2 && read; i++) {
+            read = file.seekSet(((uint32_t) i * this->_control_slots + first) * sizeof(CONTROL_SLOT));
+            read = read && file.read(block + i * CONTROL_BLOCK, bytes) == bytes;
+        }
+        if (read) return true;
+    }
+    return false;
+}
+
+bool GB_SD::_kvwrite(String key, String value) {
+    unsigned long start = millis();
+    File file;
+    bool success = false;
+    if (this->_kvopen(file)) success = this->_kvwrite(file, key, value);
+    else this->_control_failures++;
+    if (file) file.close();
+    this->off();
+
+    // A slot is written in place
+    if (success) GB_FAULTS::injector().record(GB_FAULTS::CONTROL, millis() - start, key.length() + value.length(), GB_FAULTS::sectors(0, sizeof(CONTROL_SLOT), 0));
+    return success;
+}
+
+// Write a variable over the older copy of its slot (or into a free slot)
+bool GB_SD::_kvwrite(File &file, String key, String value) {
+    key.trim(); value.trim();
+    if (key.length() == 0) return false;
+    if (key.length() >= sizeof(CONTROL_SLOT::key) || value.length() >= sizeof(CONTROL_SLOT::value)) {
+        _gb->log("Control variable too long for the store: " + key);
+        return false;
+    }
+
+    CONTROL_SLOT slot, block[2 * CONTROL_BLOCK];
+    int32_t index = -1;
+    int8_t newest = -1;
+    for (uint16_t i = 0; i < this->_control_slots; i++) {
+        int8_t copy = this->_kvread(file, i, slot, block);
+
+        // An unreadable slot (read twice) may be this variable's, or one a free slot would shadow
+        if (copy == -2) {
+            this->_control_failures++;
+            _gb->color("red").log("Control store unreadable; " + key + " not saved").color();
+            return false;
+        }
+        if (copy >= 0 && key == slot.key) {
+            index = i;
+            newest = copy;
+            break;
+        }
+        if (copy < 0 && index < 0) index = i;
+    }
+
+    // Full: continue in a store with twice the slots. A variable that can't be stored is an error
+    // (it would be back to its default after a reboot), so it's counted for controlstatus()
+    if (index < 0) {
+        if (this->_kvgrow(file)) return this->_kvwrite(file, key, value);
+
+        this->_control_failures++;
+        _gb->color("red").log("Control store full; " + key + " not saved").color();
+        if (this->_gb->hasdevice("rgb")) this->_gb->getdevice("rgb")->on(1);
+        return false;
+    }
+
+    // Nothing to do if the value hasn't changed
+    if (newest >= 0 && value == slot.value) return true;
+    if (newest < 0) {
+        memset(&slot, 0, sizeof(slot));
+        strncpy(slot.key, key.c_str(), sizeof(slot.key) - 1);
+        newest = 1;
+    }
+
+    memset(slot.value, 0, sizeof(slot.value));
+    strncpy(slot.value, value.c_str(), sizeof(slot.value) - 1);
+    slot.generation++;
+    slot.check = this->_kvcheck(slot);
+
+    file.seekSet(((uint32_t) (1 - newest) * this->_control_slots + index) * sizeof(CONTROL_SLOT));
+    if (file.write(&slot, sizeof(slot)) == sizeof(slot) && file.sync()) return true;
+    this->_control_failures++;
+    return false;
+}
+
+/*
+    Copy the variables to a store with twice the slots, then put it in place of the old one
+    The old store stays valid until the new one is complete (see _kvopen() for a cut in between).
+    'file' is left open on the new store.
+*/
+bool GB_SD::_kvgrow(File &file) {
+    uint16_t slots = this->_control_slots;
+    if (slots >= 512) return false;
+
+    File grown;
+    if (this->exists(this->_control_grown) && this->_sd.remove(this->_control_grown)) this->_dirremove(this->_control_grown);
+    if (!grown.open(this->_control_grown, O_RDWR | O_CREAT)) return false;
+
+    // Both copies of a slot start with the newest copy of the variable (an unreadable slot stops the
+    // copy, so no variable is left behind)
+    CONTROL_SLOT slot, empty, block[2 * CONTROL_BLOCK];
+    memset(&empty, 0, sizeof(empty));
+    bool success = true;
+    for (uint8_t copy = 0; copy < 2 && success; copy++) {
+        for (uint16_t i = 0; i < 2 * slots && success; i++) {
+            int8_t newest = i < slots ? this->_kvread(file, i, slot, block) : -1;
+            if (newest == -2) success = false;
+            if (newest < 0) slot = empty;
+            success = success && grown.write(&slot, sizeof(slot)) == sizeof(slot);
+        }
+    }
+    success = grown.sync() && success;
+    grown.close();
+
+    file.close();
+    if (success && this->_sd.remove(this->_control_store)) {
+        this->_dirremove(this->_control_store);
+        success = this->_sd.rename(this->_control_grown, this->_control_store);
+        if (success) this->_dirremove(this->_control_grown);
+    }
+    else if (this->_sd.remove(this->_control_grown)) this->_dirremove(this->_control_grown);
+
+    if (success) _gb->log("Control store grown to " + String(2 * slots) + " slots");
+    return this->_kvopen(file) && success;
+}
+
+// Load the control store into gb.controls; returns the number of variables
+uint32_t GB_SD::_kvload() {
+    File file;
+    if (!this->_kvopen(file)) {
+        this->off();
+        return 0;
+    }
+
+    uint32_t counter = 0;
+    CONTROL_SLOT slot, block[2 * CONTROL_BLOCK];
+    for (uint16_t i = 0; i < this->_control_slots; i++) {
+        if (this->_kvread(file, i, slot, block) < 0) continue;
+        this->_setcontrol(slot.key, slot.value);
+        counter++;
+    }
+    file.close();
+    this->off();
+    return counter;
+}
+
+uint32_t GB_SD::_kvcheck(CONTROL_SLOT &slot) {
+    uint32_t check = 2166136261UL;
+    uint8_t *bytes = (uint8_t *) &slot;
+    for (size_t i = 0; i < offsetof(CONTROL_SLOT, check); i++) check = (check ^ bytes[i]) * 16777619UL;
+    return check;
+}
+
 #endif
 
 
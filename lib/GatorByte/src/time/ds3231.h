@@ -208,7 +208,7 @@ GB_DS3231& GB_DS3231::_initialize(bool testdevice) {
                 _gb->arrow().log(this->date("MMMM DDth, YYYY") + " at " + this->time("hh:mm:ss") + ", source: " + this->getsource(), false);
                 
                 if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("--.").wait(250).play("...");
-                if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(2).wait(250).revert(); 
+                if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->flash(2, 250); 
                 _gb->arrow().log("Done", true);
                 this->settimezone(_gb->globals.TIMEZONE);
 
@@ -242,7 +242,7 @@ GB_DS3231& GB_DS3231::_initialize(bool testdevice) {
             }
             
             if (_gb->hasdevice("buzzer")) _gb->getdevice("buzzer")->play("--.").wait(250).play("...");
-            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->on(2).wait(250).revert(); 
+            if (_gb->hasdevice("rgb")) _gb->getdevice("rgb")->flash(2, 250); 
         }
     #else
         if(this->valid()) {
@@ -194,7 +194,9 @@ boolean PubSubClient::connect(const char *id, const char *user, const char *pass
 
         if (result == 1) {
 
-            nextMsgId = 1;
+            //! AG: Keep the packet id counter across reconnects so that DUP retransmissions never collide with new packets
+            if (nextMsgId == 0) nextMsgId = 1;
+            pubackCount = 0;
             // Leave room in the buffer for header and variable length field
             uint16_t length = MQTT_MAX_HEADER_SIZE;
             unsigned int j;
@@ -458,6 +460,12 @@ boolean PubSubClient::loop() {
                 } else if (type == MQTTPINGRESP) {
                     pingOutstanding = false;
                 }
+
+                //! AG: Added. Hold the packet id of the acknowledged publish until popack() collects it
+                else if (type == MQTTPUBACK) {
+                    msgId = (this->buffer[llen+1]<<8)+this->buffer[llen+2];
+                    if (pubackCount < MQTT_MAX_PUBACK_BACKLOG) pubackIds[pubackCount++] = msgId;
+                }
             } else if (!connected()) {
                 // readPacket has closed the connection
                 return false;
@@ -506,6 +514,58 @@ boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigne
     return false;
 }
 
+//! AG: Added. QoS1 publish. The caller owns the packet id so it can retransmit with DUP set.
+boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained, uint16_t msgid, boolean dup) {
+    if (connected()) {
+        if (this->bufferSize < MQTT_MAX_HEADER_SIZE + 2 + strnlen(topic, this->bufferSize) + 2 + plength) {
+            // Too long
+            return false;
+        }
+        // Leave room in the buffer for header and variable length field
+        uint16_t length = MQTT_MAX_HEADER_SIZE;
+        length = writeString(topic,this->buffer,length);
+
+        // Add packet id
+        this->buffer[length++] = (msgid >> 8);
+        this->buffer[length++] = (msgid & 0xFF);
+
+        // Add payload
+        uint16_t i;
+        for (i=0;i<plength;i++) {
+            this->buffer[length++] = payload[i];
+        }
+
+        // Write the header
+        uint8_t header = MQTTPUBLISH | MQTTQOS1;
+        if (dup) {
+            header |= 8;
+        }
+        if (retained) {
+            header |= 1;
+        }
+        return write(header, this->buffer, length-MQTT_MAX_HEADER_SIZE);
+    }
+    return false;
+}
+
+//! AG: Added. Allocate the next packet id (never 0)
+uint16_t PubSubClient::nextmessageid() {
+    nextMsgId++;
+    if (nextMsgId == 0) {
+        nextMsgId = 1;
+    }
+    return nextMsgId;
+}
+
+//! AG: Added. Collect the oldest received PUBACK packet id. Returns false if none are pending.
+boolean PubSubClient::popack(uint16_t* msgid) {
+    if (pubackCount == 0) return false;
+    *msgid = pubackIds[0];
+    for (uint8_t i = 1; i < pubackCount; i++) pubackIds[i - 1] = pubackIds[i];
+    pubackCount--;
+    return true;
+}
+
 boolean PubSubClient::publish_P(const char* topic, const char* payload, boolean retained) {
     return publish_P(topic, (const uint8_t*)payload, payload ? strnlen(payload, this->bufferSize) : 0, retained);
 }
@@ -76,6 +76,11 @@
 // Maximum size of fixed header and variable length size header
 #define MQTT_MAX_HEADER_SIZE 5
 
+//! AG: Added. Number of PUBACK packet ids that can be held until they are collected with popack()
+#ifndef MQTT_MAX_PUBACK_BACKLOG
+#define MQTT_MAX_PUBACK_BACKLOG 16
+#endif
+
 
 //! AG: Changed (char*, uint8_t*, unsigned int) to (String, String)
 #if defined(ESP8266) || defined(ESP32)
@@ -94,7 +99,8 @@ private:
    uint16_t bufferSize;
    uint16_t keepAlive;
    uint16_t socketTimeout;
-   uint16_t nextMsgId;
+   //! AG: Initialized here since connect() no longer resets it
+   uint16_t nextMsgId = 0;
    unsigned long lastOutActivity;
    unsigned long lastInActivity;
    bool pingOutstanding;
@@ -114,6 +120,10 @@ private:
    uint16_t port;
    Stream* stream;
    int _state;
+
+   //! AG: Added. Packet ids of the PUBACKs received but not yet collected
+   uint16_t pubackIds[MQTT_MAX_PUBACK_BACKLOG];
+   uint8_t pubackCount = 0;
 public:
    PubSubClient();
    PubSubClient(Client& client);
@@ -154,6 +164,8 @@ public:
    boolean publish(const char* topic, const char* payload, boolean retained);
    boolean publish(const char* topic, const uint8_t * payload, unsigned int plength);
    boolean publish(const char* topic, const uint8_t * payload, unsigned int plength, boolean retained);
+   //! AG: Added. QoS1 publish with caller-supplied packet id and DUP flag
+   boolean publish(const char* topic, const uint8_t * payload, unsigned int plength, boolean retained, uint16_t msgid, boolean dup);
    boolean publish_P(const char* topic, const char* payload, boolean retained);
    boolean publish_P(const char* topic, const uint8_t * payload, unsigned int plength, boolean retained);
    
@@ -181,6 +193,10 @@ public:
    boolean connected();
    int state();
    
+   //! AG: Added. Packet id allocation and PUBACK collection for pipelined QoS1 publishing
+   uint16_t nextmessageid();
+   boolean popack(uint16_t* msgid);
+
    bool waiting_for_response_flag = false;
    String waiting_for_response_topic = "";
 
@@ -89,6 +89,7 @@ class CRC16
     unsigned int XModemCrc(uint8_t data[], uint8_t start, uint16_t length);
     unsigned int Mcrf4XX(uint8_t data[], uint8_t start, uint16_t length);
     unsigned int Modbus(uint8_t data[], uint8_t start, uint16_t length);
+    static uint16_t ModbusFast(const uint8_t *data, uint16_t length);
 };
 
 #endif
@@ -0,0 +1,247 @@
+#include "ModbusRTU.h"
+
+//---------------------------------------------------
+// Attach to a serial port; baudrate sets the frame timing
+//---------------------------------------------------
+void ModbusRTU::init(Stream &stream, int CTRLpin, unsigned long baudrate)
+{
+  _serial = &stream;
+  _ctrl = CTRLpin;
+  pinMode(_ctrl, OUTPUT);
+  digitalWrite(_ctrl, LOW);
+
+  // 11 bits per character (start, 8 data, parity/stop, stop); rounded up, as t3.5 is a minimum
+  _t35 = baudrate > 19200 ? 1750 : (11000000UL * 7 / 2 + baudrate - 1) / baudrate;
+  _idle = micros();
+}
+
+//---------------------------------------------------
+// Time to wait for the first byte of a response (ms)
+//---------------------------------------------------
+void ModbusRTU::timeout(unsigned long ms)
+{
+  _timeout = ms;
+}
+
+uint8_t ModbusRTU::readholding(uint8_t slave, uint16_t start, uint16_t count, uint16_t *values)
+{
+  return _read(slave, READ_HOLDING, start, count, values);
+}
+
+uint8_t ModbusRTU::readinput(uint8_t slave, uint16_t start, uint16_t count, uint16_t *values)
+{
+  return _read(slave, READ_INPUT, start, count, values);
+}
+
+uint8_t ModbusRTU::writesingle(uint8_t slave, uint16_t address, uint16_t value)
+{
+  if (_serial == NULL) return INVALID;
+
+  _frame[0] = slave;
+  _frame[1] = WRITE_SINGLE;
+  _frame[2] = highByte(address);
+  _frame[3] = lowByte(address);
+  _frame[4] = highByte(value);
+  _frame[5] = lowByte(value);
+  _send(6);
+
+  // The response echoes the request
+  return _receive(slave, WRITE_SINGLE, 8);
+}
+
+//---------------------------------------------------
+// Exception code of the last EXCEPTION status
+//---------------------------------------------------
+uint8_t ModbusRTU::exception()
+{
+  return _exception;
+}
+
+//---------------------------------------------------
+// Add a request to the poll list; returns its index (or -1 if the list is full)
+//---------------------------------------------------
+int8_t ModbusRTU::poll(uint8_t slave, uint8_t function, uint16_t start, uint16_t count, uint16_t *values)
+{
+  if (_pollcount == MODBUS_MAX_POLLS) return -1;
+
+  POLL &poll = _polls[_pollcount];
+  poll.slave = slave;
+  poll.function = function;
+  poll.start = start;
+  poll.count = count;
+  poll.values = values;
+  poll.status = TIMEOUT;
+  return _pollcount++;
+}
+
+//---------------------------------------------------
+// Run the poll list back to back; returns the number of successful requests
+// Only the t3.5 silence separates a response from the next request
+//---------------------------------------------------
+uint8_t ModbusRTU::pollall()
+{
+  uint8_t success = 0;
+  for (uint8_t i = 0; i < _pollcount; i++)
+  {
+    POLL &poll = _polls[i];
+    poll.status = _read(poll.slave, poll.function, poll.start, poll.count, poll.values);
+    if (poll.status == OK) success++;
+  }
+  return success;
+}
+
+uint8_t ModbusRTU::status(uint8_t index)
+{
+  return index < _pollcount ? _polls[index].status : INVALID;
+}
+
+void ModbusRTU::clearpolls()
+{
+  _pollcount = 0;
+}
+
+//---------------------------------------------------
+// Number of registers a field spans
+//---------------------------------------------------
+uint8_t ModbusRTU::width(FIELD field)
+{
+  return field.type == U16 || field.type == S16 ? 1 : 2;
+}
+
+//---------------------------------------------------
+// Decode a field from a block of registers read from 'start'
+//---------------------------------------------------
+float ModbusRTU::value(FIELD field, uint16_t start, const uint16_t *values)
+{
+  const uint16_t *word = values + (field.address - start);
+  bool swapped = field.type == U32_SWAPPED || field.type == S32_SWAPPED || field.type == F32_SWAPPED;
+  uint32_t raw = field.type == U16 || field.type == S16 ? word[0] : swapped ? ((uint32_t) word[1] << 16) | word[0] : ((uint32_t) word[0] << 16) | word[1];
+
+  float value = 0;
+  switch (field.type)
+  {
+    case U16: value = (uint16_t) raw; break;
+    case S16: value = (int16_t) raw; break;
+    case U32:
+    case U32_SWAPPED: value = raw; break;
+    case S32:
+    case S32_SWAPPED: value = (int32_t) raw; break;
+    case F32:
+    case F32_SWAPPED: memcpy(&value, &raw, sizeof(value)); break;
+  }
+  return value * field.scale;
+}
+
+uint8_t ModbusRTU::_read(uint8_t slave, uint8_t function, uint16_t start, uint16_t count, uint16_t *values)
+{
+  if (_serial == NULL || count == 0 || count > MODBUS_MAX_REGISTERS) return INVALID;
+
+  _frame[0] = slave;
+  _frame[1] = function;
+  _frame[2] = highByte(start);
+  _frame[3] = lowByte(start);
+  _frame[4] = highByte(count);
+  _frame[5] = lowByte(count);
+  _send(6);
+
+  uint8_t status = _receive(slave, function, 5 + 2 * count);
+  if (status != OK) return status;
+
+  if (_frame[2] != 2 * count)
+  {
+    failures++;
+    return FRAME_ERROR;
+  }
+
+  for (uint16_t i = 0; i < count; i++)
+    values[i] = ((uint16_t) _frame[3 + 2 * i] << 8) | _frame[4 + 2 * i];
+
+  return OK;
+}
+
+//---------------------------------------------------
+// Append the crc and send a frame after the bus has been idle for t3.5
+//---------------------------------------------------
+void ModbusRTU::_send(uint8_t length)
+{
+  uint16_t crc = CRC16::ModbusFast(_frame, length);
+  _frame[length++] = lowByte(crc);
+  _frame[length++] = highByte(crc);
+
+  // Drop stale bytes (late responses, line noise)
+  while (_serial->available()) _serial->read();
+
+  while (micros() - _idle < _t35);
+
+  digitalWrite(_ctrl, HIGH);
+  _serial->write(_frame, length);
+
+  // Wait until the last stop bit is out before releasing the bus
+  _serial->flush();
+  digitalWrite(_ctrl, LOW);
+
+  requests++;
+  _idle = micros();
+}
+
+//---------------------------------------------------
+// Receive a response of 'expected' bytes (or a shorter exception frame) into _frame
+//---------------------------------------------------
+uint8_t ModbusRTU::_receive(uint8_t slave, uint8_t function, uint8_t expected)
+{
+  uint8_t length = 0;
+  unsigned long start = millis();
+  unsigned long last = 0;
+
+  while (length < expected)
+  {
+    if (_serial->available())
+    {
+      uint8_t c = _serial->read();
+      if (length < sizeof(_frame)) _frame[length++] = c;
+      last = micros();
+
+      // Exception responses are 5 bytes long
+      if (length == 5 && _frame[1] == (function | 0x80)) break;
+    }
+    else if (length == 0)
+    {
+      if (millis() - start >= _timeout)
+      {
+        failures++;
+        return TIMEOUT;
+      }
+    }
+
+    // End of frame: the slave went silent for t3.5
+    else if (micros() - last >= _t35) break;
+  }
+  _idle = micros();
+
+  if (length < 5 || CRC16::ModbusFast(_frame, length) != 0)
+  {
+    failures++;
+    return length < 5 ? FRAME_ERROR : CRC_ERROR;
+  }
+
+  if (_frame[0] != slave)
+  {
+    failures++;
+    return FRAME_ERROR;
+  }
+
+  if (_frame[1] == (function | 0x80))
+  {
+    _exception = _frame[2];
+    failures++;
+    return EXCEPTION;
+  }
+
+  if (_frame[1] != function || length != expected)
+  {
+    failures++;
+    return FRAME_ERROR;
+  }
+
+  return OK;
+}
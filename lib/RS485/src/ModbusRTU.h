@@ -0,0 +1,90 @@
+#ifndef MODBUSRTU_h
+#define MODBUSRTU_h
+#include "Arduino.h"
+#include "CRC16.h"
+
+// Largest read in one request (the spec allows 125; this bounds the frame buffer)
+#define MODBUS_MAX_REGISTERS 32
+#define MODBUS_MAX_POLLS 8
+
+//-------------------------------------------------------------------------------------
+// Modbus RTU master
+//
+// Half-duplex RS485 with a direction (DE/RE) pin. The inter-frame silence (t3.5) is
+// computed from the baud rate (fixed at 1750 us above 19200 baud, as in the spec).
+// A response is complete as soon as its expected length is received; a t3.5 gap ends a
+// shorter (exception) frame early instead of waiting for the timeout.
+//
+// Usage:
+//   ModbusRTU modbus;
+//   modbus.init(Serial1, A6, 9600);
+//   uint16_t values[2];
+//   if (modbus.readholding(0x01, 0x0100, 2, values) == ModbusRTU::OK) ...
+//
+// Poll list (several slaves back to back):
+//   modbus.poll(0x01, ModbusRTU::READ_HOLDING, 0x0100, 2, uss);
+//   modbus.poll(0x02, ModbusRTU::READ_INPUT, 0x0000, 4, flow);
+//   modbus.pollall();
+//-------------------------------------------------------------------------------------
+class ModbusRTU
+{
+  public:
+    enum FUNCTION { READ_HOLDING = 0x03, READ_INPUT = 0x04, WRITE_SINGLE = 0x06 };
+    enum STATUS { OK = 0, TIMEOUT, CRC_ERROR, EXCEPTION, FRAME_ERROR, INVALID };
+
+    // Typed register maps; 32-bit values span two registers, high word first unless swapped
+    enum TYPE { U16, S16, U32, S32, F32, U32_SWAPPED, S32_SWAPPED, F32_SWAPPED };
+    struct FIELD
+    {
+      uint16_t address;
+      uint8_t type;
+      float scale;
+    };
+
+    void init(Stream &stream, int CTRLpin, unsigned long baudrate);
+    void timeout(unsigned long ms);
+
+    uint8_t readholding(uint8_t slave, uint16_t start, uint16_t count, uint16_t *values);
+    uint8_t readinput(uint8_t slave, uint16_t start, uint16_t count, uint16_t *values);
+    uint8_t writesingle(uint8_t slave, uint16_t address, uint16_t value);
+    uint8_t exception();
+
+    int8_t poll(uint8_t slave, uint8_t function, uint16_t start, uint16_t count, uint16_t *values);
+    uint8_t pollall();
+    uint8_t status(uint8_t index);
+    void clearpolls();
+
+    static uint8_t width(FIELD field);
+    static float value(FIELD field, uint16_t start, const uint16_t *values);
+
+    unsigned long requests = 0;
+    unsigned long failures = 0;
+
+  private:
+    struct POLL
+    {
+      uint8_t slave;
+      uint8_t function;
+      uint16_t start;
+      uint16_t count;
+      uint16_t *values;
+      uint8_t status;
+    };
+
+    Stream *_serial = NULL;
+    int _ctrl = -1;
+    unsigned long _t35 = 1750;
+    unsigned long _timeout = 200;
+    unsigned long _idle = 0;
+    uint8_t _exception = 0;
+
+    uint8_t _frame[5 + 2 * MODBUS_MAX_REGISTERS];
+    POLL _polls[MODBUS_MAX_POLLS];
+    uint8_t _pollcount = 0;
+
+    uint8_t _read(uint8_t slave, uint8_t function, uint16_t start, uint16_t count, uint16_t *values);
+    void _send(uint8_t length);
+    uint8_t _receive(uint8_t slave, uint8_t function, uint8_t expected);
+};
+
+#endif
@@ -145,6 +145,9 @@
   }
   
 ////////////////////////////////////////////////////////
+
+  //! AG: SAMD_TIMERINTERRUPT_TC3_ONLY leaves the TC4 (Servo), TC5 (tone()) and TCC handlers to the core
+  #if !defined(SAMD_TIMERINTERRUPT_TC3_ONLY)
   
   void TC4_Handler()
   {
@@ -240,6 +243,8 @@
     }
   }
 
+  #endif    // SAMD_TIMERINTERRUPT_TC3_ONLY
+
 ///////////////////////////////////////////////////////////////////////////////
      
   // frequency (in hertz) and duration (in milliseconds). Duration = 0 or not specified => run indefinitely
@@ -158,8 +158,11 @@
 
                         String queuefilename = sd.getfirstqueuefilename();
 
+                        // A torn or corrupt record comes back empty (the file is quarantined)
+                        String data = sd.readqueuefile(queuefilename);
+
                         // Attempt publishing queue-data
-                        if (mqtt.publish("data/set", sd.readfile(queuefilename))) {
+                        if (data.length() > 0 && mqtt.publish("data/set", data)) {
 
                             // Remove queue file
                             sd.removequeuefile(queuefilename);
@@ -185,7 +188,7 @@
             mqtt.connect();
         });
 
-        rgb.rainbow(5000);
+        rgb.rainbow(5000, true);
     }
 
     /*
@@ -196,7 +199,7 @@
         flag = true;
 
         // Test RGB & buzzer
-        rgb.rainbow(5000).off(); buzzer.play(".-"); delay(2000);
+        rgb.rainbow(5000, true).off(); buzzer.play(".-"); delay(2000);
 
         // Test SD
         rgb.on(sd.rwtest() ? "green" : "red"); delay(1000); rgb.off();
@@ -253,7 +256,7 @@
         // sntl.watch(75, [] {
 
             //! Initialize SD first to read the config file
-            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("quarter").readconfig();
+            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("auto").readconfig();
 
             //! Configure MQTT broker and connect 
             mqtt.configure("mqtt.ezbean-lab.com", 1883, gb.DEVICE_SN, mqtt_message_handler, mqtt_on_connect);
@@ -295,7 +298,7 @@
         rgb.configure({0, 1, 2}).initialize(0.2).on("magenta");
         buzzer.configure({6}).initialize().play("...");
 
-        sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("quarter").readconfig();
+        sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("auto").readconfig();
 
         //! Configure MQTT broker and connect 
         mqtt.configure("mqtt.ezbean-lab.com", 1883, gb.DEVICE_ID, mqtt_message_handler, mqtt_on_connect);
@@ -202,7 +202,7 @@
         sntl.watch(120, []() {
 
             // Initialize SD first to read the config file
-            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("quarter");
+            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("auto");
 
             // Read SD config and control files
             sd.readconfig().readcontrol(set_control_variables);
@@ -321,8 +321,11 @@
 
                         gb.log("Sending queue file: " + queuefilename);
 
+                        // A torn or corrupt record comes back empty (the file is quarantined)
+                        String data = sd.readqueuefile(queuefilename);
+
                         // Attempt publishing queue-data
-                        if (mqtt.publish("data/set", sd.readqueuefile(queuefilename))) {
+                        if (data.length() > 0 && mqtt.publish("data/set", data)) {
 
                             // Remove queue file
                             sd.removequeuefile(queuefilename);
@@ -87,6 +87,11 @@
     */
     int BREATH_INTERVAL = 60 * 1000;
 
+    /*
+        Upload state
+    */
+    String QUEUE_FILE = "";
+
 
     void set_control_variables(JSONary data) {
 
@@ -288,14 +293,24 @@
                 int counter = 50;
                 
                 while (!sd.isqueueempty() && counter-- > 0) {
+
+                    // Alerts first, then readings and logs by weight (none left if the files can't be listed)
+                    QUEUE_FILE = sd.nextqueuefile("");
+                    if (QUEUE_FILE.length() == 0) break;
                     
                     sntl.watch(10, [] {
 
-                        String queuefilename = sd.getfirstqueuefilename();
+                        String queuefilename = QUEUE_FILE;
                         gb.log("Sending queue file: " + queuefilename);
 
+                        uint32_t sequence; String topic;
+                        String data = sd.readqueuefile(queuefilename, sequence, topic);
+
+                        // A torn or corrupt record comes back empty (the file is quarantined), as does one that can't be read
+                        if (data.length() == 0) return;
+
                         // Attempt publishing queue-data
-                        if (mqtt.publish("data/set", sd.readqueuefile(queuefilename))) {
+                        if (mqtt.publish(topic, data)) {
 
                             // Remove queue file
                             sd.removequeuefile(queuefilename);
@@ -353,7 +368,7 @@
             gb.log("Current battery level: " + String(mcu.fuel("level")) + " %");
 
             // Initialize SD first to read the config file
-            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("quarter");
+            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("auto");
 
             // Read SD config and control files
             sd.readconfig().readcontrol(set_control_variables);
@@ -492,19 +507,25 @@
                     // Log error to console
                     gb.color("red").log("SD card R/W error.");
 
-                    //! Connect to network
-                    mcu.connect("cellular");
-
-                    //! Connect to MQTT servver
-                    mqtt.connect();
-                        
-                    // Send notification
-                    mqtt.publish("fault/report", "sd/rw/failed");
-
                     // Send GPS coordinates
                     GPS_DATA gpsdata = gps.read(gb.env() == "development");
                     String gps_lat = String(gpsdata.lat, 5), gps_lng = String(gpsdata.lng, 5);
-                    mqtt.publish("mode/panic", "Panic mode on: " + gps_lat + "," + gps_lng);
+
+                    // Queue the alerts; the card may not take them, and then they're sent right away
+                    bool queued = sd.enqueue("alerts", "fault/report", "sd/rw/failed");
+                    queued = sd.enqueue("alerts", "mode/panic", "Panic mode on: " + gps_lat + "," + gps_lng) && queued;
+
+                    if (!queued) {
+
+                        //! Connect to network
+                        mcu.connect("cellular");
+
+                        //! Connect to MQTT servver
+                        mqtt.connect();
+
+                        mqtt.publish("fault/report", "sd/rw/failed");
+                        mqtt.publish("mode/panic", "Panic mode on: " + gps_lat + "," + gps_lng);
+                    }
                 }
             });
 
@@ -135,7 +135,7 @@
         
         });
 
-        rgb.rainbow(5000);
+        rgb.rainbow(5000, true);
     }
 
     /* 
@@ -164,7 +164,7 @@
         rgb.configure({0, 1, 2}).initialize(0.2).on("magenta");
         buzzer.configure({6}).initialize().play("...");
 
-        sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("quarter").readconfig();
+        sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("auto").readconfig();
 
         //! Configure MQTT broker and connect 
         mqtt.configure("mqtt.ezbean-lab.com", 1883, gb.DEVICE_SN, mqtt_message_handler, mqtt_on_connect);
@@ -210,7 +210,7 @@
     void test_sntl() {
         
         // Do nothing
-        rgb.rainbow(5000);
+        rgb.rainbow(5000, true);
         delay(1000);
 
         // Turn on sentinence
@@ -352,8 +352,11 @@
 
                     String queuefilename = sd.getfirstqueuefilename();
 
+                    // A torn or corrupt record comes back empty (the file is quarantined)
+                    String data = sd.readqueuefile(queuefilename);
+
                     // Attempt publishing queue-data
-                    if (mqtt.publish("data/set", sd.readfile(queuefilename))) {
+                    if (data.length() > 0 && mqtt.publish("data/set", data)) {
 
                         // Remove queue file
                         sd.removequeuefile(queuefilename);
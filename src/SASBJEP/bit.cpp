@@ -327,8 +327,11 @@
 
                         gb.log("Sending queue file: " + queuefilename);
 
+                        // A torn or corrupt record comes back empty (the file is quarantined)
+                        String data = sd.readqueuefile(queuefilename);
+
                         // Attempt publishing queue-data
-                        if (mqtt.publish("data/set", sd.readqueuefile(queuefilename))) {
+                        if (data.length() > 0 && mqtt.publish("data/set", data)) {
 
                             // Remove queue file
                             sd.removequeuefile(queuefilename);
@@ -389,7 +392,7 @@
         sntl.watch(120, []() {
 
             // Configure SD
-            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("quarter");
+            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("auto");
             
             mem.configure({true, SR0}).initialize();
 
@@ -632,8 +635,11 @@
 
                             gb.log("Sending queue file: " + queuefilename);
 
+                            // A torn or corrupt record comes back empty (the file is quarantined)
+                            String data = sd.readqueuefile(queuefilename);
+
                             // Attempt publishing queue-data
-                            if (mqtt.publish("data/set", sd.readqueuefile(queuefilename))) {
+                            if (data.length() > 0 && mqtt.publish("data/set", data)) {
 
                                 // Remove queue file
                                 sd.removequeuefile(queuefilename);
@@ -57,6 +57,11 @@
     GB_PIPER fivedayantifreezepiper(gb);
     GB_PIPER pingpiper(gb);
     GB_PIPER statepiper(gb);
+    GB_PIPER archivepiper(gb);
+
+    GB_POLICY policy(gb);
+    GB_AGGREGATOR wlevaggregator(gb);
+    GB_SAMPLER sampler(gb);
     
     string STATE = "IDLE";
     int RAINID = 0;
@@ -74,8 +79,12 @@
     int CV_UPLOAD_INTERVAL = 15 * 60 * 1000;
     int STATE_UPLOAD_INTERVAL = 60 * 60 * 1000;
     int QUEUE_UPLOAD_INTERVAL = 10 * 60 * 1000;
+    int ARCHIVE_INTERVAL = 60 * 1000;
+    bool UPLOAD_PRIORITY_ONLY = false;
     int QUEUE_LAST_UPLOAD_AT = 0;
     int WLEV_SAMPLING_INTERVAL = 10 * 60 * 1000;
+    int WLEV_AGGREGATION_WINDOW = 60 * 60 * 1000;
+    float WLEV_CHANGE_THRESHOLD = 0.5;
     int WLEV_LAST_SAMPLE_AT = 0;
 
     /*
@@ -90,6 +99,14 @@
     */
     int CUMULATIVE_TIP_COUNT = 0;
     int RAIN_INCHES = 0;
+
+    /*
+        Backfill request (data/query); served from the upload loop, capped per request
+    */
+    uint32_t BACKFILL_FROM = 0;
+    uint32_t BACKFILL_TO = 0;
+    bool BACKFILL_PENDING = false;
+    uint32_t BACKFILL_MAX_ROWS = 100;
     
     /*
         Thresholds
@@ -175,6 +192,8 @@
             .set("HOURID", HOURID)
             .set("RAINID", RAINID);
 
+        // Today's charge per subsystem
+        GB_ENERGY::meter().report(state);
 
         gb.log("Uploading state");
         gb.log(state.get());
@@ -207,6 +226,42 @@
         CV_UPLOAD_INTERVAL = data.getint("CV_UPLOAD_INTERVAL");
         ANTIFREEZE_REBOOT_DELAY = data.getint("ANTIFREEZE_REBOOT_DELAY");
 
+        // Upload policy cost model
+        policy.configure(data);
+
+        // Water level aggregation
+        if (data.getint("WLEV_AGGREGATION_WINDOW") > 0) WLEV_AGGREGATION_WINDOW = data.getint("WLEV_AGGREGATION_WINDOW");
+
+        // The change threshold keeps its default unless the variable is set (0 turns the change detection off)
+        String threshold = data.getstring("WLEV_CHANGE_THRESHOLD");
+        if (threshold.length() > 0 && threshold != "-1") WLEV_CHANGE_THRESHOLD = threshold.toFloat() > 0 ? threshold.toFloat() : 0;
+        wlevaggregator.configure(WLEV_AGGREGATION_WINDOW, WLEV_CHANGE_THRESHOLD);
+
+        // Adaptive water level sampling (water level and rain rate); baseline is WLEV_SAMPLING_INTERVAL
+        sampler
+            .watch("WLEV", 0.01, 0)
+            .watch("RAIN", 0.002, 0)
+            .configure(WLEV_SAMPLING_INTERVAL, WLEV_SAMPLING_INTERVAL / 10)
+            .configure(data);
+
+        // LED/buzzer patterns (e.g. only while someone is on site)
+        GB_INDICATOR::engine().configure(data);
+
+        // Current draws for the energy accounting
+        GB_ENERGY::meter().configure(data);
+
+        // Storage faults (faults mode only)
+        GB_FAULTS::injector().configure(data);
+
+        // Readings go to a preallocated ring file of this size (KB); 0 appends to the CSV
+        sd.ring(data.getint("SD_RING_KB") > 0 ? data.getint("SD_RING_KB") * 1024UL : 0);
+
+        // Rotate the readings file at this size (KB) and/or daily; the rotated files are archived in the background
+        sd.rotate(data.getint("SD_ROTATE_KB") > 0 ? data.getint("SD_ROTATE_KB") * 1024UL : 0, data.getboolean("SD_ROTATE_DAILY"));
+
+        // Oversampled water level readings if the ADS1115's ALERT/RDY pin is wired to this MCU pin (-1: single shots)
+        if (data.getint("EADC_ALERT_PIN") >= 0) eadc.continuous(data.getint("EADC_ALERT_PIN"), ADS1115_DR_860_SPS).oversample(16, GB_EADC::CIC, true);
+
         gb.log("Updating runtime variables -> Done");
 
         // Send the fresh list of control variables
@@ -256,7 +311,7 @@
         // Update the variables in SD card and in runtime memory
         sd.updatecontrol(str, set_control_variables);
         
-        mqtt.publish("log/message", "Control variables updated.");
+        sd.enqueue("logs", "log/message", "Control variables updated (store: " + sd.controlstatus() + ").");
         // send_control_variables();
 
         // if (RESET_VARIABLES_FLAG) {
@@ -286,6 +341,40 @@
             return;
         }
 
+        // Backfill request ("<from>,<to>" timestamps); served from the upload loop (see serve_backfill())
+        if (topic == "data/query") {
+            BACKFILL_FROM = strtoul(message.c_str(), NULL, 10);
+            BACKFILL_TO = strtoul(message.substring(message.indexOf(",") + 1).c_str(), NULL, 10);
+            BACKFILL_PENDING = true;
+            return;
+        }
+
+        /*
+            Archive request: "manifest,<offset>" for the next part of the manifest ("<offset>,<text>"), or
+            "<file>,<offset>" for the next bytes of an archive ("<file>,<offset>,<hex>"). A reply carries as
+            much as fits in one MQTT packet (at most 256 bytes); it's empty at the end.
+        */
+        if (topic == "data/archive") {
+            int comma = message.indexOf(",");
+            String file = comma > -1 ? message.substring(0, comma) : message;
+            uint32_t offset = comma > -1 ? strtoul(message.substring(comma + 1).c_str(), NULL, 10) : 0;
+            char buffer[257], hex[2 * 256 + 1] = "";
+
+            if (file == "manifest") {
+                int room = min(256, mqtt.room("data/archive/manifest") - (int) String(offset).length() - 1);
+                int length = sd.read("/archive/manifest.csv", offset, buffer, max(0, room));
+                buffer[max(0, length)] = 0;
+                mqtt.publish("data/archive/manifest", String(offset) + "," + String(buffer));
+                return;
+            }
+
+            int room = min(256, (mqtt.room("data/archive/chunk") - (int) (file.length() + String(offset).length()) - 2) / 2);
+            int length = sd.read("/archive/" + file, offset, buffer, max(0, room));
+            for (int i = 0; i < length; i++) sprintf(hex + 2 * i, "%02X", (uint8_t) buffer[i]);
+            mqtt.publish("data/archive/chunk", file + "," + String(offset) + "," + String(hex));
+            return;
+        }
+
         parse(message);
 
         // String targetdevice = topic.substring(0, topic.indexOf("::"));
@@ -309,6 +398,8 @@
         mqtt.subscribe("ping");
         mqtt.subscribe("control/update");
         mqtt.subscribe("gatorbyte/ack");
+        mqtt.subscribe("data/query");
+        mqtt.subscribe("data/archive");
     }
 
     /* 
@@ -358,11 +449,81 @@
         *time = FAT_TIME(now.hour(), now.minute(), now.second());
     }
 
+    /*
+        ! Write a water level record
+        One aggregate record is written per window. A sample that crosses the change threshold
+        is also written as a raw (single-sample) record.
+    */
+    void write_wlev_record (bool raw) {
+        GB_SD::SESSION session(sd);
+        CSVary csv;
+
+        csv
+            .clear()
+            .setheader("SURVEYID,DEVICESN,TIMESTAMP," + wlevaggregator.header("WLEV"))
+            .set(gb.globals.PROJECT_ID)
+            .set(gb.globals.DEVICE_SN)
+            .set(rtc.timestamp().toInt());
+        
+        if (raw) wlevaggregator.appendlast(csv);
+        else wlevaggregator.appendto(csv);
+
+        sd.writeCSV("/readings/" + (gb.globals.DEVICE_NAME.length() > 0 ? gb.globals.DEVICE_NAME + "_" : "") + "wlev.csv", csv);
+
+        // A sudden change goes out ahead of the backlog
+        sd.enqueue(raw ? "alerts" : "readings", "data/set", csv, mem.nextsequence());
+    }
+
     // Start antifreeze sentinence monitor    
     void antifreeze_monitor () {
         sntl.disable().interval("sentinence", 30 * 60).enable();
     }
 
+    /*
+        ! Serve a backfill request
+        The matching readings are queued 10 rows per file in the readings lane, so they go out with
+        sequence numbers through the acknowledged window like any other queue file. A request is
+        capped at BACKFILL_MAX_ROWS rows; the reply (log/message) tells the timestamp to query from next.
+    */
+    void serve_backfill () {
+        if (!BACKFILL_PENDING) return;
+        BACKFILL_PENDING = false;
+
+        struct BACKFILL { String header; String rows; int count; uint32_t total; uint32_t next; } backfill = { "", "", 0, 0, 0 };
+        char buffer[256];
+
+        GB_SD::SESSION session(sd);
+        sd.query(sd.readingsfile(), BACKFILL_FROM, BACKFILL_TO, buffer, sizeof(buffer), [] (char *line, int length, void *context) {
+            BACKFILL *backfill = (BACKFILL *) context;
+            if (backfill->header.length() == 0) { backfill->header = line; return true; }
+
+            // Over the cap; note where the next request starts
+            if (backfill->total == BACKFILL_MAX_ROWS) {
+                String row = line;
+                int column = 0;
+                for (int i = 0; i < backfill->header.indexOf("TIMESTAMP"); i++) if (backfill->header[i] == ',') column++;
+                int start = 0;
+                for (int i = 0; i < column && start >= 0; i++) start = row.indexOf(',', start) + 1;
+                backfill->next = strtoul(row.c_str() + start, NULL, 10);
+                return false;
+            }
+
+            backfill->rows += (backfill->count > 0 ? "\n" : "") + String(line);
+            backfill->total++;
+            if (++backfill->count == 10) {
+                sd.enqueue("readings", "data/set", backfill->header + "\n" + backfill->rows, mem.nextsequence());
+                backfill->rows = ""; backfill->count = 0;
+            }
+            return true;
+        }, &backfill);
+        if (backfill.count > 0) sd.enqueue("readings", "data/set", backfill.header + "\n" + backfill.rows, mem.nextsequence());
+
+        String reply = "Backfill queued " + String(backfill.total) + " readings.";
+        if (backfill.next > 0) reply += " Capped at " + String(BACKFILL_MAX_ROWS) + "; query again from " + String(backfill.next) + ".";
+        sd.enqueue("logs", "log/message", reply);
+        gb.log(reply);
+    }
+
     /*
         ! Send data to server
         Send the queue data first.
@@ -387,30 +548,69 @@
             });
 
             gb.log("MQTT connection attempted");
+
+            // The link quality for the next decisions (the modem is up now)
+            policy.sample();
             
             //! Publish first ten queued-data with MQTT
             sntl.watch(60, [] {
 
                 if (CONNECTED_TO_MQTT_BROKER) {
                     int counter = 10;
+
+                    // Remove a queue file once the broker acknowledges it
+                    mqtt.onack([] (String queuefilename, uint32_t sequence) {
+                        mem.setacked(sequence);
+                        sd.removequeuefile(queuefilename);
+                    });
+
+                    // A file the broker never acknowledged goes to the back of its lane
+                    mqtt.onabandon([] (String queuefilename, uint32_t sequence) {
+                        sd.requeuefile(queuefilename);
+                    });
                     
-                    while (!sd.isqueueempty() && counter-- > 0) {
+                    while (counter > 0 && CONNECTED_TO_MQTT_BROKER) {
 
-                        String queuefilename = sd.getfirstqueuefilename();
+                        // Wait (bounded) for a slot in the window; it stays shut while PUBACKs don't come back
+                        if (!mqtt.waitwindow(20000)) {
+                            gb.log("No room in the MQTT window. Upload deferred.");
+                            break;
+                        }
 
-                        gb.log("Sending queue file: " + queuefilename);
+                        // A backfill request received in this session is queued and drained with the rest
+                        serve_backfill();
 
-                        // Attempt publishing queue-data
-                        if (mqtt.publish("data/set", sd.readqueuefile(queuefilename))) {
+                        // Alerts first, then readings and logs by weight
+                        String queuefilename = sd.nextqueuefile(mqtt.inflighttags(), UPLOAD_PRIORITY_ONLY);
+                        if (queuefilename.length() == 0) break;
 
-                            // Remove queue file
+                        uint32_t sequence; String topic;
+                        String data = sd.readqueuefile(queuefilename, sequence, topic);
+
+                        // A torn or corrupt record comes back empty (the file is quarantined), as does one that can't be read
+                        if (data.length() == 0) { counter--; continue; }
+
+                        // Acknowledged before a reboot but not removed
+                        if (mem.isacked(sequence)) {
+                            gb.log("Queue file already acknowledged: " + queuefilename);
                             sd.removequeuefile(queuefilename);
+                            continue;
                         }
 
+                        gb.log("Sending queue file: " + queuefilename);
+
+                        // Attempt publishing queue-data
+                        if (mqtt.send(topic, data, queuefilename, sequence)) counter--;
+
                         else {
                             gb.log("Queue file not deleted.");
+                            break;
                         }
                     }
+
+                    // Wait for the outstanding acknowledgements, then persist them together
+                    mqtt.flush(20000);
+                    mem.flushacked();
                 }
             });
 
@@ -426,6 +626,9 @@
     void write_data_to_sd_and_upload () {
 
         sntl.watch(15, [] {
+
+            // Keep the SD card on for the readings and the queue file
+            GB_SD::SESSION session(sd);
         
             // Initialize CSVary object
             CSVary csv;
@@ -471,7 +674,9 @@
             String currentdataqueuefile = sd.getavailablequeuefilename();
 
             gb.log("Wrote to queue file: " + currentdataqueuefile);
-            sd.writequeuefile(currentdataqueuefile, csv);
+            sd.writequeuefile(currentdataqueuefile, csv, mem.nextsequence());
+            gb.log("SD card: " + sd.powerstatus());
+            gb.log("SD directory cache: " + sd.cachestatus());
             
         });
 
@@ -511,7 +716,7 @@
         // Turn on antifreeze monitor
         antifreeze_monitor();
 
-        rgb.rainbow(5000);
+        rgb.rainbow(5000, true);
     }
 
     void triggervst () {
@@ -558,7 +763,7 @@
             gdc.detect(false);
 
             // Configure SD
-            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("quarter");
+            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("auto");
             
             // Configure BL
             bl.configure({true, SR3, SR11}).initialize().persistent().on();
@@ -749,6 +954,8 @@
                 bl.print("Sending data");
                 String filename = "/readings/" + (gb.globals.DEVICE_NAME.length() > 0 ? gb.globals.DEVICE_NAME + "_" : "") + "readings.csv";
                 bl.print(sd.readfile(filename));
+                String ring = sd.readring(filename, 0, 50);
+                if (ring.length() > 0) bl.print(ring);
             }
             if (command == "state") {
 
@@ -958,8 +1165,8 @@
         
         //! Publish ping
         pingpiper.pipe(SERVER_PING_INTERVAL, true, [] (int counter) {
-            gb.log("Publishing ping count: "  + String(counter));
-            mqtt.publish("log/message", "Device ping counter: "  + String(counter));
+            gb.log("Queueing ping count: "  + String(counter));
+            sd.enqueue("logs", "log/message", "Device ping counter: "  + String(counter));
         });
         
         //! Remote variables reset/reboot listener
@@ -1011,24 +1218,60 @@
         
         //! Upload data to server
         uploaderpiper.pipe(QUEUE_UPLOAD_INTERVAL, true, [] (int counter) {
-            if (sd.getqueuecount() > 0) send_queue_files_to_server();
+            int backlog = sd.getqueuecount();
+            if (backlog == 0) return;
+
+            // Upload now, defer, or upload only the alerts depending on the link quality and battery
+            String decision = policy.sample().decide(backlog, sd.getqueuecount("alerts"));
+            if (decision == "defer") return;
+
+            UPLOAD_PRIORITY_ONLY = decision == "priority";
+            GB_ENERGY::meter().phase(GB_ENERGY::UPLOAD);
+            send_queue_files_to_server();
+            GB_ENERGY::meter().phase(GB_ENERGY::IDLE);
+            if (!UPLOAD_PRIORITY_ONLY && sd.getqueuecount() < backlog) policy.uploaded();
         });
 
         //! Read water level data
-        wlevpiper.pipe(WLEV_SAMPLING_INTERVAL, true, [] (int counter) {
+        wlevpiper.pipe(sampler.interval(), true, [] (int counter) {
+            GB_ENERGY::meter().phase(GB_ENERGY::SENSE);
 
             sntl.watch(4, [] {
-                WLEV = eadc.getdepth(0);
+                float depth = eadc.getdepth(0);
+                WLEV = depth;
                 gb.log("Water level: " + String(WLEV));
+                wlevaggregator.add(depth);
+
+                // Sample faster during storm onset
+                sampler.add("WLEV", depth).add("RAIN", CUMULATIVE_TIP_COUNT);
             });
 
+            // Raw record on a sudden change; aggregate record at the end of the window
+            GB_ENERGY::meter().phase(GB_ENERGY::STORE);
+            if (wlevaggregator.changed()) write_wlev_record(true);
+            if (wlevaggregator.ready()) {
+                write_wlev_record(false);
+                wlevaggregator.reset();
+            }
+
             // Turn on antifreeze monitor
             antifreeze_monitor();
+            GB_ENERGY::meter().phase(GB_ENERGY::IDLE);
         });
 
         //! Upload state to the server
         statepiper.pipe(STATE_UPLOAD_INTERVAL, true, [] (int counter) {
             send_state();
+
+            // Keep the day's energy totals across resets (rate-limited)
+            GB_ENERGY::meter().save();
+        });
+
+        //! Compress the rotated readings files, a block at a time
+        archivepiper.pipe(ARCHIVE_INTERVAL, false, [] (int counter) {
+            GB_ENERGY::meter().phase(GB_ENERGY::STORE);
+            sd.archive();
+            GB_ENERGY::meter().phase(GB_ENERGY::IDLE);
         });
 
         //! Restore action/state after a reboot
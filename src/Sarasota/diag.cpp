@@ -335,8 +335,11 @@
 
                     String queuefilename = sd.getfirstqueuefilename();
 
+                    // A torn or corrupt record comes back empty (the file is quarantined)
+                    String data = sd.readqueuefile(queuefilename);
+
                     // Attempt publishing queue-data
-                    if (mqtt.publish("data/set", sd.readfile(queuefilename))) {
+                    if (data.length() > 0 && mqtt.publish("data/set", data)) {
 
                         // Remove queue file
                         sd.removequeuefile(queuefilename);
@@ -423,7 +426,7 @@
         
         });
 
-        rgb.rainbow(5000);
+        rgb.rainbow(5000, true);
     }
 
     void triggervst () {
@@ -465,7 +468,7 @@
         sntl.configure(9).initialize();
         sntl.interval("sentinence", 60).disable().enable();
 
-        sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("quarter").readconfig();
+        sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("auto").readconfig();
 
         //! Configure MQTT broker and connect 
         mqtt.configure("mqtt.ezbean-lab.com", 1883, gb.DEVICE_SN, mqtt_message_handler, mqtt_on_connect);
@@ -55,6 +55,9 @@
     GB_AT_SCI_EC ec(gb);
     GB_AT_SCI_PH ph(gb);
 
+    // Reads the RTD first and compensates the pH, EC and DO readings with its temperature
+    GB_GRAPH sensors(gb);
+
     GB_AHT10 aht(gb);
     GB_SNTL sntl(gb);
     GB_DESKTOP gdc(gb);
@@ -68,6 +71,12 @@
 
         REBOOT_FLAG = data.getboolean("REBOOT_FLAG");
 
+        // Convergence criteria for the Atlas probes (e.g. PH_CI, PH_SLOPE)
+        rtd.convergence.configure(data, "RTD");
+        ph.convergence.configure(data, "PH");
+        ec.convergence.configure(data, "EC");
+        dox.convergence.configure(data, "DO");
+
         gb.log("Updating runtime variables -> Done");
 
         // Send the fresh list of control variables
@@ -259,8 +268,11 @@
                         String queuefilename = sd.getfirstqueuefilename();
                         gb.log("Sending queue file: " + queuefilename);
 
+                        // A torn or corrupt record comes back empty (the file is quarantined)
+                        String data = sd.readqueuefile(queuefilename);
+
                         // Attempt publishing queue-data
-                        if (mqtt.publish("data/set", sd.readqueuefile(queuefilename))) {
+                        if (data.length() > 0 && mqtt.publish("data/set", data)) {
 
                             // Remove queue file
                             sd.removequeuefile(queuefilename);
@@ -343,14 +355,14 @@
 
         while(false) {
             // sntl.configure({true, 4}, 9).initialize();
-            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("quarter");
+            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("auto");
         }
         
         sntl.watch(120, []() {
 
             // Initialize SD first to read the config file
             // while (1) 
-            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("quarter");
+            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("auto");
 
             // while (true) delay(100);
             
@@ -384,6 +396,9 @@
             ec.configure({true, SR9, true, 3}).initialize(true);
             ph.configure({true, SR7, true, 1}).initialize(true);
 
+            //! Temperature compensation; EC is read on its own so its excitation doesn't disturb the pH and DO probes
+            sensors.add(&rtd).add(&ph, &rtd).add(&ec, &rtd).add(&dox, &rtd).exclusive(&ec);
+
         });
 
         gb.log("Setup complete");
@@ -463,7 +478,8 @@
             gps.on();
 
             //! Get sensor readings
-            float read_rtd_value = rtd.readsensor(), read_ph_value = ph.readsensor(), read_ec_value = ec.readsensor(), read_dox_value = dox.readsensor();
+            sensors.acquire();
+            float read_rtd_value = sensors.value(&rtd), read_ph_value = sensors.value(&ph), read_ec_value = sensors.value(&ec), read_dox_value = sensors.value(&dox);
 
             /*
                 ! Check the current state of the system and take actions accordingly
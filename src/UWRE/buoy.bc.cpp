@@ -369,7 +369,7 @@
                     String queuefilename = sd.getfirstqueuefilename();
 
                     // Attempt publishing queue-data
-                    if (mqtt.publish("data/set", sd.readfile(queuefilename))) {
+                    if (mqtt.publish("data/set", sd.readqueuefile(queuefilename))) {
 
                         // Remove queue file
                         sd.removequeuefile(queuefilename);
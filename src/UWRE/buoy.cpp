@@ -257,8 +257,11 @@
                         String queuefilename = sd.getfirstqueuefilename();
                         gb.log("Sending queue file: " + queuefilename);
 
+                        // A torn or corrupt record comes back empty (the file is quarantined)
+                        String data = sd.readqueuefile(queuefilename);
+
                         // Attempt publishing queue-data
-                        if (mqtt.publish("data/set", sd.readqueuefile(queuefilename))) {
+                        if (data.length() > 0 && mqtt.publish("data/set", data)) {
 
                             // Remove queue file
                             sd.removequeuefile(queuefilename);
@@ -341,14 +344,14 @@
 
         while(false) {
             // sntl.configure({true, 4}, 9).initialize();
-            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("quarter");
+            sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("auto");
         }
         
         sntl.watch(120, []() {
 
             // Initialize SD first to read the config file
             // while (1) {
-                sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("quarter");
+                sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("auto");
                 
             //     gps.configure({true, SR2, SR10}).initialize();
             //     bl.configure({true, SR3, SR11}).initialize().on().persistent();
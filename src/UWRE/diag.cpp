@@ -113,7 +113,7 @@
             mqtt.connect();
         });
 
-        rgb.rainbow(5000);
+        rgb.rainbow(5000, true);
     }
 
     /*
@@ -124,7 +124,7 @@
         flag = true;
 
         // Test RGB & buzzer
-        rgb.rainbow(5000).off(); buzzer.play(".-"); delay(2000);
+        rgb.rainbow(5000, true).off(); buzzer.play(".-"); delay(2000);
 
         // Test SD
         rgb.on(sd.rwtest() ? "green" : "red"); delay(1000); rgb.off();
@@ -200,7 +200,7 @@
         // sermux.configure().initialize();
         
         //! Initialize essentials
-        sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("quarter").readconfig().on();
+        sd.configure({true, SR15, 7, SR4}).state("SKIP_CHIP_DETECT", true).initialize("auto").readconfig().on();
         // fram.configure({true, SR15, 7, SR4}).initialize("quarter");
 
         buzzer.configure({6}).initialize().play("...");
@@ -0,0 +1,1163 @@
+/*
+    ! Host library checks
+    Runs library code (unchanged) on the host against a reference or an emulator, on the virtual
+    clock, and checks:
+        - filters (GB_Filters.h): GB_MEDIAN against a sorted window and GB_HAMPEL against a
+          brute-force Hampel identifier over 10000 random samples with spikes; the integer-mm series
+          the USS filter has to pass; GB_EMA, GB_RATELIMIT and a >> chain
+        - LZW (GB_LZW.h): blocks coded in random pieces decode to the input (readings rows,
+          random bytes, one repeated byte, empty and 1-byte blocks); the ratio on readings rows
+        - Modbus RTU (lib/RS485): CRC16::ModbusFast against the bitwise CRC; ModbusRTU against
+          emulated slaves on an RS485 line (rs485.h): reads, writes, the poll list and the typed
+          fields, exceptions, timeouts, corrupt, split and foreign answers, stale bytes, and the
+          t3.5 silence before every request
+        - SD (sd.h, on an emulated card, card.h): the directory cache against the card's own
+          listing over random uploader steps; query() against brute force and its time against a
+          full read; ring against append writes and the ring read back; rotated files archived and
+          the manifest against the archives; streaming reads (readchunks(), read(), readlines())
+        - sequence numbers (at24.h, on an emulated EEPROM, eeprom.h): numbers never reused and
+          flushed acknowledgements kept, over reboots with power cuts part-way through a write
+        - MQTT (mqttserver.h and PubSubClient, against an emulated broker, broker.h): records/s
+          through the window against stop-and-wait at 100 ms, 500 ms and 2 s round trips; the
+          bounded window wait; resends with DUP and abandoned messages; an upload with lost
+          packets, dropped connections and reboots that delivers every record
+
+    Usage:
+        ./build/checks                                      // Exit status non-zero on a failure
+*/
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "GB.h"
+
+// GCC can't tell that GB_MEDIAN's heap walks stay within the window (the counts are bounded by N,
+// not by their uint8_t type) and warns at -O2; a -fsanitize=bounds build of these checks is clean
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Warray-bounds"
+#include "../../lib/GatorByte/src/core/GB_Filters.h"
+#pragma GCC diagnostic pop
+
+#include "broker.h"
+#include "card.h"
+#include "eeprom.h"
+#include "rs485.h"
+#include "../../lib/GatorByte/src/storage/sd.h"
+#include "../../lib/RS485/src/ModbusRTU.h"
+
+// mqttserver.h's subscribe() and mqtt_response_handler() leave a result and their parameters unused
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "../../lib/GatorByte/src/communication/mqttserver.h"
+#pragma GCC diagnostic pop
+
+// at24.h's older members (status(), format(), debug()) don't build warning-free; the sequence store
+// below them is what's checked
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Waddress"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+#include "../../lib/GatorByte/src/storage/at24.h"
+#pragma GCC diagnostic pop
+
+#ifndef HOST_WORK
+    #define HOST_WORK "build"
+#endif
+
+#define PIN_CD 6
+#define PIN_CS 4
+#define PIN_POWER 5
+#define PIN_MEM_POWER 3
+
+static int failures = 0;
+
+static void result(const char *name, bool passed, const std::string &detail) {
+    printf("    %-34s %s%s\n", name, passed ? "ok" : "FAILED", detail.size() ? (" (" + detail + ")").c_str() : "");
+    if (!passed) failures++;
+}
+
+// Seeded generator (xorshift32), so every run checks the same samples
+static uint32_t rng = 1;
+static uint32_t next() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static std::string format(const char *pattern, double value) {
+    char text[32];
+    snprintf(text, sizeof(text), pattern, value);
+    return text;
+}
+
+/*
+    Median: the filter against the median of a sorted copy of the last N samples (the mean of the
+    two middle ones for an even count, in T's arithmetic as the filter does)
+*/
+template <typename T, uint8_t N>
+static void median(const char *name, T range) {
+    GB_MEDIAN<T, N> filter;
+    std::vector<T> samples;
+    uint32_t mismatches = 0;
+
+    for (int i = 0; i < 10000; i++) {
+        T sample = (T) (next() % 100000) / (T) 100000 * range;
+        T got = filter.add(sample);
+
+        samples.push_back(sample);
+        std::vector<T> window(samples.end() - std::min<size_t>(samples.size(), N), samples.end());
+        std::sort(window.begin(), window.end());
+        size_t count = window.size();
+        T want = count & 1 ? window[count / 2] : (T) ((window[count / 2] + window[count / 2 - 1]) / 2);
+        if (got != want || filter.median() != want) mismatches++;
+    }
+    result(name, mismatches == 0, mismatches ? std::to_string(mismatches) + " of 10000 samples differ" : "");
+}
+
+/*
+    Hampel: the filter against the identifier computed from a sorted window (median, MAD x 1.4826
+    with the floor, threshold), over random samples with a 2% chance of a spike
+*/
+template <uint8_t N>
+static void hampel(const char *name, float threshold, float floor) {
+    GB_HAMPEL<float, N> filter(threshold, floor);
+    std::vector<float> samples;
+    uint32_t mismatches = 0, outliers = 0;
+
+    for (int i = 0; i < 10000; i++) {
+        float sample = 1000 + (float) (next() % 200) / 10;
+        if (next() % 50 == 0) sample += (next() % 2 ? 1 : -1) * (float) (50 + next() % 500);
+        float got = filter.add(sample);
+
+        samples.push_back(sample);
+        std::vector<float> window(samples.end() - std::min<size_t>(samples.size(), N), samples.end());
+        std::sort(window.begin(), window.end());
+        size_t count = window.size();
+        float middle = count & 1 ? window[count / 2] : (window[count / 2] + window[count / 2 - 1]) / 2;
+
+        float want = sample;
+        bool outlier = false;
+        if (count >= 3) {
+            std::vector<float> deviations;
+            for (float value : window) deviations.push_back(fabs(value - middle));
+            std::sort(deviations.begin(), deviations.end());
+            float mad = count & 1 ? deviations[count / 2] : (deviations[count / 2 - 1] + deviations[count / 2]) / 2;
+            float scale = 1.4826 * mad;
+            if (scale < floor) scale = floor;
+            if (fabs(sample - middle) > threshold * scale) {
+                want = middle;
+                outlier = true;
+            }
+        }
+        if (outlier) outliers++;
+        if (got != want || filter.outlier() != outlier) mismatches++;
+    }
+    std::string detail = std::to_string(outliers) + " outliers";
+    if (mismatches) detail += ", " + std::to_string(mismatches) + " of 10000 samples differ";
+    result(name, mismatches == 0 && filter.outliers() == outliers, detail);
+}
+
+static void filters() {
+    median<int32_t, 5>("Median, int, N = 5", 100000);
+    median<int32_t, 8>("Median, int, N = 8", 100000);
+    median<float, 7>("Median, float, N = 7", 1000);
+    median<float, 31>("Median, float, N = 31", 1000);
+    median<uint16_t, 64>("Median, uint16, N = 64", 60000);
+
+    hampel<7>("Hampel, N = 7, 3 MADs", 3, 0);
+    hampel<7>("Hampel, N = 7, 3 MADs, floor 10", 3, 10);
+    hampel<15>("Hampel, N = 15, 2 MADs", 2, 0);
+
+    // GB_USS's filter: whole millimeters that mostly repeat pass, a spike is replaced by the median
+    // of its window (1001)
+    GB_HAMPEL<float, 7> uss(3, 10);
+    const float levels[] = { 1000, 1000, 1001, 1001, 1002, 1001, 1002, 1500, 1002, 1003 };
+    std::string passed = "";
+    bool ok = true;
+    for (float level : levels) {
+        float out = uss.add(level);
+        if (level == 1500) ok = ok && uss.outlier() && out == 1001;
+        else ok = ok && !uss.outlier() && out == level;
+        passed += String(out, 0).c_str() + std::string(" ");
+    }
+    result("USS series (integer mm)", ok, passed.substr(0, passed.size() - 1));
+
+    // EMA, rate limit and the chain of the three against the same steps by hand
+    GB_HAMPEL<float, 7> spikes(3);
+    GB_EMA<float> smooth(0.25);
+    GB_RATELIMIT<float> limit(2);
+    auto chain = spikes >> smooth >> limit;
+
+    GB_HAMPEL<float, 7> spikes2(3);
+    float average = 0, limited = 0;
+    bool primed = false;
+    uint32_t mismatches = 0;
+    for (int i = 0; i < 10000; i++) {
+        float sample = 50 + (float) (next() % 100) / 10 + (i % 500 == 250 ? 80 : 0);
+        float value = spikes2.add(sample);
+        average = primed ? average + 0.25f * (value - average) : value;
+        float step = primed ? std::max(limited - 2, std::min(limited + 2, average)) : average;
+        limited = step;
+        primed = true;
+        if (chain.add(sample) != limited) mismatches++;
+    }
+    result("Hampel >> EMA >> rate limit", mismatches == 0, mismatches ? std::to_string(mismatches) + " of 10000 samples differ" : "");
+}
+
+/*
+    LZW: each block is coded in random pieces (as archive() feeds it), finished and decoded by a
+    coder of its own
+*/
+static bool roundtrip(const std::vector<uint8_t> &input, uint32_t &coded) {
+    static GB_LZW encoder, decoder;
+    std::vector<uint8_t> output(2 * input.size() + 8);
+
+    encoder.begin();
+    uint32_t length = 0, offset = 0;
+    while (offset < input.size()) {
+        uint16_t piece = std::min<uint32_t>(input.size() - offset, 1 + next() % 700);
+        length += encoder.compress(input.data() + offset, piece, output.data() + length);
+        offset += piece;
+    }
+    length += encoder.finish(output.data() + length);
+    coded = length;
+
+    std::vector<uint8_t> decoded(input.size() + 1);
+    uint32_t produced = decoder.decompress(output.data(), length, decoded.data(), decoded.size());
+    return produced == input.size() && std::equal(input.begin(), input.end(), decoded.begin());
+}
+
+// A readings row like the sketches write, and rows of them in 8 KB blocks (archive()'s)
+static const char *COLUMNS = "TIMESTAMP,WLEV,RAIN,BATTERY,TEMP,RSSI";
+
+static std::string reading(uint32_t timestamp) {
+    static float level = 1200;
+    level += (float) ((int) (next() % 21) - 10) / 10;
+    char row[96];
+    snprintf(row, sizeof(row), "%u,%.1f,%u,%.2f,%.1f,-%u", (unsigned) timestamp, level, (unsigned) (next() % 40 == 0 ? next() % 5 : 0),
+        3.7 + (double) (next() % 50) / 100, 24.0 + (double) (next() % 80) / 10, (unsigned) (70 + next() % 30));
+    return row;
+}
+
+static std::string readings(uint32_t rows) {
+    std::string text = std::string(COLUMNS) + "\n";
+    for (uint32_t i = 0; i < rows; i++) text += reading(1790000000 + 900 * i) + "\n";
+    return text;
+}
+
+static void lzw() {
+    std::string text = readings(2000);
+    uint32_t total = 0, coded = 0, blocks = 0, bad = 0;
+    for (size_t offset = 0; offset < text.size(); offset += 8192) {
+        std::vector<uint8_t> block(text.begin() + offset, text.begin() + std::min(text.size(), offset + 8192));
+        uint32_t length;
+        if (!roundtrip(block, length)) bad++;
+        total += block.size();
+        coded += length;
+        blocks++;
+    }
+    result("Readings rows, 8 KB blocks", bad == 0, std::to_string(blocks) + " blocks, ratio " + format("%.2f", (double) coded / total) +
+        (bad ? ", " + std::to_string(bad) + " not decoded" : ""));
+
+    // Random bytes: the worst case has to fit 'output' (2 bytes per input byte)
+    std::vector<uint8_t> noise(8192);
+    for (uint8_t &byte : noise) byte = next();
+    uint32_t length;
+    bool decoded = roundtrip(noise, length);
+    result("Random bytes, 8 KB", decoded && length <= 2 * noise.size(), "ratio " + format("%.2f", (double) length / noise.size()));
+
+    // One byte repeated: every new code is the one about to be assigned (the KwKwK case)
+    std::vector<uint8_t> repeated(8192, ',');
+    decoded = roundtrip(repeated, length);
+    result("One byte repeated, 8 KB", decoded, std::to_string(length) + " bytes");
+
+    std::vector<uint8_t> single(1, 'x'), empty;
+    bool both = roundtrip(single, length) && length == 2;
+    both = roundtrip(empty, length) && length == 0 && both;
+    result("1-byte and empty blocks", both, "");
+}
+
+/*
+    Modbus RTU: a master at 9600 baud and two slaves; every request is checked for its status, its
+    values and how long it took on the line
+*/
+static void modbus() {
+    uint8_t data[255];
+    for (uint8_t &byte : data) byte = next();
+    const char *check = "123456789";
+    CRC16 crc;
+    bool same = CRC16::ModbusFast((const uint8_t *) check, 9) == 0x4B37;
+    for (int i = 0; i < 1000 && same; i++) {
+        uint8_t length = 1 + next() % 254;
+        same = CRC16::ModbusFast(data, length) == crc.fastCrc(data, 0, length, true, true, 0x8005, 0xFFFF, 0x0000, 0x8000, 0xFFFF);
+    }
+    result("CRC16 table against bitwise", same, "check 0x" + std::string(String(CRC16::ModbusFast((const uint8_t *) check, 9), HEX).c_str()));
+
+    host::spin() = 1000;
+    host::Rs485 line(9600);
+    for (uint16_t i = 0; i < 40; i++) line.slaves[1].holding[0x0100 + i] = 1000 + i;
+    for (uint16_t i = 0; i < 8; i++) line.slaves[2].input[i] = 0xA000 + i;
+
+    ModbusRTU master;
+    master.init(line, 7, 9600);
+    uint16_t values[MODBUS_MAX_REGISTERS];
+
+    // A request and its answer: the status, and the time from the request to the status (ms)
+    auto request = [&] (const char *name, std::function<uint8_t()> send, uint8_t want, std::function<bool()> values_ok, std::string detail) {
+        uint64_t start = host::now();
+        uint8_t status = send();
+        double ms = (host::now() - start) / 1e6;
+        bool ok = status == want && (!values_ok || values_ok());
+        result(name, ok, "status " + std::to_string(status) + ", " + format("%.1f ms", ms) + (detail.size() ? ", " + detail : ""));
+        return ms;
+    };
+
+    request("Read holding, 2 registers", [&] { return master.readholding(1, 0x0100, 2, values); }, ModbusRTU::OK,
+        [&] { return values[0] == 1000 && values[1] == 1001; }, "");
+    request("Read holding, 32 registers", [&] { return master.readholding(1, 0x0100, 32, values); }, ModbusRTU::OK,
+        [&] { for (int i = 0; i < 32; i++) if (values[i] != 1000 + i) return false; return true; }, "");
+    request("Read holding, 33 registers", [&] { return master.readholding(1, 0x0100, 33, values); }, ModbusRTU::INVALID, NULL, "");
+    request("Read input, 4 registers", [&] { return master.readinput(2, 0, 4, values); }, ModbusRTU::OK,
+        [&] { return values[0] == 0xA000 && values[3] == 0xA003; }, "");
+    request("Write single", [&] { return master.writesingle(1, 0x0105, 4242); }, ModbusRTU::OK,
+        [&] { return line.slaves[1].holding[0x0105] == 4242; }, "");
+
+    // An exception frame ends at 5 bytes, well before the timeout (200 ms)
+    double ms = request("Exception (illegal address)", [&] { return master.readholding(1, 0x0200, 2, values); }, ModbusRTU::EXCEPTION,
+        [&] { return master.exception() == 2; }, "");
+    result("Exception without the timeout", ms < 50, "code " + std::to_string(master.exception()) + ", " + format("%.1f ms", ms));
+
+    request("Absent slave", [&] { return master.readholding(9, 0x0100, 2, values); }, ModbusRTU::TIMEOUT, NULL, "");
+    line.fault = host::Rs485::SILENT;
+    request("No answer", [&] { return master.readholding(1, 0x0100, 2, values); }, ModbusRTU::TIMEOUT, NULL, "");
+    line.fault = host::Rs485::CORRUPT;
+    request("Corrupt answer", [&] { return master.readholding(1, 0x0100, 2, values); }, ModbusRTU::CRC_ERROR, NULL, "");
+    // The master takes the first 3 bytes for the frame; the rest arrives later and is dropped as stale
+    line.fault = host::Rs485::GAP;
+    request("Answer split by a t3.5 gap", [&] { return master.readholding(1, 0x0100, 2, values); }, ModbusRTU::FRAME_ERROR, NULL, "");
+    delay(20);
+    line.fault = host::Rs485::IMPOSTOR;
+    request("Answer from another address", [&] { return master.readholding(1, 0x0100, 2, values); }, ModbusRTU::FRAME_ERROR, NULL, "");
+    line.noise(3);
+    request("Stale bytes before the request", [&] { return master.readholding(1, 0x0100, 2, values); }, ModbusRTU::OK,
+        [&] { return values[0] == 1000 && values[1] == 1001; }, "");
+
+    // The poll list back to back (one slave absent), then the typed fields of a block
+    uint16_t level[2], flow[4], missing[2];
+    master.clearpolls();
+    master.poll(1, ModbusRTU::READ_HOLDING, 0x0100, 2, level);
+    master.poll(9, ModbusRTU::READ_HOLDING, 0x0100, 2, missing);
+    master.poll(2, ModbusRTU::READ_INPUT, 0, 4, flow);
+    uint64_t start = host::now();
+    uint8_t success = master.pollall();
+    bool statuses = master.status(0) == ModbusRTU::OK && master.status(1) == ModbusRTU::TIMEOUT && master.status(2) == ModbusRTU::OK && master.status(3) == ModbusRTU::INVALID;
+    result("Poll list, one slave absent", success == 2 && statuses && level[1] == 1001 && flow[2] == 0xA002, std::to_string(success) + " of 3, " + format("%.1f ms", (host::now() - start) / 1e6));
+
+    float pi = 3.14159f;
+    uint32_t bits;
+    memcpy(&bits, &pi, sizeof(bits));
+    const uint16_t block[] = { 0xFFFE, 0x0001, 0x86A0, (uint16_t) (bits >> 16), (uint16_t) bits, 0x86A0, 0x0001 };
+    const struct { ModbusRTU::FIELD field; float want; } fields[] = {
+        { { 10, ModbusRTU::U16, 1 }, 65534 }, { { 10, ModbusRTU::S16, 0.5 }, -1 }, { { 11, ModbusRTU::U32, 1 }, 100000 },
+        { { 13, ModbusRTU::F32, 1 }, pi }, { { 15, ModbusRTU::U32_SWAPPED, 0.01 }, 1000 }, { { 10, ModbusRTU::S32, 1 }, -131071 }
+    };
+    int decoded = 0;
+    for (auto &test : fields) if (ModbusRTU::value(test.field, 10, block) == test.want) decoded++;
+    result("Typed fields", decoded == 6 && ModbusRTU::width(fields[3].field) == 2, std::to_string(decoded) + " of 6");
+
+    // Every request waited for t3.5 of silence on the line (4 ms at 9600 baud)
+    uint64_t t35 = 35 * line.character() / 10;
+    result("t3.5 silence before requests", line.quiet >= t35, std::to_string(line.requests) + " requests, shortest " + format("%.2f ms", line.quiet / 1e6) + " (t3.5 " + format("%.2f ms", t35 / 1e6) + ")");
+    result("Request and failure counters", master.requests == line.requests && master.failures == 7, std::to_string(master.requests) + " requests, " + std::to_string(master.failures) + " failures");
+    host::spin() = 0;
+}
+
+/*
+    SD: every section formats a card image of its own (card.h) and brings GB_SD up on it the way
+    the sketches do
+*/
+static const char *fresh(const char *path) {
+    std::filesystem::remove(path);
+    return path;
+}
+
+struct CARD {
+    host::Card medium;
+    GB gb;
+    GB_SD sd{gb};
+
+    CARD(const char *image) : medium(fresh(image), 2048UL * 64, PIN_CS, PIN_POWER) {
+        medium.powerup();
+        static uint8_t buffer[512];
+        digitalWrite(PIN_POWER, HIGH);
+        SdCardFactory factory;
+        FatFormatter formatter;
+        if (!formatter.format(factory.newCard(GB_SPI::sdconfig(PIN_CS, SD_SCK_MHZ(12))), buffer)) {
+            fprintf(stderr, "Couldn't format %s\n", image);
+            exit(1);
+        }
+        digitalWrite(PIN_POWER, LOW);
+
+        sd.configure({ false, PIN_CD, PIN_CS, PIN_POWER }).state("SKIP_CHIP_DETECT", true).initialize("auto");
+        if (!sd.initialized()) {
+            fprintf(stderr, "GB_SD didn't start on %s\n", image);
+            exit(1);
+        }
+        sd.hold();
+        if (!sd.exists("/readings")) sd.mkdir("/readings");
+        sd.release();
+    }
+};
+
+// The files in a folder as the card lists them, read behind GB_SD's cache
+static std::vector<std::string> listing(GB_SD &sd, const char *folder) {
+    std::vector<std::string> names;
+    GB_SD::SESSION session(sd);
+    File root, file;
+    if (!root.open(folder)) return names;
+    char name[64];
+    while (file.openNext(&root, O_RDONLY)) {
+        file.getName(name, sizeof(name));
+        if (!file.isDir()) names.push_back(name);
+        file.close();
+    }
+    root.close();
+    return names;
+}
+
+// Directory entries GB_SD has read from the card so far (cachestatus())
+static uint32_t entries(GB_SD &sd) {
+    unsigned long hits, scans, read;
+    return sscanf(sd.cachestatus().c_str(), "%lu hits, %lu scans (%lu entries read)", &hits, &scans, &read) == 3 ? read : 0;
+}
+
+static uint32_t number(const std::string &name) {
+    size_t at = name.find("queue_");
+    return at == std::string::npos ? 0 : strtoul(name.c_str() + at + 6, NULL, 10);
+}
+
+/*
+    Directory cache: a backlog of 1000 readings files, then 500 random uploader steps across the
+    three lanes (enqueue, acknowledge, abandon, remove); after each, every cached lookup is checked
+    against the card's own listing. The order within a folder isn't checked (a new file may take a
+    freed directory slot on the card; the cache keeps creation order), only what is in it.
+*/
+static void queues() {
+    CARD card(HOST_WORK "/checks-queue.img");
+    GB_SD &sd = card.sd;
+    GB_SD::SESSION session(sd);
+
+    const struct { const char *name; const char *folder; const char *prefix; } lanes[] = {
+        { "alerts", "/queue/alerts", "alerts/" }, { "readings", "/queue", "" }, { "logs", "/queue/logs", "logs/" }
+    };
+    auto lane = [] (const std::string &name) { return name.rfind("alerts/", 0) == 0 ? 0 : name.rfind("logs/", 0) == 0 ? 2 : 1; };
+
+    uint32_t timestamp = 1790000000, refused = 0;
+    for (int i = 0; i < 1000; i++) if (!sd.enqueue("readings", "check", reading(timestamp += 900).c_str(), 0)) refused++;
+
+    // The card's listing of each lane, read again once a step has changed the lane
+    std::vector<std::string> names[3];
+    bool changed[3] = { true, true, true };
+
+    uint32_t mismatches = 0, lookups = 0, read = 0;
+    uint64_t scanned = 0;
+    std::string first = "";
+    std::vector<std::string> removed;
+    auto mismatch = [&] (int step, const std::string &what) {
+        if (mismatches++ == 0) first = "step " + std::to_string(step) + ": " + what;
+    };
+
+    for (int step = 0; step < 500; step++) {
+        uint32_t action = next() % 100;
+        if (action < 60) {
+            uint32_t pick = next() % 100, index = pick < 60 ? 1 : pick < 75 ? 0 : 2;
+            if (!sd.enqueue(lanes[index].name, "check", reading(timestamp += 900).c_str(), step + 1)) refused++;
+            changed[index] = true;
+        }
+        else if (action < 85) {
+            // Acknowledged (the file goes) or abandoned (it goes to the back of its lane)
+            std::string name = sd.nextqueuefile("").c_str();
+            if (name.size() && action < 75) sd.removequeuefile(name.c_str());
+            else if (name.size() && !sd.requeuefile(name.c_str())) mismatch(step, "couldn't requeue " + name);
+            if (name.size()) {
+                removed.push_back(name);
+                changed[lane(name)] = true;
+            }
+        }
+        else if (action < 90) {
+            uint32_t index = next() % 3;
+            if (names[index].size()) {
+                std::string name = lanes[index].prefix + names[index][next() % names[index].size()];
+                sd.removequeuefile(name.c_str());
+                removed.push_back(name);
+                changed[index] = true;
+            }
+        }
+
+        uint32_t before = entries(sd);
+        for (int index = 0; index < 3; index++) {
+            auto &folder = lanes[index];
+            if (changed[index]) names[index] = listing(sd, folder.folder);
+            changed[index] = false;
+
+            std::vector<std::string> &files = names[index];
+            uint32_t highest = 0;
+            for (auto &name : files) highest = std::max(highest, number(name));
+            auto present = [&] (const std::string &name) { return std::find(files.begin(), files.end(), name) != files.end(); };
+
+            // A scan per lookup reads the whole folder for the count, the last file and the next name
+            scanned += 3 * files.size() + 1;
+            lookups += 4;
+
+            int count = sd.getqueuecount(folder.name);
+            if (count != (int) files.size()) mismatch(step, std::string(folder.name) + " count " + std::to_string(count) + ", card " + std::to_string(files.size()));
+
+            std::string name = sd.getfirstfilenamecontaining("queue", folder.folder).c_str();
+            if (files.empty() ? name.size() > 0 : !present(name)) mismatch(step, std::string(folder.name) + " first file '" + name + "'");
+
+            name = sd.getlastfilenamecontaining("queue", folder.folder).c_str();
+            if (files.empty() ? name.size() > 0 : !present(name)) mismatch(step, std::string(folder.name) + " last file '" + name + "'");
+
+            name = sd.getavailablequeuefilename(folder.folder).c_str();
+            if (present(name) || number(name) <= highest) mismatch(step, std::string(folder.name) + " next name " + name + ", highest " + std::to_string(highest));
+        }
+
+        // The uploader's lookups: the next readings files past the ones in flight, and exists() for a
+        // file that is there and for one that went (or came back under the same name)
+        std::vector<std::string> &files = names[1];
+        std::string exclude = "";
+        for (int i = 0; i < 3; i++) {
+            std::string name = sd.getfirstqueuefilename(exclude.c_str()).c_str();
+            lookups++;
+            if (name.size() == 0) break;
+            if (std::find(files.begin(), files.end(), name) == files.end() || exclude.find(name + ",") != std::string::npos) mismatch(step, "first readings file past '" + exclude + "': " + name);
+            exclude += name + ",";
+        }
+        if (files.size() && !sd.exists(("/queue/" + files[next() % files.size()]).c_str())) mismatch(step, "exists() misses a readings file");
+        if (removed.size()) {
+            std::string name = removed[next() % removed.size()];
+            std::vector<std::string> &there = names[lane(name)];
+            bool found = std::find(there.begin(), there.end(), name.substr(name.rfind('/') + 1)) != there.end();
+            if (sd.exists(("/queue/" + name).c_str()) != found) mismatch(step, "exists(/queue/" + name + ") " + (found ? "false" : "true"));
+        }
+        lookups += 2;
+        read += entries(sd) - before;
+    }
+
+    size_t files = names[0].size() + names[1].size() + names[2].size();
+    result("Cached lookups against the card", mismatches == 0 && refused == 0, std::to_string(lookups) + " lookups, " + std::to_string(files) + " files at the end" +
+        (refused ? ", " + std::to_string(refused) + " enqueues refused" : "") + (mismatches ? ", " + std::to_string(mismatches) + " wrong, first at " + first : ""));
+    result("Entries read by the lookups", read * 10 < scanned, std::to_string(read) + " (a scan per lookup: " + std::to_string(scanned) + "); " + sd.cachestatus().c_str());
+}
+
+/*
+    Query: a year of 15-minute rows in one indexed readings file; random and edge time ranges
+    against a scan of the rows in memory
+*/
+static void query() {
+    CARD card(HOST_WORK "/checks-query.img");
+    GB_SD &sd = card.sd;
+    GB_SD::SESSION session(sd);
+    const char *file = "/readings/year.csv";
+
+    // Written a day (96 rows) at a time
+    std::vector<std::pair<uint32_t, std::string>> rows;
+    uint32_t start = 1767225600;
+    for (int day = 0; day < 365; day++) {
+        std::string data = "";
+        for (int i = 0; i < 96; i++) {
+            uint32_t timestamp = start + (day * 96 + i) * 900 + next() % 60;
+            rows.push_back({ timestamp, reading(timestamp) });
+            data += (i ? "\n" : "") + rows.back().second;
+        }
+        sd.writeCSV(file, data.c_str(), COLUMNS);
+    }
+
+    typedef std::vector<std::string> LINES;
+    auto collect = [] (char *line, int length, void *context) { ((LINES *) context)->push_back(std::string(line, length)); return true; };
+    static char buffer[128];
+
+    uint32_t first = rows.front().first, last = rows.back().first, span = last - first;
+    std::vector<std::pair<uint32_t, uint32_t>> ranges = {
+        { 0, UINT32_MAX }, { first, first }, { last, last }, { 0, first - 1 }, { last + 1, UINT32_MAX }, { first + 1, first + 899 }, { first + 86400, first }
+    };
+    for (int i = 0; i < 200; i++) {
+        uint32_t from = first + next() % span;
+        ranges.push_back({ from, from + next() % (30 * 86400) });
+    }
+
+    uint32_t wrong = 0, matched = 0;
+    for (auto &range : ranges) {
+        LINES want = { COLUMNS }, got;
+        for (auto &row : rows) if (row.first >= range.first && row.first <= range.second) want.push_back(row.second);
+        uint32_t count = sd.query(file, range.first, range.second, buffer, sizeof(buffer), collect, &got);
+        if (got != want || count != want.size() - 1) wrong++;
+        matched += count;
+    }
+
+    // What the index saves: an hour's rows found against every line of the file read
+    uint64_t before = host::now();
+    for (int i = 0; i < 50; i++) {
+        LINES got;
+        uint32_t from = first + next() % span;
+        sd.query(file, from, from + 3600, buffer, sizeof(buffer), collect, &got);
+    }
+    double each = (host::now() - before) / 50 / 1e6;
+    before = host::now();
+    LINES lines;
+    sd.readlines(file, buffer, sizeof(buffer), collect, &lines);
+    double scan = (host::now() - before) / 1e6;
+
+    result("Time ranges against a scan", wrong == 0, std::to_string(ranges.size()) + " ranges over " + std::to_string(rows.size()) + " rows, " + std::to_string(matched) + " rows matched" +
+        (wrong ? ", " + std::to_string(wrong) + " differ" : ""));
+    result("Query time (virtual)", each * 10 < scan, format("%.1f ms for an hour's rows", each) + ", " + format("%.0f ms", scan) + " to read all " + std::to_string(lines.size()) + " lines");
+}
+
+static uint64_t percentile(std::vector<uint64_t> values, int percent) {
+    if (values.size() == 0) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, values.size() * percent / 100)];
+}
+
+/*
+    Ring: 2000 rows appended to a readings file, then 2000 to a ring file (16 KB); each write timed
+    on the virtual clock with the sectors the card programmed for it. readring() then has to return
+    the newest rows, in order, up to the last one written.
+*/
+static void ring() {
+    CARD card(HOST_WORK "/checks-ring.img");
+    GB_SD &sd = card.sd;
+    GB_SD::SESSION session(sd);
+
+    uint32_t timestamp = 1790000000;
+    std::vector<std::string> written;
+    auto run = [&] (const char *name, const char *file) {
+        std::vector<uint64_t> us;
+        uint64_t sectors = card.medium.counters.writes;
+        for (int i = 0; i < 2000; i++) {
+            std::string row = reading(timestamp += 900);
+            uint64_t start = host::now();
+            sd.writeCSV(file, row.c_str(), COLUMNS);
+            us.push_back((host::now() - start) / 1000);
+            written.push_back(row);
+        }
+        double per = (double) (card.medium.counters.writes - sectors) / 2000;
+        result(name, true, format("p50 %.1f ms", percentile(us, 50) / 1000.0) + ", " + format("p99 %.1f ms", percentile(us, 99) / 1000.0) + ", " + format("%.2f sectors per row", per));
+        return per;
+    };
+
+    double append = run("Append, 2000 rows", "/readings/append.csv");
+    written.clear();
+    sd.ring(16384);
+    double ring = run("Ring (16 KB), 2000 rows", "/readings/ring.csv");
+    result("Ring writes fewer sectors", ring < append, format("%.2f", ring) + " against " + format("%.2f", append));
+
+    // The header, then the rows still in the ring: the last ones written, oldest first
+    String content = sd.readring("/readings/ring.csv", 0, 100000);
+    std::vector<std::string> lines;
+    for (int from = 0, to; from <= (int) content.length(); from = to + 1) {
+        to = content.indexOf('\n', from);
+        if (to < 0) to = content.length();
+        lines.push_back(content.substring(from, to).c_str());
+    }
+    size_t kept = lines.size() - 1;
+    bool newest = lines[0] == COLUMNS && kept > 0 && kept < written.size() && std::equal(lines.begin() + 1, lines.end(), written.end() - kept);
+    String tail = sd.readring("/readings/ring.csv", kept - 10, 10);
+    std::string want = COLUMNS;
+    for (size_t i = written.size() - 10; i < written.size(); i++) want += "\n" + written[i];
+    result("Ring read back after wrapping", newest && want == tail.c_str(), std::to_string(kept) + " newest rows kept; " + sd.ringstatus("/readings/ring.csv").c_str());
+}
+
+/*
+    Streaming reads: 4 KB, 64 KB and 1 MB files of rows, read back whole with readchunks() and
+    readlines(), from an offset, and in random pieces with read()
+*/
+static void chunks() {
+    CARD card(HOST_WORK "/checks-chunks.img");
+    GB_SD &sd = card.sd;
+    GB_SD::SESSION session(sd);
+
+    typedef std::vector<std::string> LINES;
+    const struct { const char *name; uint32_t bytes; } sizes[] = { { "4 KB file", 4096 }, { "64 KB file", 65536 }, { "1 MB file", 1048576 } };
+    for (auto &size : sizes) {
+        std::string content = "";
+        LINES rows;
+        while (content.size() < size.bytes) {
+            rows.push_back(reading(1790000000 + 900 * rows.size()));
+            content += rows.back() + "\n";
+        }
+        std::string path = "/chunks-" + std::to_string(size.bytes) + ".csv";
+        File file;
+        file.open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC);
+        file.write(content.data(), content.size());
+        file.close();
+
+        static char buffer[512];
+        std::string whole = "", tail = "";
+        auto append = [] (const char *chunk, int length, void *context) { ((std::string *) context)->append(chunk, length); return true; };
+        uint64_t start = host::now();
+        uint32_t total = sd.readchunks(path.c_str(), 0, buffer, sizeof(buffer), append, &whole);
+        double seconds = (host::now() - start) / 1e9;
+        uint32_t offset = content.size() / 3;
+        sd.readchunks(path.c_str(), offset, buffer, sizeof(buffer), append, &tail);
+
+        LINES lines;
+        sd.readlines(path.c_str(), buffer, 128, [] (char *line, int length, void *context) { ((LINES *) context)->push_back(std::string(line, length)); return true; }, &lines);
+
+        uint32_t pieces = 0;
+        for (int i = 0; i < 50; i++) {
+            uint32_t at = next() % content.size(), length = 1 + next() % 300;
+            int count = sd.read(path.c_str(), at, buffer, length);
+            if (count == (int) std::min<uint32_t>(length, content.size() - at) && content.compare(at, count, buffer, count) == 0) pieces++;
+        }
+
+        bool ok = total == content.size() && whole == content && tail == content.substr(offset) && lines == rows && pieces == 50;
+        result(size.name, ok, format("%.0f KB/s", content.size() / 1024.0 / seconds) + (whole == content ? "" : ", chunks differ") + (tail == content.substr(offset) ? "" : ", offset read differs") +
+            (lines == rows ? "" : ", lines differ") + (pieces == 50 ? "" : ", " + std::to_string(50 - pieces) + " of 50 pieces differ"));
+    }
+}
+
+// CRC-32 (IEEE), bitwise
+static uint32_t crc32(const std::string &data) {
+    uint32_t crc = 0xFFFFFFFFUL;
+    for (unsigned char byte : data) {
+        crc ^= byte;
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320UL & -(crc & 1));
+    }
+    return ~crc;
+}
+
+// The rows of a readings file: no header, trailers or blank lines
+static void rowsof(const std::string &content, std::vector<std::string> &rows) {
+    bool header = true;
+    for (size_t from = 0; from < content.size();) {
+        size_t to = content.find('\n', from);
+        if (to == std::string::npos) to = content.size();
+        std::string line = content.substr(from, to - from);
+        if (!header && line.size() && line[0] != '#') rows.push_back(line);
+        header = false;
+        from = to + 1;
+    }
+}
+
+/*
+    Archive: rows written with rotation at 32 KB, then archive() until it has nothing left; the
+    archives decoded, their manifest rows checked, and with the current file every row accounted for
+*/
+static void archives() {
+    CARD card(HOST_WORK "/checks-archive.img");
+    GB_SD &sd = card.sd;
+    GB_SD::SESSION session(sd);
+    const char *file = "/readings/archived.csv";
+
+    sd.rotate(32768, false);
+    std::vector<std::string> rows;
+    uint32_t timestamp = 1790000000;
+    for (int i = 0; i < 150; i++) {
+        std::string data = "";
+        for (int j = 0; j < 20; j++) {
+            rows.push_back(reading(timestamp += 900));
+            data += (j ? "\n" : "") + rows.back();
+        }
+        sd.writeCSV(file, data.c_str(), COLUMNS);
+    }
+
+    int calls = 0;
+    while (calls < 1000 && sd.archive()) calls++;
+    uint32_t left = listing(sd, "/readings/rotated").size();
+
+    // The manifest in archive order; each archive decoded block by block
+    std::vector<std::string> manifest;
+    rowsof(sd.readfile("/archive/manifest.csv").c_str(), manifest);
+    std::vector<std::string> found;
+    uint64_t bytes = 0, archived = 0;
+    uint32_t bad = 0;
+    static GB_LZW decoder;
+    for (auto &entry : manifest) {
+        char name[64];
+        unsigned long from, to, size, packed, crc;
+        if (sscanf(entry.c_str(), "%63[^,],%lu,%lu,%lu,%lu,%lx", name, &from, &to, &size, &packed, &crc) != 6) { bad++; continue; }
+
+        std::string archive(packed, 0);
+        int count = sd.read(("/archive/" + std::string(name)).c_str(), 0, &archive[0], packed);
+        std::string original = "";
+        bool ok = count == (int) packed && archive.compare(0, 5, std::string("GBLZ") + (char) LZW_BITS) == 0;
+        for (size_t at = 8; ok && at < archive.size();) {
+            uint16_t block[2];
+            memcpy(block, archive.data() + at, sizeof(block));
+            std::vector<uint8_t> output(block[0] + 1);
+            ok = at + 4 + block[1] <= archive.size() && decoder.decompress((const uint8_t *) archive.data() + at + 4, block[1], output.data(), output.size()) == block[0];
+            original.append((const char *) output.data(), block[0]);
+            at += 4 + block[1];
+        }
+        std::vector<std::string> part;
+        rowsof(original, part);
+        ok = ok && original.size() == size && crc32(original) == crc && part.size() && strtoul(part.front().c_str(), NULL, 10) == from && strtoul(part.back().c_str(), NULL, 10) == to;
+        if (!ok) bad++;
+        found.insert(found.end(), part.begin(), part.end());
+        bytes += size;
+        archived += packed;
+    }
+    rowsof(sd.readfile(file).c_str(), found);
+
+    result("Rotated files archived", left == 0 && manifest.size() > 0 && bad == 0, std::to_string(manifest.size()) + " files in " + std::to_string(calls) + " calls, ratio " +
+        format("%.2f", (double) archived / std::max<uint64_t>(bytes, 1)) + (bad ? ", " + std::to_string(bad) + " don't decode or match the manifest" : "") + (left ? ", " + std::to_string(left) + " left" : ""));
+    result("Every row archived or current", found == rows, std::to_string(found.size()) + " of " + std::to_string(rows.size()) + " rows");
+}
+
+/*
+    Sequence numbers: GB_AT24 (at24.h, over the Eeprom_at24c256 driver) on an emulated EEPROM
+    (eeprom.h), booted 300 times. Each boot takes a run of numbers, acknowledges about half of them
+    and flushes the acknowledgements; a third of the boots lose power at one of their next few
+    EEPROM writes, part-way through it. After every reboot, isacked() has to hold for the last
+    flushed acknowledgement of each slot and for no number that wasn't acknowledged.
+*/
+static void sequences() {
+    host::Eeprom chip(0x50, PIN_MEM_POWER);
+    uint32_t last = 0, taken = 0, reused = 0, checked = 0, wrong = 0, boots = 0;
+    uint64_t spent = 0;
+    uint32_t flushed[16] = { 0 };                               // Per slot; 0 if none or torn
+    std::vector<uint32_t> unacked;
+
+    for (int boot = 0; boot < 300; boot++) {
+        chip.faults.seed = boot + 1;
+        chip.faults.cut = next() % 3 == 0 ? 1 + next() % 6 : 0;
+        chip.powerup();
+
+        GB gb;
+        GB_AT24 mem(gb);
+        mem.configure({ false, PIN_MEM_POWER }).initialize();
+        if (chip.dead()) continue;
+        if (mem.device.detected) boots++;
+
+        for (int slot = 0; slot < 16; slot++) {
+            if (flushed[slot] == 0) continue;
+            checked++;
+            if (!mem.isacked(flushed[slot])) wrong++;
+        }
+        for (uint32_t sequence : unacked) if (mem.isacked(sequence)) wrong++;
+
+        std::vector<uint32_t> acked;
+        int count = 1 + next() % 80;
+        for (int i = 0; i < count; i++) {
+            uint64_t start = host::now();
+            uint32_t sequence = mem.nextsequence();
+            if (chip.dead()) break;
+            spent += host::now() - start;
+
+            if (sequence <= last) reused++;
+            last = std::max(last, sequence);
+            taken++;
+            if (next() % 2) {
+                mem.setacked(sequence);
+                acked.push_back(sequence);
+            }
+            else unacked.push_back(sequence);
+        }
+        if (unacked.size() > 200) unacked.erase(unacked.begin(), unacked.end() - 200);
+        if (chip.dead()) continue;
+
+        // The flush writes the slots in order: the ones before a torn slot hold their last
+        // acknowledgement, the ones after it what they held before
+        mem.flushacked();
+        int torn = chip.torn >= 8320 && chip.torn < 8448 ? (chip.torn - 8320) / 8 : 16;
+        for (uint32_t sequence : acked) if ((int) (sequence % 16) < torn) flushed[sequence % 16] = sequence;
+        if (torn < 16) flushed[torn] = 0;
+    }
+
+    result("Numbers over 300 boots", reused == 0 && chip.refused == 0 && boots > 0, std::to_string(taken) + " taken, up to " + std::to_string(last) + ", " +
+        std::to_string(chip.counters.cuts) + " power cuts, " + format("%.0f ms per number", spent / 1e6 / std::max<uint32_t>(taken, 1)) +
+        (reused ? ", " + std::to_string(reused) + " reused" : "") + (chip.refused ? ", " + std::to_string(chip.refused) + " transactions refused" : ""));
+    result("Acknowledgements after reboots", wrong == 0 && checked > 0, std::to_string(checked) + " flushed ones checked" + (wrong ? ", " + std::to_string(wrong) + " wrong" : ""));
+}
+
+/*
+    MQTT: GB_MQTT (mqttserver.h, over the library's PubSubClient) publishing to an emulated broker
+    on a cellular link (broker.h), through a modem that is always on the network
+*/
+struct MODEM : GB_MCU {
+    host::Broker &broker;
+
+    MODEM(host::Broker &broker) : broker(broker) {}
+    bool connected() { return true; }
+    Client &getclient() { return broker; }
+    Client &deleteclient() { return broker; }
+};
+
+struct LINK {
+    host::Broker broker;
+    MODEM modem{broker};
+    GB gb;
+    GB_MQTT mqtt{gb};
+
+    LINK(uint64_t rtt) : broker(rtt * 1000000ULL, 8000) {
+        MODEM_INITIALIZED = CONNECTED_TO_NETWORK = CONNECTED_TO_INTERNET = true;
+        gb.devices.mcu = &modem;
+        mqtt.configure("broker", 1883, "host", [] (String topic, String payload) { (void) topic; (void) payload; }, [] {});
+    }
+};
+
+// What the PUBACK and abandon callbacks were handed
+static std::vector<std::string> acked, abandoned;
+
+static void tally(String tag, uint32_t sequence) { (void) sequence; acked.push_back(tag.c_str()); }
+static void giveup(String tag, uint32_t sequence) { (void) sequence; abandoned.push_back(tag.c_str()); }
+
+// The record sequence an envelope carries ("<SN>::null::s<sequence>:::<data>:::<ack>"); 0 if none
+static uint32_t sequenceof(const std::string &payload) {
+    size_t at = payload.find("::s");
+    return at == std::string::npos ? 0 : strtoul(payload.c_str() + at + 3, NULL, 10);
+}
+
+/*
+    Records/s: 60 records sent through the window (waitwindow(), then send()) or one at a time
+    (send(), then flush(): stop-and-wait), until the last PUBACK
+*/
+static double upload(uint64_t rtt, bool pipelined, int &window, unsigned long &measured) {
+    LINK link(rtt);
+    GB_MQTT &mqtt = link.mqtt;
+    acked.clear();
+    mqtt.onack(tally).connect();
+
+    std::string data = readings(4);
+    uint64_t start = host::now();
+    for (int i = 0; i < 60; i++) {
+        if (pipelined && !mqtt.waitwindow(20000)) break;
+        if (!mqtt.send("data/set", data.c_str(), ("queue_" + std::to_string(i + 1) + ".csv").c_str(), i + 1)) break;
+        if (!pipelined) mqtt.flush(20000);
+    }
+    mqtt.flush(20000);
+    window = mqtt.WINDOW;
+    measured = mqtt.RTT;
+    return acked.size() == 60 ? 60 / ((host::now() - start) / 1e9) : 0;
+}
+
+static void throughput() {
+    for (uint64_t rtt : { 100, 500, 2000 }) {
+        int window;
+        unsigned long measured;
+        double waiting = upload(rtt, false, window, measured), pipelined = upload(rtt, true, window, measured);
+
+        // No slower at a short round trip (the window stays at 1 below 150 ms), several times faster at a long one
+        bool passed = waiting > 0 && pipelined >= 0.95 * waiting && (rtt < 500 || pipelined >= 2 * waiting) && (rtt < 2000 || pipelined >= 4 * waiting);
+        char name[40];
+        snprintf(name, sizeof(name), "Records/s at %4llu ms RTT", (unsigned long long) rtt);
+        result(name, passed, format("%.2f", pipelined) + " in a window of " + std::to_string(window) + " (RTT " + std::to_string(measured) +
+            " ms), " + format("%.2f", waiting) + " stop-and-wait");
+    }
+}
+
+/*
+    A broker that stops acknowledging: waitwindow() gives up at its timeout; each message is resent
+    with DUP set when its PUBACK is overdue, then abandoned to onabandon() after the last resend
+*/
+static void unacknowledged() {
+    LINK link(500);
+    GB_MQTT &mqtt = link.mqtt;
+    acked.clear();
+    abandoned.clear();
+    mqtt.onack(tally).onabandon(giveup).connect();
+
+    // Learn the round trip (the window opens to 4), then fill the window
+    std::string data = readings(4);
+    bool sent = mqtt.send("data/set", data.c_str(), "queue_1.csv", 1);
+    mqtt.flush(20000);
+    link.broker.faults.mute = true;
+    int window = mqtt.WINDOW, count = 0;
+    while (sent && mqtt.windowavailable()) {
+        count++;
+        sent = mqtt.send("data/set", data.c_str(), ("queue_" + std::to_string(1 + count) + ".csv").c_str(), 1 + count);
+    }
+
+    uint64_t start = host::now();
+    bool opened = mqtt.waitwindow(1000);
+    double waited = (host::now() - start) / 1e9;
+    result("Window wait bounded", sent && !opened && waited >= 1 && waited < 1.1, "no PUBACK: gave up after " + format("%.2f s", waited));
+
+    start = host::now();
+    mqtt.flush(60000);
+    double spent = (host::now() - start) / 1e9;
+
+    uint32_t resent = 0;
+    for (auto &message : link.broker.received) if (message.dup) resent++;
+    result("Unacknowledged messages abandoned", count == window && abandoned.size() == (size_t) count && mqtt.inflight() == 0 && resent == (uint32_t) count * MQTT_MAX_RETRANSMITS,
+        std::to_string(abandoned.size()) + " of " + std::to_string(count) + " after " + format("%.1f s", spent) + ", " + std::to_string(resent) + " resent with DUP, window " +
+        std::to_string(window) + " -> " + std::to_string(mqtt.WINDOW));
+
+    // The broker goes away for good: the wait ends with the connection
+    link.broker.faults.mute = false;
+    link.broker.faults.refuse = true;
+    for (int i = 0; mqtt.windowavailable() && mqtt.send("data/set", data.c_str(), ("queue_" + std::to_string(10 + i) + ".csv").c_str(), 10 + i); i++) {}
+    link.broker.hangup();
+    start = host::now();
+    opened = mqtt.waitwindow(20000);
+    waited = (host::now() - start) / 1e9;
+    result("Window wait ends with the broker", !opened && !CONNECTED_TO_MQTT_BROKER && waited < 10, "gave up after " + format("%.1f s", waited));
+}
+
+/*
+    Upload end to end: readings enqueued with sequence numbers (GB_AT24 on an emulated EEPROM) and
+    uploaded the way src/Sarasota/bit.cpp does it (PUBACKs retire the files, abandoned files are
+    requeued, acknowledgements flushed once per session), over 40 boots. The broker loses 10% of the
+    PUBLISHes and 10% of the PUBACKs; a third of the sessions lose the connection part-way and a
+    third of the boots end part-way through the upload, before the flush. Then boots without faults
+    until the queue is empty. Every record has to reach the broker, and the copies of one record
+    have to carry the same sequence and data, so that the server can drop them. (The card keeps its
+    power here, so an acknowledged file is always removed; isacked() across reboots is checked in
+    sequences().)
+*/
+static GB_SD *uploading;
+static GB_AT24 *sequencing;
+
+static void retire(String tag, uint32_t sequence) {
+    sequencing->setacked(sequence);
+    uploading->removequeuefile(tag);
+}
+static void requeue(String tag, uint32_t sequence) {
+    (void) sequence;
+    uploading->requeuefile(tag);
+}
+
+static void endtoend() {
+    CARD card(HOST_WORK "/checks-upload.img");
+    host::Eeprom chip(0x50, PIN_MEM_POWER);
+    host::Broker broker(500000000ULL, 8000);
+    std::map<uint32_t, std::string> enqueued;
+    uint32_t timestamp = 1790000000, boots = 0, refused = 0, left = 0;
+    uint64_t uploading_for = 0;
+
+    for (int boot = 0; boot < 60; boot++) {
+        bool faults = boot < 40;
+        if (!faults && left == 0) break;
+        broker.faults.lost = broker.faults.unacked = faults ? 10 : 0;
+        broker.hangup();
+        chip.powerup();
+        boots++;
+
+        // A reboot: the RAM is gone, the card and the EEPROM keep what they had
+        MODEM modem(broker);
+        GB gb;
+        gb.devices.mcu = &modem;
+        GB_SD sd(gb);
+        sd.configure({ false, PIN_CD, PIN_CS, PIN_POWER }).state("SKIP_CHIP_DETECT", true).initialize("auto");
+        GB_AT24 mem(gb);
+        mem.configure({ false, PIN_MEM_POWER }).initialize();
+        GB_MQTT mqtt(gb);
+        mqtt.configure("broker", 1883, "host", [] (String topic, String payload) { (void) topic; (void) payload; }, [] {});
+        uploading = &sd;
+        sequencing = &mem;
+
+        if (faults) {
+            for (int i = 1 + next() % 12; i > 0; i--) {
+                uint32_t sequence = mem.nextsequence();
+                std::string data = std::string(COLUMNS) + "\n" + reading(timestamp += 900);
+                if (sd.enqueue("readings", "data/set", data.c_str(), sequence)) enqueued[sequence] = data;
+                else refused++;
+            }
+        }
+
+        int hangup = faults && next() % 3 == 0 ? 1 + next() % 8 : -1, reboot = faults && next() % 3 == 0 ? 1 + next() % 8 : -1;
+        uint64_t start = host::now();
+        mqtt.onack(retire).onabandon(requeue).connect();
+        int counter = 10, sent = 0;
+        while (counter > 0 && CONNECTED_TO_MQTT_BROKER) {
+            if (sent == hangup) {
+                broker.hangup();
+                hangup = -1;
+            }
+            if (sent == reboot) break;
+            if (!mqtt.waitwindow(20000)) break;
+
+            String queuefilename = sd.nextqueuefile(mqtt.inflighttags(), false);
+            if (queuefilename.length() == 0) break;
+            uint32_t sequence; String topic;
+            String data = sd.readqueuefile(queuefilename, sequence, topic);
+            if (data.length() == 0) { counter--; continue; }
+            if (mem.isacked(sequence)) {
+                sd.removequeuefile(queuefilename);
+                continue;
+            }
+            if (mqtt.send(topic, data, queuefilename, sequence)) {
+                counter--;
+                sent++;
+            }
+            else break;
+        }
+        if (sent != reboot) {
+            mqtt.flush(20000);
+            mem.flushacked();
+        }
+        uploading_for += host::now() - start;
+        left = sd.getqueuecount();
+    }
+
+    // What reached the broker, by sequence
+    std::map<uint32_t, std::string> delivered;
+    uint32_t copies = 0, differ = 0, unsequenced = 0;
+    for (auto &message : broker.received) {
+        uint32_t sequence = sequenceof(message.payload);
+        if (sequence == 0) { unsequenced++; continue; }
+        auto found = delivered.find(sequence);
+        if (found == delivered.end()) delivered[sequence] = message.payload;
+        else {
+            copies++;
+            if (found->second != message.payload) differ++;
+        }
+    }
+    uint32_t lost = 0, foreign = 0;
+    for (auto &record : enqueued) {
+        auto found = delivered.find(record.first);
+        if (found == delivered.end() || found->second.find(record.second) == std::string::npos) lost++;
+    }
+    for (auto &record : delivered) if (!enqueued.count(record.first)) foreign++;
+
+    result("Every record delivered", lost == 0 && foreign == 0 && unsequenced == 0 && left == 0 && refused == 0 && enqueued.size() > 0, std::to_string(enqueued.size()) + " records over " +
+        std::to_string(boots) + " boots, " + format("%.2f records/s", enqueued.size() / (uploading_for / 1e9)) + (lost ? ", " + std::to_string(lost) + " lost" : "") +
+        (foreign ? ", " + std::to_string(foreign) + " unknown" : "") + (left ? ", " + std::to_string(left) + " left in the queue" : "") +
+        (refused ? ", " + std::to_string(refused) + " not enqueued" : ""));
+    result("Copies carry the same sequence", differ == 0 && copies > 0, std::to_string(copies) + " copies of " + std::to_string(delivered.size()) + " records for the server to drop" + (differ ? ", " + std::to_string(differ) + " differ" : ""));
+}
+
+int main() {
+    std::filesystem::create_directories(HOST_WORK);
+    printf("Library checks\n");
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    printf("\n  Filters\n");
+    filters();
+
+    printf("\n  LZW\n");
+    lzw();
+
+    printf("\n  Modbus RTU\n");
+    modbus();
+
+    printf("\n  SD directory cache\n");
+    queues();
+
+    printf("\n  SD readings files\n");
+    query();
+    ring();
+    archives();
+
+    printf("\n  SD streaming reads\n");
+    chunks();
+
+    printf("\n  Sequence numbers\n");
+    sequences();
+
+    printf("\n  MQTT\n");
+    host::spin() = 1000;
+    throughput();
+    unacknowledged();
+    endtoend();
+    host::spin() = 0;
+
+    printf("\n  %s\n", failures ? (std::to_string(failures) + " failed").c_str() : "all passed");
+    return failures ? 1 : 0;
+}
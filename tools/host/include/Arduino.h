@@ -0,0 +1,338 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+/*
+    ! Host Arduino core
+    The part of the Arduino API the storage code uses, so that sd.h, SdFat and GB_SPI build and run
+    on the host. Time is virtual: it only moves when the code waits (delay()), the SPI or I2C bus
+    clocks bytes (see SPI.h, Wire.h) or an emulator passes bytes (rs485.h, broker.h), so the
+    latencies measured by the benchmark are the card's, not the host's.
+
+    NVIC_SystemReset() throws host::Reset. A power cut doesn't: the medium goes dead (see medium.h),
+    and the benchmark boots the storage again once the operation in progress has returned.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte_near(address) (*(const uint8_t *) (address))
+#define F(s) (s)
+class __FlashStringHelper;
+
+#define SS 10
+
+using std::min;
+using std::max;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define lowByte(w) ((uint8_t) ((w) & 0xff))
+#define highByte(w) ((uint8_t) ((w) >> 8))
+
+namespace host {
+
+    // Thrown by a software reset
+    struct Reset {};
+
+    // Virtual time (ns)
+    inline uint64_t &now() {
+        static uint64_t ns = 0;
+        return ns;
+    }
+    inline void advance(uint64_t ns) { now() += ns; }
+
+    // CPU time one read of the clock costs (ns), 0 by default. Code that busy-waits on micros()
+    // alone (ModbusRTU's t3.5 silence) only gets out of the loop with it above 0
+    inline uint64_t &spin() {
+        static uint64_t ns = 0;
+        return ns;
+    }
+
+    // Pin levels; a pin can have a hook (the card's chip select)
+    typedef void (*pin_hook_t)(int pin, int level);
+    inline int *levels() {
+        static int pins[256] = { 0 };
+        return pins;
+    }
+    inline pin_hook_t &hook() {
+        static pin_hook_t callback = NULL;
+        return callback;
+    }
+
+    // Serial output is dropped unless verbose
+    inline bool &verbose() {
+        static bool enabled = false;
+        return enabled;
+    }
+}
+
+inline unsigned long millis() { host::advance(host::spin()); return (unsigned long) (host::now() / 1000000ULL); }
+inline unsigned long micros() { host::advance(host::spin()); return (unsigned long) (host::now() / 1000ULL); }
+inline void delay(unsigned long ms) { host::advance(ms * 1000000ULL); }
+inline void delayMicroseconds(unsigned int us) { host::advance(us * 1000ULL); }
+inline void yield() {}
+
+inline void pinMode(int pin, int mode) { (void) pin; (void) mode; }
+inline void digitalWrite(int pin, int level) {
+    if (pin < 0 || pin > 255) return;
+    host::levels()[pin] = level;
+    if (host::hook()) host::hook()(pin, level);
+}
+inline int digitalRead(int pin) { return pin < 0 || pin > 255 ? LOW : host::levels()[pin]; }
+inline int analogRead(int pin) { (void) pin; return 0; }
+
+inline bool isDigit(int c) { return isdigit(c) != 0; }
+inline bool isAlpha(int c) { return isalpha(c) != 0; }
+inline bool isAlphaNumeric(int c) { return isalnum(c) != 0; }
+inline bool isSpace(int c) { return isspace(c) != 0; }
+inline bool isWhitespace(int c) { return c == ' ' || c == '\t'; }
+inline bool isPrintable(int c) { return isprint(c) != 0; }
+
+inline long random(long howbig) { return howbig > 0 ? rand() % howbig : 0; }
+inline long random(long howsmall, long howbig) { return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall); }
+inline void randomSeed(unsigned long seed) { srand(seed); }
+
+inline void NVIC_SystemReset() { throw host::Reset {}; }
+inline void __disable_irq() {}
+inline void __enable_irq() {}
+inline void interrupts() {}
+inline void noInterrupts() {}
+
+inline char *dtostrf(double value, signed char width, unsigned char precision, char *buffer) {
+    sprintf(buffer, "%*.*f", width, precision, value);
+    return buffer;
+}
+
+/*
+    ! String
+    Arduino semantics where the library depends on them: String(char) of '\0' is empty, charAt()
+    past the end is '\0', substring() clamps and swaps its bounds.
+*/
+class String {
+    public:
+        String() {}
+        String(const char *text) : _s(text ? text : "") {}
+        String(const std::string &text) : _s(text) {}
+        String(char c) { char buffer[2] = { c, 0 }; _s = buffer; }
+        String(unsigned char value, unsigned char base = DEC) { _s = _format((unsigned long) value, base); }
+        String(int value, unsigned char base = DEC) { _s = base == DEC ? std::to_string(value) : _format((unsigned long) (unsigned int) value, base); }
+        String(unsigned int value, unsigned char base = DEC) { _s = _format((unsigned long) value, base); }
+        String(long value, unsigned char base = DEC) { _s = base == DEC ? std::to_string(value) : _format((unsigned long) value, base); }
+        String(unsigned long value, unsigned char base = DEC) { _s = _format(value, base); }
+        String(long long value) { _s = std::to_string(value); }
+        String(unsigned long long value) { _s = std::to_string(value); }
+        String(float value, unsigned char decimals = 2) { _s = _decimal(value, decimals); }
+        String(double value, unsigned char decimals = 2) { _s = _decimal(value, decimals); }
+
+        unsigned int length() const { return _s.length(); }
+        const char *c_str() const { return _s.c_str(); }
+        bool reserve(unsigned int size) { _s.reserve(size); return true; }
+        bool isEmpty() const { return _s.empty(); }
+
+        char charAt(unsigned int index) const { return index < _s.length() ? _s[index] : 0; }
+        void setCharAt(unsigned int index, char c) { if (index < _s.length()) _s[index] = c; }
+        char operator[](unsigned int index) const { return charAt(index); }
+        char &operator[](unsigned int index) { static char dummy; if (index >= _s.length()) { dummy = 0; return dummy; } return _s[index]; }
+
+        int indexOf(char c, unsigned int from = 0) const { return _found(_s.find(c, from)); }
+        int indexOf(const String &text, unsigned int from = 0) const { return from > _s.length() ? -1 : _found(_s.find(text._s, from)); }
+        int lastIndexOf(char c) const { return _found(_s.rfind(c)); }
+        int lastIndexOf(char c, unsigned int from) const { return _found(_s.rfind(c, from)); }
+        int lastIndexOf(const String &text) const { return _found(_s.rfind(text._s)); }
+        int lastIndexOf(const String &text, unsigned int from) const { return _found(_s.rfind(text._s, from)); }
+
+        String substring(unsigned int from) const { return substring(from, _s.length()); }
+        String substring(unsigned int from, unsigned int to) const {
+            if (from > to) std::swap(from, to);
+            if (from >= _s.length()) return String();
+            if (to > _s.length()) to = _s.length();
+            return String(_s.substr(from, to - from));
+        }
+
+        bool startsWith(const String &prefix) const { return _s.compare(0, prefix._s.length(), prefix._s) == 0 && prefix._s.length() <= _s.length(); }
+        bool startsWith(const String &prefix, unsigned int offset) const { return offset <= _s.length() && _s.compare(offset, prefix._s.length(), prefix._s) == 0; }
+        bool endsWith(const String &suffix) const { return suffix._s.length() <= _s.length() && _s.compare(_s.length() - suffix._s.length(), suffix._s.length(), suffix._s) == 0; }
+        bool equals(const String &other) const { return _s == other._s; }
+        bool equalsIgnoreCase(const String &other) const {
+            if (_s.length() != other._s.length()) return false;
+            for (size_t i = 0; i < _s.length(); i++) if (tolower(_s[i]) != tolower(other._s[i])) return false;
+            return true;
+        }
+        int compareTo(const String &other) const { return strcmp(_s.c_str(), other._s.c_str()); }
+
+        void replace(char find, char with) { std::replace(_s.begin(), _s.end(), find, with); }
+        void replace(const String &find, const String &with) {
+            if (find._s.empty()) return;
+            size_t at = 0;
+            while ((at = _s.find(find._s, at)) != std::string::npos) {
+                _s.replace(at, find._s.length(), with._s);
+                at += with._s.length();
+            }
+        }
+        void remove(unsigned int index) { if (index < _s.length()) _s.erase(index); }
+        void remove(unsigned int index, unsigned int count) { if (index < _s.length()) _s.erase(index, count); }
+        void trim() {
+            size_t start = 0, end = _s.length();
+            while (start < end && isspace((unsigned char) _s[start])) start++;
+            while (end > start && isspace((unsigned char) _s[end - 1])) end--;
+            _s = _s.substr(start, end - start);
+        }
+        void toLowerCase() { for (auto &c : _s) c = tolower(c); }
+        void toUpperCase() { for (auto &c : _s) c = toupper(c); }
+
+        long toInt() const { return atol(_s.c_str()); }
+        float toFloat() const { return atof(_s.c_str()); }
+        double toDouble() const { return atof(_s.c_str()); }
+        void toCharArray(char *buffer, unsigned int size, unsigned int index = 0) const { getBytes((unsigned char *) buffer, size, index); }
+        void getBytes(unsigned char *buffer, unsigned int size, unsigned int index = 0) const {
+            if (size == 0) return;
+            size_t count = index < _s.length() ? std::min((size_t) size - 1, _s.length() - index) : 0;
+            if (count > 0) memcpy(buffer, _s.data() + index, count);
+            buffer[count] = 0;
+        }
+
+        bool concat(const String &text) { _s += text._s; return true; }
+        String &operator+=(const String &text) { _s += text._s; return *this; }
+        String &operator+=(const char *text) { _s += text ? text : ""; return *this; }
+        String &operator+=(char c) { _s += c; return *this; }
+        template <typename T> String &operator+=(T value) { return *this += String(value); }
+
+        bool operator==(const String &other) const { return _s == other._s; }
+        bool operator==(const char *other) const { return _s == (other ? other : ""); }
+        bool operator!=(const String &other) const { return _s != other._s; }
+        bool operator!=(const char *other) const { return !(*this == other); }
+        bool operator<(const String &other) const { return _s < other._s; }
+        bool operator>(const String &other) const { return _s > other._s; }
+        bool operator<=(const String &other) const { return _s <= other._s; }
+        bool operator>=(const String &other) const { return _s >= other._s; }
+
+        friend String operator+(const String &a, const String &b) { return String(a._s + b._s); }
+        friend String operator+(const String &a, const char *b) { return String(a._s + (b ? b : "")); }
+        friend String operator+(const char *a, const String &b) { return String((a ? a : "") + b._s); }
+        friend String operator+(const String &a, char b) { String s(a); s._s += b; return s; }
+        template <typename T> friend String operator+(const String &a, T b) { return a + String(b); }
+
+    private:
+        std::string _s;
+
+        static int _found(size_t at) { return at == std::string::npos ? -1 : (int) at; }
+        static std::string _format(unsigned long value, unsigned char base) {
+            if (base == DEC) return std::to_string(value);
+            char buffer[72];
+            int i = sizeof(buffer) - 1;
+            buffer[i] = 0;
+            do { buffer[--i] = "0123456789ABCDEF"[value % base]; value /= base; } while (value > 0);
+            return std::string(buffer + i);
+        }
+        static std::string _decimal(double value, unsigned char decimals) {
+            char buffer[64];
+            snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+            return buffer;
+        }
+};
+
+/*
+    ! Print and Stream
+*/
+class Print {
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t *buffer, size_t size) {
+            size_t count = 0;
+            while (size--) count += write(*buffer++);
+            return count;
+        }
+        size_t write(const char *text) { return text ? write((const uint8_t *) text, strlen(text)) : 0; }
+        size_t write(const char *buffer, size_t size) { return write((const uint8_t *) buffer, size); }
+        virtual int availableForWrite() { return 0; }
+        virtual void flush() {}
+
+        int getWriteError() { return _write_error; }
+        void clearWriteError() { _write_error = 0; }
+
+        size_t print(const String &text) { return write(text.c_str(), text.length()); }
+        size_t print(const char *text) { return write(text); }
+        size_t print(const __FlashStringHelper *text) { return write((const char *) text); }
+        size_t print(char c) { return write((uint8_t) c); }
+        size_t print(unsigned char value, int base = DEC) { return print(String(value, base)); }
+        size_t print(int value, int base = DEC) { return print(String(value, base)); }
+        size_t print(unsigned int value, int base = DEC) { return print(String(value, base)); }
+        size_t print(long value, int base = DEC) { return print(String(value, base)); }
+        size_t print(unsigned long value, int base = DEC) { return print(String(value, base)); }
+        size_t print(long long value, int base = DEC) { (void) base; return print(String(value)); }
+        size_t print(unsigned long long value, int base = DEC) { (void) base; return print(String(value)); }
+        size_t print(double value, int decimals = 2) { return print(String(value, decimals)); }
+
+        size_t println() { return write("\r\n"); }
+        template <typename T> size_t println(T value) { return print(value) + println(); }
+        template <typename T> size_t println(T value, int format) { return print(value, format) + println(); }
+
+    protected:
+        void setWriteError(int error = 1) { _write_error = error; }
+
+    private:
+        int _write_error = 0;
+};
+
+class Stream : public Print {
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+        void setTimeout(unsigned long timeout) { _timeout = timeout; }
+        String readString() {
+            String text;
+            int c;
+            while ((c = read()) >= 0) text += (char) c;
+            return text;
+        }
+        String readStringUntil(char terminator) {
+            String text;
+            int c;
+            while ((c = read()) >= 0 && c != terminator) text += (char) c;
+            return text;
+        }
+
+    protected:
+        unsigned long _timeout = 1000;
+};
+
+// Serial goes to stdout when host::verbose() is set
+class HostSerial : public Stream {
+    public:
+        void begin(unsigned long baud) { (void) baud; }
+        void end() {}
+        operator bool() { return true; }
+        size_t write(uint8_t c) { if (host::verbose()) fputc(c, stdout); return 1; }
+        size_t write(const uint8_t *buffer, size_t size) { if (host::verbose()) fwrite(buffer, 1, size, stdout); return size; }
+        int available() { return 0; }
+        int read() { return -1; }
+        int peek() { return -1; }
+        using Print::write;
+};
+
+inline HostSerial Serial;
+
+#endif
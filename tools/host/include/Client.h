@@ -0,0 +1,23 @@
+#ifndef Client_h
+#define Client_h
+
+#include "Arduino.h"
+#include "IPAddress.h"
+
+// Host stand-in for the Arduino network client interface (GB_Manager's GB_MCU refers to it; the MQTT
+// broker emulator, broker.h, implements it)
+class Client : public Stream {
+    public:
+        virtual int connect(IPAddress ip, uint16_t port) { (void) ip; (void) port; return 0; }
+        virtual int connect(const char *host, uint16_t port) { (void) host; (void) port; return 0; }
+        virtual uint8_t connected() { return 0; }
+        virtual void stop() {}
+        int available() { return 0; }
+        int read() { return -1; }
+        int peek() { return -1; }
+        size_t write(uint8_t c) { (void) c; return 0; }
+        using Print::write;
+        operator bool() { return false; }
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef GB_h
+#define GB_h
+
+/*
+    ! Host GB core
+    Stands in for GB_Primary.h on the host: the GB members the storage and MQTT code calls
+    (logging, the globals, the control variables, the device registry), around the library's own
+    GB_Manager.h (DEVICE, GB_DEVICE, DEVICES) and GB_Globals.h (the connection states). The storage
+    headers (sd.h, GB_SPI.h, GB_Faults.h, GB_Energy.h, GB_LZW.h) are the library's, unchanged.
+
+    No peripheral is attached, so hasdevice() is false for all of them; sd.h then skips the RGB,
+    buzzer and GDC feedback. getmcu() is the one in devices.mcu once a check sets it. The log goes
+    to stdout when host::verbose() is set.
+*/
+
+#include "Arduino.h"
+#include "CSVary.h"
+#include "JSONary.h"
+
+struct DEVICE {
+    String id;
+    String name;
+    bool detected = false;
+};
+
+// GB_DEVICE's defaults (GB_Manager.h) ignore their parameters, and the Client ones don't return;
+// the host doesn't call them
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wreturn-type"
+#include "../../../lib/GatorByte/src/core/GB_Manager.h"
+#pragma GCC diagnostic pop
+#include "../../../lib/GatorByte/src/core/GB_Globals.h"
+
+class GB {
+    public:
+        DEVICE device = {
+            "core",
+            "GatorByte library"
+        };
+
+        struct GLOBALS {
+            String DEVICE_TYPE = "gatorbyte", DEVICE_ID = "host", DEVICE_NAME = "host", DEVICE_SN = "host";
+            String INIT_REPORT = "";
+            String SERVER_URL = "/", MQTTUSER = "", MQTTPASS = "";
+            int SERVER_PORT = 1883;
+            bool OFFLINE_MODE = false;
+            String MODE = "inactive";
+            String SENSOR_MODE = "iterations";
+            int WRITE_DATA_TO_SD = 1;
+            bool GDC_CONNECTED = false;
+        } globals;
+
+        DEVICES devices = DEVICES();
+        JSONary controls;
+
+        GB& includelibrary(String device_id, String device_name) {
+            if (_libraries.indexOf(device_id + ":") == -1) _libraries += device_id + ":" + device_name + "::";
+            return *this;
+        }
+        GB& includedevice(String device_id, String device_name) {
+            (void) device_name;
+            if (_devices.indexOf(device_id + ":") == -1) _devices += device_id + "::";
+            return *this;
+        }
+        bool haslibrary(String device) { return _libraries.indexOf(device + ":") > -1; }
+        bool hasdevice(String device) { (void) device; return false; }
+
+        GB_DEVICE* getdevice(String name) {
+            if (name == "sd" && this->devices.sd) return this->devices.sd;
+            return &this->_none;
+        }
+        GB_MCU* getmcu() { return this->devices.mcu ? this->devices.mcu : &this->_mcu; }
+
+        GB& init() { return *this; }
+        String env() { return this->_env; }
+        String env(String environment) { return this->_env = environment; }
+
+        GB& br() { return this->log("", true); }
+        GB& bs() { return *this; }
+        GB& space(int count) { for (int i = 0; i < count; i++) this->_print(" "); return *this; }
+        GB& color() { return *this; }
+        GB& color(String color) { (void) color; return *this; }
+        GB& arrow() { this->_print(" -> "); return *this; }
+
+        GB& log(String message, bool new_line) {
+            this->_print(message);
+            if (new_line) this->_print("\n");
+            return *this;
+        }
+        GB& log(String message) { return this->log(message, true); }
+        GB& log(const char *message) { return this->log(String(message), true); }
+        GB& log(const char *message, bool new_line) { return this->log(String(message), new_line); }
+        GB& log(int message, bool new_line) { return this->log(String(message), new_line); }
+        GB& log(int message) { return this->log(String(message), true); }
+        GB& log(float message, bool new_line) { return this->log(String(message), new_line); }
+        GB& log(float message) { return this->log(String(message), true); }
+        GB& log() { return this->log("", true); }
+        GB& logd(String message, bool new_line) { return this->log(message, new_line); }
+        GB& logd(String message) { return this->log(message, true); }
+
+        /*
+            The board's s2c() returns the buffer of its (by-value) argument, which the heap leaves
+            intact until the next allocation; std::string keeps short strings inside the object, so
+            the host hands out copies from a small ring instead
+        */
+        char* s2c(String str) {
+            static char buffers[8][256];
+            static uint8_t next = 0;
+            char *buffer = buffers[next++ % 8];
+            str.toCharArray(buffer, sizeof(buffers[0]));
+            return buffer;
+        }
+        String uuid() { return String(random(10000, 99999)); }
+        String ca2s(char char_array[]) { return String((char *) char_array); }
+        bool isnumber(String str) {
+            for (unsigned int i = 0; i < str.length(); i++) if (!isDigit(str.charAt(i))) return false;
+            return true;
+        }
+
+    private:
+        String _env = "development";
+        String _libraries = "";
+        String _devices = "";
+        GB_DEVICE _none;
+        GB_MCU _mcu;
+
+        void _print(String text) {
+            if (host::verbose()) fputs(text.c_str(), stdout);
+        }
+};
+
+#include "../../../lib/GatorByte/src/core/GB_Energy.h"
+#include "../../../lib/GatorByte/src/core/GB_Faults.h"
+#include "../../../lib/GatorByte/src/core/GB_SPI.h"
+#include "../../../lib/GatorByte/src/core/GB_LZW.h"
+
+// No indicator on the host (sd.h only reaches it through hasdevice("rgb"))
+#define GB_RGB_h
+
+#endif
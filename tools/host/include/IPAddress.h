@@ -0,0 +1,19 @@
+#ifndef IPAddress_h
+#define IPAddress_h
+
+#include "Arduino.h"
+
+// Host stand-in for the Arduino IPv4 address (PubSubClient keeps the broker's)
+class IPAddress {
+    public:
+        IPAddress() {}
+        IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _bytes{ a, b, c, d } {}
+
+        uint8_t operator[](int index) const { return _bytes[index]; }
+        bool operator==(const IPAddress &other) const { return memcmp(_bytes, other._bytes, 4) == 0; }
+
+    private:
+        uint8_t _bytes[4] = { 0, 0, 0, 0 };
+};
+
+#endif
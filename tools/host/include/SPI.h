@@ -0,0 +1,93 @@
+#ifndef SPI_h
+#define SPI_h
+
+#include "Arduino.h"
+
+/*
+    ! Host SPI bus
+    Bytes go to the device whose chip select is low (0xFF comes back when there is none). Every byte
+    advances the virtual clock by 8 bit times at the transaction's clock, so polling a busy card
+    costs time the way it does on the board.
+*/
+
+#define MSBFIRST 1
+#define LSBFIRST 0
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+namespace host {
+
+    // A device on the bus: it sees every pin change (its chip select, its power) and the bytes
+    // clocked while it's selected
+    class SpiDevice {
+        public:
+            virtual ~SpiDevice() {}
+            virtual void pin(int pin, int level) = 0;
+            virtual bool selected() = 0;
+            virtual uint8_t exchange(uint8_t mosi, uint32_t clock) = 0;
+    };
+
+    inline SpiDevice **devices() {
+        static SpiDevice *attached[4] = { NULL, NULL, NULL, NULL };
+        return attached;
+    }
+
+    inline void route(int pin, int level) {
+        for (int i = 0; i < 4; i++) if (devices()[i]) devices()[i]->pin(pin, level);
+    }
+
+    // Put a device on the bus (detach() takes it off)
+    inline void attach(SpiDevice *device) {
+        for (int i = 0; i < 4; i++) if (devices()[i] == NULL || devices()[i] == device) {
+            devices()[i] = device;
+            break;
+        }
+        hook() = route;
+    }
+    inline void detach(SpiDevice *device) {
+        for (int i = 0; i < 4; i++) if (devices()[i] == device) devices()[i] = NULL;
+    }
+}
+
+class SPISettings {
+    public:
+        SPISettings() {}
+        SPISettings(uint32_t clock, uint8_t order, uint8_t mode) : clock(clock) { (void) order; (void) mode; }
+        uint32_t clock = 4000000;
+};
+
+class SPIClass {
+    public:
+        void begin() {}
+        void end() {}
+        void beginTransaction(SPISettings settings) { _clock = settings.clock; }
+        void endTransaction() {}
+
+        uint8_t transfer(uint8_t data) {
+            host::advance(8000000000ULL / _clock);
+            for (int i = 0; i < 4; i++) {
+                host::SpiDevice *device = host::devices()[i];
+                if (device && device->selected()) return device->exchange(data, _clock);
+            }
+            return 0xFF;
+        }
+        void transfer(void *buffer, size_t count) {
+            uint8_t *data = (uint8_t *) buffer;
+            for (size_t i = 0; i < count; i++) data[i] = transfer(data[i]);
+        }
+        uint16_t transfer16(uint16_t data) {
+            uint16_t high = transfer(data >> 8);
+            return (high << 8) | transfer(data & 0xFF);
+        }
+
+        uint32_t clock() { return _clock; }
+
+    private:
+        uint32_t _clock = 4000000;
+};
+
+inline SPIClass SPI;
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef SPIMEMORY_H
+#define SPIMEMORY_H
+
+#include <vector>
+
+#include "Arduino.h"
+#include "SPI.h"
+
+/*
+    ! Host SPIMemory
+    Stands in for lib/SPIMemory (which only builds for the boards) under fram.h: the SPIFlash calls
+    GB_FRAM makes, over the bus to the flash emulator (flash.h), with the same commands and data
+    layout. readStr() reads what writeStr() writes: the length with the terminator (4 bytes, least
+    significant first), then the characters and the terminator. Every command waits for the chip
+    first, as SPIMemory's _notBusy() does.
+*/
+
+#define KiB 1024L
+#define MiB KiB * KiB
+
+class SPIFlash {
+    public:
+        SPIFlash(uint8_t cs, SPIClass *spi = &SPI) : _cs(cs), _spi(spi) {}
+
+        void setClock(uint32_t clock) { _settings = SPISettings(clock, MSBFIRST, SPI_MODE0); }
+
+        bool begin(uint32_t size = 0) {
+            (void) size;
+            _id = 0;
+            if (!_select(0x9F)) return false;
+            for (int i = 0; i < 3; i++) _id = (_id << 8) | _spi->transfer(0xFF);
+            _deselect();
+            _capacity = (_id & 0xFF) >= 0x10 && (_id & 0xFF) <= 0x20 ? 1UL << (_id & 0xFF) : 0;
+            return _id != 0 && _id != 0xFFFFFF;
+        }
+
+        uint32_t getJEDECID() { return _id; }
+        uint32_t getCapacity() { return _capacity; }
+
+        bool readByteArray(uint32_t address, uint8_t *data, size_t size, bool fast = false) {
+            if (!_select(fast ? 0x0B : 0x03, address)) return false;
+            if (fast) _spi->transfer(0xFF);
+            for (size_t i = 0; i < size; i++) data[i] = _spi->transfer(0xFF);
+            _deselect();
+            return true;
+        }
+
+        bool readStr(uint32_t address, String &data, bool fast = false) {
+            uint8_t length[4];
+            if (!readByteArray(address, length, sizeof(length), fast)) return false;
+            uint32_t size = length[0] | (length[1] << 8) | ((uint32_t) length[2] << 16) | ((uint32_t) length[3] << 24);
+            if (size == 0 || size > 4096) return false;
+
+            std::vector<char> characters(size + 1, 0);
+            if (!readByteArray(address + sizeof(length), (uint8_t *) characters.data(), size, fast)) return false;
+            data = String(characters.data());
+            return true;
+        }
+
+        bool eraseSection(uint32_t address, uint32_t size) {
+            for (uint32_t sector = address - address % 4096; sector < address + size; sector += 4096) {
+                if (!_select(0x06)) return false;
+                _deselect();
+                if (!_select(0x20, sector)) return false;
+                _deselect();
+            }
+            return _ready();
+        }
+
+    private:
+        uint8_t _cs;
+        SPIClass *_spi;
+        SPISettings _settings = SPISettings(4000000, MSBFIRST, SPI_MODE0);
+        uint32_t _id = 0;
+        uint32_t _capacity = 0;
+
+        // Status register 1 until the chip isn't busy (a sector erase takes up to 400 ms)
+        bool _ready() {
+            unsigned long start = millis();
+            uint8_t status;
+            do {
+                _spi->beginTransaction(_settings);
+                digitalWrite(_cs, LOW);
+                _spi->transfer(0x05);
+                status = _spi->transfer(0xFF);
+                digitalWrite(_cs, HIGH);
+                _spi->endTransaction();
+            } while ((status & 0x01) && millis() - start < 400);
+            return !(status & 0x01);
+        }
+
+        bool _select(uint8_t command) {
+            if (!_ready()) return false;
+            _spi->beginTransaction(_settings);
+            digitalWrite(_cs, LOW);
+            _spi->transfer(command);
+            return true;
+        }
+        bool _select(uint8_t command, uint32_t address) {
+            if (!_select(command)) return false;
+            _spi->transfer(address >> 16);
+            _spi->transfer(address >> 8);
+            _spi->transfer(address);
+            return true;
+        }
+        void _deselect() {
+            digitalWrite(_cs, HIGH);
+            _spi->endTransaction();
+        }
+};
+
+#endif
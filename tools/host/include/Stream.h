@@ -0,0 +1,7 @@
+#ifndef Stream_h
+#define Stream_h
+
+// Print and Stream are in the host Arduino core (Arduino.h)
+#include "Arduino.h"
+
+#endif
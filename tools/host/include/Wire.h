@@ -0,0 +1,97 @@
+#ifndef TwoWire_h
+#define TwoWire_h
+
+#include <vector>
+
+#include "Arduino.h"
+
+/*
+    ! Host I2C bus
+    A transmission goes to the device at its address when it ends (endTransmission()); a request
+    reads from it at once. A device that doesn't answer NACKs: endTransmission() returns 2 and
+    requestFrom() 0. Every byte on the bus, the address included, advances the virtual clock by 9
+    bit times at the bus clock (100 kHz unless setClock()).
+*/
+namespace host {
+
+    // A device on the bus: what it's sent and what it's asked for (false / 0 is a NACK)
+    class I2cDevice {
+        public:
+            virtual ~I2cDevice() {}
+            virtual uint8_t address() = 0;
+            virtual bool transmit(const uint8_t *data, size_t length) = 0;
+            virtual size_t receive(uint8_t *data, size_t length) = 0;
+    };
+
+    inline I2cDevice **i2c() {
+        static I2cDevice *attached[4] = { NULL, NULL, NULL, NULL };
+        return attached;
+    }
+    inline I2cDevice *i2c(uint8_t address) {
+        for (int i = 0; i < 4; i++) if (i2c()[i] && i2c()[i]->address() == address) return i2c()[i];
+        return NULL;
+    }
+
+    // Put a device on the bus (detach() takes it off)
+    inline void attach(I2cDevice *device) {
+        for (int i = 0; i < 4; i++) if (i2c()[i] == NULL || i2c()[i] == device) {
+            i2c()[i] = device;
+            break;
+        }
+    }
+    inline void detach(I2cDevice *device) {
+        for (int i = 0; i < 4; i++) if (i2c()[i] == device) i2c()[i] = NULL;
+    }
+}
+
+class TwoWire : public Stream {
+    public:
+        void begin() {}
+        void end() {}
+        void setClock(uint32_t clock) { _clock = clock; }
+
+        void beginTransmission(uint8_t address) {
+            _address = address;
+            _outgoing.clear();
+        }
+        void beginTransmission(int address) { beginTransmission((uint8_t) address); }
+        uint8_t endTransmission(bool stop = true) {
+            (void) stop;
+            _clocked(1 + _outgoing.size());
+            host::I2cDevice *device = host::i2c(_address);
+            return device && device->transmit(_outgoing.data(), _outgoing.size()) ? 0 : 2;
+        }
+
+        uint8_t requestFrom(int address, int count) {
+            _incoming.assign(count > 0 ? count : 0, 0);
+            _at = 0;
+            host::I2cDevice *device = host::i2c(address);
+            _incoming.resize(device ? device->receive(_incoming.data(), _incoming.size()) : 0);
+            _clocked(1 + _incoming.size());
+            return _incoming.size();
+        }
+
+        size_t write(uint8_t c) {
+            _outgoing.push_back(c);
+            return 1;
+        }
+        size_t write(int c) { return write((uint8_t) c); }
+        using Print::write;
+
+        int available() { return _incoming.size() - _at; }
+        int read() { return _at < _incoming.size() ? _incoming[_at++] : -1; }
+        int peek() { return _at < _incoming.size() ? _incoming[_at] : -1; }
+        void flush() {}
+
+    private:
+        uint32_t _clock = 100000;
+        uint8_t _address = 0;
+        std::vector<uint8_t> _outgoing, _incoming;
+        size_t _at = 0;
+
+        void _clocked(size_t bytes) { host::advance(bytes * 9000000000ULL / _clock); }
+};
+
+inline TwoWire Wire;
+
+#endif
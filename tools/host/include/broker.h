@@ -0,0 +1,174 @@
+#ifndef HOST_BROKER_h
+#define HOST_BROKER_h
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include "Client.h"
+
+/*
+    ! MQTT broker on a cellular link
+    The Client PubSubClient talks to. A packet the client writes goes up the link at 'rate' bytes/s
+    (the clock moves by that much, as the modem blocks until it's sent); the broker's answer arrives
+    one round trip ('rtt', ns) after the packet has gone. The broker answers CONNECT (CONNACK),
+    QoS1 PUBLISH (PUBACK), SUBSCRIBE (SUBACK) and PINGREQ (PINGRESP), and keeps every PUBLISH that
+    reaches it in 'received'.
+
+    Faults, drawn from the seeded generator:
+        lost        percentage of PUBLISHes lost on the way up (no PUBACK either)
+        unacked     percentage of PUBACKs lost on the way down
+        mute        no PUBACK at all
+        refuse      connections are refused
+    hangup() drops the connection (the client sees connected() go false).
+
+    Usage:
+        host::Broker broker(500000000ULL, 8000);           // 500 ms round trip, 8 KB/s up
+        broker.faults.unacked = 10;
+        ...
+        broker.received[0].payload;
+*/
+namespace host {
+
+    class Broker : public Client {
+        public:
+            struct MESSAGE {
+                std::string topic;
+                std::string payload;
+                uint16_t id;
+                bool dup;
+            };
+            std::vector<MESSAGE> received;
+
+            struct {
+                uint32_t seed = 1;
+                uint8_t lost = 0;
+                uint8_t unacked = 0;
+                bool mute = false;
+                bool refuse = false;
+            } faults;
+
+            uint64_t rtt;
+            uint32_t rate;
+            uint32_t connections = 0;
+
+            Broker(uint64_t rtt, uint32_t rate) : rtt(rtt), rate(rate) {}
+
+            int connect(IPAddress ip, uint16_t port) {
+                (void) ip; (void) port;
+                return _open();
+            }
+            int connect(const char *host, uint16_t port) {
+                (void) host; (void) port;
+                return _open();
+            }
+            uint8_t connected() { return _connected; }
+            void stop() { hangup(); }
+
+            void hangup() {
+                _connected = false;
+                _request.clear();
+                _answer.clear();
+            }
+
+            size_t write(uint8_t c) { return write(&c, 1); }
+            size_t write(const uint8_t *buffer, size_t size) {
+                if (!_connected) return 0;
+                advance(size * 1000000000ULL / rate);
+                _request.insert(_request.end(), buffer, buffer + size);
+                while (_packet()) {}
+                return size;
+            }
+            using Print::write;
+
+            int available() {
+                int count = 0;
+                for (auto &byte : _answer) {
+                    if (byte.at > now()) break;
+                    count++;
+                }
+                return count;
+            }
+            int read() {
+                if (_answer.empty() || _answer.front().at > now()) return -1;
+                uint8_t c = _answer.front().value;
+                _answer.pop_front();
+                return c;
+            }
+            int peek() { return available() ? _answer.front().value : -1; }
+            void flush() {}
+
+            operator bool() { return _connected; }
+
+        private:
+            struct BYTE {
+                uint8_t value;
+                uint64_t at;
+            };
+            bool _connected = false;
+            std::vector<uint8_t> _request;
+            std::deque<BYTE> _answer;
+
+            // The TCP handshake takes a round trip
+            int _open() {
+                hangup();
+                advance(rtt);
+                if (faults.refuse) return 0;
+                _connected = true;
+                connections++;
+                return 1;
+            }
+
+            uint32_t _random() {
+                faults.seed ^= faults.seed << 13;
+                faults.seed ^= faults.seed >> 17;
+                faults.seed ^= faults.seed << 5;
+                return faults.seed;
+            }
+
+            void _reply(std::vector<uint8_t> answer) {
+                uint64_t at = std::max(now() + rtt, _answer.empty() ? 0 : _answer.back().at);
+                for (uint8_t value : answer) _answer.push_back({ value, at });
+            }
+
+            // Take one whole packet off the request bytes and answer it; false if there isn't one yet
+            bool _packet() {
+                size_t at = 1, length = 0;
+                for (int shift = 0; ; shift += 7) {
+                    if (at >= _request.size()) return false;
+                    length |= (_request[at] & 0x7F) << shift;
+                    if (!(_request[at++] & 0x80)) break;
+                }
+                if (_request.size() < at + length) return false;
+                std::vector<uint8_t> body(_request.begin() + at, _request.begin() + at + length);
+                uint8_t header = _request[0];
+                _request.erase(_request.begin(), _request.begin() + at + length);
+
+                switch (header & 0xF0) {
+                    case 0x10: _reply({ 0x20, 0x02, 0x00, 0x00 }); break;
+                    case 0x80: _reply({ 0x90, 0x03, body[0], body[1], 0x01 }); break;
+                    case 0xC0: _reply({ 0xD0, 0x00 }); break;
+                    case 0xE0: hangup(); break;
+                    case 0x30: {
+                        if (faults.lost && _random() % 100 < faults.lost) break;
+                        size_t topic = (body[0] << 8) | body[1], qos = (header >> 1) & 3;
+                        MESSAGE message = { std::string(body.begin() + 2, body.begin() + 2 + topic), "", 0, (header & 0x08) != 0 };
+                        size_t payload = 2 + topic;
+                        if (qos) {
+                            message.id = (body[payload] << 8) | body[payload + 1];
+                            payload += 2;
+                        }
+                        message.payload.assign(body.begin() + payload, body.end());
+                        received.push_back(message);
+                        if (!qos || faults.mute || (faults.unacked && _random() % 100 < faults.unacked)) break;
+                        _reply({ 0x40, 0x02, (uint8_t) (message.id >> 8), (uint8_t) (message.id & 0xFF) });
+                        break;
+                    }
+                }
+                return true;
+            }
+    };
+}
+
+#endif
@@ -0,0 +1,347 @@
+#ifndef HOST_CARD_h
+#define HOST_CARD_h
+
+#include "Arduino.h"
+#include "SPI.h"
+#include "medium.h"
+
+/*
+    ! SD card emulator (SPI mode)
+    An SDHC card over a raw disk image file, answering the commands SdFat's SPI driver sends (CMD0,
+    CMD8, ACMD41, CMD58, CMD9/10, CMD17/18, CMD24/25, CMD12, CMD13, CMD32/33/38), so the real SdFat,
+    GB_SPI and sd.h run on top of it. Sectors are written through to the image as the card accepts
+    them; what SdFat still holds in its cache is lost at a power cut, as on the board.
+
+    The card is powered by its enable pin and selected by its chip select. Each sector it accepts
+    keeps it busy (MISO low) for the programming time; the host polls it like the board does, at
+    the bus clock, on the virtual clock. The faults are the medium's (medium.h); a read error is an
+    ECC error token in place of the data, and above 'stable_hz' the card flips a bit in one of
+    'noise' bytes it sends.
+
+    Usage:
+        host::Card card("card.img", 512UL * 2048, 4, 5);    // Image, sectors, chip select, power pin
+        card.faults.seed = 7; card.faults.cut = 120;
+        card.powerup();
+        ...
+        card.counters.writes;                               // Sectors programmed
+*/
+namespace host {
+
+    class Card : public Medium, public SpiDevice {
+        public:
+            uint64_t commands = 0;
+            uint32_t clock = 0;                                 // Bus clock of the last byte
+
+            // stdio rather than the POSIX calls: <fcntl.h> would redefine SdFat's O_* flags
+            Card(const char *path, uint32_t sectors, int cs, int power) : _sectors(sectors), _cs(cs), _power(power) {
+                _image = fopen(path, "r+b");
+                if (_image == NULL) _image = fopen(path, "w+b");
+                if (_image && (fseeko(_image, 0, SEEK_END) != 0 || (uint64_t) ftello(_image) < (uint64_t) sectors * 512)) {
+                    uint8_t zero = 0;
+                    if (fseeko(_image, (off_t) sectors * 512 - 1, SEEK_SET) != 0 || fwrite(&zero, 1, 1, _image) != 1) {
+                        fclose(_image);
+                        _image = NULL;
+                    }
+                }
+                attach(this);
+            }
+            ~Card() {
+                detach(this);
+                if (_image) fclose(_image);
+            }
+
+            bool ok() { return _image != NULL; }
+            uint32_t sectors() { return _sectors; }
+
+            // Power returns after a cut (or at the start): the card is in its idle state
+            void powerup() {
+                Medium::powerup();
+                _reset();
+            }
+
+            void pin(int pin, int level) {
+                if (pin == _cs) _selected = level == LOW;
+                if (pin == _power) {
+                    if (level == HIGH && !_powered) _reset();
+                    _powered = level == HIGH;
+                }
+            }
+
+            bool selected() {
+                return _selected && _powered && !_dead;
+            }
+
+            uint8_t exchange(uint8_t mosi, uint32_t clock) {
+                this->clock = clock;
+                uint8_t miso = _output();
+                _input(mosi);
+                if (clock > faults.stable_hz && faults.noise > 0 && _random() % faults.noise == 0) {
+                    miso ^= 1 << (_random() % 8);
+                    counters.corrupted++;
+                }
+                return miso;
+            }
+
+        private:
+            enum STATE { IDLE, COMMAND, READING, WAITING, RECEIVING };
+
+            FILE *_image = NULL;
+            uint32_t _sectors;
+            int _cs, _power;
+            bool _selected = false;
+            bool _powered = false;
+
+            uint8_t _state = IDLE;
+            uint8_t _command[6];
+            uint8_t _received = 0;
+            bool _application = false;
+            bool _initialized = false;
+            uint8_t _polls = 0;
+
+            // Bytes queued for MISO, then busy (0x00) until _busy_until; a read's data token comes
+            // after _ready_at (0xFF until then)
+            uint8_t _queue[530];
+            uint16_t _head = 0, _tail = 0;
+            uint64_t _busy_until = 0;
+            uint64_t _ready_at = 0;
+
+            // Sector reads (CMD18 streams until CMD12) and writes (CMD25 until the stop token)
+            uint32_t _address = 0;
+            bool _multiple = false;
+            uint8_t _block[514];
+            uint16_t _count = 0;
+            uint32_t _erase_from = 0, _erase_to = 0;
+
+            void _reset() {
+                _state = IDLE;
+                _head = _tail = 0;
+                _busy_until = _ready_at = 0;
+                _initialized = false;
+                _application = false;
+                _polls = 0;
+            }
+
+            bool _load(uint32_t sector, uint8_t *data) {
+                return fseeko(_image, (off_t) sector * 512, SEEK_SET) == 0 && fread(data, 1, 512, _image) == 512;
+            }
+            bool _store(uint32_t sector, const uint8_t *data) {
+                return fseeko(_image, (off_t) sector * 512, SEEK_SET) == 0 && fwrite(data, 1, 512, _image) == 512 && fflush(_image) == 0;
+            }
+
+            void _push(uint8_t byte) { if (_tail < sizeof(_queue)) _queue[_tail++] = byte; }
+
+            uint8_t _output() {
+                if (_head < _tail) {
+                    uint8_t byte = _queue[_head++];
+                    if (_head == _tail) _head = _tail = 0;
+                    return byte;
+                }
+                if (now() < _busy_until) return 0x00;
+                if (_state == READING && now() >= _ready_at) {
+                    _sector();
+                    return _output();
+                }
+                return 0xFF;
+            }
+
+            void _input(uint8_t mosi) {
+                switch (_state) {
+                    case RECEIVING:
+                        _block[_count++] = mosi;
+                        if (_count == sizeof(_block)) _accept();
+                        return;
+
+                    case WAITING:
+                        if (mosi == 0xFE || mosi == 0xFC) {
+                            _state = RECEIVING;
+                            _count = 0;
+                        }
+                        else if (mosi == 0xFD && _multiple) {
+                            _state = IDLE;
+                            _busy_until = now() + 1000ULL * faults.access_us;
+                        }
+                        else if ((mosi & 0xC0) == 0x40) _start(mosi);
+                        return;
+
+                    case COMMAND:
+                        _command[_received++] = mosi;
+                        if (_received == 6) _execute();
+                        return;
+
+                    default:
+                        if ((mosi & 0xC0) == 0x40) _start(mosi);
+                        return;
+                }
+            }
+
+            void _start(uint8_t first) {
+                if (_state == READING) _head = _tail = 0;
+                _state = COMMAND;
+                _command[0] = first;
+                _received = 1;
+            }
+
+            void _respond(uint8_t r1) {
+                _push(0xFF);
+                _push(r1);
+            }
+
+            void _execute() {
+                uint8_t index = _command[0] & 0x3F;
+                uint32_t argument = ((uint32_t) _command[1] << 24) | ((uint32_t) _command[2] << 16) | ((uint32_t) _command[3] << 8) | _command[4];
+                uint8_t idle = _initialized ? 0x00 : 0x01;
+                bool application = _application;
+                _application = false;
+                _state = IDLE;
+                commands++;
+
+                if (application && index == 41) {
+                    _initialized = ++_polls > 2;
+                    return _respond(_initialized ? 0x00 : 0x01);
+                }
+                if (application) return _respond(idle);
+
+                switch (index) {
+                    case 0:
+                        _initialized = false;
+                        _polls = 0;
+                        return _respond(0x01);
+                    case 8:
+                        _respond(idle);
+                        _push(0x00); _push(0x00); _push(0x01); _push(argument & 0xFF);
+                        return;
+                    case 55:
+                        _application = true;
+                        return _respond(idle);
+                    case 58:
+                        _respond(idle);
+                        _push(_initialized ? 0xC0 : 0x40); _push(0xFF); _push(0x80); _push(0x00);
+                        return;
+                    case 59: case 16:
+                        return _respond(idle);
+                    case 13:
+                        _respond(0x00);
+                        _push(0x00);
+                        return;
+                    case 9: case 10:
+                        return _register(index == 9);
+                    case 12:
+                        _respond(0x00);
+                        _busy_until = now() + 1000ULL * faults.access_us / 4;
+                        return;
+                    case 17: case 18:
+                        if (argument >= _sectors) return _respond(0x40);
+                        _respond(0x00);
+                        _address = argument;
+                        _multiple = index == 18;
+                        _state = READING;
+                        _ready_at = now() + 1000ULL * faults.access_us;
+                        return;
+                    case 24: case 25:
+                        if (argument >= _sectors) return _respond(0x40);
+                        _respond(0x00);
+                        _address = argument;
+                        _multiple = index == 25;
+                        _state = WAITING;
+                        return;
+                    case 32:
+                        _erase_from = argument;
+                        return _respond(0x00);
+                    case 33:
+                        _erase_to = argument;
+                        return _respond(0x00);
+                    case 38:
+                        _respond(0x00);
+                        _erase();
+                        return;
+                    default:
+                        return _respond(idle | 0x04);
+                }
+            }
+
+            // CSD (version 2: capacity from C_SIZE) or CID, as a 16-byte data block
+            void _register(bool csd) {
+                uint8_t data[16] = { 0 };
+                if (csd) {
+                    uint32_t size = _sectors / 1024 - 1;
+                    const uint8_t layout[16] = { 0x40, 0x0E, 0x00, 0x32, 0x5B, 0x59, 0x00, 0x00, 0x00, 0x00, 0x7F, 0x80, 0x0A, 0x40, 0x00, 0x01 };
+                    memcpy(data, layout, sizeof(data));
+                    data[7] = (size >> 16) & 0x3F;
+                    data[8] = (size >> 8) & 0xFF;
+                    data[9] = size & 0xFF;
+                }
+                else {
+                    const uint8_t layout[16] = { 0x03, 'S', 'D', 'H', 'O', 'S', 'T', '0', 0x10, 0x12, 0x34, 0x56, 0x78, 0x01, 0x6A, 0x01 };
+                    memcpy(data, layout, sizeof(data));
+                }
+                _respond(0x00);
+                _push(0xFF);
+                _push(0xFE);
+                for (int i = 0; i < 16; i++) _push(data[i]);
+                _push(0xFF); _push(0xFF);
+            }
+
+            // Next sector of a read: the token and data, or an error token
+            void _sector() {
+                if (_address >= _sectors) {
+                    _state = IDLE;
+                    _push(0x08);
+                    return;
+                }
+
+                // An ECC error ends a multi-sector read as well
+                if (_readerror()) {
+                    _push(0x04);
+                    _state = IDLE;
+                    return;
+                }
+                else {
+                    uint8_t data[512];
+                    if (!_load(_address, data)) memset(data, 0, 512);
+                    _push(0xFE);
+                    for (int i = 0; i < 512; i++) _push(data[i]);
+                    _push(0xFF); _push(0xFF);
+                }
+
+                if (_multiple) {
+                    _address++;
+                    _ready_at = now() + 1000ULL * faults.access_us;
+                }
+                else _state = IDLE;
+            }
+
+            // A data block is in: write it to the image (or its torn prefix at the cut) and go busy
+            void _accept() {
+                uint32_t address = _address;
+                _state = _multiple ? WAITING : IDLE;
+                if (_multiple) _address++;
+
+                uint32_t stored = _tear();
+                if (stored < 512) {
+                    uint8_t data[512];
+                    if (!_load(address, data)) memset(data, 0, 512);
+                    memcpy(data, _block, stored);
+                    _store(address, data);
+                    _cut();
+                    return;
+                }
+
+                if (!_store(address, _block)) {
+                    _push(0x0D);
+                    return;
+                }
+                _push(0xE5);
+                _busy_until = now() + _program();
+            }
+
+            void _erase() {
+                uint8_t zeros[512] = { 0 };
+                for (uint32_t sector = _erase_from; sector <= _erase_to && sector < _sectors; sector++) {
+                    if (!_store(sector, zeros)) break;
+                }
+                _busy_until = now() + 1000ULL * faults.program_us;
+            }
+    };
+}
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef HOST_DIRECTORY_h
+#define HOST_DIRECTORY_h
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include "SPI.h"
+#include "medium.h"
+
+/*
+    ! Host directory volume
+    The storage under posix/SdFat.h: the card's files are the files under a host directory, and
+    what reaches them goes through one 512-byte sector cache, like SdFat's. A sector is written when
+    the cache moves to another sector, or at sync() and close(); a metadata change (a file's length
+    at sync, a new, removed or renamed entry) writes one directory sector. The faults are the
+    medium's (medium.h): at the cut a prefix of the sector reaches the file, and a read error fails
+    the read that missed the cache.
+
+    Unlike a FAT volume, a file's length on the host follows the sectors written rather than the
+    directory entry, and no allocation table is written, so the sector counts are a lower bound of
+    the FAT image's. Entries are listed by name.
+
+    Like the card, the volume sees its power pin: it answers only while powered, and after a power
+    cycle only once begin() has mounted it again (SdFat's cache is dropped then, as on the board).
+
+    Usage:
+        host::Directory volume("card", 5);                 // Host folder, power pin
+        volume.faults.seed = 7; volume.faults.cut = 120;
+        volume.powerup();
+*/
+namespace host {
+
+    class Directory : public Medium, public SpiDevice {
+        public:
+            uint32_t clock = 12000000;
+            uint32_t cluster = 4096;
+
+            Directory(const char *root, int power) : _root(root), _power(power) {
+                std::error_code error;
+                std::filesystem::create_directories(_root, error);
+                attach(this);
+                mounted() = this;
+            }
+            ~Directory() {
+                detach(this);
+                if (mounted() == this) mounted() = NULL;
+            }
+
+            // The volume SdFat::begin() mounts
+            static Directory *&mounted() {
+                static Directory *volume = NULL;
+                return volume;
+            }
+
+            void powerup() {
+                Medium::powerup();
+                _begun = false;
+                _cached = "";
+                _dirty = false;
+            }
+
+            void pin(int pin, int level) {
+                if (pin != _power) return;
+                if (level == HIGH && !_powered) _begun = false;
+                _powered = level == HIGH;
+            }
+            bool selected() { return false; }
+            uint8_t exchange(uint8_t mosi, uint32_t clock) { (void) mosi; (void) clock; return 0xFF; }
+
+            bool begin() {
+                if (!_powered || _dead) return false;
+                _begun = true;
+                _cached = "";
+                _dirty = false;
+                _cwd = "/";
+                advance(1000ULL * faults.access_us);
+                return true;
+            }
+            bool ready() { return _powered && _begun && !_dead; }
+
+            // Volume path (absolute, or from the working folder) to its normal form ("/a/b")
+            std::string resolve(const char *path) {
+                std::string full = path && path[0] == '/' ? std::string(path) : _cwd + "/" + (path ? path : "");
+                std::string normal = "";
+                size_t start = 0;
+                while (start <= full.size()) {
+                    size_t end = full.find('/', start);
+                    if (end == std::string::npos) end = full.size();
+                    std::string part = full.substr(start, end - start);
+                    if (part == "..") { size_t cut = normal.rfind('/'); normal = cut == std::string::npos ? "" : normal.substr(0, cut); }
+                    else if (part.size() > 0 && part != ".") normal += "/" + part;
+                    start = end + 1;
+                }
+                return normal.size() > 0 ? normal : "/";
+            }
+            std::filesystem::path host(const std::string &path) { return std::filesystem::path(_root) / path.substr(1); }
+
+            bool chdir(const char *path) {
+                std::string target = resolve(path);
+                if (!ready() || !std::filesystem::is_directory(host(target))) return false;
+                _cwd = target;
+                return true;
+            }
+
+            bool exists(const std::string &path) { return ready() && std::filesystem::exists(host(path)); }
+            bool folder(const std::string &path) { return ready() && std::filesystem::is_directory(host(path)); }
+
+            // Bytes of the file on the host, and what the cache adds past them
+            uint32_t length(const std::string &path) {
+                std::error_code error;
+                uint64_t bytes = std::filesystem::file_size(host(path), error);
+                if (error) bytes = 0;
+                if (_cached == path) bytes = std::max<uint64_t>(bytes, (uint64_t) _sector * 512 + _valid);
+                return (uint32_t) bytes;
+            }
+
+            // Names in a folder, sorted
+            std::vector<std::string> list(const std::string &path) {
+                std::vector<std::string> names;
+                std::error_code error;
+                for (auto &entry : std::filesystem::directory_iterator(host(path), error)) names.push_back(entry.path().filename().string());
+                std::sort(names.begin(), names.end());
+                return names;
+            }
+
+            // Metadata changes (one directory sector each)
+            bool create(const std::string &path, bool directory) {
+                if (!ready() || !folder(parent(path)) || exists(path)) return false;
+                if (!entry()) return false;
+                std::error_code error;
+                if (directory) return std::filesystem::create_directory(host(path), error);
+                FILE *file = fopen(host(path).c_str(), "wb");
+                if (file) fclose(file);
+                return file != NULL;
+            }
+            bool erase(const std::string &path) {
+                if (!ready() || !exists(path)) return false;
+                if (folder(path) && list(path).size() > 0) return false;
+                if (_cached == path) { _cached = ""; _dirty = false; }
+                if (!entry()) return false;
+                std::error_code error;
+                return std::filesystem::remove(host(path), error);
+            }
+            bool rename(const std::string &from, const std::string &to) {
+                if (!ready() || !exists(from) || exists(to) || !folder(parent(to))) return false;
+                if (_cached == from && !flush()) return false;
+                if (!entry() || !entry()) return false;
+                if (_cached == from) _cached = "";
+                std::error_code error;
+                std::filesystem::rename(host(from), host(to), error);
+                return !error;
+            }
+            bool resize(const std::string &path, uint32_t bytes) {
+                if (!ready()) return false;
+                if (_cached == path && !flush()) return false;
+                if (_cached == path) _cached = "";
+                std::error_code error;
+                std::filesystem::resize_file(host(path), bytes, error);
+                return !error && entry();
+            }
+
+            static std::string parent(const std::string &path) {
+                size_t cut = path.rfind('/');
+                return cut == 0 || cut == std::string::npos ? "/" : path.substr(0, cut);
+            }
+
+            // A directory sector is written
+            bool entry() {
+                if (!ready()) return false;
+                advance(_bus());
+                if (_tear() < 512) {
+                    _cut();
+                    return false;
+                }
+                advance(_program());
+                return true;
+            }
+
+            // The cache holds the file's sector (read unless 'fresh': nothing of it is on the host yet)
+            bool load(const std::string &path, uint32_t sector) {
+                if (_cached == path && _sector == sector) return true;
+                if (!ready() || !flush()) return false;
+
+                memset(_data, 0, sizeof(_data));
+                _valid = 0;
+                std::error_code error;
+                uint64_t bytes = std::filesystem::file_size(host(path), error);
+                if (!error && bytes > (uint64_t) sector * 512) {
+                    advance(1000ULL * faults.access_us + _bus());
+                    if (_readerror()) return false;
+                    FILE *file = fopen(host(path).c_str(), "rb");
+                    if (file == NULL) return false;
+                    if (fseeko(file, (off_t) sector * 512, SEEK_SET) == 0) _valid = fread(_data, 1, 512, file);
+                    fclose(file);
+                }
+                _cached = path;
+                _sector = sector;
+                return true;
+            }
+            uint8_t *data() { return _data; }
+            void dirty(uint32_t end) {
+                _dirty = true;
+                _valid = std::max(_valid, end);
+            }
+
+            // The cached sector goes to the file (a prefix of it at the cut)
+            bool flush() {
+                if (!_dirty) return true;
+                if (!ready()) return false;
+                advance(_bus());
+                uint32_t tear = _tear();
+                uint32_t stored = std::min(tear, _valid);
+
+                FILE *file = fopen(host(_cached).c_str(), "r+b");
+                if (file == NULL) return false;
+                bool success = fseeko(file, (off_t) _sector * 512, SEEK_SET) == 0 && fwrite(_data, 1, stored, file) == stored;
+                fclose(file);
+                if (tear < 512) {
+                    _cut();
+                    return false;
+                }
+
+                advance(_program());
+                _dirty = false;
+                return success;
+            }
+
+        private:
+            std::string _root;
+            int _power;
+            bool _powered = false;
+            bool _begun = false;
+            std::string _cwd = "/";
+
+            std::string _cached = "";
+            uint32_t _sector = 0;
+            uint32_t _valid = 0;
+            bool _dirty = false;
+            uint8_t _data[512];
+
+            // A sector's bytes at the bus clock (the token, the data and the CRC)
+            uint64_t _bus() { return 8000000000ULL * 515 / clock; }
+    };
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef HOST_EEPROM_h
+#define HOST_EEPROM_h
+
+#include <vector>
+
+#include "Arduino.h"
+#include "Wire.h"
+#include "medium.h"
+
+/*
+    ! I2C EEPROM emulator
+    An AT24C256 (32 KB, 64-byte pages) on the host I2C bus (Wire.h), under the library's own
+    Eeprom_at24c256 driver. A write transaction sets the address pointer and programs the bytes
+    after it, wrapping within the page like the chip does, and keeps the chip busy for the write
+    cycle (5 ms); a read goes on from the pointer. The chip only answers while its power pin is
+    high and it isn't busy; a transaction it refuses otherwise is counted.
+
+    Faults are the medium's (medium.h), counted in page writes: at the 'cut'-th write since
+    powerup() a random prefix of its bytes is programmed and the chip is dead until powerup().
+    'torn' is the address that write started at.
+
+    Usage:
+        host::Eeprom chip(0x50, 3);                         // I2C address, power pin
+        chip.faults.cut = 12;
+        chip.powerup();
+        ...
+        chip.dead(); chip.torn; chip.refused;
+*/
+namespace host {
+
+    class Eeprom : public Medium, public I2cDevice {
+        public:
+            uint64_t refused = 0;
+            int32_t torn = -1;
+
+            Eeprom(uint8_t address, int power) : _memory(32768, 0xFF), _address(address), _power(power) { attach(this); }
+            ~Eeprom() { detach(this); }
+
+            void powerup() {
+                Medium::powerup();
+                torn = -1;
+                _busy_until = 0;
+            }
+
+            uint8_t address() { return _address; }
+
+            bool transmit(const uint8_t *data, size_t length) {
+                if (!_ready()) return false;
+                if (length < 2) return true;
+                _pointer = ((data[0] << 8) | data[1]) & 0x7FFF;
+                if (length == 2) return true;
+
+                // The bytes of the write that get programmed (all of them, or fewer at the cut)
+                size_t count = length - 2, stored = count;
+                if (faults.cut > 0 && ++_written == faults.cut) stored = _random() % count;
+
+                uint16_t page = _pointer & ~63;
+                for (size_t i = 0; i < stored; i++) _memory[page | ((_pointer + i) & 63)] = data[2 + i];
+                counters.writes++;
+                if (stored < count) {
+                    torn = _pointer;
+                    _cut();
+                    return true;
+                }
+                _pointer = page | ((_pointer + count) & 63);
+                _busy_until = now() + 5000000ULL;
+                return true;
+            }
+
+            size_t receive(uint8_t *data, size_t length) {
+                if (!_ready()) return 0;
+                for (size_t i = 0; i < length; i++) {
+                    data[i] = _memory[_pointer];
+                    _pointer = (_pointer + 1) & 0x7FFF;
+                }
+                counters.reads++;
+                return length;
+            }
+
+        private:
+            std::vector<uint8_t> _memory;
+            uint8_t _address;
+            int _power;
+            uint16_t _pointer = 0;
+            uint64_t _busy_until = 0;
+
+            bool _ready() {
+                if (_dead) return false;
+                if (digitalRead(_power) == HIGH && now() >= _busy_until) return true;
+                refused++;
+                return false;
+            }
+    };
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef HOST_FLASH_h
+#define HOST_FLASH_h
+
+#include <algorithm>
+#include <vector>
+
+#include "Arduino.h"
+#include "SPI.h"
+#include "medium.h"
+
+/*
+    ! SPI NOR flash emulator
+    A W25Q64-like chip (8 MB, 256-byte pages, 4 KB sectors) answering the commands GB_FRAM and the
+    host SPIMemory.h send: JEDEC ID (0x9F), status (0x05), write enable/disable (0x06/0x04), read
+    and fast read (0x03/0x0B), page program (0x02) and sector erase (0x20). A command runs when its
+    chip select goes high; a program clears bits (NOR), wraps within its page like the chip does,
+    and keeps it busy for the programming time.
+
+    What a driver gets wrong is counted rather than tolerated: a program or erase without write
+    enable, any command but status while busy, and a program that wrapped past its page end.
+    Above 'stable_hz' the chip flips a bit in one of 'noise' bytes it sends, like the card.
+
+    Usage:
+        host::Flash flash(8, 7);                            // Chip select, power pin
+        flash.powerup();
+        ...
+        flash.refused; flash.wrapped;                       // Driver errors
+*/
+namespace host {
+
+    class Flash : public Medium, public SpiDevice {
+        public:
+            uint64_t programs = 0;
+            uint64_t wrapped = 0;
+            uint64_t refused = 0;
+            uint32_t clock = 0;                                 // Bus clock of the last byte
+
+            Flash(int cs, int power) : _memory(8UL * 1024 * 1024, 0xFF), _cs(cs), _power(power) { attach(this); }
+            ~Flash() { detach(this); }
+
+            const std::vector<uint8_t> &memory() { return _memory; }
+
+            void powerup() {
+                Medium::powerup();
+                _enabled = false;
+                _busy_until = 0;
+            }
+
+            void pin(int pin, int level) {
+                if (pin == _power) {
+                    if (level == HIGH && !_powered) powerup();
+                    _powered = level == HIGH;
+                }
+                if (pin != _cs) return;
+                bool select = level == LOW;
+                if (!select && _selected) _execute();
+                if (select && !_selected) _count = 0;
+                _selected = select;
+            }
+
+            bool selected() {
+                return _selected && _powered && !_dead;
+            }
+
+            uint8_t exchange(uint8_t mosi, uint32_t clock) {
+                this->clock = clock;
+                uint8_t miso = _exchange(mosi);
+                if (clock > faults.stable_hz && faults.noise > 0 && _random() % faults.noise == 0) {
+                    miso ^= 1 << (_random() % 8);
+                    counters.corrupted++;
+                }
+                return miso;
+            }
+
+        private:
+            std::vector<uint8_t> _memory;
+            int _cs, _power;
+            bool _selected = false;
+            bool _powered = false;
+
+            // The command being clocked in: its byte count, address and page data
+            uint8_t _command = 0;
+            uint32_t _count = 0;
+            uint32_t _address = 0;
+            uint8_t _page[256];
+            uint32_t _length = 0;
+
+            bool _enabled = false;
+            uint64_t _busy_until = 0;
+
+            bool _busy() { return now() < _busy_until; }
+
+            uint8_t _exchange(uint8_t mosi) {
+                uint32_t index = _count++;
+                if (index == 0) {
+                    _command = mosi;
+                    _address = 0;
+                    _length = 0;
+                    return 0xFF;
+                }
+                if (_command == 0x05) return (_busy() ? 0x01 : 0x00) | (_enabled ? 0x02 : 0x00);
+                if (_busy()) return 0xFF;
+
+                if (_command == 0x9F) {
+                    const uint8_t id[3] = { 0xEF, 0x40, 0x17 };
+                    return index <= 3 ? id[index - 1] : 0xFF;
+                }
+                if (index <= 3) {
+                    _address = (_address << 8) | mosi;
+                    return 0xFF;
+                }
+
+                // Reads stream on from the address (fast read after a dummy byte)
+                uint32_t data = index - (_command == 0x0B ? 5 : 4);
+                if ((_command == 0x03 || _command == 0x0B) && index >= (_command == 0x0B ? 5U : 4U)) {
+                    return _memory[(_address + data) % _memory.size()];
+                }
+                if (_command == 0x02) {
+                    _page[(_address + data) % 256] = mosi;
+                    _length = data + 1;
+                }
+                return 0xFF;
+            }
+
+            void _execute() {
+                if (_count == 0 || _command == 0x05) return;
+                if (_busy()) {
+                    refused++;
+                    return;
+                }
+
+                switch (_command) {
+                    case 0x9F: case 0x03: case 0x0B: return;
+                    case 0x06: _enabled = true; return;
+                    case 0x04: _enabled = false; return;
+                    case 0x02: case 0x20:
+                        if (!_enabled || _count < 4) {
+                            refused++;
+                            return;
+                        }
+                        _enabled = false;
+                        _address %= _memory.size();
+                        if (_command == 0x20) {
+                            uint32_t start = _address - _address % 4096;
+                            for (uint32_t i = 0; i < 4096; i++) _memory[start + i] = 0xFF;
+                            _busy_until = now() + 45000000ULL;
+                            return;
+                        }
+
+                        // A page program touches its own page only
+                        programs++;
+                        if (_address % 256 + _length > 256) wrapped++;
+                        uint32_t page = _address - _address % 256;
+                        for (uint32_t i = 0; i < std::min<uint32_t>(_length, 256); i++) {
+                            uint32_t offset = (_address + i) % 256;
+                            _memory[page + offset] &= _page[offset];
+                        }
+                        _busy_until = now() + _program();
+                        return;
+                }
+            }
+    };
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef HOST_MEDIUM_h
+#define HOST_MEDIUM_h
+
+#include "Arduino.h"
+
+/*
+    ! Storage medium faults
+    Shared by the two backings (card.h, the SD card over a FAT image, and posix/SdFat.h, a host
+    directory). Faults are counted in 512-byte sector writes and reads and all come from one seeded
+    generator (xorshift32), so a seed and a workload give the same faults on every run:
+        cut         Power cut at the N-th sector write since power-up (0 = off): a random prefix of
+                    that sector is stored, and the medium is dead until powerup(); nothing reaches
+                    it any more. The cut doesn't unwind the caller (SdFat syncs in destructors, and
+                    the MCU would be off anyway), so the caller checks dead() after each operation
+        spikes      Chance (per 1000 sector writes) that programming takes 'spike_ms' instead of
+                    'program_us'
+        reads       Chance (per 1000 sector reads) of a read error
+        stable_hz   Clock above which the card corrupts one in 'noise' bytes (SPI only)
+*/
+namespace host {
+
+    class Medium {
+        public:
+            struct FAULTS {
+                uint32_t seed = 1;
+                uint32_t cut = 0;
+                uint16_t spikes = 0;
+                uint32_t spike_ms = 250;
+                uint16_t reads = 0;
+                uint32_t stable_hz = 25000000;
+                uint16_t noise = 64;
+                uint32_t program_us = 400;
+                uint32_t access_us = 100;
+            } faults;
+
+            struct COUNTERS {
+                uint64_t writes = 0;
+                uint64_t reads = 0;
+                uint64_t spikes = 0;
+                uint64_t read_errors = 0;
+                uint64_t corrupted = 0;
+                uint64_t cuts = 0;
+            } counters;
+
+            virtual ~Medium() {}
+
+            // Power returns (after a cut, or at the start): the generator and the sector count
+            // restart from the seed
+            virtual void powerup() {
+                _dead = false;
+                _rng = faults.seed ? faults.seed : 1;
+                _written = 0;
+            }
+
+            bool dead() { return _dead; }
+
+            // Sector writes since power-up (the cut is armed against this count)
+            uint32_t written() { return _written; }
+
+        protected:
+            bool _dead = false;
+            uint32_t _rng = 1;
+            uint32_t _written = 0;
+
+            uint32_t _random() {
+                _rng ^= _rng << 13;
+                _rng ^= _rng >> 17;
+                _rng ^= _rng << 5;
+                return _rng;
+            }
+            bool _chance(uint16_t permille) { return permille > 0 && _random() % 1000 < permille; }
+
+            // A sector is about to be written: the bytes of it that get stored (512, or fewer at the cut)
+            uint32_t _tear() {
+                if (++_written != faults.cut || faults.cut == 0) return 512;
+                return _random() % 512;
+            }
+
+            // The torn sector is stored: the power goes
+            void _cut() {
+                counters.cuts++;
+                _dead = true;
+            }
+
+            // Programming time of a sector that was written (ns)
+            uint64_t _program() {
+                counters.writes++;
+                if (_chance(faults.spikes)) {
+                    counters.spikes++;
+                    return 1000000ULL * faults.spike_ms;
+                }
+                return 1000ULL * faults.program_us;
+            }
+
+            // A sector is read: whether it fails
+            bool _readerror() {
+                counters.reads++;
+                if (!_chance(faults.reads)) return false;
+                counters.read_errors++;
+                return true;
+            }
+    };
+}
+
+#endif
@@ -0,0 +1,441 @@
+#ifndef SdFat_h
+#define SdFat_h
+
+#include "Arduino.h"
+#include "../directory.h"
+
+/*
+    ! SdFat on a host directory
+    The part of SdFat's API the library uses (SdFat, File/FsFile/SdFile, the card, the external SPI
+    driver base) over host::Directory, with SdFat's semantics where the storage code relies on them:
+    open() closes the file first and fails on a missing parent or, without O_CREAT, a missing file;
+    close() syncs, and so does the destructor (FsFile's closes); fgets() drops CR and keeps the '\n';
+    copies of a File share the volume's cache. Put include/posix ahead of SdFat's folder on the include path.
+*/
+
+// Open flags (SdFat's values without <fcntl.h>)
+typedef int oflag_t;
+#define O_RDONLY 0X00
+#define O_WRONLY 0X01
+#define O_RDWR 0X02
+#define O_AT_END 0X04
+#define O_APPEND 0X08
+#define O_CREAT 0x10
+#define O_TRUNC 0x20
+#define O_EXCL 0x40
+#define O_SYNC 0x80
+#define O_ACCMODE (O_RDONLY | O_WRONLY | O_RDWR)
+#define O_READ O_RDONLY
+#define O_WRITE O_WRONLY
+#define FILE_READ O_RDONLY
+#define FILE_WRITE (O_RDWR | O_CREAT | O_AT_END)
+
+// SPI configuration (SdSpiDriver.h)
+typedef uint8_t SdCsPin_t;
+const uint8_t SHARED_SPI = 0;
+const uint8_t DEDICATED_SPI = 1;
+#define SD_SCK_HZ(maxSpeed) (maxSpeed)
+#define SD_SCK_MHZ(maxMhz) (1000000UL*(maxMhz))
+#define SPI_FULL_SPEED SD_SCK_MHZ(50)
+#define SPI_DIV3_SPEED SD_SCK_MHZ(16)
+#define SPI_HALF_SPEED SD_SCK_MHZ(4)
+#define SPI_DIV6_SPEED SD_SCK_MHZ(8)
+#define SPI_QUARTER_SPEED SD_SCK_MHZ(2)
+#define SPI_EIGHTH_SPEED SD_SCK_MHZ(1)
+#define SPI_SIXTEENTH_SPEED SD_SCK_HZ(500000)
+
+class SdSpiBaseClass;
+typedef SdSpiBaseClass SpiPort_t;
+
+class SdSpiConfig {
+    public:
+        SdSpiConfig(SdCsPin_t cs, uint8_t opt, uint32_t maxSpeed, SpiPort_t *port) : csPin(cs), options(opt), maxSck(maxSpeed), spiPort(port) {}
+        SdSpiConfig(SdCsPin_t cs, uint8_t opt, uint32_t maxSpeed) : csPin(cs), options(opt), maxSck(maxSpeed) {}
+        SdSpiConfig(SdCsPin_t cs, uint8_t opt) : csPin(cs), options(opt) {}
+        explicit SdSpiConfig(SdCsPin_t cs) : csPin(cs) {}
+
+        const SdCsPin_t csPin;
+        const uint8_t options = SHARED_SPI;
+        const uint32_t maxSck = SD_SCK_MHZ(50);
+        SpiPort_t *spiPort = nullptr;
+};
+
+class SdSpiBaseClass {
+    public:
+        virtual ~SdSpiBaseClass() {}
+        virtual void activate() {}
+        virtual void begin(SdSpiConfig config) = 0;
+        virtual void deactivate() {}
+        virtual void end() {}
+        virtual uint8_t receive() = 0;
+        virtual uint8_t receive(uint8_t *buf, size_t count) = 0;
+        virtual void send(uint8_t data) = 0;
+        virtual void send(const uint8_t *buf, size_t count) = 0;
+        virtual void setSckSpeed(uint32_t maxSck) { (void) maxSck; }
+};
+
+// Card identification (SdCardInfo.h)
+typedef struct CID {
+    uint8_t mid;
+    char oid[2];
+    char pnm[5];
+    uint8_t prv;
+    uint32_t psn;
+    uint8_t mdt[2];
+    uint8_t crc;
+} cid_t;
+
+// The card behind the volume: it has no sectors of its own, so readSector() gives zeros
+class SdCard {
+    public:
+        bool readCID(cid_t *cid) {
+            host::Directory *volume = host::Directory::mounted();
+            if (!volume || !volume->ready()) return false;
+            memset(cid, 0, sizeof(cid_t));
+            cid->mid = 0x03;
+            memcpy(cid->oid, "SD", 2);
+            memcpy(cid->pnm, "HOST0", 5);
+            cid->psn = 0x12345678;
+            return true;
+        }
+        bool readSector(uint32_t sector, uint8_t *dst) {
+            (void) sector;
+            host::Directory *volume = host::Directory::mounted();
+            if (!volume || !volume->ready()) return false;
+            memset(dst, 0, 512);
+            return true;
+        }
+        uint32_t sectorCount() { return 2048UL * 256; }
+        bool syncDevice() { return true; }
+        uint8_t errorCode() { return 0; }
+        uint32_t errorData() { return 0; }
+};
+
+class SdCardFactory {
+    public:
+        SdCard *newCard(SdSpiConfig config) { (void) config; return &_card; }
+
+    private:
+        SdCard _card;
+};
+
+class FsFile : public Stream {
+    public:
+        FsFile() {}
+        ~FsFile() { this->close(); }
+
+        bool open(const char *path, oflag_t oflag = O_RDONLY) {
+            this->close();
+            host::Directory *volume = host::Directory::mounted();
+            if (!volume || !volume->ready()) return false;
+
+            std::string target = volume->resolve(path);
+            bool writable = (oflag & O_ACCMODE) != O_RDONLY;
+            if (volume->folder(target)) {
+                if (writable) return false;
+                this->_open(volume, target, oflag, true);
+                this->_names = volume->list(target);
+                return true;
+            }
+
+            if (volume->exists(target)) {
+                if ((oflag & O_CREAT) && (oflag & O_EXCL)) return false;
+            }
+            else if (!(oflag & O_CREAT) || !writable || !volume->create(target, false)) return false;
+
+            this->_open(volume, target, oflag, false);
+            if ((oflag & O_TRUNC) && writable && this->_size > 0 && !this->truncate(0)) {
+                this->_volume = NULL;
+                return false;
+            }
+            if (oflag & O_AT_END) this->_position = this->_size;
+            return true;
+        }
+        bool open(const String &path, oflag_t oflag = O_RDONLY) { return this->open(path.c_str(), oflag); }
+
+        // The next entry of an open folder
+        bool openNext(FsFile *dir, oflag_t oflag = O_RDONLY) {
+            this->close();
+            if (!dir || !dir->_directory || !dir->_volume || !dir->_volume->ready()) return false;
+            while (dir->_next < dir->_names.size()) {
+                std::string name = dir->_names[dir->_next++];
+                std::string path = dir->_path == "/" ? "/" + name : dir->_path + "/" + name;
+                if (dir->_volume->exists(path)) return this->open(path.c_str(), oflag);
+            }
+            return false;
+        }
+        FsFile openNextFile(oflag_t oflag = O_RDONLY) {
+            FsFile file;
+            file.openNext(this, oflag);
+            return file;
+        }
+
+        bool close() {
+            bool success = this->sync();
+            this->_volume = NULL;
+            this->_names.clear();
+            return success;
+        }
+
+        // The cached sector and, when the length changed, the directory entry go to the volume
+        bool sync() {
+            if (!this->_volume) return true;
+            if (!this->_volume->ready()) return false;
+            if (!this->_volume->flush()) return false;
+            if (this->_changed) {
+                if (!this->_volume->entry()) return false;
+                this->_changed = false;
+            }
+            return true;
+        }
+        void flush() { this->sync(); }
+
+        bool isOpen() const { return this->_volume != NULL; }
+        operator bool() const { return this->isOpen(); }
+        bool isDir() const { return this->isOpen() && this->_directory; }
+        bool isFile() const { return this->isOpen() && !this->_directory; }
+        bool isContiguous() const { return this->isFile(); }
+        uint8_t getError() const { return this->_error; }
+
+        size_t getName(char *name, size_t size) {
+            if (!this->isOpen() || size == 0) return 0;
+            std::string base = this->_path == "/" ? "/" : this->_path.substr(this->_path.rfind('/') + 1);
+            size_t length = std::min(base.size(), size - 1);
+            memcpy(name, base.c_str(), length);
+            name[length] = '\0';
+            return length;
+        }
+
+        uint32_t fileSize() const { return this->_size; }
+        uint32_t size() const { return this->_size; }
+        uint32_t curPosition() const { return this->_position; }
+        uint32_t position() const { return this->_position; }
+        bool seekSet(uint32_t position) {
+            if (!this->isFile() || position > this->_size) return false;
+            this->_position = position;
+            return true;
+        }
+        bool seekCur(int32_t offset) { return this->seekSet(this->_position + offset); }
+        bool seekEnd(int32_t offset = 0) { return this->seekSet(this->_size + offset); }
+        bool seek(uint32_t position) { return this->seekSet(position); }
+        void rewind() {
+            this->_position = 0;
+            this->_next = 0;
+        }
+
+        int available() override {
+            if (!this->isFile()) return 0;
+            uint32_t left = this->_size - this->_position;
+            return left > 0x7FFF ? 0x7FFF : left;
+        }
+        int read() override {
+            uint8_t byte;
+            return this->read(&byte, 1) == 1 ? byte : -1;
+        }
+        int peek() override {
+            uint32_t position = this->_position;
+            int byte = this->read();
+            this->_position = position;
+            return byte;
+        }
+        int read(void *buffer, size_t count) {
+            if (!this->isFile() || (this->_oflag & O_ACCMODE) == O_WRONLY) return -1;
+            uint8_t *out = (uint8_t *) buffer;
+            size_t done = 0;
+            count = std::min<size_t>(count, this->_size - this->_position);
+            while (done < count) {
+                uint32_t sector = this->_position / 512, offset = this->_position % 512;
+                if (!this->_volume->load(this->_path, sector)) {
+                    this->_error = 1;
+                    return -1;
+                }
+                size_t part = std::min<size_t>(512 - offset, count - done);
+                memcpy(out + done, this->_volume->data() + offset, part);
+                done += part;
+                this->_position += part;
+            }
+            return done;
+        }
+
+        int fgets(char *str, int num, char *delim = nullptr) {
+            char ch;
+            int n = 0;
+            int r = -1;
+            while ((n + 1) < num && (r = this->read(&ch, 1)) == 1) {
+                if (ch == '\r') continue;
+                str[n++] = ch;
+                if (!delim) {
+                    if (ch == '\n') break;
+                }
+                else if (strchr(delim, ch)) break;
+            }
+            if (r < 0) return -1;
+            str[n] = '\0';
+            return n;
+        }
+
+        using Print::write;
+        size_t write(uint8_t byte) override { return this->write(&byte, 1); }
+        size_t write(const uint8_t *buffer, size_t count) override { return this->write((const void *) buffer, count); }
+        size_t write(const void *buffer, size_t count) {
+            if (!this->isFile() || (this->_oflag & O_ACCMODE) == O_RDONLY) {
+                this->setWriteError();
+                return 0;
+            }
+            if (this->_oflag & O_APPEND) this->_position = this->_size;
+
+            const uint8_t *in = (const uint8_t *) buffer;
+            size_t done = 0;
+            while (done < count) {
+                uint32_t sector = this->_position / 512, offset = this->_position % 512;
+                if (!this->_volume->load(this->_path, sector)) {
+                    this->setWriteError();
+                    break;
+                }
+                size_t part = std::min<size_t>(512 - offset, count - done);
+                memcpy(this->_volume->data() + offset, in + done, part);
+                this->_volume->dirty(offset + part);
+                done += part;
+                this->_position += part;
+                if (this->_position > this->_size) {
+                    this->_size = this->_position;
+                    this->_changed = true;
+                }
+            }
+            if (done > 0 && (this->_oflag & O_SYNC) && !this->sync()) return 0;
+            return done;
+        }
+
+        bool truncate(uint32_t length) {
+            if (!this->isFile() || (this->_oflag & O_ACCMODE) == O_RDONLY || length > this->_size) return false;
+            if (!this->_volume->resize(this->_path, length)) return false;
+            this->_size = length;
+            if (this->_position > length) this->_position = length;
+            return true;
+        }
+        bool truncate() { return this->truncate(this->_position); }
+
+        // Reserves the length (zeros on the host) of an empty file
+        bool preAllocate(uint32_t length) {
+            if (!this->isFile() || (this->_oflag & O_ACCMODE) == O_RDONLY || length == 0 || this->_size > 0) return false;
+            if (!this->_volume->resize(this->_path, length)) return false;
+            this->_size = length;
+            return true;
+        }
+
+        bool remove() {
+            if (!this->isFile()) return false;
+            std::string path = this->_path;
+            host::Directory *volume = this->_volume;
+            this->_volume = NULL;
+            return volume->erase(path);
+        }
+
+    private:
+        host::Directory *_volume = NULL;
+        std::string _path = "";
+        oflag_t _oflag = O_RDONLY;
+        bool _directory = false;
+        uint32_t _size = 0;
+        uint32_t _position = 0;
+        bool _changed = false;
+        uint8_t _error = 0;
+        std::vector<std::string> _names;
+        size_t _next = 0;
+
+        void _open(host::Directory *volume, const std::string &path, oflag_t oflag, bool directory) {
+            this->_volume = volume;
+            this->_path = path;
+            this->_oflag = oflag;
+            this->_directory = directory;
+            this->_size = directory ? 0 : volume->length(path);
+            this->_position = 0;
+            this->_changed = false;
+            this->_error = 0;
+            this->_next = 0;
+        }
+};
+
+typedef FsFile File;
+typedef FsFile SdFile;
+typedef FsFile SdBaseFile;
+
+class SdFat {
+    public:
+        bool begin(SdSpiConfig config) {
+            if (config.spiPort) config.spiPort->begin(config);
+            host::Directory *volume = host::Directory::mounted();
+            return volume && volume->begin();
+        }
+        void end() {}
+
+        SdCard *card() { return &_card; }
+        uint32_t bytesPerCluster() {
+            host::Directory *volume = host::Directory::mounted();
+            return volume ? volume->cluster : 512;
+        }
+
+        bool exists(const char *path) {
+            host::Directory *volume = host::Directory::mounted();
+            return volume && volume->exists(volume->resolve(path));
+        }
+        bool exists(const String &path) { return this->exists(path.c_str()); }
+
+        // Makes the folder (and its parents with 'pFlag')
+        bool mkdir(const char *path, bool pFlag = true) {
+            host::Directory *volume = host::Directory::mounted();
+            if (!volume || !volume->ready()) return false;
+            std::string target = volume->resolve(path);
+            if (pFlag) {
+                size_t slash = 0;
+                while ((slash = target.find('/', slash + 1)) != std::string::npos) {
+                    std::string parent = target.substr(0, slash);
+                    if (!volume->folder(parent) && !volume->create(parent, true)) return false;
+                }
+            }
+            return volume->create(target, true);
+        }
+        bool mkdir(const String &path, bool pFlag = true) { return this->mkdir(path.c_str(), pFlag); }
+
+        bool rmdir(const char *path) {
+            host::Directory *volume = host::Directory::mounted();
+            if (!volume) return false;
+            std::string target = volume->resolve(path);
+            return volume->folder(target) && volume->erase(target);
+        }
+        bool rmdir(const String &path) { return this->rmdir(path.c_str()); }
+
+        bool remove(const char *path) {
+            host::Directory *volume = host::Directory::mounted();
+            if (!volume) return false;
+            std::string target = volume->resolve(path);
+            return volume->exists(target) && !volume->folder(target) && volume->erase(target);
+        }
+        bool remove(const String &path) { return this->remove(path.c_str()); }
+
+        bool rename(const char *from, const char *to) {
+            host::Directory *volume = host::Directory::mounted();
+            return volume && volume->rename(volume->resolve(from), volume->resolve(to));
+        }
+        bool rename(const String &from, const String &to) { return this->rename(from.c_str(), to.c_str()); }
+
+        bool chdir(const char *path = "/") {
+            host::Directory *volume = host::Directory::mounted();
+            return volume && volume->chdir(path);
+        }
+        bool chdir(const String &path) { return this->chdir(path.c_str()); }
+
+        File open(const char *path, oflag_t oflag = O_RDONLY) {
+            File file;
+            file.open(path, oflag);
+            return file;
+        }
+        File open(const String &path, oflag_t oflag = O_RDONLY) { return this->open(path.c_str(), oflag); }
+
+    private:
+        SdCard _card;
+};
+
+typedef SdFat SdFs;
+
+#endif
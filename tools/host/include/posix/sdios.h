@@ -0,0 +1,7 @@
+#ifndef sdios_h
+#define sdios_h
+
+// SdFat's stream classes; the library includes the header but doesn't use them
+#include "SdFat.h"
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef HOST_RS485_h
+#define HOST_RS485_h
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "Arduino.h"
+#include "../../../lib/RS485/src/CRC16.h"
+
+/*
+    ! RS485 line with Modbus RTU slaves
+    The Stream ModbusRTU talks to. What the master writes goes out when it flushes (the UART drains
+    at 11 bits per character, and the clock moves by that much); the slave addressed then answers
+    after 'turnaround', one character time per byte. available() only counts the bytes that have
+    arrived by now, so the master's timeouts and t3.5 gaps run on the virtual clock.
+
+    A slave answers read holding (0x03), read input (0x04) and write single (0x06) for the registers
+    it has; any other register gets exception 2 (illegal data address), any other function
+    exception 1. A request with a bad CRC or for an absent slave gets no answer.
+
+    'fault' spoils the next answer only:
+        SILENT      no answer
+        CORRUPT     one byte flipped (the CRC doesn't match)
+        GAP         the answer stops for 3 x t3.5 after its third byte
+        IMPOSTOR    the answer comes from another address
+    noise() puts stale bytes on the line (line noise, a late answer), as if before the next request.
+
+    'quiet' is the shortest silence seen before a request (ns), for the t3.5 check.
+
+    Usage:
+        host::Rs485 line(9600);
+        line.slaves[1].holding[0x0100] = 1234;
+        modbus.init(line, 7, 9600);
+*/
+namespace host {
+
+    class Rs485 : public Stream {
+        public:
+            enum FAULT { NONE, SILENT, CORRUPT, GAP, IMPOSTOR };
+
+            struct SLAVE {
+                std::map<uint16_t, uint16_t> holding;
+                std::map<uint16_t, uint16_t> input;
+            };
+            std::map<uint8_t, SLAVE> slaves;
+
+            FAULT fault = NONE;
+            uint64_t turnaround = 2000000ULL;
+            uint64_t quiet = UINT64_MAX;
+            uint32_t requests = 0;
+
+            Rs485(unsigned long baud) : _character(11000000000ULL / baud) {}
+
+            uint64_t character() { return _character; }
+
+            size_t write(uint8_t c) {
+                _request.push_back(c);
+                return 1;
+            }
+            using Print::write;
+
+            // The request is on the line once the UART has drained
+            void flush() {
+                if (_request.empty()) return;
+                uint64_t start = now();
+                advance(_request.size() * _character);
+                if (start - _busy < quiet) quiet = start - _busy;
+                _busy = now();
+                requests++;
+
+                _respond(_request);
+                _request.clear();
+                fault = NONE;
+            }
+
+            void noise(uint8_t count) {
+                uint64_t at = _answer.empty() ? now() : std::max(now(), _answer.back().at);
+                for (uint8_t i = 0; i < count; i++) _answer.push_back({ (uint8_t) (0x55 + i), at });
+            }
+
+            int available() {
+                int count = 0;
+                for (auto &byte : _answer) {
+                    if (byte.at > now()) break;
+                    count++;
+                }
+                return count;
+            }
+            int read() {
+                if (_answer.empty() || _answer.front().at > now()) return -1;
+                uint8_t c = _answer.front().value;
+                _busy = std::max(_busy, _answer.front().at);
+                _answer.pop_front();
+                return c;
+            }
+            int peek() { return available() ? _answer.front().value : -1; }
+
+        private:
+            struct BYTE {
+                uint8_t value;
+                uint64_t at;
+            };
+            uint64_t _character;
+            uint64_t _busy = 0;                                 // End of the last byte on the line
+            std::vector<uint8_t> _request;
+            std::deque<BYTE> _answer;
+
+            static uint16_t _word(const std::vector<uint8_t> &frame, int at) { return (frame[at] << 8) | frame[at + 1]; }
+
+            void _respond(const std::vector<uint8_t> &request) {
+                if (request.size() < 8 || CRC16::ModbusFast(request.data(), request.size()) != 0) return;
+                if (!slaves.count(request[0]) || fault == SILENT) return;
+                SLAVE &slave = slaves[request[0]];
+                uint8_t function = request[1];
+                uint16_t address = _word(request, 2), count = _word(request, 4);
+
+                std::vector<uint8_t> answer = { request[0], function };
+                uint8_t exception = 0;
+                if (function == 0x03 || function == 0x04) {
+                    std::map<uint16_t, uint16_t> &registers = function == 0x03 ? slave.holding : slave.input;
+                    answer.push_back(2 * count);
+                    for (uint16_t i = 0; i < count && !exception; i++) {
+                        if (!registers.count(address + i)) exception = 0x02;
+                        else {
+                            answer.push_back(registers[address + i] >> 8);
+                            answer.push_back(registers[address + i] & 0xFF);
+                        }
+                    }
+                }
+                else if (function == 0x06) {
+                    if (!slave.holding.count(address)) exception = 0x02;
+                    else {
+                        slave.holding[address] = count;
+                        answer.assign(request.begin(), request.begin() + 6);
+                    }
+                }
+                else exception = 0x01;
+                if (exception) answer = { request[0], (uint8_t) (function | 0x80), exception };
+
+                if (fault == IMPOSTOR) answer[0]++;
+                uint16_t crc = CRC16::ModbusFast(answer.data(), answer.size());
+                answer.push_back(crc & 0xFF);
+                answer.push_back(crc >> 8);
+                if (fault == CORRUPT) answer[answer.size() / 2] ^= 0x10;
+
+                uint64_t at = std::max(now(), _answer.empty() ? 0 : _answer.back().at) + turnaround;
+                for (size_t i = 0; i < answer.size(); i++) {
+                    if (fault == GAP && i == 3) at += 3 * 35 * _character / 10;
+                    _answer.push_back({ answer[i], at += _character });
+                }
+            }
+    };
+}
+
+#endif
@@ -0,0 +1,170 @@
+/*
+    ! Host SPI check
+    Runs GB_SD and GB_FRAM (the library's sd.h and fram.h, unchanged) over GB_SPI against the SD
+    card (card.h) and the flash (flash.h) emulators, and checks:
+        - clock negotiation: with each device unstable above a given clock, initialize("auto")
+          settles on the highest of 12, 8, 6, 4, 2 and 1 MHz that is stable, or fails below them all;
+          a row written at that clock reads back intact
+        - flash page writes: GB_FRAM::write() strings of several lengths and alignments go out as
+          page programs (writepage()) that neither cross a page nor reach the chip while it is
+          busy or without write enable, and read() returns them
+
+    On the host GB_SPI takes its polled path (post() completes before it returns), so this checks
+    the commands, the data and the clock, not the DMA overlap; sd.bench reports that on a board.
+
+    Usage:
+        ./build/spi-check                                   // Exit status non-zero on a failure
+*/
+#include <filesystem>
+#include <string>
+
+#include "GB.h"
+#include "card.h"
+#include "flash.h"
+#include "../../lib/GatorByte/src/storage/sd.h"
+#include "../../lib/GatorByte/src/storage/fram.h"
+
+#ifndef HOST_WORK
+    #define HOST_WORK "build"
+#endif
+
+#define PIN_CD 6
+#define PIN_CS 4
+#define PIN_POWER 5
+#define PIN_FLASH_CS 8
+#define PIN_FLASH_POWER 9
+
+static int failures = 0;
+
+static void result(const char *name, bool passed, const std::string &detail) {
+    printf("    %-34s %s%s\n", name, passed ? "ok" : "FAILED", detail.size() ? (" (" + detail + ")").c_str() : "");
+    if (!passed) failures++;
+}
+
+// The clock negotiation should settle on: the highest candidate at or below the stable limit
+static uint32_t expected(uint32_t stable_hz) {
+    static const uint8_t clocks[] = { 12, 8, 6, 4, 2, 1 };
+    for (uint8_t i = 0; i < sizeof(clocks); i++) if (clocks[i] * 1000000UL <= stable_hz) return clocks[i] * 1000000UL;
+    return 0;
+}
+
+static std::string mhz(uint32_t clock) {
+    char text[32];
+    snprintf(text, sizeof(text), "%g MHz", clock / 1000000.0);
+    return clock ? text : "none";
+}
+
+/*
+    SD: a fresh FAT image (formatted while the card is still stable at 12 MHz), then the limit
+*/
+static void sd(uint32_t stable_hz) {
+    std::string image = HOST_WORK "/spi-card.img";
+    std::filesystem::remove(image);
+    host::Card card(image.c_str(), 2048UL * 64, PIN_CS, PIN_POWER);
+    card.powerup();
+
+    static uint8_t buffer[512];
+    digitalWrite(PIN_POWER, HIGH);
+    SdCardFactory factory;
+    FatFormatter formatter;
+    if (!formatter.format(factory.newCard(GB_SPI::sdconfig(PIN_CS, SD_SCK_MHZ(12))), buffer)) {
+        fprintf(stderr, "Couldn't format %s\n", image.c_str());
+        exit(1);
+    }
+    digitalWrite(PIN_POWER, LOW);
+    card.faults.stable_hz = stable_hz;
+
+    GB gb;
+    GB_SD device(gb);
+    device.configure({ false, PIN_CD, PIN_CS, PIN_POWER }).state("SKIP_CHIP_DETECT", true).initialize("auto");
+
+    std::string name = "SD, stable up to " + mhz(stable_hz);
+    uint32_t want = expected(stable_hz);
+    if (want == 0) return result(name.c_str(), !device.initialized(), device.initialized() ? "started at " + mhz(card.clock) : "didn't start");
+    if (!device.initialized()) return result(name.c_str(), false, "didn't start");
+
+    // A row at the negotiated clock, read back
+    const char *row = "2026-10-19 12:00:00,1.25,0.00,3.98";
+    device.writeCSV("/check.csv", row, "TIMESTAMP,WLEV,RAIN,BATTERY");
+    String content = device.readfile("/check.csv");
+    bool intact = content.indexOf(row) > -1;
+
+    result(name.c_str(), card.clock == want && intact, mhz(card.clock) + (intact ? "" : ", row not read back"));
+}
+
+/*
+    Flash: the limit, then GB_FRAM's initialize("auto") (negotiation, erase, R/W test)
+*/
+static void flash(uint32_t stable_hz) {
+    host::Flash chip(PIN_FLASH_CS, PIN_FLASH_POWER);
+    chip.faults.stable_hz = stable_hz;
+
+    GB gb;
+    GB_FRAM device(gb);
+    device.configure({ false, 0, PIN_FLASH_CS, PIN_FLASH_POWER }).initialize("auto");
+
+    // initialize() leaves the chip off; the R/W test wrote 'teststring' at the clock it settled on
+    std::string name = "Flash, stable up to " + mhz(stable_hz);
+    uint32_t want = expected(stable_hz);
+    device.on();
+    bool written = device.write(4096, "check");
+    if (want == 0) return result(name.c_str(), !written, written ? "wrote at " + mhz(chip.clock) : "didn't start");
+
+    bool intact = device.read(4096) == "check";
+    result(name.c_str(), chip.clock == want && written && intact, mhz(chip.clock) + (intact ? "" : ", string not read back"));
+}
+
+/*
+    Flash page writes: lengths and alignments around the page size, each written to erased flash
+*/
+static void pages() {
+    host::Flash chip(PIN_FLASH_CS, PIN_FLASH_POWER);
+
+    GB gb;
+    GB_FRAM device(gb);
+    device.configure({ false, 0, PIN_FLASH_CS, PIN_FLASH_POWER }).initialize("auto");
+    device.on();
+
+    // Address and length: within a page, to its last byte, across one and several pages
+    const struct { uint32_t address; uint32_t length; } cases[] = {
+        { 8192, 1 }, { 12288, 251 }, { 16384, 252 }, { 20480 + 250, 600 }, { 24576 + 17, 2000 }
+    };
+    for (auto &test : cases) {
+        std::string text = "";
+        for (uint32_t i = 0; i < test.length; i++) text += (char) ('a' + (i * 7 + test.length) % 26);
+
+        uint64_t programs = chip.programs, refused = chip.refused, wrapped = chip.wrapped;
+        bool written = device.write(test.address, text.c_str());
+        bool intact = device.read(test.address) == text.c_str();
+
+        // The bytes (the 4-byte length, the characters, the terminator) in as many pages as they span
+        uint32_t bytes = 4 + test.length + 1;
+        uint64_t spanned = (test.address + bytes - 1) / 256 - test.address / 256 + 1;
+        std::string detail = std::to_string(chip.programs - programs) + " page programs for " + std::to_string(spanned) + " pages";
+        if (chip.refused > refused) detail += ", " + std::to_string(chip.refused - refused) + " commands refused";
+        if (chip.wrapped > wrapped) detail += ", " + std::to_string(chip.wrapped - wrapped) + " wrapped";
+        if (!intact) detail += ", not read back";
+
+        std::string name = std::to_string(test.length) + " characters at " + std::to_string(test.address);
+        result(name.c_str(), written && intact && chip.programs - programs == spanned && chip.refused == refused && chip.wrapped == wrapped, detail);
+    }
+}
+
+int main() {
+    std::filesystem::create_directories(HOST_WORK);
+    printf("GB_SPI check\n");
+
+    const uint32_t limits[] = { 25000000, 10000000, 7000000, 5000000, 3000000, 1500000, 1000000, 500000 };
+
+    printf("\n  SD clock negotiation\n");
+    for (uint32_t limit : limits) sd(limit);
+
+    printf("\n  Flash clock negotiation\n");
+    for (uint32_t limit : limits) flash(limit);
+
+    printf("\n  Flash page writes\n");
+    pages();
+
+    printf("\n  %s\n", failures ? (std::to_string(failures) + " failed").c_str() : "all passed");
+    return failures ? 1 : 0;
+}